@@ -0,0 +1,145 @@
+// Account logins: what one PBKDF2 hash costs, how long the loop stalls when it
+// runs the hashes itself against handing them to PasswordHasher, and account
+// lookups in the mapped table against the same table read with pread(2).
+#include "AccountStore.hpp"
+#include "PasswordHasher.hpp"
+#include "MaskIndex.hpp"
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+static const unsigned int ITERATIONS = 100000;	// IRC_HASH_ITERATIONS default
+static const int LOGINS = 8;					// a burst of SASL logins
+static const size_t ACCOUNTS = 100000;
+static const int LOOKUPS = 200000;
+
+static std::string accountName(size_t i)
+{
+	std::ostringstream name;
+	name << "user" << i;
+	return name.str();
+}
+
+// Same probe sequence as AccountStore, one pread per record instead of the mapping
+static bool preadFind(int fd, const std::string &name, unsigned long long slots)
+{
+	std::string folded = MaskIndex::casefold(name);
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < folded.size(); ++i)
+	{
+		hash ^= static_cast<unsigned char>(folded[i]);
+		hash *= 16777619u;
+	}
+	size_t mask = static_cast<size_t>(slots) - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask)
+	{
+		AccountRecord record;
+		if (pread(fd, &record, sizeof(record), 64 + i * sizeof(record)) != static_cast<ssize_t>(sizeof(record)))
+			return false;
+		if (!record.used)
+			return false;
+		if (record.hash == hash && MaskIndex::casefold(std::string(record.name, record.nameLen)) == folded)
+			return true;
+	}
+}
+
+int main()
+{
+	unsigned char salt[PasswordHasher::SALT];
+	unsigned char digest[PasswordHasher::DIGEST];
+	PasswordHasher::randomSalt(salt);
+
+	unsigned long start = CommandStats::nowMicros();
+	PasswordHasher::pbkdf2("correct horse", salt, sizeof(salt), ITERATIONS, digest);
+	unsigned long hashUs = CommandStats::nowMicros() - start;
+	std::cout << "bench=hash.pbkdf2 iterations=" << ITERATIONS << " ms=" << hashUs / 1000.0 << "\n";
+
+	// The loop runs the hashes of a burst of logins between two polls
+	unsigned long worst = 0;
+	start = CommandStats::nowMicros();
+	unsigned long last = start;
+	for (int i = 0; i < LOGINS; ++i)
+	{
+		PasswordHasher::pbkdf2("correct horse", salt, sizeof(salt), ITERATIONS, digest);
+		unsigned long now = CommandStats::nowMicros();
+		worst = std::max(worst, now - last);
+		last = now;
+	}
+	std::cout << "bench=loop.inline logins=" << LOGINS << " total_ms=" << (last - start) / 1000.0
+			  << " max_stall_ms=" << worst / 1000.0 << "\n";
+
+	// The loop submits them and keeps polling with a 1 ms timeout, as the server does
+	PasswordHasher hasher;
+	hasher.start(1, LOGINS);
+	start = CommandStats::nowMicros();
+	for (int i = 0; i < LOGINS; ++i)
+		hasher.submit(i, "correct horse", salt, ITERATIONS);
+	int done = 0;
+	worst = 0;
+	last = start;
+	unsigned long iterations = 0;
+	while (done < LOGINS)
+	{
+		struct pollfd pfd = { hasher.notifyFd(), POLLIN, 0 };
+		poll(&pfd, 1, 1);
+		if (pfd.revents & POLLIN)
+			done += hasher.collect().size();
+		unsigned long now = CommandStats::nowMicros();
+		worst = std::max(worst, now - last);
+		last = now;
+		iterations++;
+	}
+	hasher.stop();
+	std::cout << "bench=loop.hasher logins=" << LOGINS << " total_ms=" << (last - start) / 1000.0
+			  << " max_stall_ms=" << worst / 1000.0 << " loop_iterations=" << iterations << "\n";
+
+	char path[] = "/tmp/ircbench-accounts-XXXXXX";
+	int tmp = mkstemp(path);
+	if (tmp < 0)
+		return 1;
+	close(tmp);
+	unlink(path); // AccountStore creates it
+	AccountStore store;
+	std::string error;
+	if (!store.open(path, error))
+	{
+		std::cerr << path << ": " << error << "\n";
+		return 1;
+	}
+	start = CommandStats::nowMicros();
+	for (size_t i = 0; i < ACCOUNTS; ++i)
+		store.add(accountName(i), salt, digest, ITERATIONS, 0);
+	std::cout << "bench=store.add accounts=" << store.size() << " slots=" << store.capacity()
+			  << " file_mb=" << store.bytes() / (1024.0 * 1024.0)
+			  << " ns_per_op=" << (CommandStats::nowMicros() - start) * 1000.0 / ACCOUNTS << "\n";
+
+	std::vector<std::string> names;
+	std::srand(3);
+	for (int i = 0; i < LOOKUPS; ++i)
+		names.push_back(accountName(std::rand() % (ACCOUNTS * 2))); // half of them miss
+	size_t found = 0;
+	start = CommandStats::nowMicros();
+	for (int i = 0; i < LOOKUPS; ++i)
+		found += store.find(names[i]) != NULL;
+	std::cout << "bench=store.find_mapped lookups=" << LOOKUPS << " found=" << found
+			  << " ns_per_op=" << (CommandStats::nowMicros() - start) * 1000.0 / LOOKUPS << "\n";
+
+	int fd = open(path, O_RDONLY);
+	found = 0;
+	start = CommandStats::nowMicros();
+	for (int i = 0; i < LOOKUPS; ++i)
+		found += preadFind(fd, names[i], store.capacity());
+	std::cout << "bench=store.find_pread lookups=" << LOOKUPS << " found=" << found
+			  << " ns_per_op=" << (CommandStats::nowMicros() - start) * 1000.0 / LOOKUPS << "\n";
+	close(fd);
+	store.close();
+	unlink(path);
+	return 0;
+}
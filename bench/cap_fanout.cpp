@@ -0,0 +1,169 @@
+// Channel PRIVMSG to 200 members on a live ./ircserv with different capability
+// mixes: every member plain, half with server-time, every member with
+// server-time + message-tags and a client-tagged sender. Tagged forms are
+// rendered once per capability class, so the cost per message should stay flat.
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+static const int MEMBERS = 200;
+static const int MESSAGES = 2000;
+
+static int dial(int port)
+{
+	for (int attempt = 0; attempt < 50; ++attempt)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(static_cast<uint16_t>(port));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			return fd;
+		close(fd);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void sendAll(int fd, const std::string &data)
+{
+	size_t off = 0;
+	while (off < data.size())
+	{
+		ssize_t n = send(fd, data.c_str() + off, data.size() - off, 0);
+		if (n <= 0)
+			return;
+		off += n;
+	}
+}
+
+// Reads every fd until each has seen needle; the bytes read are added to total
+static bool drainUntil(const std::vector<int> &fds, const std::string &needle, int timeoutMs, unsigned long &total)
+{
+	std::vector<std::string> tails(fds.size());
+	std::vector<bool> done(fds.size(), false);
+	size_t remaining = fds.size();
+	unsigned long deadline = CommandStats::nowMicros() + timeoutMs * 1000UL;
+	std::vector<struct pollfd> pfds(fds.size());
+	while (remaining > 0 && CommandStats::nowMicros() < deadline)
+	{
+		for (size_t i = 0; i < fds.size(); ++i)
+		{
+			pfds[i].fd = done[i] ? -1 : fds[i];
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+		if (poll(&pfds[0], pfds.size(), 100) <= 0)
+			continue;
+		for (size_t i = 0; i < fds.size(); ++i)
+		{
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+			char buf[65536];
+			ssize_t n = recv(fds[i], buf, sizeof(buf), 0);
+			if (n <= 0)
+				return false;
+			total += n;
+			tails[i].append(buf, n);
+			if (tails[i].find(needle) != std::string::npos)
+			{
+				done[i] = true;
+				remaining--;
+			}
+			else if (tails[i].size() > 4096)
+				tails[i].erase(0, tails[i].size() - 512);
+		}
+	}
+	return remaining == 0;
+}
+
+static void runCase(const char *name, int port, int taggedEvery, bool clientTags)
+{
+	std::cout.flush();
+	pid_t server = fork();
+	if (server == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		std::ostringstream p;
+		p << port;
+		execl("./ircserv", "ircserv", p.str().c_str(), "benchpw", (char *)NULL);
+		_exit(127);
+	}
+	int sender = dial(port);
+	bool ok = sender >= 0;
+	unsigned long ignored = 0;
+	std::vector<int> members;
+	std::vector<int> one(1, sender);
+	sendAll(sender, "CAP REQ :message-tags\r\nPASS benchpw\r\nNICK sender\r\nUSER s h s :S\r\nCAP END\r\n");
+	ok = ok && drainUntil(one, "Welcome to ft_irc,", 5000, ignored);
+	sendAll(sender, "JOIN #fan\r\n");
+	ok = ok && drainUntil(one, "End of /NAMES", 5000, ignored);
+	for (int i = 0; ok && i < MEMBERS; ++i)
+	{
+		int fd = dial(port);
+		ok = fd >= 0;
+		members.push_back(fd);
+		std::ostringstream reg;
+		if (taggedEvery && i % taggedEvery == 0)
+			reg << "CAP REQ :server-time message-tags\r\n";
+		reg << "PASS benchpw\r\nNICK m" << i << "\r\nUSER m h s :M\r\nCAP END\r\n";
+		sendAll(fd, reg.str());
+	}
+	// registration waits for the hostname lookup, JOIN only counts after it
+	ok = ok && drainUntil(members, "Welcome to ft_irc,", 10000, ignored);
+	for (size_t i = 0; ok && i < members.size(); ++i)
+		sendAll(members[i], "JOIN #fan\r\n");
+	ok = ok && drainUntil(members, "End of /NAMES", 10000, ignored);
+	ok = ok && drainUntil(one, "m199 JOIN", 10000, ignored);
+
+	std::string burst;
+	for (int i = 0; i < MESSAGES; ++i)
+	{
+		std::ostringstream line;
+		if (clientTags)
+			line << "@+draft/react=ok ";
+		line << "PRIVMSG #fan :message number " << i << " with some ordinary chat text\r\n";
+		burst += line.str();
+	}
+	std::ostringstream last;
+	last << "message number " << (MESSAGES - 1) << " ";
+	unsigned long bytes = 0;
+	unsigned long start = CommandStats::nowMicros();
+	sendAll(sender, burst);
+	ok = ok && drainUntil(members, last.str(), 30000, bytes);
+	unsigned long elapsed = CommandStats::nowMicros() - start;
+	if (ok)
+		std::cout << "bench=" << name << " members=" << MEMBERS << " ops=" << MESSAGES
+				  << " bytes_per_delivery=" << static_cast<double>(bytes) / (MESSAGES * MEMBERS)
+				  << " ns_per_op=" << (elapsed * 1000.0 / MESSAGES) << "\n";
+	else
+		std::cout << "bench=" << name << " failed\n";
+	kill(server, SIGINT);
+	close(sender);
+	for (size_t i = 0; i < members.size(); ++i)
+		close(members[i]);
+	waitpid(server, NULL, 0);
+}
+
+int main()
+{
+	runCase("caps.plain", 16674, 0, false);
+	runCase("caps.half_server_time", 16675, 2, false);
+	runCase("caps.all_tagged", 16676, 1, true);
+	return 0;
+}
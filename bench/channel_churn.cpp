@@ -0,0 +1,66 @@
+// Channel churn: a channel is created, a few users join and talk, and it is
+// reclaimed when they leave, over and over (short-lived bot and support
+// channels). Objects from the ChannelPool against a new/delete per channel,
+// plus the heap calls each cycle makes.
+#include "ChannelPool.hpp"
+#include "CommandStats.hpp"
+#include "AllocStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const int CYCLES = 20000;
+static const int LIVE = 32;		// channels alive at once
+static const int MEMBERS = 4;
+
+static std::vector<std::string> names;
+
+static void use(Channel &channel, int cycle)
+{
+	for (int m = 0; m < MEMBERS; ++m)
+		channel.addMember(100 + m, names[m], m == 0);
+	channel.getMaskList('b')->add("spam*!*@*", names[0], cycle);
+	for (int l = 0; l < 8; ++l)
+		channel.getHistory().append(cycle, ":alice PRIVMSG #churn :hello there, anyone around?");
+	channel.setTopic("support ticket");
+}
+
+static void run(const char *mode, bool pooled)
+{
+	ChannelPool pool;
+	pool.setMax(pooled ? LIVE : 0);
+	std::vector<Channel *> live(LIVE, static_cast<Channel *>(NULL));
+	unsigned long allocs = AllocStats::allocations();
+	unsigned long start = CommandStats::nowMicros();
+	for (int i = 0; i < CYCLES; ++i)
+	{
+		Channel *&slot = live[i % LIVE];
+		if (slot)
+			pool.release(slot);
+		std::ostringstream name;
+		name << "#churn" << i;
+		slot = pool.acquire(name.str());
+		use(*slot, i);
+	}
+	double ns = (CommandStats::nowMicros() - start) * 1000.0 / CYCLES;
+	allocs = AllocStats::allocations() - allocs;
+	for (int i = 0; i < LIVE; ++i)
+		if (live[i])
+			pool.release(live[i]);
+	std::cout << "bench=channel_churn." << mode << " cycles=" << CYCLES << " live=" << LIVE << " reused=" << pool.reused()
+			  << " allocs_per_op=" << static_cast<double>(allocs) / CYCLES
+			  << " ns_per_op=" << ns << "\n";
+}
+
+int main()
+{
+	const char *nicks[MEMBERS] = { "alice", "bob", "carol", "dave" };
+	names.assign(nicks, nicks + MEMBERS);
+	AllocStats::enable();
+	run("new_delete", false);
+	run("pooled", true);
+	run("new_delete", false);
+	run("pooled", true);
+	return 0;
+}
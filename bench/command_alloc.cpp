@@ -0,0 +1,228 @@
+// Heap allocations per command on a live ./ircserv (IRC_ALLOC_STATS=1, read back
+// with STATS a), plus the cost of building a PRIVMSG line with std::string vs the arena
+#include "Arena.hpp"
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+static int dial(int port)
+{
+	for (int attempt = 0; attempt < 50; ++attempt)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(static_cast<uint16_t>(port));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			return fd;
+		close(fd);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void sendAll(int fd, const std::string &data)
+{
+	size_t off = 0;
+	while (off < data.size())
+	{
+		ssize_t n = send(fd, data.c_str() + off, data.size() - off, 0);
+		if (n <= 0)
+			return;
+		off += n;
+	}
+}
+
+static bool waitFor(int fd, std::string &buffer, const std::string &needle, int timeoutMs)
+{
+	unsigned long deadline = CommandStats::nowMicros() + timeoutMs * 1000UL;
+	while (buffer.find(needle) == std::string::npos)
+	{
+		unsigned long now = CommandStats::nowMicros();
+		if (now >= deadline)
+			return false;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, static_cast<int>((deadline - now) / 1000) + 1) <= 0)
+			continue;
+		char buf[65536];
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return false;
+		buffer.append(buf, n);
+		// keep only the tail, the needles are always the last line sent
+		if (buffer.size() > 1 << 20)
+			buffer.erase(0, buffer.size() - 4096);
+	}
+	buffer.clear();
+	return true;
+}
+
+// "<verb> <count> <allocs> <bytes> ..." from STATS a
+static bool allocCounts(int fd, std::string &buffer, const std::string &verb, unsigned long &count,
+						unsigned long &allocs, unsigned long &bytes)
+{
+	sendAll(fd, "STATS a\r\n");
+	std::string reply;
+	unsigned long deadline = CommandStats::nowMicros() + 2000000UL;
+	while (reply.find(" 219 ") == std::string::npos && CommandStats::nowMicros() < deadline)
+	{
+		char buf[4096];
+		ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n > 0)
+			reply.append(buf, n);
+		else
+			usleep(1000);
+	}
+	buffer.clear();
+	size_t pos = reply.find(" " + verb + " ");
+	if (pos == std::string::npos)
+		return false;
+	std::istringstream fields(reply.substr(pos + verb.size() + 2));
+	return static_cast<bool>(fields >> count >> allocs >> bytes);
+}
+
+static void report(const char *name, unsigned long ops, unsigned long allocs, unsigned long bytes, unsigned long us)
+{
+	std::cout << "bench=" << name << " ops=" << ops << " allocs_per_op=" << static_cast<double>(allocs) / ops
+			  << " bytes_per_op=" << static_cast<double>(bytes) / ops
+			  << " ns_per_op=" << (us * 1000.0 / ops) << "\n";
+}
+
+static void live()
+{
+	const int WARMUP = 100;
+	const int MESSAGES = 5000;
+	const int JOINS = 200;
+	std::cout.flush();
+	pid_t server = fork();
+	if (server == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		setenv("IRC_ALLOC_STATS", "1", 1);
+		execl("./ircserv", "ircserv", "16673", "benchpw", (char *)NULL);
+		_exit(127);
+	}
+	int a = dial(16673);
+	int b = dial(16673);
+	std::string bufA, bufB;
+	sendAll(a, "PASS benchpw\r\nNICK sender\r\nUSER sender h s :Sender\r\n");
+	sendAll(b, "PASS benchpw\r\nNICK receiver\r\nUSER receiver h s :Receiver\r\n");
+	bool ok = a >= 0 && b >= 0 && waitFor(a, bufA, "Welcome to ft_irc,", 5000) && waitFor(b, bufB, "Welcome to ft_irc,", 5000);
+	sendAll(a, "JOIN #bench\r\n");
+	sendAll(b, "JOIN #bench\r\n");
+	ok = ok && waitFor(b, bufB, "Users: 2/", 2000);
+
+	const char *targets[] = { "#bench", "receiver" };
+	const char *names[] = { "alloc.privmsg_channel", "alloc.privmsg_user" };
+	for (int t = 0; ok && t < 2; ++t)
+	{
+		std::string warm;
+		for (int i = 0; i < WARMUP; ++i)
+			warm += std::string("PRIVMSG ") + targets[t] + " :warmup\r\n";
+		sendAll(a, warm + std::string("PRIVMSG ") + targets[t] + " :warm-done\r\n");
+		ok = waitFor(b, bufB, "warm-done\r\n", 5000);
+		unsigned long c0 = 0, a0 = 0, b0 = 0, c1 = 0, a1 = 0, b1 = 0;
+		ok = ok && allocCounts(a, bufA, "PRIVMSG", c0, a0, b0);
+		std::string burst;
+		for (int i = 0; i < MESSAGES; ++i)
+		{
+			std::ostringstream line;
+			line << "PRIVMSG " << targets[t] << " :message number " << i << " with some ordinary chat text\r\n";
+			burst += line.str();
+		}
+		unsigned long start = CommandStats::nowMicros();
+		sendAll(a, burst);
+		std::ostringstream last;
+		last << "message number " << (MESSAGES - 1) << " ";
+		ok = ok && waitFor(b, bufB, last.str(), 10000);
+		unsigned long elapsed = CommandStats::nowMicros() - start;
+		ok = ok && allocCounts(a, bufA, "PRIVMSG", c1, a1, b1);
+		if (ok)
+			report(names[t], c1 - c0, a1 - a0, b1 - b0, elapsed);
+	}
+
+	// every JOIN creates a channel, so this is the cost including the channel itself
+	if (ok)
+	{
+		unsigned long c0 = 0, a0 = 0, b0 = 0, c1 = 0, a1 = 0, b1 = 0;
+		allocCounts(a, bufA, "JOIN", c0, a0, b0);
+		std::string joins;
+		for (int i = 0; i < JOINS; ++i)
+		{
+			std::ostringstream line;
+			line << "JOIN #new" << i << "\r\n";
+			joins += line.str();
+		}
+		unsigned long start = CommandStats::nowMicros();
+		sendAll(a, joins);
+		std::ostringstream last;
+		last << "#new" << (JOINS - 1) << " :End of /NAMES";
+		ok = waitFor(a, bufA, last.str(), 10000);
+		unsigned long elapsed = CommandStats::nowMicros() - start;
+		ok = ok && allocCounts(a, bufA, "JOIN", c1, a1, b1);
+		if (ok)
+			report("alloc.join_new_channel", c1 - c0, a1 - a0, b1 - b0, elapsed);
+	}
+	if (!ok)
+		std::cout << "bench=alloc.live failed\n";
+	kill(server, SIGINT);
+	close(a);
+	close(b);
+	waitpid(server, NULL, 0);
+}
+
+// Formatting one outgoing PRIVMSG line, the old way and on the arena
+static void formatting()
+{
+	const int ROUNDS = 1000000;
+	const std::string nick = "somebody", target = "#a-longer-channel-name", text = "an ordinary line of chat text";
+	unsigned long sink = 0;
+
+	unsigned long start = CommandStats::nowMicros();
+	for (int i = 0; i < ROUNDS; ++i)
+	{
+		std::string line = ":" + nick + " PRIVMSG " + target + ":" + text + "\r\n";
+		sink += line.size();
+	}
+	unsigned long heapUs = CommandStats::nowMicros() - start;
+
+	Arena arena;
+	start = CommandStats::nowMicros();
+	for (int i = 0; i < ROUNDS; ++i)
+	{
+		ArenaString line(arena);
+		line << ':' << nick << " PRIVMSG " << target << ':' << text << "\r\n";
+		sink += line.size();
+		if ((i & 63) == 63)
+			arena.reset(); // roughly one loop iteration's worth of commands
+	}
+	unsigned long arenaUs = CommandStats::nowMicros() - start;
+
+	std::cout << "bench=format.std_string ops=" << ROUNDS << " ns_per_op=" << (heapUs * 1000.0 / ROUNDS) << "\n";
+	std::cout << "bench=format.arena ops=" << ROUNDS << " ns_per_op=" << (arenaUs * 1000.0 / ROUNDS)
+			  << " checksum=" << sink << "\n";
+}
+
+int main()
+{
+	formatting();
+	live();
+	return 0;
+}
@@ -0,0 +1,46 @@
+#!/usr/bin/env bash
+# Compares two `make bench-core` outputs. A benchmark is every field but ops=
+# and ns_per_op=, so sizes have to match; a file holding several runs counts
+# the fastest of each. Exits 1 when a benchmark got slower by more than
+# THRESHOLD percent (default 10).
+set -euo pipefail
+
+if [[ $# -ne 2 ]]; then
+  echo "usage: $0 old.txt new.txt" >&2
+  exit 2
+fi
+THRESHOLD="${THRESHOLD:-10}"
+
+awk -v threshold="$THRESHOLD" '
+  function parse(line,    i, n, f, key, ns) {
+    n = split(line, f, " ")
+    key = ""; ns = ""
+    for (i = 1; i <= n; i++) {
+      if (f[i] ~ /^ns_per_op=/) ns = substr(f[i], 11)
+      else if (f[i] !~ /^ops=/) key = key (key == "" ? "" : " ") f[i]
+    }
+    parsedKey = key; parsedNs = ns
+  }
+  /^#/ || NF == 0 { next }
+  {
+    parse($0)
+    if (parsedNs == "") next
+    if (FNR == NR) {
+      if (!(parsedKey in old) || parsedNs + 0 < old[parsedKey]) old[parsedKey] = parsedNs + 0
+    } else {
+      if (!(parsedKey in cur)) order[count++] = parsedKey
+      if (!(parsedKey in cur) || parsedNs + 0 < cur[parsedKey]) cur[parsedKey] = parsedNs + 0
+    }
+  }
+  END {
+    for (i = 0; i < count; i++) {
+      key = order[i]
+      if (!(key in old)) { printf "%-70s %12s -> %10.1f  new\n", key, "-", cur[key]; continue }
+      ratio = old[key] > 0 ? cur[key] / old[key] : 1
+      flag = ""
+      if (ratio > 1 + threshold / 100) { flag = "  REGRESSION"; regressed++ }
+      printf "%-70s %12.1f -> %10.1f  x%.2f%s\n", key, old[key], cur[key], ratio, flag
+    }
+    if (regressed) { printf "%d regression(s) over %s%%\n", regressed, threshold; exit 1 }
+  }
+' "$1" "$2"
@@ -0,0 +1,107 @@
+// PRIVMSG content filter: one Aho-Corasick scan per message against a loop
+// that searches for every phrase in turn, for growing rule counts. Also how
+// long a rule set takes to compile (what a SIGHUP reload costs its thread)
+// and how big the automaton gets.
+#include "ContentFilter.hpp"
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+static const int MESSAGES = 20000;
+
+static const char *WORDS[] = { "the", "meeting", "is", "at", "noon", "anyone", "seen", "build", "log", "thanks",
+							   "deploy", "server", "channel", "link", "tomorrow", "lol", "patch", "review", "ok",
+							   "coffee", "broken", "fixed", "again", "weekend", "release", "notes" };
+static const size_t WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+static std::string randomText(size_t words)
+{
+	std::string text;
+	for (size_t i = 0; i < words; ++i)
+	{
+		if (i)
+			text += ' ';
+		text += WORDS[std::rand() % WORD_COUNT];
+	}
+	return text;
+}
+
+// Spam-wave style phrases: URLs and short word runs with a random tag, so
+// they share prefixes with each other and with ordinary text
+static std::string randomPhrase(int i)
+{
+	std::ostringstream phrase;
+	if (i % 2)
+		phrase << "http://promo" << std::rand() % 100000 << ".example/" << randomText(1);
+	else
+		phrase << randomText(1 + std::rand() % 2) << " x" << std::rand() % 100000;
+	return phrase.str();
+}
+
+static std::string fold(const std::string &s)
+{
+	std::string out(s);
+	for (size_t i = 0; i < out.size(); ++i)
+		if (out[i] >= 'A' && out[i] <= 'Z')
+			out[i] = static_cast<char>(out[i] + ('a' - 'A'));
+	return out;
+}
+
+int main()
+{
+	std::srand(11);
+	std::vector<std::string> messages;
+	for (int i = 0; i < MESSAGES; ++i)
+		messages.push_back(randomText(4 + std::rand() % 20)); // 20-150 bytes of clean chat
+
+	const size_t counts[] = { 10, 100, 1000, 10000 };
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+	{
+		size_t rules = counts[c];
+		std::vector<std::string> phrases;
+		ContentFilter filter;
+		for (size_t i = 0; i < rules; ++i)
+		{
+			phrases.push_back(fold(randomPhrase(static_cast<int>(i))));
+			filter.add(FILTER_DROP, phrases.back(), static_cast<int>(i) + 1);
+		}
+		unsigned long start = CommandStats::nowMicros();
+		filter.compile();
+		unsigned long compileUs = CommandStats::nowMicros() - start;
+
+		size_t hits = 0;
+		start = CommandStats::nowMicros();
+		for (int i = 0; i < MESSAGES; ++i)
+		{
+			const FilterRule *rule = NULL;
+			hits += filter.scan(messages[i].data(), messages[i].size(), rule) != FILTER_PASS;
+		}
+		double automatonNs = (CommandStats::nowMicros() - start) * 1000.0 / MESSAGES;
+
+		// The loop folds the message once, then looks for each phrase
+		int naiveMessages = rules >= 1000 ? MESSAGES / 20 : MESSAGES;
+		size_t naiveHits = 0;
+		start = CommandStats::nowMicros();
+		for (int i = 0; i < naiveMessages; ++i)
+		{
+			std::string folded = fold(messages[i]);
+			for (size_t p = 0; p < phrases.size(); ++p)
+				if (folded.find(phrases[p]) != std::string::npos)
+				{
+					naiveHits++;
+					break;
+				}
+		}
+		double naiveNs = (CommandStats::nowMicros() - start) * 1000.0 / naiveMessages;
+
+		std::cout << "bench=filter.automaton rules=" << rules << " states=" << filter.states()
+				  << " kb=" << filter.bytes() / 1024 << " compile_ms=" << compileUs / 1000.0 << " hits=" << hits
+				  << " ns_per_op=" << automatonNs << "\n";
+		std::cout << "bench=filter.per_pattern rules=" << rules << " ops=" << naiveMessages << " hits=" << naiveHits
+				  << " ns_per_op=" << naiveNs << "\n";
+	}
+	return 0;
+}
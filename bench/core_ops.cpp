@@ -0,0 +1,401 @@
+// Core operations in isolation, no live server: Channel membership and
+// lookups, Client accessors, a broadcast written to N sinks, and the command
+// handlers of a Server whose clients are socketpairs the benchmark drains.
+// Every result is one line of key=value pairs: bench=<suite>.<op>, the sizes,
+// ops and ns_per_op last, so runs can be saved and compared with
+// bench/compare.sh (make bench-core BENCH_OUT=<file>).
+#include "Server.hpp"
+#include "FanOut.hpp"
+#include "CommandStats.hpp"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+// Server.o expects main.cpp's shutdown flag
+volatile sig_atomic_t *getShutdownFlag()
+{
+	static volatile sig_atomic_t flag = 0;
+	return &flag;
+}
+
+static const size_t SIZES[] = { 10, 100, 1000 };
+static const size_t SIZE_COUNT = sizeof(SIZES) / sizeof(SIZES[0]);
+static const size_t CLIENTS = 1000;		// registered clients of the server benchmarks
+static const size_t WORK = 1000000;	// ops of a size n benchmark: WORK / n, so each takes about as long
+
+static std::ostream *g_out; // std::cout itself is silenced, the server logs to it
+
+static void report(const std::string &name, const std::string &sizes, unsigned long us, size_t ops)
+{
+	*g_out << "bench=" << name << (sizes.empty() ? "" : " ") << sizes << " ops=" << ops
+		   << " ns_per_op=" << (ops ? us * 1000.0 / ops : 0) << "\n";
+}
+
+static std::string sized(const char *key, size_t n)
+{
+	std::ostringstream out;
+	out << key << "=" << n;
+	return out.str();
+}
+
+static std::string nickOf(size_t i)
+{
+	std::ostringstream nick;
+	nick << "user" << i;
+	return nick.str();
+}
+
+// Reads everything the server wrote to the first count peers, outside the timed part
+static void drain(const std::vector<int> &peers, size_t count = ~static_cast<size_t>(0))
+{
+	char buf[65536];
+	for (size_t i = 0; i < peers.size() && i < count; ++i)
+		while (read(peers[i], buf, sizeof(buf)) > 0)
+			;
+}
+
+// Gets at Server's private state and handlers, as the event loop would
+class ServerProbe
+{
+	public:
+		// A registered client on one end of a socketpair; the other end is returned
+		static int connect(Server &server, const std::string &nick)
+		{
+			int pair[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+				return -1;
+			fcntl(pair[0], F_SETFL, O_NONBLOCK);
+			fcntl(pair[1], F_SETFL, O_NONBLOCK);
+			int big = 1 << 20;
+			setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &big, sizeof(big));
+			server.addPollFd(pair[0]);
+			server._clients.insert(std::make_pair(pair[0], Client(pair[0])));
+			Client &client = server._clients[pair[0]];
+			client.setHostname("bench.local");
+			command(server, client, "PASS pw");
+			command(server, client, "NICK " + nick);
+			command(server, client, "USER " + nick + " h s :" + nick);
+			return pair[1];
+		}
+		static Client &client(Server &server, int fd)
+		{
+			return server._clients[fd];
+		}
+		// One command through handleCommand, then the fan-out jobs it left
+		static void command(Server &server, Client &client, const std::string &line)
+		{
+			server.handleCommand(client, StringRef(line.data(), line.size()));
+			while (!server._fanoutJobs.empty())
+				server.processFanOutJobs();
+			server._arena.reset();
+		}
+		static int getFdByNick(Server &server, const std::string &nick)
+		{
+			return server.getFdByNick(nick);
+		}
+		static void notifyNickChange(Server &server, int fd, const std::string &from, const std::string &to)
+		{
+			server.notifyNickChange(fd, from, to, "user");
+		}
+};
+
+static void channelBenchmarks()
+{
+	for (size_t s = 0; s < SIZE_COUNT; ++s)
+	{
+		size_t n = SIZES[s];
+		size_t ops = WORK / n;
+		std::string size = sized("members", n);
+		std::vector<std::string> nicks;
+		for (size_t i = 0; i < n; ++i)
+			nicks.push_back(nickOf(i));
+
+		// filled and emptied a few times, so the small sizes time more than a handful of calls
+		size_t cycles = WORK / n / 100 + 1;
+		unsigned long addUs = 0;
+		unsigned long removeUs = 0;
+		for (size_t c = 0; c < cycles; ++c)
+		{
+			Channel churn("#churn");
+			unsigned long start = CommandStats::nowMicros();
+			for (size_t i = 0; i < n; ++i)
+				churn.addMember(1000 + static_cast<int>(i), nicks[i], i == 0);
+			addUs += CommandStats::nowMicros() - start;
+			start = CommandStats::nowMicros();
+			for (size_t i = 0; i < n; ++i)
+				churn.removeMemberByFd(1000 + static_cast<int>(i));
+			removeUs += CommandStats::nowMicros() - start;
+		}
+		report("channel.add_member", size, addUs, cycles * n);
+		report("channel.remove_member", size, removeUs, cycles * n);
+
+		Channel channel("#bench");
+		for (size_t i = 0; i < n; ++i)
+			channel.addMember(1000 + static_cast<int>(i), nicks[i], i == 0);
+		unsigned long start;
+
+		size_t hits = 0;
+		start = CommandStats::nowMicros();
+		for (size_t i = 0; i < ops; ++i)
+			hits += channel.hasMember(1000 + static_cast<int>(i % n));
+		report("channel.has_member_hit", size, CommandStats::nowMicros() - start, ops);
+
+		start = CommandStats::nowMicros();
+		for (size_t i = 0; i < ops; ++i)
+			hits += channel.hasMember(5);
+		report("channel.has_member_miss", size, CommandStats::nowMicros() - start, ops);
+
+		start = CommandStats::nowMicros();
+		for (size_t i = 0; i < ops; ++i)
+			hits += channel.getFdByNick(nicks[i % n]) != -1;
+		report("channel.get_fd_by_nick", size, CommandStats::nowMicros() - start, ops);
+
+		start = CommandStats::nowMicros();
+		for (size_t i = 0; i < ops; ++i)
+			hits += channel.isOperator(1000 + static_cast<int>(i % n));
+		report("channel.is_operator", size, CommandStats::nowMicros() - start, ops);
+
+		start = CommandStats::nowMicros();
+		for (size_t i = 0; i < ops; ++i)
+			channel.updateMemberNick(1000 + static_cast<int>(i % n), (i / n) % 2 ? nicks[i % n] : "renamed");
+		report("channel.update_member_nick", size, CommandStats::nowMicros() - start, ops);
+
+		// the first call after a change builds the reply, the next ones reuse it
+		size_t rebuilds = ops / 10 + 1;
+		start = CommandStats::nowMicros();
+		for (size_t i = 0; i < rebuilds; ++i)
+		{
+			channel.setTopic(i % 2 ? "a" : "b");
+			hits += channel.getNamesReply() != NULL;
+		}
+		report("channel.names_reply_rebuild", size, CommandStats::nowMicros() - start, rebuilds);
+		start = CommandStats::nowMicros();
+		for (size_t i = 0; i < WORK; ++i)
+			hits += channel.getNamesReply() != NULL;
+		report("channel.names_reply_cached", size, CommandStats::nowMicros() - start, WORK);
+		if (hits == 42)
+			*g_out << "\n"; // keeps the loops from being optimized away
+	}
+}
+
+static void clientBenchmarks()
+{
+	const size_t ops = 200000;
+	Client client(7);
+	client.setHostname("bench.local");
+	client.setUser("user");
+	client.setRealname("A bench user");
+	unsigned long start = CommandStats::nowMicros();
+	for (size_t i = 0; i < ops; ++i)
+		client.setNick(i % 2 ? "alice" : "alice_");
+	report("client.set_nick", "", CommandStats::nowMicros() - start, ops);
+
+	size_t total = 0;
+	start = CommandStats::nowMicros();
+	for (size_t i = 0; i < ops; ++i)
+		total += client.isNick("ALICE");
+	report("client.is_nick", "", CommandStats::nowMicros() - start, ops);
+
+	start = CommandStats::nowMicros();
+	for (size_t i = 0; i < ops; ++i)
+		total += client.getHostmask().size();
+	report("client.get_hostmask", "", CommandStats::nowMicros() - start, ops);
+
+	start = CommandStats::nowMicros();
+	for (size_t i = 0; i < ops; ++i)
+	{
+		Client copy(client);
+		total += copy.getFd();
+	}
+	report("client.copy", "", CommandStats::nowMicros() - start, ops);
+	if (total == 42)
+		*g_out << "\n";
+}
+
+// FanOut over a channel, then one write per recipient: /dev/null takes the
+// bytes for free, a socketpair pays the socket path
+static void broadcastBenchmarks()
+{
+	static const char LINE[] = ":alice!alice@bench.local PRIVMSG #bench :a line of ordinary chat\r\n";
+	for (int sink = 0; sink < 2; ++sink)
+	{
+		for (size_t s = 0; s < SIZE_COUNT; ++s)
+		{
+			size_t n = SIZES[s];
+			size_t ops = WORK / n / 10 + 1;
+			std::vector<int> fds;
+			std::vector<int> peers;
+			Channel channel("#bench");
+			for (size_t i = 0; i < n; ++i)
+			{
+				int fd = -1;
+				if (sink == 0)
+					fd = open("/dev/null", O_WRONLY);
+				else
+				{
+					int pair[2];
+					if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0)
+					{
+						fcntl(pair[1], F_SETFL, O_NONBLOCK);
+						fd = pair[0];
+						peers.push_back(pair[1]);
+					}
+				}
+				if (fd < 0)
+					break;
+				fds.push_back(fd);
+				channel.addMember(fd, nickOf(i), false);
+			}
+			unsigned long us = 0;
+			size_t written = 0;
+			for (size_t op = 0; op < ops; ++op)
+			{
+				unsigned long start = CommandStats::nowMicros();
+				FanOut fan;
+				fan.addChannel(channel);
+				const FanOut::FdList &to = fan.recipients();
+				for (size_t i = 0; i < to.size(); ++i)
+					written += write(to[i], LINE, sizeof(LINE) - 1) > 0;
+				us += CommandStats::nowMicros() - start;
+				drain(peers);
+			}
+			report(sink == 0 ? "broadcast.devnull" : "broadcast.socketpair", sized("members", fds.size()), us, ops);
+			for (size_t i = 0; i < fds.size(); ++i)
+				close(fds[i]);
+			for (size_t i = 0; i < peers.size(); ++i)
+				close(peers[i]);
+			if (written == 42)
+				*g_out << "\n";
+		}
+	}
+}
+
+static void serverBenchmarks()
+{
+	setenv("IRC_SLOW_CMD_US", "1000000000", 1);
+	setenv("IRC_RESOLVER_THREADS", "0", 1);
+	Server server(0, "pw");
+	std::vector<int> peers;
+	std::vector<int> fds;
+	for (size_t i = 0; i < CLIENTS; ++i)
+	{
+		int peer = ServerProbe::connect(server, nickOf(i));
+		if (peer < 0)
+			break;
+		peers.push_back(peer);
+		fds.push_back(ServerProbe::getFdByNick(server, nickOf(i)));
+	}
+	drain(peers);
+	std::string clients = sized("clients", fds.size());
+
+	size_t ops = 20000;
+	size_t found = 0;
+	unsigned long start = CommandStats::nowMicros();
+	for (size_t i = 0; i < ops; ++i)
+		found += ServerProbe::getFdByNick(server, nickOf((i * 7919) % fds.size())) != -1;
+	report("server.get_fd_by_nick_hit", clients, CommandStats::nowMicros() - start, ops);
+	start = CommandStats::nowMicros();
+	for (size_t i = 0; i < ops; ++i)
+		found += ServerProbe::getFdByNick(server, "nobody") != -1;
+	report("server.get_fd_by_nick_miss", clients, CommandStats::nowMicros() - start, ops);
+
+	// fds[1] to fds[10] share m channels, then fds[1] changes nick back and forth
+	size_t joined = 0;
+	unsigned long us = 0;
+	static const size_t CHANNELS[] = { 1, 10, 100 };
+	for (size_t c = 0; c < 3; ++c)
+	{
+		for (; joined < CHANNELS[c]; ++joined)
+		{
+			std::ostringstream name;
+			name << "#n" << joined;
+			for (size_t k = 1; k <= 10 && k < fds.size(); ++k)
+				ServerProbe::command(server, ServerProbe::client(server, fds[k]), "JOIN " + name.str());
+		}
+		drain(peers);
+		std::string channels = sized("channels", CHANNELS[c]);
+		size_t rounds = 2000;
+		us = 0;
+		for (size_t op = 0; op < rounds; ++op)
+		{
+			start = CommandStats::nowMicros();
+			ServerProbe::command(server, ServerProbe::client(server, fds[1]), op % 2 ? "NICK user1" : "NICK renamed");
+			us += CommandStats::nowMicros() - start;
+			drain(peers, 11);
+		}
+		report("server.nick_command", channels + " " + clients, us, rounds);
+		us = 0;
+		for (size_t op = 0; op < rounds; ++op)
+		{
+			start = CommandStats::nowMicros();
+			ServerProbe::notifyNickChange(server, fds[1], "user1", "user1");
+			us += CommandStats::nowMicros() - start;
+			drain(peers, 11);
+		}
+		report("server.notify_nick_change", channels + " " + clients, us, rounds);
+	}
+
+	// #m<n>: the first n clients, fds[0] speaks. After the nick benchmarks, whose
+	// users would otherwise be in these channels too
+	for (size_t s = 0; s < SIZE_COUNT && SIZES[s] <= fds.size(); ++s)
+	{
+		size_t n = SIZES[s];
+		std::ostringstream name;
+		name << "#m" << n;
+		for (size_t i = 0; i < n; ++i)
+			ServerProbe::command(server, ServerProbe::client(server, fds[i]), "JOIN " + name.str());
+		drain(peers);
+		std::string line = "PRIVMSG " + name.str() + " :a line of ordinary chat";
+		size_t rounds = WORK / n / 10 + 1;
+		us = 0;
+		for (size_t op = 0; op < rounds; ++op)
+		{
+			start = CommandStats::nowMicros();
+			ServerProbe::command(server, ServerProbe::client(server, fds[0]), line);
+			us += CommandStats::nowMicros() - start;
+			drain(peers, n);
+		}
+		report("server.privmsg_channel", sized("members", n) + " " + clients, us, rounds);
+	}
+
+	ops = 2000;
+	us = 0;
+	for (size_t op = 0; op < ops; ++op)
+	{
+		std::ostringstream line;
+		line << "JOIN #fresh" << op;
+		start = CommandStats::nowMicros();
+		ServerProbe::command(server, ServerProbe::client(server, fds[2 % fds.size()]), line.str());
+		us += CommandStats::nowMicros() - start;
+		drain(peers, 3);
+	}
+	report("server.join_new_channel", clients, us, ops);
+	for (size_t i = 0; i < peers.size(); ++i)
+		close(peers[i]);
+	if (found == 42)
+		*g_out << "\n";
+}
+
+int main()
+{
+	std::ostream out(std::cout.rdbuf());
+	std::ofstream devnull("/dev/null");
+	std::streambuf *console = std::cout.rdbuf(devnull.rdbuf());
+	out << std::fixed << std::setprecision(1);
+	g_out = &out;
+	channelBenchmarks();
+	clientBenchmarks();
+	broadcastBenchmarks();
+	serverBenchmarks();
+	std::cout.rdbuf(console);
+	return 0;
+}
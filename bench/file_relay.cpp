@@ -0,0 +1,209 @@
+// Server-relayed FILE transfer on a live ./ircserv: throughput of the splice
+// relay, and PRIVMSG latency between two other clients while it runs, so a
+// transfer that hogs the loop shows up as chat latency
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const unsigned long FILE_SIZE = 256UL * 1024 * 1024;
+
+static int dial(int port)
+{
+	for (int attempt = 0; attempt < 50; ++attempt)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(static_cast<uint16_t>(port));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		{
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			return fd;
+		}
+		close(fd);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void sendLine(int fd, const std::string &line)
+{
+	std::string msg = line + "\r\n";
+	send(fd, msg.c_str(), msg.size(), 0);
+}
+
+// Reads until needle, returns the rest of the line it is on
+static bool waitFor(int fd, std::string &buffer, const std::string &needle, int timeoutMs, std::string *rest = NULL)
+{
+	unsigned long deadline = CommandStats::nowMicros() + timeoutMs * 1000UL;
+	while (buffer.find(needle) == std::string::npos || buffer.find("\r\n", buffer.find(needle)) == std::string::npos)
+	{
+		unsigned long now = CommandStats::nowMicros();
+		if (now >= deadline)
+			return false;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, static_cast<int>((deadline - now) / 1000) + 1) <= 0)
+			continue;
+		char buf[4096];
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return false;
+		buffer.append(buf, n);
+	}
+	size_t at = buffer.find(needle) + needle.size();
+	size_t end = buffer.find("\r\n", at);
+	if (rest)
+		*rest = buffer.substr(at, end - at);
+	buffer.erase(0, end + 2);
+	return true;
+}
+
+static int client(int port, const std::string &nick)
+{
+	int fd = dial(port);
+	std::string buffer;
+	sendLine(fd, "PASS benchpw");
+	sendLine(fd, "NICK " + nick);
+	sendLine(fd, "USER " + nick + " h s :" + nick);
+	if (fd < 0 || !waitFor(fd, buffer, "Welcome to ft_irc,", 5000))
+		return -1;
+	return fd;
+}
+
+static unsigned long percentile(std::vector<unsigned long> &samples, double p)
+{
+	if (samples.empty())
+		return 0;
+	std::sort(samples.begin(), samples.end());
+	return samples[static_cast<size_t>(p * (samples.size() - 1))];
+}
+
+static void run(const char *name, int port, const char *rate)
+{
+	std::ostringstream filePort;
+	filePort << port + 1;
+	std::cout.flush();
+	pid_t server = fork();
+	if (server == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		setenv("IRC_FILE_PORT", filePort.str().c_str(), 1);
+		setenv("IRC_FILE_RATE", rate, 1);
+		std::ostringstream p;
+		p << port;
+		execl("./ircserv", "ircserv", p.str().c_str(), "benchpw", (char *)NULL);
+		_exit(127);
+	}
+	usleep(200000);
+	int alice = client(port, "alice");
+	int bob = client(port, "bob");
+	int ping = client(port, "ping");
+	int pong = client(port, "pong");
+	std::string ab, bb, pb;
+	std::string offer, readyA, readyB;
+	std::ostringstream send;
+	send << "FILE SEND bob bench.bin " << FILE_SIZE;
+	bool ok = alice >= 0 && bob >= 0 && ping >= 0 && pong >= 0;
+	if (ok)
+		sendLine(alice, send.str());
+	ok = ok && waitFor(bob, bb, "OFFER alice ", 5000, &offer);
+	if (ok)
+		sendLine(bob, "FILE ACCEPT " + offer.substr(0, offer.find(' ')));
+	ok = ok && waitFor(alice, ab, " READY ", 5000, &readyA) && waitFor(bob, bb, " READY ", 5000, &readyB);
+	int in = -1, out = -1;
+	if (ok)
+	{
+		in = dial(port + 1);
+		out = dial(port + 1);
+		sendLine(in, readyA.substr(readyA.rfind(' ') + 1));
+		sendLine(out, readyB.substr(readyB.rfind(' ') + 1));
+		fcntl(in, F_SETFL, O_NONBLOCK);
+		fcntl(out, F_SETFL, O_NONBLOCK);
+	}
+
+	static char chunk[1 << 20];
+	std::memset(chunk, 'x', sizeof(chunk));
+	unsigned long written = 0, received = 0, sentAt = 0;
+	std::vector<unsigned long> latencies;
+	unsigned long start = CommandStats::nowMicros();
+	unsigned long deadline = start + 120000000UL;
+	while (ok && received < FILE_SIZE && CommandStats::nowMicros() < deadline)
+	{
+		if (sentAt == 0)
+		{
+			sendLine(ping, "PRIVMSG pong :probe");
+			sentAt = CommandStats::nowMicros();
+		}
+		struct pollfd pfds[3] = { { in, static_cast<short>(written < FILE_SIZE ? POLLOUT : 0), 0 },
+								  { out, POLLIN, 0 }, { pong, POLLIN, 0 } };
+		if (poll(pfds, 3, 100) <= 0)
+			continue;
+		if (pfds[0].revents & POLLOUT)
+		{
+			size_t len = std::min(static_cast<unsigned long>(sizeof(chunk)), FILE_SIZE - written);
+			ssize_t n = ::send(in, chunk, len, MSG_NOSIGNAL);
+			if (n > 0)
+				written += n;
+		}
+		if (pfds[1].revents & POLLIN)
+		{
+			ssize_t n = recv(out, chunk, sizeof(chunk), 0);
+			ok = n > 0;
+			received += n > 0 ? n : 0;
+		}
+		if (pfds[2].revents & POLLIN)
+		{
+			char buf[4096];
+			ssize_t n = recv(pong, buf, sizeof(buf), 0);
+			pb.append(buf, n > 0 ? n : 0);
+			if (pb.find("probe\r\n") != std::string::npos)
+			{
+				latencies.push_back(CommandStats::nowMicros() - sentAt);
+				pb.clear();
+				sentAt = 0;
+			}
+		}
+	}
+	unsigned long elapsed = CommandStats::nowMicros() - start;
+	ok = ok && received == FILE_SIZE && waitFor(alice, ab, " DONE ", 5000);
+	if (ok)
+		std::cout << "bench=" << name << " bytes=" << received << " mib_per_s="
+				  << (received / 1048576.0) / (elapsed / 1e6) << " probes=" << latencies.size()
+				  << " chat_p50_us=" << percentile(latencies, 0.50) << " chat_p99_us=" << percentile(latencies, 0.99)
+				  << " ns_per_op=" << (elapsed * 1000.0 / (received / 1048576.0)) << "\n";
+	else
+		std::cout << "bench=" << name << " failed\n";
+	kill(server, SIGINT);
+	int fds[6] = { alice, bob, ping, pong, in, out };
+	for (int i = 0; i < 6; ++i)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	waitpid(server, NULL, 0);
+}
+
+int main()
+{
+	run("file.relay_uncapped", 16680, "0");
+	run("file.relay_64mib_s", 16682, "67108864");
+	return 0;
+}
@@ -0,0 +1,232 @@
+// Resident memory per idle registered connection at 10k/50k/100k clients.
+// In process: the per-connection state the server keeps (Client in the clients
+// map, pollfd, fd index), current layout vs the old seven-std::string one.
+// Live: a real ./ircserv with idle registered sockets, where the fd limit allows.
+#include "Client.hpp"
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+// Client as it was laid out before compaction
+struct LegacyClient
+{
+	int fd;
+	bool authenticated, hasPass, hasNick, hasUser;
+	unsigned long identity;
+	std::string username, nickname, hostname, servername, realname;
+	std::string uid, origin;
+	int linkFd;
+	long nickTs;
+	std::string recv_buffer, send_buffer;
+};
+
+static long rssKb(pid_t pid)
+{
+	std::ostringstream path;
+	path << "/proc/" << pid << "/status";
+	std::ifstream status(path.str().c_str());
+	std::string line;
+	while (std::getline(status, line))
+	{
+		if (line.compare(0, 6, "VmRSS:") == 0)
+			return std::atol(line.c_str() + 6);
+	}
+	return -1;
+}
+
+static std::string num(size_t n)
+{
+	std::ostringstream ss;
+	ss << n;
+	return ss.str();
+}
+
+static void report(const char *name, size_t clients, long before, long after)
+{
+	std::cout << "bench=" << name << " clients=" << clients << " rss_kb=" << (after - before)
+			  << " bytes_per_client=" << ((after - before) * 1024.0 / clients) << "\n";
+}
+
+static const std::string REGISTRATION = "PASS pw\r\nNICK user00000\r\nUSER user00000 host srv :Real Name\r\n";
+
+static void fillCompact(size_t count)
+{
+	std::map<int, Client> clients;
+	std::vector<struct pollfd> pfds;
+	std::vector<int> pfdIndex;
+	long before = rssKb(getpid());
+	for (size_t i = 0; i < count; ++i)
+	{
+		int fd = static_cast<int>(i) + 4;
+		Client &client = clients[fd];
+		client = Client(fd);
+		client.getBuffer().append(REGISTRATION);
+		client.getBuffer().clear(); // every line handled
+		client.releaseBuffer();
+		client.setPass(true);
+		client.setNick("user" + num(i));
+		client.setUser("user" + num(i));
+		client.setHostname("host");
+		client.setServername("srv");
+		client.setRealname("Real Name");
+		client.setAuthenticated(true);
+		client.setUid(num(i + 1) + "@ft_irc.local");
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (static_cast<size_t>(fd) >= pfdIndex.size())
+			pfdIndex.resize(fd + 1, -1);
+		pfdIndex[fd] = static_cast<int>(pfds.size());
+		pfds.push_back(pfd);
+	}
+	report("idle.compact", count, before, rssKb(getpid()));
+}
+
+static void fillLegacy(size_t count)
+{
+	std::map<int, LegacyClient> clients;
+	std::vector<struct pollfd> pfds;
+	long before = rssKb(getpid());
+	for (size_t i = 0; i < count; ++i)
+	{
+		int fd = static_cast<int>(i) + 4;
+		LegacyClient &client = clients[fd];
+		client.fd = fd;
+		client.recv_buffer.append(REGISTRATION);
+		client.recv_buffer.erase(0, client.recv_buffer.size()); // keeps its capacity
+		client.nickname = "user" + num(i);
+		client.username = "user" + num(i);
+		client.hostname = "host";
+		client.servername = "srv";
+		client.realname = "Real Name";
+		client.uid = num(i + 1) + "@ft_irc.local";
+		client.linkFd = -1;
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		pfds.push_back(pfd);
+	}
+	report("idle.legacy", count, before, rssKb(getpid()));
+}
+
+static int dial(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(static_cast<uint16_t>(port));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		return fd;
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+// Waits for the registration welcome on every socket
+static bool awaitWelcome(const std::vector<int> &fds)
+{
+	std::vector<std::string> buffers(fds.size());
+	std::vector<bool> done(fds.size(), false);
+	size_t remaining = fds.size();
+	unsigned long deadline = CommandStats::nowMicros() + 60000000UL;
+	while (remaining > 0 && CommandStats::nowMicros() < deadline)
+	{
+		for (size_t i = 0; i < fds.size(); ++i)
+		{
+			if (done[i])
+				continue;
+			char buf[4096];
+			ssize_t n = recv(fds[i], buf, sizeof(buf), MSG_DONTWAIT);
+			if (n > 0)
+				buffers[i].append(buf, n);
+			if (buffers[i].find("Welcome to ft_irc,") != std::string::npos)
+			{
+				done[i] = true;
+				buffers[i].clear();
+				remaining--;
+			}
+		}
+	}
+	return remaining == 0;
+}
+
+static void live(size_t count)
+{
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	if (limit.rlim_cur < count + 64)
+	{
+		std::cout << "bench=idle.live clients=" << count << " skipped=fd_limit_" << limit.rlim_cur << "\n";
+		return;
+	}
+	std::cout.flush();
+	pid_t server = fork();
+	if (server == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		execl("./ircserv", "ircserv", "16670", "pw", (char *)NULL);
+		_exit(127);
+	}
+	usleep(300000);
+	long before = rssKb(server);
+	std::vector<int> fds;
+	for (size_t i = 0; i < count; ++i)
+	{
+		int fd = dial(16670);
+		if (fd < 0)
+			break;
+		std::string reg = "PASS pw\r\nNICK u" + num(i) + "\r\nUSER u" + num(i) + " host srv :Real Name\r\n";
+		send(fd, reg.c_str(), reg.size(), 0);
+		fds.push_back(fd);
+	}
+	if (fds.size() == count && awaitWelcome(fds))
+		report("idle.live", count, before, rssKb(server));
+	else
+		std::cout << "bench=idle.live clients=" << count << " failed=registered_" << fds.size() << "\n";
+	kill(server, SIGINT);
+	for (size_t i = 0; i < fds.size(); ++i)
+		close(fds[i]);
+	waitpid(server, NULL, 0);
+}
+
+// Each measurement in its own process so freed memory from the previous one does not skew RSS
+static void isolated(void (*fill)(size_t), size_t count)
+{
+	std::cout.flush();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		fill(count);
+		std::cout.flush();
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+int main()
+{
+	const size_t counts[] = { 10000, 50000, 100000 };
+	for (size_t i = 0; i < 3; ++i)
+	{
+		isolated(fillLegacy, counts[i]);
+		isolated(fillCompact, counts[i]);
+		live(counts[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,172 @@
+// PRIVMSG delivery latency and server CPU, default loop vs IRC_LOW_LATENCY=1
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static pid_t spawn(const char *port, bool lowLatency)
+{
+	std::cout.flush();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		if (lowLatency)
+		{
+			setenv("IRC_LOW_LATENCY", "1", 1);
+			setenv("IRC_CPU", "0", 1);
+		}
+		execl("./ircserv", "ircserv", port, "benchpw", (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+// utime + stime of the server, in microseconds
+static unsigned long cpuMicros(pid_t pid)
+{
+	std::ostringstream path;
+	path << "/proc/" << pid << "/stat";
+	std::ifstream stat(path.str().c_str());
+	std::string content;
+	std::getline(stat, content);
+	std::istringstream fields(content.substr(content.rfind(')') + 2));
+	std::string field;
+	unsigned long utime = 0, stime = 0;
+	for (int i = 3; i <= 15 && fields >> field; ++i)
+	{
+		if (i == 14)
+			utime = std::strtoul(field.c_str(), NULL, 10);
+		if (i == 15)
+			stime = std::strtoul(field.c_str(), NULL, 10);
+	}
+	return (utime + stime) * (1000000UL / sysconf(_SC_CLK_TCK));
+}
+
+static int dial(int port)
+{
+	for (int attempt = 0; attempt < 50; ++attempt)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(static_cast<uint16_t>(port));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		{
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			return fd;
+		}
+		close(fd);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void sendLine(int fd, const std::string &line)
+{
+	std::string msg = line + "\r\n";
+	send(fd, msg.c_str(), msg.size(), 0);
+}
+
+static bool waitFor(int fd, std::string &buffer, const std::string &needle, int timeoutMs)
+{
+	unsigned long deadline = CommandStats::nowMicros() + timeoutMs * 1000UL;
+	while (buffer.find(needle) == std::string::npos)
+	{
+		unsigned long now = CommandStats::nowMicros();
+		if (now >= deadline)
+			return false;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, static_cast<int>((deadline - now) / 1000) + 1) <= 0)
+			continue;
+		char buf[4096];
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return false;
+		buffer.append(buf, n);
+	}
+	size_t end = buffer.find("\r\n", buffer.find(needle));
+	buffer.erase(0, end == std::string::npos ? buffer.size() : end + 2);
+	return true;
+}
+
+// One message in flight at a time, paced like interactive chat traffic
+static void run(const char *name, const char *port, bool lowLatency)
+{
+	const int MESSAGES = 2000;
+	const useconds_t GAP_US = 500;
+	pid_t server = spawn(port, lowLatency);
+	usleep(200000);
+	int a = dial(std::atoi(port));
+	int b = dial(std::atoi(port));
+	std::string bufA, bufB;
+	sendLine(a, "PASS benchpw");
+	sendLine(a, "NICK sender");
+	sendLine(a, "USER sender h s :Sender");
+	sendLine(b, "PASS benchpw");
+	sendLine(b, "NICK receiver");
+	sendLine(b, "USER receiver h s :Receiver");
+	bool ok = waitFor(a, bufA, "Welcome to ft_irc,", 5000) && waitFor(b, bufB, "Welcome to ft_irc,", 5000);
+
+	std::vector<unsigned long> samples;
+	unsigned long cpuStart = cpuMicros(server);
+	unsigned long wallStart = CommandStats::nowMicros();
+	for (int i = 0; ok && i < MESSAGES; ++i)
+	{
+		std::ostringstream tag;
+		tag << "m" << i;
+		unsigned long start = CommandStats::nowMicros();
+		sendLine(a, "PRIVMSG receiver :" + tag.str());
+		if (!waitFor(b, bufB, "PRIVMSG receiver:" + tag.str() + "\r\n", 2000))
+			ok = false;
+		samples.push_back(CommandStats::nowMicros() - start);
+		usleep(GAP_US);
+	}
+	unsigned long wall = CommandStats::nowMicros() - wallStart;
+	unsigned long cpu = cpuMicros(server) - cpuStart;
+	kill(server, SIGINT);
+	close(a);
+	close(b);
+	waitpid(server, NULL, 0);
+	if (!ok || samples.empty())
+	{
+		std::cout << "bench=" << name << " failed\n";
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	unsigned long total = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+		total += samples[i];
+	std::cout << "bench=" << name << " ops=" << samples.size()
+			  << " p50_us=" << samples[samples.size() / 2]
+			  << " p99_us=" << samples[samples.size() * 99 / 100]
+			  << " server_cpu_pct=" << (cpu * 100.0 / wall)
+			  << " ns_per_op=" << (total * 1000.0 / samples.size()) << "\n";
+}
+
+int main()
+{
+	run("latency.default", "16671", false);
+	run("latency.lowlatency", "16672", true);
+	return 0;
+}
@@ -0,0 +1,162 @@
+// Line framing of receive chunks and nick validation: the scalar paths the
+// server used before (memmem / std::string::find for "\r\n", a string
+// search per nick character) against LineFramer's SSE2 and table kernels
+#include "LineFramer.hpp"
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+static const size_t CHUNK = 4096; // handleClientRead's recv size
+static const int ROUNDS = 400;
+
+static void report(const char *name, size_t bytes, size_t lines, unsigned long us)
+{
+	std::cout << "bench=" << name << " bytes=" << bytes << " lines=" << lines
+			  << " mb_per_s=" << (us ? bytes / static_cast<double>(us) : 0)
+			  << " ns_per_line=" << (us * 1000.0 / lines) << "\n";
+}
+
+// Chat traffic: PRIVMSGs of 10 to 400 characters, a few with colour codes
+static std::string traffic(size_t bytes)
+{
+	std::string out;
+	std::srand(42);
+	while (out.size() < bytes)
+	{
+		std::ostringstream line;
+		line << "PRIVMSG #chan" << std::rand() % 50 << " :";
+		size_t len = 10 + std::rand() % 390;
+		for (size_t i = 0; i < len; ++i)
+			line << static_cast<char>(std::rand() % 8 == 0 ? ' ' : 'a' + std::rand() % 26);
+		if (std::rand() % 10 == 0)
+			line << "\x03" "04red\x0f";
+		line << "\r\n";
+		out += line.str();
+	}
+	return out;
+}
+
+static size_t framedMemmem(const char *data, size_t len, size_t &bytes)
+{
+	size_t lines = 0;
+	size_t start = 0;
+	const char *eol;
+	while ((eol = static_cast<const char *>(memmem(data + start, len - start, "\r\n", 2))) != NULL)
+	{
+		bytes += eol - (data + start);
+		start = (eol - data) + 2;
+		lines++;
+	}
+	return lines;
+}
+
+static size_t framedFind(const std::string &chunk, size_t &bytes)
+{
+	size_t lines = 0;
+	size_t start = 0;
+	size_t pos;
+	while ((pos = chunk.find("\r\n", start)) != std::string::npos)
+	{
+		bytes += pos - start;
+		start = pos + 2;
+		lines++;
+	}
+	return lines;
+}
+
+// The nick check the server had before IrcChars::isNick
+static bool legacyIsValidNick(const std::string &nick)
+{
+	if (std::isdigit(nick[0]))
+		return false;
+	for (size_t i = 0; i < nick.size(); ++i)
+	{
+		char c = nick[i];
+		if (!std::isalnum(c) && std::string("[]\\`_^{|}-").find(c) == std::string::npos)
+			return false;
+	}
+	return true;
+}
+
+int main()
+{
+	std::string stream = traffic(1024 * 1024);
+	std::vector<std::string> chunks;
+	for (size_t off = 0; off < stream.size(); off += CHUNK)
+		chunks.push_back(stream.substr(off, CHUNK));
+	size_t total = stream.size() * ROUNDS;
+	Arena arena;
+
+	size_t lines = 0, payload = 0;
+	unsigned long start = CommandStats::nowMicros();
+	for (int r = 0; r < ROUNDS; ++r)
+		for (size_t c = 0; c < chunks.size(); ++c)
+			lines += framedFind(chunks[c], payload);
+	report("framing.string_find", total, lines, CommandStats::nowMicros() - start);
+
+	lines = 0;
+	start = CommandStats::nowMicros();
+	for (int r = 0; r < ROUNDS; ++r)
+		for (size_t c = 0; c < chunks.size(); ++c)
+			lines += framedMemmem(chunks[c].data(), chunks[c].size(), payload);
+	report("framing.memmem", total, lines, CommandStats::nowMicros() - start);
+
+	const char *names[2] = { "framing.table", "framing.sse2" };
+	for (int kernel = 0; kernel < 2; ++kernel)
+	{
+		lines = 0;
+		start = CommandStats::nowMicros();
+		for (int r = 0; r < ROUNDS; ++r)
+		{
+			for (size_t c = 0; c < chunks.size(); ++c)
+			{
+				LineFramer::Lines found((ArenaAllocator<LineFramer::Line>(&arena)));
+				if (kernel == 0)
+					LineFramer::scanScalar(chunks[c].data(), chunks[c].size(), found);
+				else
+					LineFramer::scan(chunks[c].data(), chunks[c].size(), found);
+				for (size_t k = 0; k < found.size(); ++k)
+					payload += found[k].len + found[k].clean;
+				lines += found.size();
+				arena.reset();
+			}
+		}
+		report(names[kernel], total, lines, CommandStats::nowMicros() - start);
+	}
+
+	std::vector<std::string> nicks;
+	std::srand(7);
+	for (int i = 0; i < 10000; ++i)
+	{
+		std::string nick;
+		size_t len = 3 + std::rand() % 14;
+		for (size_t k = 0; k < len; ++k)
+			nick += "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-[]|^{}!@ "[std::rand() % 73];
+		nicks.push_back(nick);
+	}
+	const int NICK_ROUNDS = 100;
+	size_t valid = 0;
+	start = CommandStats::nowMicros();
+	for (int r = 0; r < NICK_ROUNDS; ++r)
+		for (size_t i = 0; i < nicks.size(); ++i)
+			valid += legacyIsValidNick(nicks[i]);
+	unsigned long us = CommandStats::nowMicros() - start;
+	std::cout << "bench=nick.legacy ops=" << nicks.size() * NICK_ROUNDS << " valid=" << valid
+			  << " ns_per_op=" << (us * 1000.0 / (nicks.size() * NICK_ROUNDS)) << "\n";
+	valid = 0;
+	start = CommandStats::nowMicros();
+	for (int r = 0; r < NICK_ROUNDS; ++r)
+		for (size_t i = 0; i < nicks.size(); ++i)
+			valid += IrcChars::isNick(nicks[i]);
+	us = CommandStats::nowMicros() - start;
+	std::cout << "bench=nick.table ops=" << nicks.size() * NICK_ROUNDS << " valid=" << valid
+			  << " ns_per_op=" << (us * 1000.0 / (nicks.size() * NICK_ROUNDS)) << "\n";
+	if (payload == 42)
+		std::cout << "\n"; // keeps the framing loops from being optimized away
+	return 0;
+}
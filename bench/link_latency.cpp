@@ -0,0 +1,156 @@
+// Two linked ./ircserv nodes on loopback: PRIVMSG latency from a user on one node to a user on the other
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static pid_t spawn(const char *port, const char *name, const char *links, const char *linkListen)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		setenv("IRC_SERVER_NAME", name, 1);
+		setenv("IRC_LINK_PASSWORD", "benchlink", 1);
+		if (links)
+			setenv("IRC_LINKS", links, 1);
+		if (linkListen)
+			setenv("IRC_LINK_LISTEN", linkListen, 1);
+		execl("./ircserv", "ircserv", port, "benchpw", (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+static int dial(int port)
+{
+	for (int attempt = 0; attempt < 50; ++attempt)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(static_cast<uint16_t>(port));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			return fd;
+		close(fd);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void sendLine(int fd, const std::string &line)
+{
+	std::string msg = line + "\r\n";
+	send(fd, msg.c_str(), msg.size(), 0);
+}
+
+// Reads until a line containing needle arrives, false after timeoutMs
+static bool waitFor(int fd, std::string &buffer, const std::string &needle, int timeoutMs)
+{
+	unsigned long deadline = CommandStats::nowMicros() + timeoutMs * 1000UL;
+	while (true)
+	{
+		size_t pos = buffer.find(needle);
+		if (pos != std::string::npos)
+		{
+			size_t end = buffer.find("\r\n", pos);
+			buffer.erase(0, end == std::string::npos ? buffer.size() : end + 2);
+			return true;
+		}
+		unsigned long now = CommandStats::nowMicros();
+		if (now >= deadline)
+			return false;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, static_cast<int>((deadline - now) / 1000) + 1) <= 0)
+			continue;
+		char buf[4096];
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return false;
+		buffer.append(buf, n);
+	}
+}
+
+int main()
+{
+	const int MESSAGES = 2000;
+	pid_t nodeA = spawn("16667", "a.bench", NULL, "127.0.0.1:16669");
+	usleep(200000);
+	pid_t nodeB = spawn("16668", "b.bench", "127.0.0.1:16669", NULL);
+
+	int a = dial(16667);
+	int b = dial(16668);
+	std::string bufA, bufB;
+	bool ok = a >= 0 && b >= 0;
+	if (ok)
+	{
+		sendLine(a, "PASS benchpw");
+		sendLine(a, "NICK sender");
+		sendLine(a, "USER sender h s :Sender");
+		sendLine(b, "PASS benchpw");
+		sendLine(b, "NICK receiver");
+		sendLine(b, "USER receiver h s :Receiver");
+		ok = waitFor(a, bufA, "Welcome to ft_irc,", 2000) && waitFor(b, bufB, "Welcome to ft_irc,", 2000);
+	}
+	// the link comes up on B's first connect attempt; poke until the remote nick resolves
+	for (int attempt = 0; ok && attempt < 100; ++attempt)
+	{
+		sendLine(a, "PRIVMSG receiver :ping");
+		if (waitFor(b, bufB, "PRIVMSG receiver:ping", 100))
+			break;
+		if (attempt == 99)
+			ok = false;
+	}
+
+	std::vector<unsigned long> samples;
+	for (int i = 0; ok && i < MESSAGES; ++i)
+	{
+		std::ostringstream tag;
+		tag << "m" << i;
+		unsigned long start = CommandStats::nowMicros();
+		sendLine(a, "PRIVMSG receiver :" + tag.str());
+		if (!waitFor(b, bufB, "PRIVMSG receiver:" + tag.str() + "\r\n", 2000))
+		{
+			ok = false;
+			break;
+		}
+		samples.push_back(CommandStats::nowMicros() - start);
+	}
+
+	kill(nodeA, SIGINT);
+	kill(nodeB, SIGINT);
+	waitpid(nodeA, NULL, 0);
+	waitpid(nodeB, NULL, 0);
+	if (!ok || samples.empty())
+	{
+		std::cerr << "bench=link.privmsg failed: nodes did not link\n";
+		return 1;
+	}
+	std::sort(samples.begin(), samples.end());
+	unsigned long total = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+		total += samples[i];
+	std::cout << "bench=link.privmsg nodes=2 ops=" << samples.size()
+			  << " p50_us=" << samples[samples.size() / 2]
+			  << " p99_us=" << samples[samples.size() * 99 / 100]
+			  << " ns_per_op=" << (total * 1000.0 / samples.size()) << "\n";
+	return 0;
+}
@@ -0,0 +1,288 @@
+// Client traffic over loopback TCP against a UNIX-domain listener (IRC_LISTEN
+// unix:<path>): message latency, a burst's throughput and the server CPU each
+// costs. Then a connection storm on listeners with accept budgets 1 and 64.
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const char *SOCKET_PATH = "/tmp/ircbench-listeners.sock";
+
+static pid_t spawn(const char *port, const std::string &listen)
+{
+	std::cout.flush();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		setenv("IRC_LISTEN", listen.c_str(), 1);
+		execl("./ircserv", "ircserv", port, "benchpw", (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+// utime + stime of the server, in microseconds
+static unsigned long cpuMicros(pid_t pid)
+{
+	std::ostringstream path;
+	path << "/proc/" << pid << "/stat";
+	std::ifstream stat(path.str().c_str());
+	std::string content;
+	std::getline(stat, content);
+	std::istringstream fields(content.substr(content.rfind(')') + 2));
+	std::string field;
+	unsigned long utime = 0, stime = 0;
+	for (int i = 3; i <= 15 && fields >> field; ++i)
+	{
+		if (i == 14)
+			utime = std::strtoul(field.c_str(), NULL, 10);
+		if (i == 15)
+			stime = std::strtoul(field.c_str(), NULL, 10);
+	}
+	return (utime + stime) * (1000000UL / sysconf(_SC_CLK_TCK));
+}
+
+// port 0 dials SOCKET_PATH
+static int dial(int port)
+{
+	for (int attempt = 0; attempt < 50; ++attempt)
+	{
+		int fd;
+		int rc;
+		if (port)
+		{
+			fd = socket(AF_INET, SOCK_STREAM, 0);
+			struct sockaddr_in addr;
+			std::memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(static_cast<uint16_t>(port));
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			rc = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+		else
+		{
+			fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			struct sockaddr_un addr;
+			std::memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			std::strcpy(addr.sun_path, SOCKET_PATH);
+			rc = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+		}
+		if (rc == 0)
+			return fd;
+		close(fd);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void sendLine(int fd, const std::string &line)
+{
+	std::string msg = line + "\r\n";
+	send(fd, msg.c_str(), msg.size(), 0);
+}
+
+static bool waitFor(int fd, std::string &buffer, const std::string &needle, int timeoutMs)
+{
+	unsigned long deadline = CommandStats::nowMicros() + timeoutMs * 1000UL;
+	while (buffer.find(needle) == std::string::npos)
+	{
+		unsigned long now = CommandStats::nowMicros();
+		if (now >= deadline)
+			return false;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, static_cast<int>((deadline - now) / 1000) + 1) <= 0)
+			continue;
+		char buf[65536];
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return false;
+		buffer.append(buf, n);
+	}
+	size_t end = buffer.find("\r\n", buffer.find(needle));
+	buffer.erase(0, end == std::string::npos ? buffer.size() : end + 2);
+	return true;
+}
+
+static bool registerAs(int fd, std::string &buffer, const std::string &nick)
+{
+	sendLine(fd, "PASS benchpw");
+	sendLine(fd, "NICK " + nick);
+	sendLine(fd, "USER " + nick + " h s :" + nick);
+	return waitFor(fd, buffer, "Welcome to ft_irc,", 5000);
+}
+
+// Ping-pong latency, then a burst the sender writes in one go
+static void traffic(const char *name, pid_t server, int port)
+{
+	const int MESSAGES = 2000;
+	const int BURST = 20000;
+	int a = dial(port);
+	int b = dial(port);
+	std::string bufA, bufB;
+	std::string sender = std::string(name) + "_a";
+	std::string receiver = std::string(name) + "_b";
+	bool ok = a >= 0 && b >= 0 && registerAs(a, bufA, sender) && registerAs(b, bufB, receiver);
+
+	std::vector<unsigned long> samples;
+	unsigned long cpuStart = cpuMicros(server);
+	for (int i = 0; ok && i < MESSAGES; ++i)
+	{
+		std::ostringstream tag;
+		tag << "m" << i;
+		unsigned long start = CommandStats::nowMicros();
+		sendLine(a, "PRIVMSG " + receiver + " :" + tag.str());
+		ok = waitFor(b, bufB, "PRIVMSG " + receiver + ":" + tag.str() + "\r\n", 2000);
+		samples.push_back(CommandStats::nowMicros() - start);
+	}
+	unsigned long pingCpu = cpuMicros(server) - cpuStart;
+
+	std::string burst;
+	for (int i = 0; i < BURST; ++i)
+	{
+		std::ostringstream line;
+		line << "PRIVMSG " << receiver << " :burst line " << i << " of ordinary chat\r\n";
+		burst += line.str();
+	}
+	std::ostringstream last;
+	last << "burst line " << BURST - 1 << " of";
+	cpuStart = cpuMicros(server);
+	unsigned long start = CommandStats::nowMicros();
+	size_t sent = 0;
+	while (ok && sent < burst.size())
+	{
+		ssize_t n = send(a, burst.data() + sent, std::min<size_t>(burst.size() - sent, 65536), MSG_DONTWAIT);
+		if (n > 0)
+			sent += n;
+		// keep the receiver drained so the server never has to queue for it
+		char buf[65536];
+		ssize_t got;
+		while ((got = recv(b, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+		{
+			bufB.append(buf, got);
+			if (bufB.size() > 4096)
+				bufB.erase(0, bufB.size() - 256); // only the tail can hold the last line
+		}
+		if (n < 0)
+			usleep(50);
+	}
+	ok = ok && waitFor(b, bufB, last.str(), 10000);
+	unsigned long burstUs = CommandStats::nowMicros() - start;
+	unsigned long burstCpu = cpuMicros(server) - cpuStart;
+	close(a);
+	close(b);
+	if (!ok || samples.empty())
+	{
+		std::cout << "bench=listeners." << name << " failed\n";
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	unsigned long total = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+		total += samples[i];
+	std::cout << "bench=listeners." << name << "_pingpong ops=" << samples.size()
+			  << " p50_us=" << samples[samples.size() / 2] << " p99_us=" << samples[samples.size() * 99 / 100]
+			  << " server_cpu_us_per_msg=" << pingCpu / static_cast<double>(samples.size())
+			  << " ns_per_op=" << total * 1000.0 / samples.size() << "\n";
+	std::cout << "bench=listeners." << name << "_burst ops=" << BURST
+			  << " msgs_per_s=" << BURST * 1000000.0 / burstUs
+			  << " server_cpu_us_per_msg=" << burstCpu / static_cast<double>(BURST)
+			  << " ns_per_op=" << burstUs * 1000.0 / BURST << "\n";
+}
+
+// CLIENTS connections land at once; the clock stops when the last is welcomed.
+// Two registered clients exchange messages all along, so the worst round trip
+// shows what the storm costs the users already on the server.
+static void storm(const char *port, const char *budget)
+{
+	const int CLIENTS = 300;
+	std::ostringstream listen;
+	listen << "127.0.0.1:" << std::atoi(port) + 1 << "@" << budget;
+	pid_t server = spawn(port, listen.str());
+	int user = dial(std::atoi(port));
+	int peer = dial(std::atoi(port));
+	std::string userBuf, peerBuf;
+	bool ok = user >= 0 && peer >= 0 && registerAs(user, userBuf, "steady") && registerAs(peer, peerBuf, "peer");
+
+	std::vector<int> fds;
+	std::vector<std::string> bufs(CLIENTS);
+	unsigned long start = CommandStats::nowMicros();
+	for (int i = 0; ok && i < CLIENTS; ++i)
+	{
+		int fd = dial(std::atoi(port) + 1);
+		std::ostringstream nick;
+		nick << "storm" << i;
+		sendLine(fd, "PASS benchpw");
+		sendLine(fd, "NICK " + nick.str());
+		sendLine(fd, "USER x h s :x");
+		fds.push_back(fd);
+	}
+	unsigned long worstPing = 0;
+	size_t welcomed = 0;
+	std::vector<bool> done(fds.size(), false);
+	for (int round = 0; ok && welcomed < fds.size() && round < 10000; ++round)
+	{
+		unsigned long pingStart = CommandStats::nowMicros();
+		sendLine(user, "PRIVMSG peer :p");
+		ok = waitFor(peer, peerBuf, "PRIVMSG peer:p", 5000);
+		worstPing = std::max(worstPing, CommandStats::nowMicros() - pingStart);
+		for (size_t i = 0; i < fds.size(); ++i)
+		{
+			char buf[4096];
+			ssize_t n;
+			while (!done[i] && (n = recv(fds[i], buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+			{
+				bufs[i].append(buf, n);
+				if (bufs[i].find("Welcome to ft_irc,") != std::string::npos)
+				{
+					done[i] = true;
+					welcomed++;
+				}
+			}
+		}
+	}
+	unsigned long us = CommandStats::nowMicros() - start;
+	for (size_t i = 0; i < fds.size(); ++i)
+		close(fds[i]);
+	close(user);
+	close(peer);
+	kill(server, SIGINT);
+	waitpid(server, NULL, 0);
+	std::cout << "bench=listeners.storm budget=" << budget << " clients=" << CLIENTS << " welcomed=" << welcomed
+			  << " total_ms=" << us / 1000.0 << " worst_rtt_us=" << worstPing << "\n";
+}
+
+int main()
+{
+	signal(SIGPIPE, SIG_IGN);
+	pid_t server = spawn("16681", std::string("unix:") + SOCKET_PATH);
+	usleep(200000);
+	traffic("tcp", server, 16681);
+	traffic("unix", server, 0);
+	kill(server, SIGINT);
+	waitpid(server, NULL, 0);
+	storm("16683", "1");
+	storm("16685", "64");
+	return 0;
+}
@@ -0,0 +1,87 @@
+// 10k-mask ban list: indexed lookups vs a naive glob over every mask
+#include "MaskIndex.hpp"
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+
+static std::string num(int n)
+{
+	std::ostringstream ss;
+	ss << n;
+	return ss.str();
+}
+
+static void report(const char *name, size_t masks, unsigned long us, size_t ops, size_t hits)
+{
+	std::cout << "bench=" << name << " masks=" << masks << " ops=" << ops << " hits=" << hits
+			  << " ns_per_op=" << (us * 1000.0 / ops) << "\n";
+}
+
+int main()
+{
+	const size_t MASKS = 10000;
+	const size_t LOOKUPS = 20000;
+	std::srand(42);
+
+	MaskIndex index;
+	std::vector<std::string> naive;
+	for (size_t i = 0; i < MASKS; ++i)
+	{
+		std::string mask;
+		switch (i % 4)
+		{
+			case 0: mask = "spammer" + num(i) + "!*@*"; break;				// nick bans
+			case 1: mask = "*!*@host" + num(i) + ".example.net"; break;	// host bans
+			case 2: mask = "*!ident" + num(i) + "@*.isp" + num(i % 50) + ".com"; break;
+			default: mask = "*!*bot" + num(i) + "*@*"; break;				// no literal ends
+		}
+		index.add(mask, "bench", 0);
+		naive.push_back(MaskIndex::casefold(MaskIndex::normalize(mask)));
+	}
+
+	std::vector<std::string> subjects;
+	for (size_t i = 0; i < LOOKUPS; ++i)
+	{
+		int r = std::rand() % 20000;
+		if (i % 10 == 0)
+			subjects.push_back("spammer" + num(r) + "!u@somewhere.org");	// ~5% of these are banned
+		else
+			subjects.push_back("user" + num(r) + "!ident" + num(r) + "@client" + num(r) + ".isp" + num(r % 50) + ".com");
+	}
+
+	// the naive scan is ~10k globs per lookup, a slice of the subjects is enough
+	const size_t NAIVE_LOOKUPS = 500;
+	size_t hits = 0;
+	unsigned long start = CommandStats::nowMicros();
+	for (size_t i = 0; i < NAIVE_LOOKUPS; ++i)
+	{
+		std::string subject = MaskIndex::casefold(subjects[i]);
+		for (size_t m = 0; m < naive.size(); ++m)
+		{
+			if (MaskIndex::globMatch(naive[m], subject))
+			{
+				hits++;
+				break;
+			}
+		}
+	}
+	report("masks.naive", MASKS, CommandStats::nowMicros() - start, NAIVE_LOOKUPS, hits);
+
+	hits = 0;
+	start = CommandStats::nowMicros();
+	for (size_t i = 0; i < subjects.size(); ++i)
+		hits += index.matches(subjects[i]);
+	report("masks.indexed", MASKS, CommandStats::nowMicros() - start, subjects.size(), hits);
+
+	// same clients checked again (JOIN then every PRIVMSG): served from the per-client cache
+	hits = 0;
+	for (size_t i = 0; i < subjects.size(); ++i)
+		index.matches(static_cast<int>(i), 1, subjects[i]);
+	start = CommandStats::nowMicros();
+	for (size_t i = 0; i < subjects.size(); ++i)
+		hits += index.matches(static_cast<int>(i), 1, subjects[i]);
+	report("masks.cached", MASKS, CommandStats::nowMicros() - start, subjects.size(), hits);
+	return 0;
+}
@@ -0,0 +1,259 @@
+// Chat latency of registered users during a reconnect storm, with admission
+// control off (IRC_SHED_LAG_US=0) and on. 200 users sit in #big. A second
+// process opens a connection every few milliseconds; each one registers,
+// joins #big and asks for NAMES and WHO. Meanwhile one registered user
+// messages another, one message in flight at a time.
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const int MEMBERS = 200;
+static const int STORM_MS = 3000;
+static const int STORM_GAP_US = 4000;
+static const int PING_GAP_MS = 2;
+
+static int dial(int port)
+{
+	for (int attempt = 0; attempt < 50; ++attempt)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(static_cast<uint16_t>(port));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		{
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			return fd;
+		}
+		close(fd);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void sendLine(int fd, const std::string &lines)
+{
+	send(fd, lines.c_str(), lines.size(), MSG_NOSIGNAL);
+}
+
+static std::string registration(const std::string &nick)
+{
+	return "PASS benchpw\r\nNICK " + nick + "\r\nUSER " + nick + " h s :" + nick + "\r\n";
+}
+
+// Reads whatever is there for up to ms. Member sockets are drained and
+// discarded, so the server never sees them as slow; the bytes of sockets
+// that have an inbox are appended to it.
+static void pump(const std::vector<int> &fds, std::map<int, std::string> &inboxes, int ms)
+{
+	std::vector<struct pollfd> pfds(fds.size());
+	for (size_t i = 0; i < fds.size(); ++i)
+	{
+		pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+	if (poll(&pfds[0], pfds.size(), ms) <= 0)
+		return;
+	char buf[65536];
+	for (size_t i = 0; i < pfds.size(); ++i)
+	{
+		if (!(pfds[i].revents & POLLIN))
+			continue;
+		ssize_t n = recv(pfds[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+		std::map<int, std::string>::iterator inbox = inboxes.find(pfds[i].fd);
+		if (n > 0 && inbox != inboxes.end())
+			inbox->second.append(buf, n);
+	}
+}
+
+// The storm: one new connection every STORM_GAP_US for STORM_MS. Reports on
+// out how many registered, how many got the overload ERROR and how many
+// heard nothing either way.
+static void storm(int port, int out)
+{
+	enum { WAITING, ADMITTED, REJECTED };
+	std::vector<int> fds;
+	std::vector<int> state;
+	std::vector<std::string> seen;
+	unsigned long end = CommandStats::nowMicros() + STORM_MS * 1000UL;
+	unsigned long next = 0;
+	int counts[3] = { 0, 0, 0 };
+	while (CommandStats::nowMicros() < end)
+	{
+		if (CommandStats::nowMicros() >= next)
+		{
+			int fd = dial(port);
+			if (fd >= 0)
+			{
+				std::ostringstream nick;
+				nick << "storm" << fds.size();
+				sendLine(fd, registration(nick.str()) + "JOIN #big\r\nNAMES #big\r\nWHO #big\r\n");
+				fds.push_back(fd);
+				state.push_back(WAITING);
+				seen.push_back("");
+			}
+			next = CommandStats::nowMicros() + STORM_GAP_US;
+		}
+		std::vector<struct pollfd> pfds;
+		for (size_t i = 0; i < fds.size(); ++i)
+		{
+			if (fds[i] < 0)
+				continue;
+			struct pollfd p = { fds[i], POLLIN, 0 };
+			pfds.push_back(p);
+		}
+		if (pfds.empty() || poll(&pfds[0], pfds.size(), 1) <= 0)
+			continue;
+		char buf[65536];
+		for (size_t i = 0; i < fds.size(); ++i)
+		{
+			if (fds[i] < 0)
+				continue;
+			ssize_t n = recv(fds[i], buf, sizeof(buf), MSG_DONTWAIT);
+			if (n > 0 && state[i] == WAITING)
+			{
+				seen[i].append(buf, n);
+				if (seen[i].find("Welcome to ft_irc,") != std::string::npos)
+					state[i] = ADMITTED;
+				else if (seen[i].find("ERROR :") != std::string::npos)
+					state[i] = REJECTED;
+			}
+			if (n == 0 && state[i] == WAITING)
+				state[i] = REJECTED;
+			if (n == 0 || state[i] == REJECTED)
+			{
+				close(fds[i]);
+				fds[i] = -1;
+			}
+		}
+	}
+	for (size_t i = 0; i < state.size(); ++i)
+		counts[state[i]]++;
+	std::ostringstream report;
+	report << counts[ADMITTED] << " " << counts[REJECTED] << " " << counts[WAITING];
+	std::string line = report.str();
+	write(out, line.c_str(), line.size());
+}
+
+static void run(const char *name, int port, const char *shedLagUs)
+{
+	std::cout.flush();
+	pid_t server = fork();
+	if (server == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		setenv("IRC_SHED_LAG_US", shedLagUs, 1);
+		std::ostringstream portArg;
+		portArg << port;
+		execl("./ircserv", "ircserv", portArg.str().c_str(), "benchpw", (char *)NULL);
+		_exit(127);
+	}
+	usleep(200000);
+	std::vector<int> fds;
+	std::map<int, std::string> inboxes;
+	for (int i = 0; i < MEMBERS; ++i)
+	{
+		int fd = dial(port);
+		std::ostringstream nick;
+		nick << "member" << i;
+		sendLine(fd, registration(nick.str()) + "JOIN #big\r\n");
+		fds.push_back(fd);
+		pump(fds, inboxes, 0);
+	}
+	int pinger = dial(port);
+	int ponger = dial(port);
+	fds.push_back(pinger);
+	fds.push_back(ponger);
+	sendLine(pinger, registration("pinger"));
+	sendLine(ponger, registration("ponger"));
+	inboxes[pinger];
+	std::string &inbox = inboxes[ponger];
+	unsigned long settled = CommandStats::nowMicros() + 1000000UL;
+	while (inboxes[pinger].find("Welcome to ft_irc,") == std::string::npos
+		   || inbox.find("Welcome to ft_irc,") == std::string::npos || CommandStats::nowMicros() < settled)
+		pump(fds, inboxes, 2);
+
+	int report[2];
+	if (pipe(report) < 0)
+		return;
+	pid_t stormer = fork();
+	if (stormer == 0)
+	{
+		close(report[0]);
+		storm(port, report[1]);
+		_exit(0);
+	}
+	close(report[1]);
+	std::vector<unsigned long> samples;
+	int lost = 0;
+	unsigned long end = CommandStats::nowMicros() + STORM_MS * 1000UL;
+	for (int i = 0; CommandStats::nowMicros() < end; ++i)
+	{
+		std::ostringstream tag;
+		tag << "PRIVMSG ponger:t" << i << "\r\n";
+		inbox.clear();
+		unsigned long start = CommandStats::nowMicros();
+		std::ostringstream line;
+		line << "PRIVMSG ponger :t" << i << "\r\n";
+		sendLine(pinger, line.str());
+		while (inbox.find(tag.str()) == std::string::npos && CommandStats::nowMicros() - start < 2000000UL)
+			pump(fds, inboxes, 1);
+		if (inbox.find(tag.str()) == std::string::npos)
+			lost++;
+		else
+			samples.push_back(CommandStats::nowMicros() - start);
+		unsigned long gapEnd = CommandStats::nowMicros() + PING_GAP_MS * 1000UL;
+		while (CommandStats::nowMicros() < gapEnd)
+			pump(fds, inboxes, PING_GAP_MS);
+	}
+	char counts[64] = { 0 };
+	ssize_t got = read(report[0], counts, sizeof(counts) - 1);
+	close(report[0]);
+	waitpid(stormer, NULL, 0);
+	int admitted = 0, rejected = 0, pending = 0;
+	if (got > 0)
+		std::istringstream(counts) >> admitted >> rejected >> pending;
+	kill(server, SIGINT);
+	for (size_t i = 0; i < fds.size(); ++i)
+		close(fds[i]);
+	waitpid(server, NULL, 0);
+	if (samples.empty())
+	{
+		std::cout << "bench=" << name << " failed\n";
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	std::cout << "bench=" << name << " ops=" << samples.size() << " lost=" << lost
+			  << " p50_us=" << samples[samples.size() / 2]
+			  << " p99_us=" << samples[samples.size() * 99 / 100]
+			  << " max_us=" << samples.back()
+			  << " storm_admitted=" << admitted << " storm_rejected=" << rejected << " storm_waiting=" << pending << "\n";
+}
+
+int main()
+{
+	signal(SIGPIPE, SIG_IGN);
+	run("overload.shed_off", 16686, "0");
+	run("overload.shed_on", 16687, "5000");
+	return 0;
+}
@@ -0,0 +1,252 @@
+// Reconnecting a user who sits in CHANNELS channels: a full reconnect
+// (QUIT, register, JOIN every channel) against RESUME with the token of the
+// dropped connection. Counts the time until the user is back, the lines a
+// peer sharing every channel has to read and the server CPU per reconnect.
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const int CHANNELS = 50;
+static const int ROUNDS = 100;
+static const int PORT = 6693;
+
+static pid_t spawn()
+{
+	std::cout.flush();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		execl("./ircserv", "ircserv", "6693", "benchpw", (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+// utime + stime of the server, in microseconds
+static unsigned long cpuMicros(pid_t pid)
+{
+	std::ostringstream path;
+	path << "/proc/" << pid << "/stat";
+	std::ifstream stat(path.str().c_str());
+	std::string content;
+	std::getline(stat, content);
+	std::istringstream fields(content.substr(content.rfind(')') + 2));
+	std::string field;
+	unsigned long utime = 0, stime = 0;
+	for (int i = 3; i <= 15 && fields >> field; ++i)
+	{
+		if (i == 14)
+			utime = std::strtoul(field.c_str(), NULL, 10);
+		if (i == 15)
+			stime = std::strtoul(field.c_str(), NULL, 10);
+	}
+	return (utime + stime) * (1000000UL / sysconf(_SC_CLK_TCK));
+}
+
+static int dial()
+{
+	for (int attempt = 0; attempt < 50; ++attempt)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(PORT);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		{
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			return fd;
+		}
+		close(fd);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void sendLine(int fd, const std::string &line)
+{
+	std::string msg = line + "\r\n";
+	send(fd, msg.c_str(), msg.size(), 0);
+}
+
+// Reads until needle shows up and hands back its line; bytes counts everything read on the way
+static bool waitFor(int fd, std::string &buffer, const std::string &needle, size_t *bytes = NULL,
+					std::string *line = NULL)
+{
+	unsigned long deadline = CommandStats::nowMicros() + 5000000UL;
+	while (buffer.find(needle) == std::string::npos)
+	{
+		unsigned long now = CommandStats::nowMicros();
+		if (now >= deadline)
+			return false;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, static_cast<int>((deadline - now) / 1000) + 1) <= 0)
+			continue;
+		char buf[65536];
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return false;
+		buffer.append(buf, n);
+		if (bytes)
+			*bytes += n;
+	}
+	size_t at = buffer.find(needle);
+	size_t end = buffer.find("\r\n", at);
+	if (line)
+		*line = buffer.substr(at, end - at);
+	buffer.erase(0, end == std::string::npos ? buffer.size() : end + 2);
+	return true;
+}
+
+// Lines that reach fd within a short quiet period
+static size_t drainLines(int fd)
+{
+	size_t lines = 0;
+	char buf[65536];
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 50) > 0)
+	{
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			break;
+		lines += std::count(buf, buf + n, '\n');
+	}
+	return lines;
+}
+
+static std::string channel(int i)
+{
+	std::ostringstream name;
+	name << "#room" << i;
+	return name.str();
+}
+
+// Registers and joins every channel. With token set it asks for
+// draft/resume-0.5 and stores the token it gets.
+static bool arrive(int fd, std::string &buffer, const std::string &nick, std::string *token, size_t *bytes = NULL)
+{
+	if (token)
+		sendLine(fd, "CAP REQ :draft/resume-0.5");
+	sendLine(fd, "PASS benchpw");
+	sendLine(fd, "NICK " + nick);
+	sendLine(fd, "USER " + nick + " h s :" + nick);
+	if (token)
+		sendLine(fd, "CAP END");
+	if (!waitFor(fd, buffer, token ? "RESUME TOKEN " : "Welcome to ft_irc,", bytes, token))
+		return false;
+	for (int i = 0; i < CHANNELS; ++i)
+		sendLine(fd, "JOIN " + channel(i));
+	return waitFor(fd, buffer, " " + channel(CHANNELS - 1) + " :End of /NAMES list.", bytes);
+}
+
+static void report(const char *name, std::vector<unsigned long> &samples, size_t peerLines, size_t bytes,
+				   unsigned long cpu)
+{
+	std::sort(samples.begin(), samples.end());
+	std::cout << "bench=resume." << name << " channels=" << CHANNELS << " ops=" << samples.size()
+			  << " p50_us=" << samples[samples.size() / 2] << " max_us=" << samples.back()
+			  << " peer_lines=" << peerLines / static_cast<double>(samples.size())
+			  << " client_bytes=" << bytes / static_cast<double>(samples.size())
+			  << " server_cpu_us=" << cpu / static_cast<double>(samples.size()) << "\n";
+}
+
+int main()
+{
+	std::signal(SIGPIPE, SIG_IGN);
+	pid_t server = spawn();
+	int peer = dial();
+	std::string peerBuf;
+	if (peer < 0 || !arrive(peer, peerBuf, "peer", NULL))
+	{
+		std::cerr << "resume: no server on port " << PORT << "\n";
+		kill(server, SIGINT);
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+	int user = dial();
+	std::string userBuf;
+	bool ok = arrive(user, userBuf, "plain", NULL);
+	drainLines(peer);
+
+	// Full reconnect: the peer sees the QUIT, then a JOIN per channel
+	std::vector<unsigned long> samples;
+	size_t peerLines = 0;
+	size_t bytes = 0;
+	unsigned long cpuStart = cpuMicros(server);
+	for (int round = 0; ok && round < ROUNDS; ++round)
+	{
+		close(user);
+		if (!waitFor(peer, peerBuf, "plain!plain@localhost QUIT"))
+			break;
+		peerLines++;
+		unsigned long start = CommandStats::nowMicros();
+		user = dial();
+		userBuf.clear();
+		ok = arrive(user, userBuf, "plain", NULL, &bytes);
+		samples.push_back(CommandStats::nowMicros() - start);
+		peerLines += drainLines(peer);
+	}
+	if (!samples.empty())
+		report("full_reconnect", samples, peerLines, bytes, cpuMicros(server) - cpuStart);
+
+	// RESUME: the old connection drops and the token takes its place
+	close(user);
+	drainLines(peer);
+	user = dial();
+	userBuf.clear();
+	std::string token;
+	if (!arrive(user, userBuf, "roamer", &token))
+		token.clear();
+	drainLines(peer);
+	samples.clear();
+	peerLines = 0;
+	bytes = 0;
+	cpuStart = cpuMicros(server);
+	for (int round = 0; !token.empty() && round < ROUNDS; ++round)
+	{
+		close(user);
+		usleep(20000); // let the server notice, as a real drop would
+		unsigned long start = CommandStats::nowMicros();
+		user = dial();
+		userBuf.clear();
+		sendLine(user, "CAP REQ :draft/resume-0.5");
+		sendLine(user, "RESUME " + token.substr(token.rfind(' ') + 1));
+		size_t got = 0;
+		if (!waitFor(user, userBuf, "RESUME TOKEN ", &got, &token))
+			break;
+		samples.push_back(CommandStats::nowMicros() - start);
+		bytes += got;
+		peerLines += drainLines(peer);
+	}
+	if (!samples.empty())
+		report("resume", samples, peerLines, bytes, cpuMicros(server) - cpuStart);
+
+	close(user);
+	close(peer);
+	kill(server, SIGINT);
+	waitpid(server, NULL, 0);
+	return 0;
+}
@@ -0,0 +1,187 @@
+// !ping -> pong round trips through a bot on a live ./ircserv: the in-process
+// service (IRC_BOT=1) against the same bot as a TCP client in its own process,
+// which pays a socket hop and a line parse for every message it sees.
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const int PINGS = 20000;
+
+static int dial(int port)
+{
+	for (int attempt = 0; attempt < 50; ++attempt)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(static_cast<uint16_t>(port));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		{
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			return fd;
+		}
+		close(fd);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void sendAll(int fd, const std::string &data)
+{
+	size_t off = 0;
+	while (off < data.size())
+	{
+		ssize_t n = send(fd, data.c_str() + off, data.size() - off, 0);
+		if (n <= 0)
+			return;
+		off += n;
+	}
+}
+
+// Reads until needle has been seen count times
+static bool waitCount(int fd, const std::string &needle, int count, int timeoutMs)
+{
+	std::string tail;
+	int seen = 0;
+	unsigned long deadline = CommandStats::nowMicros() + timeoutMs * 1000UL;
+	while (seen < count && CommandStats::nowMicros() < deadline)
+	{
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		char buf[65536];
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return false;
+		tail.append(buf, n);
+		size_t at = 0, found;
+		while ((found = tail.find(needle, at)) != std::string::npos)
+		{
+			seen++;
+			at = found + needle.size();
+		}
+		tail.erase(0, tail.size() > needle.size() ? std::max(at, tail.size() - needle.size()) : 0);
+	}
+	return seen >= count;
+}
+
+static int registerAs(int port, const std::string &nick, const std::string &channel)
+{
+	int fd = dial(port);
+	if (fd < 0)
+		return -1;
+	sendAll(fd, "PASS benchpw\r\nNICK " + nick + "\r\nUSER " + nick + " h s :" + nick + "\r\n");
+	if (!waitCount(fd, "Welcome to ft_irc,", 1, 5000))
+		return -1;
+	sendAll(fd, "JOIN " + channel + "\r\n");
+	if (!waitCount(fd, "End of /NAMES", 1, 5000))
+		return -1;
+	return fd;
+}
+
+// The same bot as a TCP client: reads lines, answers !ping in the channel
+static void tcpBot(int port)
+{
+	int fd = registerAs(port, "tcpbot", "#bench");
+	if (fd < 0)
+		_exit(1);
+	sendAll(fd, "PRIVMSG #bench :ready\r\n"); // what registerAs read past the NAMES reply is gone
+	std::string buffer;
+	char buf[65536];
+	ssize_t n;
+	while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+	{
+		buffer.append(buf, n);
+		std::string replies;
+		size_t start = 0, eol;
+		while ((eol = buffer.find("\r\n", start)) != std::string::npos)
+		{
+			std::string line = buffer.substr(start, eol - start);
+			start = eol + 2;
+			size_t cmd = line.find(' ');
+			if (cmd != std::string::npos && line.compare(cmd + 1, 8, "PRIVMSG ") == 0
+				&& line.find(":!ping", cmd) != std::string::npos)
+				replies += "PRIVMSG #bench :pong\r\n";
+		}
+		buffer.erase(0, start);
+		sendAll(fd, replies);
+	}
+	_exit(0);
+}
+
+static void runCase(const char *name, int port, bool inProcess)
+{
+	std::cout.flush();
+	pid_t server = fork();
+	if (server == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		if (inProcess)
+		{
+			setenv("IRC_BOT", "1", 1);
+			setenv("IRC_BOT_CHANNELS", "#bench", 1);
+		}
+		std::ostringstream p;
+		p << port;
+		execl("./ircserv", "ircserv", p.str().c_str(), "benchpw", (char *)NULL);
+		_exit(127);
+	}
+	pid_t bot = -1;
+	int user = registerAs(port, "user", "#bench");
+	bool ok = user >= 0;
+	if (ok && !inProcess)
+	{
+		bot = fork();
+		if (bot == 0)
+			tcpBot(port);
+		ok = waitCount(user, "tcpbot PRIVMSG #bench:ready", 1, 5000);
+	}
+	std::string burst;
+	for (int i = 0; i < PINGS; ++i)
+		burst += "PRIVMSG #bench :!ping\r\n";
+	std::string pong = inProcess ? ":ircbot PRIVMSG #bench:pong" : ":tcpbot PRIVMSG #bench:pong";
+	unsigned long start = CommandStats::nowMicros();
+	if (ok)
+		sendAll(user, burst);
+	ok = ok && waitCount(user, pong, PINGS, 60000);
+	unsigned long elapsed = CommandStats::nowMicros() - start;
+	if (ok)
+		std::cout << "bench=" << name << " ops=" << PINGS << " pongs_per_s=" << PINGS / (elapsed / 1e6)
+				  << " ns_per_op=" << (elapsed * 1000.0 / PINGS) << "\n";
+	else
+		std::cout << "bench=" << name << " failed\n";
+	if (bot > 0)
+	{
+		kill(bot, SIGKILL);
+		waitpid(bot, NULL, 0);
+	}
+	kill(server, SIGINT);
+	if (user >= 0)
+		close(user);
+	waitpid(server, NULL, 0);
+}
+
+int main()
+{
+	runCase("bot.tcp_client", 16684, false);
+	runCase("bot.in_process", 16685, true);
+	
+	return 0;
+}
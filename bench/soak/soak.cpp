@@ -0,0 +1,373 @@
+// Soak test: ./ircserv_faults under socket faults (FaultInjection.hpp) and a
+// steady channel load for SOAK_SECONDS. Every message carries its sender
+// session, a sequence number and a checksum, so receivers can tell a
+// corrupted, lost or reordered line from the ones faults are allowed to
+// cost (the tail of a session that got reset). The server's RSS is sampled
+// to check memory settles instead of growing.
+//
+//   SOAK_SECONDS   60     run time, hours work as well (3600 * n)
+//   SOAK_CLIENTS   20     clients, all in #soak
+//   SOAK_RATE      20     messages per second per client
+//   SOAK_PORT      16690
+//   SOAK_LOG       /dev/null  server output, it ends with the injected fault counts
+// IRC_FAULT_* already in the environment override the default rates below.
+#include "CommandStats.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static long envLong(const char *name, long def)
+{
+	const char *val = std::getenv(name);
+	return val && *val ? std::atol(val) : def;
+}
+
+static pid_t spawn(int port, const char *log)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		int out = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out >= 0)
+		{
+			dup2(out, 1);
+			dup2(out, 2);
+		}
+		setenv("IRC_FAULT_RECV_SPLIT", "30", 0);
+		setenv("IRC_FAULT_RECV_EAGAIN", "5", 0);
+		setenv("IRC_FAULT_SEND_SHORT", "30", 0);
+		setenv("IRC_FAULT_SEND_EAGAIN", "10", 0);
+		setenv("IRC_FAULT_RESET", "0.005", 0);
+		std::ostringstream p;
+		p << port;
+		execl("./ircserv_faults", "ircserv_faults", p.str().c_str(), "soakpw", (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+static long rssKb(pid_t pid)
+{
+	std::ostringstream path;
+	path << "/proc/" << pid << "/status";
+	std::ifstream status(path.str().c_str());
+	std::string line;
+	while (std::getline(status, line))
+		if (line.compare(0, 6, "VmRSS:") == 0)
+			return std::atol(line.c_str() + 6);
+	return -1;
+}
+
+static unsigned long checksum(const std::string &s)
+{
+	unsigned long h = 2166136261UL;
+	for (size_t i = 0; i < s.size(); ++i)
+		h = ((h ^ static_cast<unsigned char>(s[i])) * 16777619UL) & 0xffffffffUL;
+	return h;
+}
+
+struct Totals
+{
+	unsigned long sent;
+	unsigned long received;
+	unsigned long corrupt;
+	unsigned long gaps;
+	unsigned long reconnects;
+};
+
+struct SoakClient
+{
+	int index;
+	int fd;
+	int session;
+	bool joined;
+	std::string tag;		// "c<index>.<session>", names this session in its messages
+	std::string in;
+	std::string out;
+	long seq;
+	unsigned long nextSend;
+	unsigned long reconnectAt;
+	std::map<std::string, long> seen; // <sender tag, last seq> over this session
+};
+
+static std::map<std::string, long> g_lastSent; // <sender tag, last seq sent>
+static Totals g_totals;
+
+static int dial(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(static_cast<uint16_t>(port));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+static void connectClient(SoakClient &c, int port)
+{
+	c.fd = dial(port);
+	if (c.fd < 0)
+	{
+		c.reconnectAt = CommandStats::nowMicros() + 100000;
+		return;
+	}
+	c.session++;
+	std::ostringstream tag;
+	tag << "c" << c.index << "." << c.session;
+	c.tag = tag.str();
+	std::string nick = "s" + c.tag.substr(1);
+	nick[nick.find('.')] = 'x';
+	c.joined = false;
+	c.in.clear();
+	c.out = "PASS soakpw\r\nNICK " + nick + "\r\nUSER " + nick + " h s :soak\r\n";
+	c.seq = 0;
+	c.seen.clear();
+}
+
+static void drop(SoakClient &c)
+{
+	close(c.fd);
+	c.fd = -1;
+	c.joined = false;
+	c.reconnectAt = CommandStats::nowMicros() + 100000;
+	g_totals.reconnects++;
+}
+
+// "<tag> <seq> <payload> <checksum>" from a channel PRIVMSG
+static void check(SoakClient &c, const std::string &text)
+{
+	std::istringstream fields(text);
+	std::string tag, payload;
+	long seq = -1;
+	unsigned long sum = 0;
+	fields >> tag >> seq >> payload >> std::hex >> sum;
+	std::ostringstream body;
+	body << tag << " " << seq << " " << payload;
+	if (seq < 1 || checksum(body.str()) != sum)
+	{
+		g_totals.corrupt++;
+		std::cerr << "soak: corrupt line at " << c.tag << ": " << text << "\n";
+		return;
+	}
+	g_totals.received++;
+	std::map<std::string, long>::iterator last = c.seen.find(tag);
+	// a receiver may join partway through a session, after that nothing may be skipped
+	if (last != c.seen.end() && seq != last->second + 1)
+	{
+		g_totals.gaps++;
+		std::cerr << "soak: " << c.tag << " got " << tag << " #" << seq << " after #" << last->second << "\n";
+	}
+	c.seen[tag] = seq;
+}
+
+static void readLines(SoakClient &c)
+{
+	char buf[8192];
+	while (true)
+	{
+		ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+		if (n > 0)
+		{
+			c.in.append(buf, n);
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		drop(c);
+		return;
+	}
+	size_t eol;
+	while ((eol = c.in.find("\r\n")) != std::string::npos)
+	{
+		std::string line = c.in.substr(0, eol);
+		c.in.erase(0, eol + 2);
+		size_t at = line.find(" PRIVMSG #soak");
+		if (at != std::string::npos)
+		{
+			size_t text = at + 14;
+			while (text < line.size() && (line[text] == ' ' || line[text] == ':'))
+				text++;
+			check(c, line.substr(text));
+		}
+		else if (line.find("Welcome to ft_irc,") != std::string::npos)
+			c.out += "JOIN #soak\r\n"; // registration may wait for the hostname lookup
+		else if (!c.joined && line.find(" JOIN #soak") != std::string::npos)
+			c.joined = true;
+	}
+}
+
+static void writeQueued(SoakClient &c)
+{
+	while (!c.out.empty())
+	{
+		ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+		if (n > 0)
+		{
+			c.out.erase(0, n);
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		drop(c);
+		return;
+	}
+}
+
+static void queueMessage(SoakClient &c)
+{
+	static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	std::string payload(10 + std::rand() % 370, 'x');
+	for (size_t i = 0; i < payload.size(); ++i)
+		payload[i] = alphabet[std::rand() % (sizeof(alphabet) - 1)];
+	std::ostringstream body;
+	body << c.tag << " " << ++c.seq << " " << payload;
+	char sum[16];
+	std::snprintf(sum, sizeof(sum), "%lx", checksum(body.str()));
+	c.out += "PRIVMSG #soak :" + body.str() + " " + sum + "\r\n";
+	g_lastSent[c.tag] = c.seq;
+	g_totals.sent++;
+}
+
+static void pump(std::vector<SoakClient> &clients, int port, bool sending, unsigned long intervalUs)
+{
+	std::vector<struct pollfd> pfds;
+	std::vector<size_t> owners;
+	unsigned long now = CommandStats::nowMicros();
+	for (size_t i = 0; i < clients.size(); ++i)
+	{
+		SoakClient &c = clients[i];
+		if (c.fd < 0 && now >= c.reconnectAt)
+			connectClient(c, port);
+		if (c.fd < 0)
+			continue;
+		if (sending && c.joined && now >= c.nextSend)
+		{
+			queueMessage(c);
+			c.nextSend = now + intervalUs / 2 + std::rand() % intervalUs;
+		}
+		struct pollfd p;
+		p.fd = c.fd;
+		p.events = POLLIN | (c.out.empty() ? 0 : POLLOUT);
+		p.revents = 0;
+		pfds.push_back(p);
+		owners.push_back(i);
+	}
+	if (pfds.empty() || poll(&pfds[0], pfds.size(), 5) <= 0)
+		return;
+	for (size_t i = 0; i < pfds.size(); ++i)
+	{
+		SoakClient &c = clients[owners[i]];
+		if (pfds[i].revents & POLLOUT)
+			writeQueued(c);
+		if (c.fd >= 0 && (pfds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+			readLines(c);
+	}
+}
+
+int main()
+{
+	long seconds = envLong("SOAK_SECONDS", 60);
+	long clientCount = envLong("SOAK_CLIENTS", 20);
+	long rate = envLong("SOAK_RATE", 20);
+	int port = static_cast<int>(envLong("SOAK_PORT", 16690));
+	const char *log = std::getenv("SOAK_LOG") ? std::getenv("SOAK_LOG") : "/dev/null";
+	std::srand(static_cast<unsigned>(getpid()));
+
+	pid_t server = spawn(port, log);
+	usleep(300000);
+
+	std::vector<SoakClient> clients(clientCount);
+	for (long i = 0; i < clientCount; ++i)
+	{
+		clients[i].index = static_cast<int>(i);
+		clients[i].fd = -1;
+		clients[i].session = 0;
+		clients[i].reconnectAt = 0;
+		clients[i].nextSend = 0;
+	}
+	unsigned long intervalUs = 1000000UL / (rate > 0 ? rate : 1);
+	unsigned long start = CommandStats::nowMicros();
+	unsigned long end = start + seconds * 1000000UL;
+	unsigned long sampleEvery = seconds > 10 ? seconds * 100000UL : 1000000UL; // ten samples
+	unsigned long nextSample = start + sampleEvery;
+	std::vector<long> rss;
+	bool crashed = false;
+	while (CommandStats::nowMicros() < end && !crashed)
+	{
+		pump(clients, port, true, intervalUs);
+		if (CommandStats::nowMicros() >= nextSample)
+		{
+			rss.push_back(rssKb(server));
+			nextSample += sampleEvery;
+			crashed = waitpid(server, NULL, WNOHANG) != 0;
+		}
+	}
+	// let queued messages reach everyone before the tail check
+	unsigned long drain = CommandStats::nowMicros() + 3000000UL;
+	while (!crashed && CommandStats::nowMicros() < drain)
+		pump(clients, port, false, intervalUs);
+
+	// Sessions still up at the end lost nothing: whoever saw one of them saw it to the last message
+	unsigned long tailMissing = 0;
+	for (size_t i = 0; i < clients.size(); ++i)
+	{
+		if (clients[i].fd < 0)
+			continue;
+		for (std::map<std::string, long>::iterator it = clients[i].seen.begin(); it != clients[i].seen.end(); ++it)
+		{
+			long index = std::atol(it->first.c_str() + 1);
+			const SoakClient &sender = clients[index];
+			if (sender.fd >= 0 && sender.tag == it->first && it->second != g_lastSent[it->first])
+			{
+				tailMissing++;
+				std::cerr << "soak: " << clients[i].tag << " stopped at " << it->first << " #" << it->second
+						  << " of " << g_lastSent[it->first] << "\n";
+			}
+		}
+	}
+	if (!crashed)
+		crashed = waitpid(server, NULL, WNOHANG) != 0;
+	if (!crashed)
+	{
+		kill(server, SIGINT);
+		waitpid(server, NULL, 0);
+	}
+	for (size_t i = 0; i < clients.size(); ++i)
+		if (clients[i].fd >= 0)
+			close(clients[i].fd);
+
+	// after a warm-up fifth of the run the footprint may wobble, not climb
+	long warm = rss.size() > 2 ? rss[rss.size() / 5] : (rss.empty() ? 0 : rss[0]);
+	long last = rss.empty() ? 0 : rss.back();
+	bool memoryOk = warm <= 0 || last <= warm + warm / 4 + 4096;
+	bool ok = !crashed && g_totals.corrupt == 0 && g_totals.gaps == 0 && tailMissing == 0 && memoryOk
+			  && g_totals.received > 0;
+	std::cout << "bench=soak seconds=" << seconds << " clients=" << clientCount << " sent=" << g_totals.sent
+			  << " received=" << g_totals.received << " reconnects=" << g_totals.reconnects
+			  << " corrupt=" << g_totals.corrupt << " gaps=" << g_totals.gaps << " tail_missing=" << tailMissing
+			  << " rss_warm_kb=" << warm << " rss_end_kb=" << last << " crashed=" << (crashed ? 1 : 0)
+			  << " result=" << (ok ? "ok" : "FAIL") << "\n";
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#ifndef ACCOUNTSTORE_HPP
+#define ACCOUNTSTORE_HPP
+
+#include <string>
+#include <cstddef>
+#include "PasswordHasher.hpp"
+
+// One account as it sits in the file
+struct AccountRecord
+{
+	unsigned int hash;			// of the casefolded name, spares most name compares while probing
+	unsigned char used;
+	unsigned char nameLen;
+	unsigned char pad[2];
+	char name[32];				// as registered, compared casefolded
+	unsigned char salt[PasswordHasher::SALT];
+	unsigned char digest[PasswordHasher::DIGEST];
+	unsigned int iterations;
+	unsigned int pad2;
+	long long created;			// unix time
+	unsigned char reserved[24];
+};
+
+// Accounts in one file mapped into memory: a header and an open-addressing
+// hash table of fixed 128-byte records. A lookup is a hash and a few probes
+// in mapped pages, populated when the file is opened, so logging in never
+// reads from disk. A record is written in place and flushed asynchronously;
+// past half full the table is rebuilt twice as large in a new file that
+// replaces the old one with rename(2), so a crash leaves one or the other.
+class AccountStore
+{
+	public:
+		static const size_t MAX_NAME = 31; // AccountRecord::name keeps a NUL
+
+	private:
+		struct Header
+		{
+			char magic[8];
+			unsigned int version;
+			unsigned int recordSize;
+			unsigned long long slots;
+			unsigned long long count;
+			unsigned char reserved[32];
+		};
+
+		std::string		_path;
+		int				_fd;
+		void			*_map;
+		size_t			_mapLen;
+		Header			*_header;
+		AccountRecord	*_records;
+
+		AccountStore(const AccountStore &);
+		AccountStore &operator=(const AccountStore &);
+
+		static unsigned int	hashName(const std::string &folded);
+		static size_t		fileSize(unsigned long long slots);
+		bool				map(int fd);
+		void				unmap();
+		bool				create(const std::string &path, unsigned long long slots, int &fd);
+		bool				grow();
+		AccountRecord		*probe(const std::string &folded, unsigned int hash) const;
+
+	public:
+		AccountStore();
+		~AccountStore();
+
+		// Opens or creates the file; false (and the reason in error) when it
+		// cannot be used
+		bool					open(const std::string &path, std::string &error);
+		void					close();
+		bool					isOpen() const;
+		const AccountRecord		*find(const std::string &name) const;
+		// false when the name is taken or the file cannot grow
+		bool					add(const std::string &name, const unsigned char *salt, const unsigned char *digest,
+									unsigned int iterations, long long created);
+		size_t					size() const;
+		size_t					capacity() const;
+		size_t					bytes() const;
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef ALLOCSTATS_HPP
+#define ALLOCSTATS_HPP
+
+// Heap allocation counters fed by the global operator new in AllocStats.cpp.
+// Off by default; once enabled only the enabling thread is counted, so the
+// resolver threads do not show up in the event loop's numbers.
+class AllocStats
+{
+	public:
+		static void				enable();
+		static bool				enabled();
+		static unsigned long	allocations();
+		static unsigned long	bytes();
+};
+
+#endif
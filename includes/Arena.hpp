@@ -0,0 +1,156 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <string>
+#include <cstddef>
+#include <new>
+
+// Bump allocator for temporaries that die together. The event loop resets it
+// once per iteration, so parsing and formatting a command costs no heap
+// traffic once the first block is warm.
+class Arena
+{
+	public:
+		static const size_t DEFAULT_BLOCK = 64 * 1024;
+		static const size_t MAX_RETAINED = 1024 * 1024; // reset() keeps at most this much
+		static const size_t ALIGN = 2 * sizeof(void *);
+
+	private:
+		struct Block
+		{
+			Block	*next;
+			size_t	size;
+		};
+
+		Block	*_blocks;	// newest first, the one being filled
+		size_t	_used;		// bytes taken from _blocks
+		size_t	_spilled;	// bytes taken from the older blocks
+		size_t	_highWater;
+		size_t	_blockSize;
+
+		Arena(const Arena &);
+		Arena &operator=(const Arena &);
+
+		static char	*payload(Block *block);
+		void		addBlock(size_t minimum);
+		void		freeBlocks();
+
+	public:
+		explicit Arena(size_t blockSize = DEFAULT_BLOCK);
+		~Arena();
+
+		void	*allocate(size_t size);
+		char	*copy(const char *data, size_t len); // NUL-terminated
+		// Everything handed out so far becomes invalid
+		void	reset();
+
+		size_t	used() const;
+		size_t	highWater() const;
+		size_t	capacity() const;
+};
+
+// STL allocator over an Arena. Without an arena it falls back to the heap, so
+// a container type can be shared by command-scoped and long-lived code.
+template <typename T>
+class ArenaAllocator
+{
+	public:
+		typedef T			value_type;
+		typedef T			*pointer;
+		typedef const T		*const_pointer;
+		typedef T			&reference;
+		typedef const T		&const_reference;
+		typedef size_t		size_type;
+		typedef ptrdiff_t	difference_type;
+
+		template <typename U>
+		struct rebind
+		{
+			typedef ArenaAllocator<U> other;
+		};
+
+		Arena	*arena;
+
+		ArenaAllocator(Arena *a = NULL) : arena(a) {}
+		template <typename U>
+		ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+		pointer allocate(size_type n, const void * = 0)
+		{
+			if (arena)
+				return static_cast<pointer>(arena->allocate(n * sizeof(T)));
+			return static_cast<pointer>(::operator new(n * sizeof(T)));
+		}
+		void deallocate(pointer p, size_type)
+		{
+			if (!arena)
+				::operator delete(p);
+		}
+		void construct(pointer p, const T &value) { new (static_cast<void *>(p)) T(value); }
+		void destroy(pointer p) { p->~T(); }
+		pointer address(reference r) const { return &r; }
+		const_pointer address(const_reference r) const { return &r; }
+		size_type max_size() const { return static_cast<size_type>(-1) / sizeof(T); }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
+
+// Non-owning view of bytes in a command line or an arena
+class StringRef
+{
+	private:
+		const char	*_data;
+		size_t		_size;
+
+	public:
+		StringRef();
+		StringRef(const char *data, size_t size);
+		StringRef(const std::string &value);
+
+		const char	*data() const;
+		size_t		size() const;
+		bool		empty() const;
+		char		operator[](size_t i) const;
+		bool		operator==(const StringRef &other) const;
+		bool		operator==(const char *literal) const;
+		std::string	str() const;
+
+		// Like `iss >> word`: skips spaces, returns the next word and consumes it
+		StringRef	word();
+		// Like getline(ss, out, sep): the text up to sep, consumed along with sep
+		StringRef	split(char sep);
+		StringRef	trimLeft(char c) const;
+};
+
+// Append-only text in an arena, for building reply lines without std::string
+class ArenaString
+{
+	private:
+		Arena	&_arena;
+		char	*_data;
+		size_t	_size;
+		size_t	_capacity;
+
+		void	reserve(size_t needed);
+
+	public:
+		explicit ArenaString(Arena &arena, size_t capacity = 256);
+
+		ArenaString	&append(const char *data, size_t len);
+		ArenaString	&operator<<(const char *text);
+		ArenaString	&operator<<(const std::string &text);
+		ArenaString	&operator<<(const StringRef &text);
+		ArenaString	&operator<<(char c);
+		ArenaString	&operator<<(int value);
+		ArenaString	&operator<<(long value);
+		ArenaString	&operator<<(unsigned long value);
+
+		const char	*data() const;
+		size_t		size() const;
+		void		clear();
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef BOT_HPP
+#define BOT_HPP
+
+#include <map>
+#include <vector>
+#include <string>
+#include "Service.hpp"
+
+// Sample service (IRC_BOT=1). It joins IRC_BOT_CHANNELS and the channels it
+// is invited to, answers !ping, !time, !roll [sides], !seen <nick> and !help
+// in channels and in private, and remembers when it last saw each nick.
+class Bot : public Service
+{
+	public:
+		static const size_t SEEN_MAX = 4096;
+
+	private:
+		std::string					_nick;
+		std::vector<std::string>	_channels;
+		std::map<std::string, std::pair<long, std::string> > _seen; // <nick, <time, what> >
+		unsigned long				_rng;
+
+		void	saw(StringRef nick, const std::string &what);
+		void	answer(const std::string &replyTo, StringRef text);
+
+	public:
+		Bot(const std::string &nick, const std::string &channels);
+
+		std::string	nick() const;
+		std::string	realname() const;
+		void		start();
+		void		onEvent(const ServiceEvent &event);
+};
+
+#endif
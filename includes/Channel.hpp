@@ -4,6 +4,9 @@
 #include <string>
 #include <vector>
 #include <map>
+#include "ChannelHistory.hpp"
+#include "ReplyBlock.hpp"
+#include "MaskIndex.hpp"
 
 struct Member
 {
@@ -23,11 +26,26 @@ class Channel
 		bool _topicProtect;
         std::vector<struct Member> _members; // member file descriptors
 		std::vector<int> _whiteList;
+		long _createdAt; // channel TS, the older side keeps its operators on netjoin
+		ChannelHistory _history; // recent PRIVMSG/JOIN/KICK lines for CHATHISTORY
+		MaskIndex _bans;		// +b
+		MaskIndex _excepts;		// +e, overrides +b
+		MaskIndex _invexes;		// +I, may join while +i
+		// Serialized NAMES/WHO/LIST replies, dropped on membership, nick or topic change
+		ReplyBlock *_namesCache;
+		ReplyBlock *_whoCache;
+		std::string _listCache;
 
+		void invalidateReplies();
 
     public:
         Channel();
         Channel(const std::string &name);
+        Channel(const Channel &other);
+        Channel &operator=(const Channel &other);
+        ~Channel();
+		// Back to a new, empty channel; the member list keeps its capacity (ChannelPool)
+		void reset(const std::string &name);
 
         const std::string &getName() const;
         const std::string &getTopic() const;
@@ -37,8 +55,22 @@ class Channel
 		int getUserLimit();
 		int getFdByNick(std::string nick);
 		bool getInviteOnly();
-		std::string getKey();
+		const std::string &getKey() const;
 		bool isInWhiteList(int client_fd);
+		ChannelHistory &getHistory();
+		const ChannelHistory &getHistory() const;
+		// The +b/+e/+I list for a mode letter, NULL for any other letter
+		MaskIndex *getMaskList(char mode);
+		bool hasBans() const; // lets callers skip building the hostmask
+		bool isBanned(int client_fd, unsigned long identity, const std::string &hostmask);
+		bool isInviteExempt(int client_fd, unsigned long identity, const std::string &hostmask);
+		// "= #chan :nick @op ..." bodies for 353, built on demand
+		ReplyBlock *getNamesReply();
+		// 352 bodies are built by the server, which knows the clients
+		ReplyBlock *getWhoReply();
+		void setWhoReply(ReplyBlock *block);
+		// "#chan <users> :<topic>" body for 322
+		const std::string &getListReply();
 		
 
     void addMember(int client_fd, std::string nick, bool op);
@@ -48,12 +80,16 @@ class Channel
 	bool isOperator(int client_fd);
 	void addToWhiteList(int target_fd);
 	void setKey(std::string key);
+	void setTopic(const std::string &topic);
+	long getCreatedAt() const;
+	void setCreatedAt(long ts);
+	void setOperator(int client_fd, bool op);
+	void clearOperators();
 	// Remove a member from this channel by fd, without permission checks (used on disconnect)
 	void removeMemberByFd(int target_fd);
 	// Update a member's nickname in the channel
 	void updateMemberNick(int client_fd, const std::string &newNick);
 
-    void broadcast(const std::string &message, int sender_fd = -1);
 };
 
 #endif
\ No newline at end of file
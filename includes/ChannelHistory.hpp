@@ -0,0 +1,62 @@
+#ifndef CHANNELHISTORY_HPP
+#define CHANNELHISTORY_HPP
+
+#include <string>
+#include <vector>
+
+struct HistoryEntry
+{
+	long	when;	// ms since epoch
+	size_t	offset;	// start of the line inside the arena
+	size_t	length;
+};
+
+// Bounded history of recent channel events. Lines are packed back to back in
+// a single byte arena used as a ring, with a fixed-size ring of entries
+// indexing them, so a stored message costs its bytes plus one HistoryEntry.
+class ChannelHistory
+{
+	private:
+		std::vector<char>			_arena;
+		std::vector<HistoryEntry>	_index;	// ring, _head is the oldest entry
+		size_t						_head;
+		size_t						_count;
+		size_t						_writePos;
+		size_t						_liveBytes;
+		size_t						_accounted;	// what this ring has charged to s_globalBytes
+
+		static size_t	s_maxEntries;
+		static size_t	s_channelBytes;
+		static size_t	s_globalCap;
+		static size_t	s_globalBytes;
+
+		void	account();
+		void	evictOldest();
+		bool	grow(size_t needed);
+		const HistoryEntry &entryAt(size_t i) const; // i = 0 is the oldest
+
+	public:
+		ChannelHistory();
+		ChannelHistory(const ChannelHistory &other);
+		ChannelHistory &operator=(const ChannelHistory &other);
+		~ChannelHistory();
+
+		static void		configure(size_t maxEntries, size_t channelBytes, size_t globalCap);
+		static size_t	globalUsage();
+		static size_t	globalCap();
+
+		void	append(long when, const std::string &line);
+		void	append(long when, const char *line, size_t len);
+		// Last `limit` lines, oldest first
+		void	latest(size_t limit, std::vector<std::string> &out) const;
+		// Up to `limit` lines strictly newer than `when`, oldest first
+		void	after(long when, size_t limit, std::vector<std::string> &out) const;
+		void	clear();
+
+		size_t	size() const;
+		size_t	memoryUsage() const;
+
+		static long	nowMillis();
+};
+
+#endif
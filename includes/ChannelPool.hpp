@@ -0,0 +1,40 @@
+#ifndef CHANNELPOOL_HPP
+#define CHANNELPOOL_HPP
+
+#include <string>
+#include <vector>
+#include "Channel.hpp"
+
+// Channel objects for the server's channel table. A channel whose last member
+// leaves comes back here, reset, and the next new channel reuses it with the
+// member list capacity it already had, so throwaway channels cost no
+// allocations once the pool is warm. At most `max` spare objects are kept.
+class ChannelPool
+{
+	private:
+		std::vector<Channel *>	_free;
+		size_t					_max;
+		size_t					_live;
+		unsigned long			_created;	// channels handed out
+		unsigned long			_reused;	// of those, taken from _free
+		unsigned long			_reclaimed;	// channels given back
+
+		ChannelPool(const ChannelPool &);
+		ChannelPool &operator=(const ChannelPool &);
+
+	public:
+		ChannelPool();
+		~ChannelPool();
+
+		void		setMax(size_t max);
+		Channel		*acquire(const std::string &name);
+		void		release(Channel *channel);
+
+		size_t			live() const;
+		size_t			spare() const;
+		unsigned long	created() const;
+		unsigned long	reused() const;
+		unsigned long	reclaimed() const;
+};
+
+#endif
@@ -3,31 +3,66 @@
 
 #include <string>
  #include <stdlib.h>
+#include "CompactString.hpp"
+
+// IRCv3 capabilities a client turned on with CAP REQ (Server/Capabilities.cpp)
+enum Capability
+{
+    CAP_MESSAGE_TAGS = 1,
+    CAP_SERVER_TIME = 2,
+    CAP_ECHO_MESSAGE = 4,
+    CAP_MULTI_PREFIX = 8,
+    CAP_SASL = 16,
+    CAP_RESUME = 32
+};
+// The capabilities that change how a line is written; their combinations index the wire forms
+static const unsigned int CAP_WIRE_MASK = CAP_MESSAGE_TAGS | CAP_SERVER_TIME;
+static const unsigned int WIRE_FORMS = CAP_WIRE_MASK + 1;
 
 struct Client
 {
     private:
+    // Kept small: idle connections are most of the process. Short fields sit inline,
+    // fields clients share are interned and the read buffer only exists while it holds data.
     int fd;
-    bool _authenticated;
-    bool _hasPass;
-    bool _hasNick;
-    bool _hasUser;
-    std::string _username;
-    std::string _nickname;
-    std::string _hostname;
-    std::string _servername;
-    std::string _realname;
-
-    std::string recv_buffer;
-    std::string send_buffer;
+    int _linkFd;            // link the user is reached through, -1 when local
+    unsigned int _identity; // changes with the nick, keys cached ban matches
+    unsigned int _uidSerial; // "<serial>@<server>" network uid, 0 until registered
+    long _nickTs;           // when the nick was taken, the older one wins collisions
+    bool _authenticated : 1;
+    bool _hasPass : 1;
+    bool _hasNick : 1;
+    bool _hasUser : 1;
+    bool _capNegotiating : 1; // CAP LS/REQ before registration holds it until CAP END
+    unsigned int _caps : 6;   // Capability bits
+    CompactString _username;
+    CompactString _nickname;
+    CompactString _realname;
+    const std::string *_hostname;   // interned
+    const std::string *_servername; // interned
+    const std::string *_uidServer;  // interned, server that issued the uid
+    const std::string *_origin;     // interned, server the user is connected to, NULL when local
+    std::string *recv_buffer;       // NULL while empty
 
     public:
     Client(int fd_ = -1);
+    Client(const Client &other);
+    Client &operator=(const Client &other);
     ~Client();
     int getFd() const;
-    const std::string& getUser() const;
-    const std::string& getNick() const;
+    std::string getUser() const;
+    std::string getNick() const;
+    bool isNick(const std::string& nick) const;
+    std::string getRealname() const;
+    const std::string& getHost() const;
+    std::string getHostmask() const;
+    unsigned int getIdentity() const;
     bool isAuthenticated() const;
+    std::string getUid() const;
+    const std::string& getOrigin() const;
+    int getLinkFd() const;
+    bool isRemote() const;
+    long getNickTs() const;
 
     void setUser(const std::string& user);
     void setHostname(const std::string& hostname);
@@ -36,6 +71,15 @@ struct Client
 
     void setNick(const std::string& nick);
     void setAuthenticated(bool auth);
+    void setUid(const std::string& uid);
+    void setRemote(const std::string& origin, int linkFd);
+    void setNickTs(long ts);
+
+    unsigned int getCaps() const;
+    bool hasCap(Capability cap) const;
+    void setCaps(unsigned int caps);
+    bool isNegotiatingCaps() const;
+    void setNegotiatingCaps(bool val);
 
     bool hasPass() const;
     bool hasNick() const;
@@ -43,9 +87,12 @@ struct Client
 
     void setPass(bool val);
     void setHasNick(bool val);
+    void clearNick();
     void setHasUser(bool val);
 
     std::string& getBuffer();
+    bool hasBufferedInput() const;
+    void releaseBuffer();
 };
 
 #endif
\ No newline at end of file
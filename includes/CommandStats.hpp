@@ -0,0 +1,72 @@
+#ifndef COMMANDSTATS_HPP
+#define COMMANDSTATS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+// HDR-style latency histogram in microseconds: log2 buckets split into
+// 8 linear sub-buckets, so every value is kept with ~12% relative error.
+class LatencyHistogram
+{
+	public:
+		static const int SUB_BITS = 3;
+		static const int SUB_COUNT = 1 << SUB_BITS;
+		static const int BUCKETS = 64 * SUB_COUNT;
+
+	private:
+		unsigned long _counts[BUCKETS];
+		unsigned long _total;
+		unsigned long _sum;
+		unsigned long _max;
+
+		static int bucketFor(unsigned long value);
+		static unsigned long bucketHigh(int bucket);
+
+	public:
+		LatencyHistogram();
+
+		void record(unsigned long value);
+		unsigned long percentile(double p) const;
+		unsigned long count() const;
+		unsigned long mean() const;
+		unsigned long max() const;
+};
+
+// Heap traffic of every command of one verb, while allocation counting is on
+struct AllocCount
+{
+	unsigned long commands;
+	unsigned long allocations;
+	unsigned long bytes;
+};
+
+// Per-verb dispatch latency, plus the slow-command log
+class CommandStats
+{
+	public:
+		// Garbage verbs past this many distinct entries are folded into "OTHER"
+		static const size_t MAX_VERBS = 64;
+
+	private:
+		std::map<std::string, LatencyHistogram> _byVerb;
+		std::map<std::string, AllocCount> _allocByVerb;
+		unsigned long _slowUs;
+
+	public:
+		CommandStats();
+
+		static unsigned long nowMicros();
+
+		void setSlowThreshold(unsigned long us);
+		unsigned long getSlowThreshold() const;
+		// Returns true if the command crossed the slow threshold
+		bool record(const std::string &verb, unsigned long us);
+		// One line per verb: "<verb> <count> <mean> <p50> <p90> <p99> <max>"
+		std::vector<std::string> report() const;
+		void recordAllocations(const std::string &verb, unsigned long allocations, unsigned long bytes);
+		// One line per verb: "<verb> <count> <allocs> <bytes> <allocs/cmd> <bytes/cmd>"
+		std::vector<std::string> allocationReport() const;
+};
+
+#endif
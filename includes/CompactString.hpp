@@ -0,0 +1,38 @@
+#ifndef COMPACTSTRING_HPP
+#define COMPACTSTRING_HPP
+
+#include <string>
+
+// 16-byte string for short per-client fields (nick, user, realname). Up to
+// INLINE_CAPACITY chars live in the object itself, longer values go to the heap.
+class CompactString
+{
+	public:
+		static const size_t INLINE_CAPACITY = 14;
+
+	private:
+		// inline: chars in [0, 14), length in [14], tag 0 in [15]
+		// heap:   char * in [0, 8), length in [8, 12), tag 1 in [15]
+		char	_bytes[16];
+
+		bool		isHeap() const;
+		char		*heapPtr() const;
+		void		assign(const char *data, size_t len);
+		void		clear();
+
+	public:
+		CompactString();
+		CompactString(const std::string &value);
+		CompactString(const CompactString &other);
+		CompactString &operator=(const CompactString &other);
+		CompactString &operator=(const std::string &value);
+		~CompactString();
+
+		const char	*data() const;
+		size_t		size() const;
+		bool		empty() const;
+		std::string	str() const;
+		bool		equals(const std::string &value) const;
+};
+
+#endif
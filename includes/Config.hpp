@@ -0,0 +1,10 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+
+// Runtime tunables are read from the environment (IRC_*), falling back to the default
+long		configLong(const char *name, long def);
+std::string	configStr(const char *name, const std::string &def);
+
+#endif
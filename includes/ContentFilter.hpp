@@ -0,0 +1,68 @@
+#ifndef CONTENTFILTER_HPP
+#define CONTENTFILTER_HPP
+
+#include <string>
+#include <vector>
+
+// What a matching rule does; a message that matches several rules gets the
+// strongest of them
+enum FilterAction
+{
+	FILTER_PASS = 0,
+	FILTER_NOTIFY,	// delivered, the staff channel's operators are told
+	FILTER_DROP,	// not delivered, the sender is not told
+	FILTER_KILL		// not delivered, the sender is disconnected
+};
+
+// One line of the filter file: "<notify|drop|kill> <phrase>"
+struct FilterRule
+{
+	FilterAction action;
+	std::string pattern;	// as written, for the notices
+	int line;
+};
+
+// Every phrase of the filter file compiled into one Aho-Corasick automaton,
+// so a message is scanned once, byte by byte, whatever the number of rules.
+// Matching ignores ASCII case. The trie is stored flat: the edges of a state
+// are a sorted run of one array, and the root, where most bytes of ordinary
+// text land, has a full 256-entry table. Each state carries the strongest
+// action of every phrase ending there or along its failure links, so a scan
+// needs no output lists and stops at the first kill.
+class ContentFilter
+{
+	private:
+		std::vector<FilterRule>		_rules;
+		std::vector<unsigned int>	_edgeStart;	// edges of s are [_edgeStart[s], _edgeStart[s + 1])
+		std::vector<unsigned char>	_edgeByte;
+		std::vector<unsigned int>	_edgeTarget;
+		std::vector<unsigned int>	_fail;
+		std::vector<unsigned char>	_action;	// FilterAction
+		std::vector<int>			_rule;		// rule behind _action, -1 for none
+		std::vector<unsigned int>	_root;		// 256 transitions out of the root
+
+		unsigned int	step(unsigned int state, unsigned char c) const;
+
+	public:
+		ContentFilter();
+
+		// Reads and compiles a rule file; blank lines and # comments are skipped
+		bool	load(const std::string &path, std::string &error);
+		// Rules added by hand are matched once compile() has run
+		void	add(FilterAction action, const std::string &pattern, int line);
+		void	compile();
+		void	clear();
+		void	swap(ContentFilter &other);
+
+		bool	empty() const;
+		size_t	size() const;
+		size_t	states() const;
+		size_t	bytes() const;
+
+		// Strongest action among the rules found in text; rule is set to it
+		FilterAction	scan(const char *text, size_t len, const FilterRule *&rule) const;
+
+		static const char	*actionName(FilterAction action);
+};
+
+#endif
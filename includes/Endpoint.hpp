@@ -0,0 +1,33 @@
+#ifndef ENDPOINT_HPP
+#define ENDPOINT_HPP
+
+#include <string>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// Address a listener binds to or a link dials, as written in IRC_LISTEN and
+// IRC_LINKS:
+//   6667              every local address, IPv6 and IPv4 on one dual-stack socket
+//   1.2.3.4:6667      IPv4 ("localhost:6667" is 127.0.0.1)
+//   [::1]:6667        IPv6 only, so [::]:6667 and 0.0.0.0:6667 can be bound side by side
+//   unix:/some/path   UNIX-domain stream socket
+// Hosts are numeric: nothing is resolved while the configuration is read.
+struct Endpoint
+{
+	int family;				// AF_INET, AF_INET6 or AF_UNIX
+	bool dualStack;			// wildcard IPv6 socket that takes IPv4 clients too
+	int port;				// 0 for AF_UNIX
+	struct sockaddr_storage addr;
+	socklen_t len;
+	std::string text;		// as written, for logs and STATS P
+
+	Endpoint();
+
+	static bool			parse(const std::string &spec, Endpoint &endpoint);
+	static bool			numeric(const std::string &host, int port, Endpoint &endpoint);
+	// Numeric host of a peer; IPv4 clients of a dual-stack socket come out as IPv4
+	static std::string	host(const struct sockaddr_storage &peer, int &port);
+	std::string			path() const;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef FANOUT_HPP
+#define FANOUT_HPP
+
+#include <vector>
+#include "Channel.hpp"
+#include "Arena.hpp"
+
+// Collects the recipients of one message across several channels and users
+// and hands back each fd exactly once, so a peer sharing many channels with
+// the source still gets a single copy. Given an arena, its lists live there.
+class FanOut
+{
+	public:
+		typedef std::vector<int, ArenaAllocator<int> > FdList;
+
+	private:
+		FdList				_fds;
+		FdList				_excluded;
+		size_t				_sources;
+		bool				_resolved;
+
+	public:
+		explicit FanOut(Arena *arena = NULL);
+
+		void	addChannel(const Channel &channel);
+		void	addFd(int fd);
+		void	exclude(int fd);
+		void	exclude(const FdList &fds);
+
+		// Deduplicated recipients minus the excluded fds
+		const FdList	&recipients();
+};
+
+#endif
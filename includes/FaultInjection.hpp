@@ -0,0 +1,41 @@
+#ifndef FAULTINJECTION_HPP
+#define FAULTINJECTION_HPP
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// Socket faults for the test build (make faults, -DIRC_FAULT_INJECTION):
+// reads cut short down to one byte, short writes, EAGAIN and ECONNRESET, each
+// at a rate read from the IRC_FAULT_* variables. Other builds call the
+// system directly through sockRecv/sockSend.
+class FaultInjection
+{
+	public:
+		enum Kind { RECV_SPLIT, RECV_EAGAIN, SEND_SHORT, SEND_EAGAIN, CONN_RESET, KINDS };
+
+		static void				configure();
+		static ssize_t			recv(int fd, void *buf, size_t len, int flags);
+		static ssize_t			send(int fd, const void *buf, size_t len, int flags);
+		static unsigned long	injected(Kind kind);
+		static const char		*name(Kind kind);
+};
+
+inline ssize_t sockRecv(int fd, void *buf, size_t len, int flags)
+{
+#ifdef IRC_FAULT_INJECTION
+	return FaultInjection::recv(fd, buf, len, flags);
+#else
+	return ::recv(fd, buf, len, flags);
+#endif
+}
+
+inline ssize_t sockSend(int fd, const void *buf, size_t len, int flags)
+{
+#ifdef IRC_FAULT_INJECTION
+	return FaultInjection::send(fd, buf, len, flags);
+#else
+	return ::send(fd, buf, len, flags);
+#endif
+}
+
+#endif
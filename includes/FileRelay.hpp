@@ -0,0 +1,50 @@
+#ifndef FILERELAY_HPP
+#define FILERELAY_HPP
+
+#include <cstddef>
+
+// Moves a file of known size from one socket to another through a pipe with
+// splice(2): the bytes never enter userspace. Both sockets are non-blocking
+// and the caller polls them for what events() asks. A rate above 0 caps the
+// transfer with a token bucket; pump() returns THROTTLED when it runs dry and
+// resumeAt() says when there is allowance again.
+class FileRelay
+{
+	public:
+		enum State { READING, WRITING, THROTTLED, DONE, FAILED };
+		static const size_t CHUNK = 65536; // a default pipe holds 64 KiB
+
+	private:
+		int				_from;
+		int				_to;
+		int				_pipe[2];
+		unsigned long	_size;		// bytes the sender announced
+		unsigned long	_received;	// taken from the sender into the pipe
+		unsigned long	_sent;		// handed to the receiver
+		unsigned long	_rate;		// bytes per second, 0 for no cap
+		unsigned long	_allowance;
+		unsigned long	_refilledAt;	// us
+		State			_state;
+		const char		*_error;
+
+		void	refill(unsigned long nowUs);
+		State	fail(const char *error);
+
+	public:
+		FileRelay();
+
+		bool			start(int from, int to, unsigned long size, unsigned long rate, unsigned long nowUs);
+		void			stop();	// closes the pipe, the sockets stay the caller's
+		// Moves at most maxBytes, so one transfer cannot hold the loop
+		State			pump(unsigned long nowUs, size_t maxBytes);
+		State			state() const;
+		short			events(int fd) const;
+		unsigned long	resumeAt() const;
+		bool			allReceived() const;
+		unsigned long	sent() const;
+		int				from() const;
+		int				to() const;
+		const char		*error() const;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef LINEFRAMER_HPP
+#define LINEFRAMER_HPP
+
+#include <cstddef>
+#include <vector>
+#include "Arena.hpp"
+
+// Character classes of the protocol, one table lookup per byte
+class IrcChars
+{
+	public:
+		enum Class
+		{
+			NICK_FIRST = 1,	// letter or one of []\`_^{|}-
+			NICK = 2,		// NICK_FIRST or a digit
+			CHANNEL = 4,	// any byte above space but ',' and ':' (controls are left out)
+			TERMINATOR = 8,	// CR or LF
+			FORMAT = 16		// control codes clients use for colours and styles, and TAB
+		};
+
+		static const unsigned char	table[256];
+
+		static bool	is(char c, Class cls)
+		{
+			return table[static_cast<unsigned char>(c)] & cls;
+		}
+		static bool	isNick(StringRef nick);
+		static bool	isChannel(StringRef name);	// '#' and at least one channel character
+};
+
+// Splits a receive chunk into lines in one pass. CR, LF and CRLF all end a
+// line and empty lines are skipped. Every byte below 0x20 is found 16 at a
+// time with SSE2 (one compare per block), and only those bytes are looked
+// up: plain text moves at vector speed. A line holding NUL or any other
+// control byte that is not a formatting code is reported as not clean.
+class LineFramer
+{
+	public:
+		struct Line
+		{
+			size_t	start;
+			size_t	len;	// without the terminator
+			bool	clean;
+		};
+		typedef std::vector<Line, ArenaAllocator<Line> > Lines;
+
+		// Appends the complete lines of data to lines and returns how many
+		// bytes they used; what is left is a partial line
+		static size_t	scan(const char *data, size_t len, Lines &lines);
+		// Same result without SSE2, one table lookup per byte
+		static size_t	scanScalar(const char *data, size_t len, Lines &lines);
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef LOADSHEDDER_HPP
+#define LOADSHEDDER_HPP
+
+#include <cstddef>
+
+// Overload stages of the event loop. The loop reports how long each iteration
+// kept it busy and how much work was queued at the end of it. Every window
+// the longest iteration (the worst wait an event could have had) is folded
+// into a smoothed lag. The stage climbs as soon as lag or queue depth crosses
+// its threshold. Thresholds double from one stage to the next. The stage
+// steps back down one level at a time, each step after the signals have
+// stayed under half the threshold for the hold time.
+class LoadShedder
+{
+	public:
+		enum Stage
+		{
+			NORMAL,
+			DEFER_ACCEPTS,				// listeners are not polled, connections wait in the backlog
+			REJECT_CONNECTIONS,			// connections are accepted and closed with an ERROR
+			DEPRIORITIZE_UNREGISTERED,	// unregistered clients are read last, a few per iteration
+			REFUSE_EXPENSIVE,			// LIST, WHO, NAMES, CHATHISTORY and FILE SEND get 263
+			STAGES
+		};
+
+	private:
+		unsigned long	_lagUs;			// stage 1 threshold, 0 turns shedding off
+		size_t			_queued;		// stage 1 threshold, 0 ignores queue depth
+		unsigned long	_windowUs;
+		unsigned long	_holdUs;
+		unsigned long	_windowEnd;
+		unsigned long	_windowMax;		// longest iteration of the current window
+		size_t			_windowQueued;	// deepest queue of the current window
+		unsigned long	_lag;			// smoothed, us
+		size_t			_depth;			// queue depth of the last window
+		unsigned long	_calmSince;		// 0 while the signals are above the step-down mark
+		Stage			_stage;
+		unsigned long	_entered[STAGES];
+		unsigned long	_actions[STAGES];
+
+		Stage	target(unsigned long scale) const;
+		bool	closeWindow(unsigned long nowUs);
+
+	public:
+		LoadShedder();
+
+		void			configure(unsigned long lagUs, size_t queued, unsigned long windowUs, unsigned long holdUs);
+		bool			enabled() const;
+		// Returns true when the stage changed
+		bool			sample(unsigned long busyUs, size_t queued, unsigned long nowUs);
+		Stage			stage() const;
+		unsigned long	lag() const;
+		size_t			depth() const;
+		unsigned long	window() const;
+		void			note(Stage stage);	// one connection, read or command shed at this stage
+		unsigned long	entered(Stage stage) const;
+		unsigned long	actions(Stage stage) const;
+		static const char	*name(Stage stage);
+};
+
+#endif
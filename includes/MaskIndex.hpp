@@ -0,0 +1,84 @@
+#ifndef MASKINDEX_HPP
+#define MASKINDEX_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+// One nick!user@host wildcard mask, split around its wildcards when added so
+// matching only has to run the glob on the part between prefix and suffix
+struct MaskEntry
+{
+	std::string	mask;		// normalized, as shown in the lists
+	std::string	pattern;	// casefolded mask
+	std::string	prefix;		// literal text before the first wildcard
+	std::string	suffix;		// literal text after the last wildcard
+	bool		literal;	// no wildcards at all
+	char		bucket;		// 'p'refix, 's'uffix, 't'rigram or 'g'eneric
+	unsigned	trigram;	// three literal chars the subject must contain, for 't'
+	std::string	setBy;
+	long		setAt;
+};
+
+// Mask list (+b, +e, +I) indexed for fast "does any mask match" queries.
+// Literal masks are found by key, wildcard masks are bucketed by their literal
+// prefix; masks starting with a wildcard go to whichever is more selective of
+// their literal suffix or a trigram taken from their literal parts. Only masks
+// with no literal text left are scanned one by one. Results are cached per
+// client until its identity (nick or host) or the list changes.
+class MaskIndex
+{
+	private:
+		struct CacheEntry
+		{
+			unsigned long	identity;
+			unsigned long	generation;
+			bool			result;
+		};
+
+		typedef std::map<std::string, std::vector<const MaskEntry *> > Buckets;
+		typedef std::map<unsigned, std::vector<const MaskEntry *> > TrigramBuckets;
+
+		std::map<std::string, MaskEntry>	_entries;	// <pattern, entry>
+		Buckets								_byPrefix;
+		Buckets								_bySuffix;	// keyed by the reversed suffix
+		TrigramBuckets						_byTrigram;
+		std::vector<const MaskEntry *>		_generic;
+		size_t								_maxPrefix;
+		size_t								_maxSuffix;
+		unsigned long						_generation;
+		std::map<int, CacheEntry>			_cache;
+
+		void		index(MaskEntry *entry);
+		static unsigned	trigramAt(const std::string &s, size_t pos);
+		static bool	globRange(const std::string &pattern, size_t p, size_t pEnd,
+							const std::string &subject, size_t s, size_t sEnd);
+		static void	unlink(std::vector<const MaskEntry *> &list, const MaskEntry *entry);
+		static bool	matchEntry(const MaskEntry &entry, const std::string &subject);
+
+	public:
+		MaskIndex();
+		// buckets point into _entries, so copies re-index their own entries
+		MaskIndex(const MaskIndex &other);
+		MaskIndex &operator=(const MaskIndex &other);
+
+		// "nick" -> "nick!*@*", "user@host" -> "*!user@host", ...
+		static std::string	normalize(const std::string &mask);
+		// rfc1459 case mapping: A-Z[]\~ fold to a-z{}|^
+		static std::string	casefold(const std::string &s);
+		// Plain '*'/'?' glob over casefolded strings
+		static bool			globMatch(const std::string &pattern, const std::string &subject);
+
+		bool	add(const std::string &mask, const std::string &setBy, long setAt);
+		bool	remove(const std::string &mask);
+		bool	contains(const std::string &mask) const;
+		size_t	size() const;
+		const std::map<std::string, MaskEntry> &entries() const;
+
+		// hostmask is nick!user@host, matched case-insensitively
+		bool	matches(const std::string &hostmask) const;
+		bool	matches(int fd, unsigned long identity, const std::string &hostmask);
+		void	forget(int fd);
+};
+
+#endif
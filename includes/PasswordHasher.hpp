@@ -0,0 +1,73 @@
+#ifndef PASSWORDHASHER_HPP
+#define PASSWORDHASHER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <pthread.h>
+
+// Finished hash, handed back to the event loop
+struct HashResult
+{
+	unsigned long id;
+	int fd;
+	unsigned char digest[32];
+};
+
+// PBKDF2-HMAC-SHA256 on a small pool of threads. A hash that is meant to be
+// slow would stall every client if the loop ran it, so requests are queued to
+// the workers and finished ones are announced through a pipe the loop polls,
+// as the Resolver does. The queue is bounded: submit() refuses work past it
+// instead of letting a login storm pile up CPU time.
+class PasswordHasher
+{
+	public:
+		static const size_t DIGEST = 32;
+		static const size_t SALT = 16;
+
+	private:
+		struct Request
+		{
+			unsigned long id;
+			int fd;
+			std::string password;
+			unsigned char salt[SALT];
+			unsigned long iterations;
+		};
+
+		pthread_mutex_t _lock;
+		pthread_cond_t _wake;
+		std::vector<pthread_t> _threads;
+		std::deque<Request> _queue;
+		std::vector<HashResult> _done;
+		int _pipe[2];
+		bool _stopping;
+		unsigned long _nextId;
+		size_t _maxQueued;
+
+		PasswordHasher(const PasswordHasher &);
+		PasswordHasher &operator=(const PasswordHasher &);
+
+		static void	*worker(void *self);
+		void		work();
+
+	public:
+		PasswordHasher();
+		~PasswordHasher();
+
+		void			start(size_t threads, size_t maxQueued);
+		void			stop();
+		int				notifyFd() const;
+		// 0 when the queue is full or the workers are not running
+		unsigned long	submit(int fd, const std::string &password, const unsigned char *salt, unsigned long iterations);
+		std::vector<HashResult> collect();
+
+		static void	sha256(const unsigned char *data, size_t len, unsigned char digest[DIGEST]);
+		static void	pbkdf2(const std::string &password, const unsigned char *salt, size_t saltLen,
+						   unsigned long iterations, unsigned char digest[DIGEST]);
+		// Compares every byte whatever the first difference, so timing says nothing
+		static bool	equal(const unsigned char *a, const unsigned char *b, size_t len);
+		static bool	randomSalt(unsigned char salt[SALT]);
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef REPLYBLOCK_HPP
+#define REPLYBLOCK_HPP
+
+#include <string>
+#include <vector>
+
+// Serialized reply lines shared by a channel's cache and the reply jobs still
+// streaming them; freed when the last holder releases it.
+class ReplyBlock
+{
+	private:
+		size_t	_refs;
+
+		ReplyBlock();
+		ReplyBlock(const ReplyBlock &);
+		ReplyBlock &operator=(const ReplyBlock &);
+
+	public:
+		std::vector<std::string> lines;
+
+		static ReplyBlock *create();
+		ReplyBlock	*retain();
+		void		release();
+};
+
+#endif
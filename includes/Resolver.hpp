@@ -0,0 +1,78 @@
+#ifndef RESOLVER_HPP
+#define RESOLVER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <ctime>
+#include <pthread.h>
+
+// Finished lookup, handed back to the event loop
+struct ResolverResult
+{
+	unsigned long id;
+	int fd;
+	std::string host;	// forward-confirmed hostname, empty when there is none
+	std::string ident;	// RFC 1413 user id, empty when disabled or unanswered
+};
+
+// Reverse DNS (and optionally ident) on a small pool of threads so blocking
+// resolver calls never stall the poll loop. Finished lookups are queued and
+// announced through a pipe the loop polls. Hostnames are cached for ttl seconds;
+// entries of the hosts file (/etc/hosts format) answer without asking DNS.
+class Resolver
+{
+	private:
+		struct Request
+		{
+			unsigned long id;
+			int fd;
+			std::string ip;
+			int remotePort;
+			int localPort;
+		};
+		struct CacheEntry
+		{
+			std::string host;
+			time_t expires;
+		};
+
+		static const size_t MAX_CACHE = 10000;
+
+		pthread_mutex_t _lock;
+		pthread_cond_t _wake;
+		std::vector<pthread_t> _threads;
+		std::deque<Request> _queue;
+		std::vector<ResolverResult> _done;
+		std::map<std::string, CacheEntry> _cache;	// <ip, hostname>
+		std::map<std::string, std::string> _hosts;	// static entries, never expire
+		int _pipe[2];
+		bool _stopping;
+		unsigned long _nextId;
+		long _ttl;
+		bool _ident;
+		int _identTimeoutMs;
+
+		Resolver(const Resolver &);
+		Resolver &operator=(const Resolver &);
+
+		static void	*worker(void *self);
+		void		work();
+		std::string	lookupHost(const std::string &ip);
+		std::string	lookupIdent(const std::string &ip, int remotePort, int localPort);
+		void		loadHosts(const std::string &path);
+
+	public:
+		Resolver();
+		~Resolver();
+
+		void			start(size_t threads, long ttl, bool ident, int identTimeoutMs, const std::string &hostsFile);
+		void			stop();
+		int				notifyFd() const;
+		bool			cached(const std::string &ip, std::string &host);
+		unsigned long	submit(int fd, const std::string &ip, int remotePort, int localPort);
+		std::vector<ResolverResult> collect();
+};
+
+#endif
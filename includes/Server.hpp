@@ -15,20 +15,279 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <deque>
+#include <ctime>
+#include <netinet/in.h>
 #include "Client.hpp"
 #include <stdlib.h>
 #include "Channel.hpp"
+#include "CommandStats.hpp"
+#include "FanOut.hpp"
+#include "Arena.hpp"
+#include "WebSocket.hpp"
+#include "Resolver.hpp"
+#include "FileRelay.hpp"
+#include "Service.hpp"
+#include "LoadShedder.hpp"
+#include "LineFramer.hpp"
+#include "AccountStore.hpp"
+#include "PasswordHasher.hpp"
+#include "Endpoint.hpp"
+#include "ContentFilter.hpp"
+#include "ChannelPool.hpp"
+
+// A long reply (NAMES/WHO of a big channel, LIST) streamed a few lines per loop iteration
+struct ReplyJob
+{
+	std::string prefix;		// ":server <numeric> <nick> " put in front of every line
+	ReplyBlock *block;		// cached lines to stream, NULL for LIST
+	size_t next;
+	bool list;				// LIST walks _channels after `cursor` instead of a block
+	std::string cursor;
+	std::string trailer;	// end-of-list numeric, sent once the lines run out
+};
+
+// Connection to another server of the network
+struct Link
+{
+	std::string name;		// peer server, empty until its SERVER line arrives
+	std::string buffer;		// partial line from the peer
+	std::vector<std::string> servers; // every server reached through this link
+	bool outbound;			// we dialed it, so our SERVER line is already sent
+	bool connecting;		// outbound connect() still in progress
+};
+
+// Server from IRC_LINKS we keep a link to, redialed after a netsplit
+struct LinkTarget
+{
+	Endpoint endpoint;
+	int fd;					// -1 while disconnected
+	time_t nextAttempt;
+};
+
+// Message to a large fan-out, delivered a slice of recipients per loop iteration
+struct FanOutJob
+{
+	unsigned long seq;			// jobs are numbered in creation order
+	std::string tags;			// client-only tags of the message, for message-tags recipients
+	long timeMs;				// server-time of the message
+	std::vector<int> recipients;
+	size_t cursor;				// next recipient
+	std::string forms[WIRE_FORMS];	// [0] is the plain line, tagged forms are rendered when first needed
+	std::string framed[WIRE_FORMS];	// a form as WebSocket frames, once a WebSocket recipient needs it
+};
+
+// A message on its way to one or many clients. WebSocket clients get it as
+// frames, built the first time one of them is reached and reused after that.
+struct WireMessage
+{
+	const char *data;
+	size_t len;
+	const char *framed;		// NULL until needed, lives in the arena
+	size_t framedLen;
+};
+
+// Hostname/ident lookup of a new connection; registration waits until it is done
+struct PendingLookup
+{
+	unsigned long id;
+	std::string ip;
+	unsigned long deadline;	// us, CommandStats::nowMicros() clock
+	bool done;
+	std::string ident;		// applied as the username when registration completes
+};
+
+// File offered with FILE SEND. Once accepted, both ends connect to
+// IRC_FILE_PORT, present their token and the server splices one socket into
+// the other (FileTransfers.cpp)
+struct Transfer
+{
+	int fromFd;				// IRC clients, -1 once they leave
+	int toFd;
+	std::string name;
+	unsigned long size;
+	std::string sendToken;	// first line of the sender's data connection
+	std::string recvToken;	// first line of the receiver's
+	bool accepted;
+	int sendData;			// data connections, -1 until they present their token
+	int recvData;
+	bool relaying;
+	FileRelay relay;
+	unsigned long deadline;	// us; an offer or a missing data connection expires
+	unsigned long resumeAt;	// us, while the relay is THROTTLED
+};
+
+// SASL exchange of a connection that sent AUTHENTICATE PLAIN (Accounts.cpp)
+struct SaslSession
+{
+	std::string payload;	// base64 chunks so far
+	unsigned long job;		// hash being checked, 0 while the payload is still coming
+};
+
+// Password hash running on the hasher threads, and what it is for
+struct PendingHash
+{
+	int fd;
+	bool registering;		// REGISTER stores the digest, a login compares it
+	std::string account;
+	unsigned char salt[PasswordHasher::SALT];
+	unsigned int iterations;
+	unsigned char expected[PasswordHasher::DIGEST];	// the stored digest, for a login
+};
+
+// Socket clients connect to: the port argument, IRC_LISTEN and IRC_WS_PORT (Listeners.cpp)
+struct Listener
+{
+	Endpoint endpoint;
+	bool webSocket;			// clients speak WebSocket (IRC_WS_PORT)
+	bool serverLinks;		// peer servers only, each opens with SERVER (IRC_LINK_LISTEN)
+	size_t acceptBudget;	// connections accepted per poll wakeup
+	unsigned long accepted;
+};
+
+// Resume token of a client with draft/resume-0.5 (Resume.cpp). While detached
+// the fd number is held by a /dev/null placeholder, so the memberships and
+// everything else keyed by fd stay as they are; output waits in the send queue.
+struct Session
+{
+	std::string token;
+	bool detached;			// the connection dropped and the grace period runs
+	unsigned long deadline;	// us, while detached
+};
+
+// Filter file compiled on its own thread after a SIGHUP (Filter.cpp). The loop
+// leaves it alone while running is set and takes the result when the thread
+// writes to the pipe.
+struct FilterReload
+{
+	std::string path;
+	ContentFilter filter;
+	std::string error;	// empty when filter is good
+	bool running;
+	bool again;			// another SIGHUP came while compiling
+	pthread_t thread;
+	int pipe[2];
+};
+
+// Data connection on IRC_FILE_PORT that has not finished its token line yet
+struct DataHandshake
+{
+	unsigned long deadline;	// us
+	std::string line;		// token bytes read so far, no newline among them
+};
 
 class Server
 {
+    friend class ServerProbe; // bench/core_ops.cpp runs handlers without the event loop
+
 private:
-    int _listen_fd;
+    std::map<int, Listener> _listeners; // <fd, Listener>
     std::string _password;
-    std::vector<int> _ports;
     std::vector<struct pollfd> _pfds;
     std::map<int, Client> _clients;  // <fd, Client>
-    std::map<std::string, Channel> _channels; // <channel_name, Channel>
+    std::map<std::string, Channel *> _channels; // <channel_name, Channel from _channelPool>
+    ChannelPool _channelPool;
+    std::set<std::string> _persistentChannels; // IRC_PERSISTENT_CHANNELS, kept when empty
     bool _running;
+    CommandStats _stats;
+    size_t _cmdFanout; // messages delivered to other clients by the command being dispatched
+    std::map<int, std::deque<ReplyJob> > _replyJobs; // <fd, pending long replies in order>
+    int _replyRR; // last fd served, for round robin between clients
+    size_t _replyLinesPerTick;
+    size_t _maxMaskEntries; // per +b/+e/+I list
+    std::vector<int> _pfdIndex; // <fd, position in _pfds>, -1 when not polled
+
+    // Incremental fan-out (Delivery.cpp)
+    std::deque<FanOutJob> _fanoutJobs;
+    unsigned long _fanoutSeq;
+    std::vector<unsigned long> _fanoutTail;      // <fd, newest job that has to reach it>
+    std::vector<unsigned long> _fanoutDelivered; // <fd, newest job that reached it>
+    std::map<int, std::deque<std::pair<unsigned long, std::string> > > _deferred; // <fd, <job to wait for, msg> >
+    size_t _fanoutInlineMax; // larger fan-outs become jobs
+    size_t _fanoutPerTick;   // recipients served per loop iteration
+    std::vector<unsigned char> _wireCaps; // <fd, CAP_WIRE_MASK bits>, picks a recipient's form without a client lookup
+    std::map<int, std::string> _sendQueues; // <fd, bytes the socket did not take yet>, flushed on POLLOUT
+    size_t _sendQueueMax; // a peer that falls this far behind is disconnected
+    std::map<int, std::string> _closing; // <fd, reason> of write errors, closed after the event at hand
+
+    // Server-to-server linking
+    std::string _serverName;
+    std::string _linkPassword; // IRC_LINK_PASSWORD, linking is off while it is empty
+    std::map<int, Link> _links; // <fd, Link>
+    std::vector<LinkTarget> _linkTargets;
+    std::set<int> _linkAccepts; // <fd accepted on a link listener that has not sent its SERVER yet>
+    std::map<std::string, int> _uids; // <uid, client id>, remote users have negative ids
+    int _nextVirtualId;
+    unsigned long _nextUid;
+
+    // Hostname and ident lookups (Resolve.cpp)
+    Resolver _resolver;
+    std::map<int, PendingLookup> _lookups; // <fd, lookup>
+    unsigned long _lookupTimeoutUs;
+    bool _identEnabled;
+
+    // Command-scoped temporaries, reset once per loop iteration
+    Arena _arena;
+    std::string _nameKey; // reused to look up channels and nicks held as StringRef
+    StringRef _clientTags; // "+tag" part of the current line's message tags, relayed to message-tags clients
+    bool _allocStats;     // IRC_ALLOC_STATS: count heap allocations per command verb
+
+    // WebSocket clients (WebClients.cpp)
+    std::map<int, WebSocket> _webSockets; // <fd, connection accepted on the WebSocket listener>
+
+    // MONITOR presence (Monitor.cpp)
+    std::map<std::string, std::set<int> > _watchers; // <casefolded nick, fds monitoring it>
+    std::map<int, std::map<std::string, std::string> > _monitored; // <fd, <casefolded nick, nick as given> >
+    std::map<std::string, int> _online; // <casefolded nick, client id> of registered users, local and remote
+    size_t _monitorMax; // targets per client
+
+    // Server-relayed file transfers (FileTransfers.cpp)
+    int _fileListenFd; // IRC_FILE_PORT, -1 when disabled
+    long _filePort;
+    std::map<unsigned long, Transfer> _transfers;
+    unsigned long _nextTransfer;
+    std::map<int, DataHandshake> _fileHandshakes; // <data fd, handshake> until its token line arrives
+    std::map<int, unsigned long> _fileSockets;    // <data fd, transfer id>
+    size_t _fileMax;            // transfers at once, offers included
+    unsigned long _fileMaxSize;
+    unsigned long _fileRate;    // bytes per second per transfer, 0 for no cap
+    size_t _fileBytesPerTick;   // bytes one transfer moves per wakeup
+    unsigned long _fileTimeoutUs;
+
+    // In-process services (Services.cpp)
+    std::map<int, Service *> _services; // <client id, service>, owned
+    std::vector<std::pair<int, StringRef> > _serviceQueue; // <service id, line in the arena> for runServices
+    int _activeService; // service whose code is running, 0 otherwise
+    std::vector<Service *> _retiredServices; // deleted once runServices is past them
+
+    // Accounts and SASL PLAIN (Accounts.cpp)
+    AccountStore _accounts; // closed when IRC_ACCOUNTS_FILE is unset
+    PasswordHasher _hasher;
+    std::map<int, std::string> _loggedIn; // <fd, account>
+    std::map<int, SaslSession> _sasl;     // <fd, exchange in progress>
+    std::map<unsigned long, PendingHash> _hashJobs; // <hasher id, what the hash is for>
+    unsigned int _hashIterations; // PBKDF2 rounds of new accounts, old ones keep theirs
+    size_t _minPasswordLen;
+
+    // Content filter on PRIVMSG (Filter.cpp)
+    ContentFilter _filter;          // empty when IRC_FILTER_FILE is unset
+    std::string _filterChannel;     // IRC_FILTER_NOTIFY, its operators get the notify notices
+    FilterReload _filterReload;
+
+    // Session resumption (Resume.cpp)
+    std::map<int, Session> _sessions;         // <fd, session> of clients holding a resume token
+    std::map<std::string, int> _resumeTokens; // <token, fd>
+    unsigned long _resumeGraceUs;             // IRC_RESUME_GRACE, 0 turns resumption off
+
+    // Overload admission control (Admission.cpp)
+    LoadShedder _shedder;
+    size_t _shedUnregisteredPerTick; // unregistered clients read per iteration while they are deprioritized
+
+    // Low-latency mode (LowLatency.cpp)
+    bool _lowLatency;
+    unsigned long _spinUs;
+    int _busyPollUs;
 
 public:
     Server(int port, const std::string &password);
@@ -37,28 +296,188 @@ public:
     void run();
     void stop();
 
+    // In-process services (Services.cpp)
+    void registerService(Service *service);
+    void serviceCommand(int id, const std::string &line);
+
 private:
-    void setupListener(int port);
-    void acceptNewConnection();
+    void addPollFd(int fd);
+    void removePollFd(int fd);
+    int pollIndex(int fd) const;
+    bool acceptNewConnection(int listenFd);
     void handleClientRead(int index);
-    void closeClient(int index);
+    void closeClient(int index, const std::string &reason = "Connection closed");
 	void sendWelcomeMessage(int client_fd);
 	bool authMiddleware(Client &client, const std::string &command, std::istringstream &iss);
-	bool handleJoin(Client &client, 	std::istringstream &iss);
+	bool handleJoin(Client &client, StringRef params);
 	bool handleKick(Client &client, std::istringstream &iss);
 	bool handleInvite(Client &client, std::istringstream &iss);
-	void handlePriv(Client &client, std::istringstream &iss);
+	void handlePriv(Client &client, StringRef params);
 	// Gracefully disconnect a client by file descriptor (remove from poll and maps)
-	void disconnectClientFd(int fd);
+	void disconnectClientFd(int fd, const std::string &reason = "Connection closed");
 	// Notify all channels where client is present about nick change
-	void notifyNickChange(int client_fd, const std::string &oldNick, const std::string &newNick, const std::string &username);
+	void notifyNickChange(int client_fd, const std::string &oldNick, const std::string &newNick, const std::string &username, int exceptLink = -1);
+	void quitUser(Client &client, const std::string &reason, int exceptLink);
+	void completeRegistration(Client &client);
+
+	// Hostname and ident lookups (Resolve.cpp)
+	void startLookup(int fd, const struct sockaddr_storage &peer);
+	void handleResolved();
+	void expireLookups();
+	void finishLookup(int fd, const std::string &host, const std::string &ident);
+
+	// Server-to-server links (Link.cpp)
+	void loadLinkTargets(const std::string &spec);
+	void connectLinks();
+	void promoteToLink(int fd, const std::string &firstLine);
+	void handleLinkData(int fd, const char *data, size_t len);
+	void handleLinkLine(int fd, const std::string &line);
+	void dropLink(int fd, const std::string &reason);
+	void sendLink(int fd, const std::string &line);
+	void propagate(const std::string &line, int exceptLink = -1);
+	void propagateToChannel(Channel &channel, const std::string &line, int exceptLink = -1);
+	void sendBurst(int fd);
+	bool serverKnown(const std::string &name) const;
+	void introduceUser(Client &client);
+	void killUser(int id, const std::string &reason, int exceptLink = -1);
+	void netsplit(int fd, const std::vector<std::string> &names);
+	void linkUid(int fd, const std::vector<std::string> &params);
+	void linkNick(int fd, Client &user, const std::vector<std::string> &params);
+	void linkSjoin(int fd, const std::vector<std::string> &params);
+	void linkKick(int fd, Client &by, const std::vector<std::string> &params);
+	void linkPrivmsg(int fd, Client &from, const std::vector<std::string> &params);
 
 	bool channelExist(std::string channelName, Client &client);
 	bool clientExist(int target_fd, Client &client);
 	bool hasPermissions(int client_fd, Client &client, Channel &channel);
 	bool channelHasNick(std::string target, std::string channelName, Client &client);
 
-    void handleCommand(Client &client, const std::string &line);
+	void handleStats(Client &client, std::istringstream &iss);
+	void handleChatHistory(Client &client, std::istringstream &iss);
+	void handleMode(Client &client, std::istringstream &iss);
+	void sendMaskList(Client &client, Channel &channel, char mode);
+	void handleNames(Client &client, std::istringstream &iss);
+	void handleWho(Client &client, std::istringstream &iss);
+	void handleList(Client &client, std::istringstream &iss);
+	void sendNames(Client &client, Channel &channel);
+	void queueReply(int fd, const ReplyJob &job);
+	size_t stepReplyJob(int fd, size_t maxLines);
+	void processReplyJobs();
+	void dropReplyJobs(int fd);
+
+	void sendTo(int fd, const std::string &msg);
+	void sendTo(int fd, const char *msg, size_t len);
+	void sendTo(int fd, WireMessage &wire);
+	void transmit(int fd, WireMessage &wire);
+	void deliver(FanOut &fan, const std::string &msg);
+	void deliver(FanOut &fan, const char *msg, size_t len, StringRef clientTags = StringRef());
+	unsigned int wireForm(int fd, bool tagged) const;
+	StringRef renderForm(unsigned int form, const char *msg, size_t len, StringRef clientTags, long timeMs);
+	void processFanOutJobs();
+
+	// WebSocket clients (WebClients.cpp)
+	bool readWebSocket(int fd, const char *&data, size_t &len);
+
+	// IRCv3 capability negotiation (Capabilities.cpp)
+	void handleCap(Client &client, std::istringstream &iss);
+	void setCaps(Client &client, unsigned int caps);
+
+	// MONITOR presence (Monitor.cpp)
+	void handleMonitor(Client &client, std::istringstream &iss);
+	void sendMonitorStatus(Client &client, const std::vector<std::string> &targets);
+	void userOnline(Client &client);
+	void userOffline(int id, const std::string &nick);
+	void dropMonitor(int fd);
+
+	// Server-relayed file transfers (FileTransfers.cpp)
+	void configureFileTransfers();
+	void handleFile(Client &client, std::istringstream &iss);
+	void acceptFileConnection();
+	bool isFileSocket(int fd) const;
+	void handleFileSocket(int fd, short revents);
+	void readFileToken(int fd);
+	void startRelay(unsigned long id);
+	void pumpTransfer(unsigned long id);
+	void finishTransfer(unsigned long id, const char *reason);
+	void expireTransfers();
+	unsigned long nextTransferEvent() const;
+	void dropTransfers(int fd);
+
+	// In-process services (Services.cpp)
+	void loadServices();
+	void queueServiceInput(int id, const char *data, size_t len);
+	void runServices();
+	bool isService(int id) const;
+	void retireService(int id, const std::string &reason);
+
+	// Accounts and SASL PLAIN (Accounts.cpp)
+	void configureAccounts();
+	void handleAuthenticate(Client &client, std::istringstream &iss);
+	void handleRegister(Client &client, std::istringstream &iss);
+	void handleHashed();
+	void finishLogin(Client &client, const PendingHash &job, const unsigned char *digest);
+	void finishRegister(Client &client, const PendingHash &job, const unsigned char *digest);
+	void logIn(Client &client, const std::string &account);
+	bool nickReserved(const Client &client, const std::string &nick) const;
+	void dropAccountState(int fd);
+
+	// Channel lifetime and pool (Channels.cpp)
+	void configureChannels();
+	std::map<std::string, Channel *>::iterator createChannel(const std::string &name);
+	void reclaimChannel(std::map<std::string, Channel *>::iterator it);
+	void sendChannelStats(Client &client);
+
+	// Content filter on PRIVMSG (Filter.cpp)
+	void configureFilter();
+	void reloadFilter();
+	void finishFilterReload();
+	void stopFilterReload();
+	bool filterMessage(Client &client, StringRef target, StringRef message);
+
+	// Session resumption (Resume.cpp)
+	void configureResume();
+	void issueResumeToken(Client &client);
+	bool detachSession(int fd);
+	void handleResume(Client &client, std::istringstream &iss);
+	void expireSessions();
+	unsigned long nextSessionExpiry() const;
+	void dropSession(int fd);
+
+	// Listening sockets (Listeners.cpp)
+	void configureListeners(int port);
+	int setupListener(const Endpoint &endpoint);
+	void openListeners(const char *variable, size_t defaultBudget, bool serverLinks);
+	void openListener(const Endpoint &endpoint, bool webSocket, size_t acceptBudget, bool serverLinks = false);
+	bool isListener(int fd) const;
+	void acceptConnections(int listenFd);
+	void closeListeners();
+	void sendListenerStats(Client &client);
+
+	// Overload admission control (Admission.cpp)
+	void configureAdmission();
+	size_t queuedWork() const;
+	void updateAdmission(unsigned long busyUs, unsigned long nowUs);
+	bool rejectConnections(int listenFd);
+	bool postponeRead(int fd) const;
+	bool refuseUnderLoad(Client &client, const std::string &command, StringRef params);
+	void sendLoadStats(Client &client);
+
+	// Low-latency mode and loop timing (LowLatency.cpp)
+	void configureLowLatency();
+	void tuneSocket(int fd);
+	int nextTimeout() const;
+	int waitForEvents(int timeout);
+
+	void forgetDelivery(int fd);
+	void writeOut(int fd, const char *data, size_t len);
+	bool writeSome(int fd, const char *data, size_t len, size_t &sent);
+	void flushSendQueue(int fd);
+	void watchWritable(int fd, bool on);
+	void closeLater(int fd, const std::string &reason);
+	void closePending();
+
+    void handleCommand(Client &client, StringRef line);
+	void dispatchCommand(Client &client, const std::string &command, StringRef params);
 	int getFdByNick(const std::string &nick);
 
 };
@@ -0,0 +1,52 @@
+#ifndef SERVICE_HPP
+#define SERVICE_HPP
+
+#include <string>
+#include "Arena.hpp"
+
+class Server;
+
+// A line the server delivered to a service, split in place: every field
+// points into line, which lives in the server's arena until the event has
+// been handled. Copy what has to outlive the callback.
+struct ServiceEvent
+{
+	StringRef line;		// without the CRLF
+	StringRef source;	// nick!user@host or server name, empty when the line has no prefix
+	StringRef nick;		// nick part of source
+	StringRef command;	// PRIVMSG, JOIN, PART, QUIT, KICK, NICK, INVITE, MODE, a numeric...
+	StringRef target;	// first parameter: a channel, or the service's own nick
+	StringRef params;	// everything after the command
+	StringRef text;		// trailing parameter, after its ':'
+
+	static ServiceEvent parse(StringRef line);
+};
+
+// An in-process pseudo-client. It is a registered Client with a negative id
+// and no socket: it joins channels and is messaged like any user, and what
+// the server sends it arrives as events instead of bytes. command() runs a
+// line as the service through the normal command path, so its replies reach
+// people, links and history the same way a user's do.
+class Service
+{
+	private:
+		Server	*_server;
+		int		_id;
+
+	protected:
+		void	command(const std::string &line);
+
+	public:
+		Service();
+		virtual ~Service();
+
+		void	attach(Server *server, int id);
+		int		id() const;
+
+		virtual std::string	nick() const = 0;
+		virtual std::string	realname() const;
+		virtual void		start();	// registered: join channels here
+		virtual void		onEvent(const ServiceEvent &event) = 0;
+};
+
+#endif
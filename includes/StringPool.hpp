@@ -0,0 +1,21 @@
+#ifndef STRINGPOOL_HPP
+#define STRINGPOOL_HPP
+
+#include <string>
+#include <map>
+
+// Refcounted interning for strings most clients share (hostnames, server
+// names): every holder points at the same copy, freed with its last holder.
+class StringPool
+{
+	private:
+		static std::map<std::string, unsigned long> &pool();
+
+	public:
+		static const std::string *intern(const std::string &value);
+		static void release(const std::string *value);
+		static const std::string &empty();
+		static size_t size();
+};
+
+#endif
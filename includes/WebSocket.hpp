@@ -0,0 +1,45 @@
+#ifndef WEBSOCKET_HPP
+#define WEBSOCKET_HPP
+
+#include <string>
+
+// Server side of RFC 6455 for one connection: the HTTP upgrade, then frames.
+// Every text or binary message carries IRC lines (the IRCv3 WebSocket
+// mapping, "text.ircv3.net"); feed() hands them back CRLF-terminated so they
+// go through the same line path as plain TCP input.
+class WebSocket
+{
+	public:
+		static const size_t MAX_HANDSHAKE = 8192;
+		static const size_t MAX_MESSAGE = 16384;
+
+	private:
+		bool			_open;		// upgrade done
+		std::string		_input;		// bytes not decoded yet
+		std::string		_message;	// fragments of the message being reassembled
+		bool			_fragmented;
+		std::string		_lines;		// decoded IRC lines, CRLF-terminated
+
+		bool	handshake(std::string &reply);
+		bool	fail(unsigned short code, std::string &reply);
+		void	takeMessage(const char *payload, size_t len);
+
+	public:
+		WebSocket();
+
+		bool	isOpen() const;
+		// Consumes raw socket bytes. Whatever has to go back unframed-by-the-caller
+		// (the 101/400 response, pong and close frames) is appended to reply.
+		// Returns false once the connection should be closed after sending reply.
+		bool	feed(const char *data, size_t len, std::string &reply);
+		const std::string	&lines() const;
+		void	clearLines();
+
+		// One outgoing text frame per CRLF-terminated line of msg, line ending dropped
+		static size_t	framedSize(const char *msg, size_t len);
+		static size_t	frameLines(char *out, const char *msg, size_t len);
+		static void		appendFrame(std::string &out, unsigned char opcode, const char *payload, size_t len);
+		static std::string	acceptKey(const std::string &key);
+};
+
+#endif
@@ -0,0 +1,281 @@
+#include "AccountStore.hpp"
+#include "MaskIndex.hpp"
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char MAGIC[8] = { 'I', 'R', 'C', 'A', 'C', 'C', 'T', '1' };
+static const unsigned int VERSION = 1;
+static const unsigned long long INITIAL_SLOTS = 1024;
+
+AccountStore::AccountStore() : _fd(-1), _map(NULL), _mapLen(0), _header(NULL), _records(NULL)
+{
+}
+
+AccountStore::~AccountStore()
+{
+	close();
+}
+
+// FNV-1a
+unsigned int AccountStore::hashName(const std::string &folded)
+{
+	unsigned int h = 2166136261u;
+	for (size_t i = 0; i < folded.size(); ++i)
+	{
+		h ^= static_cast<unsigned char>(folded[i]);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+size_t AccountStore::fileSize(unsigned long long slots)
+{
+	return sizeof(Header) + static_cast<size_t>(slots) * sizeof(AccountRecord);
+}
+
+static void *mapFile(int fd, size_t len)
+{
+	int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE; // fault every page in now, not during a login storm
+#endif
+	void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, fd, 0);
+	return map == MAP_FAILED ? NULL : map;
+}
+
+// Empty table of `slots` records in a new file at path
+bool AccountStore::create(const std::string &path, unsigned long long slots, int &fd)
+{
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, fileSize(slots)) < 0)
+	{
+		::close(fd);
+		unlink(path.c_str());
+		return false;
+	}
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.recordSize = sizeof(AccountRecord);
+	header.slots = slots;
+	if (pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+	{
+		::close(fd);
+		unlink(path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool AccountStore::map(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(Header))
+		return false;
+	Header header;
+	if (pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+		return false;
+	unsigned long long slots = header.slots;
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION
+		|| header.recordSize != sizeof(AccountRecord) || slots == 0 || (slots & (slots - 1)) != 0
+		|| header.count * 2 > slots || static_cast<size_t>(st.st_size) != fileSize(slots))
+		return false;
+	void *map = mapFile(fd, st.st_size);
+	if (map == NULL)
+		return false;
+	unmap();
+	_fd = fd;
+	_map = map;
+	_mapLen = st.st_size;
+	_header = static_cast<Header *>(map);
+	_records = reinterpret_cast<AccountRecord *>(static_cast<char *>(map) + sizeof(Header));
+	return true;
+}
+
+void AccountStore::unmap()
+{
+	if (_map != NULL)
+		munmap(_map, _mapLen);
+	if (_fd != -1)
+		::close(_fd);
+	_fd = -1;
+	_map = NULL;
+	_mapLen = 0;
+	_header = NULL;
+	_records = NULL;
+}
+
+bool AccountStore::open(const std::string &path, std::string &error)
+{
+	close();
+	_path = path;
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+	{
+		error = std::strerror(errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size == 0)
+	{
+		::close(fd);
+		if (!create(path, INITIAL_SLOTS, fd))
+		{
+			error = std::strerror(errno);
+			return false;
+		}
+	}
+	if (!map(fd))
+	{
+		::close(fd);
+		error = "not an account file, or a damaged one";
+		return false;
+	}
+	return true;
+}
+
+void AccountStore::close()
+{
+	if (_map != NULL)
+		msync(_map, _mapLen, MS_SYNC);
+	unmap();
+}
+
+bool AccountStore::isOpen() const
+{
+	return _map != NULL;
+}
+
+// The record holding folded, or the empty slot where it would go. The table
+// is never more than half full, so there always is one; NULL only for a
+// damaged file whose header count hides that every slot is used.
+AccountRecord *AccountStore::probe(const std::string &folded, unsigned int hash) const
+{
+	size_t mask = static_cast<size_t>(_header->slots) - 1;
+	size_t i = hash & mask;
+	for (size_t n = 0; n <= mask; ++n, i = (i + 1) & mask)
+	{
+		AccountRecord &record = _records[i];
+		if (!record.used)
+			return &record;
+		if (record.hash == hash && record.nameLen == folded.size()
+			&& MaskIndex::casefold(std::string(record.name, record.nameLen)) == folded)
+			return &record;
+	}
+	return NULL;
+}
+
+const AccountRecord *AccountStore::find(const std::string &name) const
+{
+	if (!isOpen() || name.empty() || name.size() > MAX_NAME)
+		return NULL;
+	std::string folded = MaskIndex::casefold(name);
+	AccountRecord *record = probe(folded, hashName(folded));
+	return record && record->used ? record : NULL;
+}
+
+// Copies every record into a table twice the size, then swaps the files
+bool AccountStore::grow()
+{
+	std::string tmp = _path + ".tmp";
+	unsigned long long slots = _header->slots * 2;
+	int fd;
+	if (!create(tmp, slots, fd))
+		return false;
+	void *map = mapFile(fd, fileSize(slots));
+	if (map == NULL)
+	{
+		::close(fd);
+		unlink(tmp.c_str());
+		return false;
+	}
+	Header *header = static_cast<Header *>(map);
+	AccountRecord *records = reinterpret_cast<AccountRecord *>(static_cast<char *>(map) + sizeof(Header));
+	size_t mask = static_cast<size_t>(slots) - 1;
+	for (size_t i = 0; i < _header->slots; ++i)
+	{
+		if (!_records[i].used)
+			continue;
+		size_t k = _records[i].hash & mask;
+		while (records[k].used)
+			k = (k + 1) & mask;
+		records[k] = _records[i];
+		header->count++;
+	}
+	bool ok = msync(map, fileSize(slots), MS_SYNC) == 0 && rename(tmp.c_str(), _path.c_str()) == 0;
+	munmap(map, fileSize(slots));
+	if (!ok)
+	{
+		::close(fd);
+		unlink(tmp.c_str());
+		return false;
+	}
+	if (!this->map(fd))
+	{
+		::close(fd);
+		return false;
+	}
+	return true;
+}
+
+bool AccountStore::add(const std::string &name, const unsigned char *salt, const unsigned char *digest,
+					   unsigned int iterations, long long created)
+{
+	if (!isOpen() || name.empty() || name.size() > MAX_NAME)
+		return false;
+	std::string folded = MaskIndex::casefold(name);
+	unsigned int hash = hashName(folded);
+	AccountRecord *record = probe(folded, hash);
+	if (record && record->used)
+		return false;
+	if (!record || (_header->count + 1) * 2 > _header->slots)
+	{
+		if (!grow())
+			return false;
+		record = probe(folded, hash);
+		if (record->used) // was hidden behind the full table
+			return false;
+	}
+	std::memset(record, 0, sizeof(*record));
+	record->hash = hash;
+	record->nameLen = static_cast<unsigned char>(name.size());
+	std::memcpy(record->name, name.data(), name.size());
+	std::memcpy(record->salt, salt, PasswordHasher::SALT);
+	std::memcpy(record->digest, digest, PasswordHasher::DIGEST);
+	record->iterations = iterations;
+	record->created = created;
+	record->used = 1;
+	_header->count++;
+
+	// write the record's page and the header back without waiting for the disk
+	long page = sysconf(_SC_PAGESIZE);
+	char *base = static_cast<char *>(_map);
+	size_t offset = reinterpret_cast<char *>(record) - base;
+	size_t start = offset / page * page;
+	msync(base + start, offset + sizeof(*record) - start, MS_ASYNC);
+	msync(base, sizeof(Header), MS_ASYNC);
+	return true;
+}
+
+size_t AccountStore::size() const
+{
+	return isOpen() ? static_cast<size_t>(_header->count) : 0;
+}
+
+size_t AccountStore::capacity() const
+{
+	return isOpen() ? static_cast<size_t>(_header->slots) : 0;
+}
+
+size_t AccountStore::bytes() const
+{
+	return _mapLen;
+}
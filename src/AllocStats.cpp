@@ -0,0 +1,52 @@
+#include "AllocStats.hpp"
+#include <new>
+#include <cstdlib>
+#include <pthread.h>
+
+static bool				s_enabled = false;
+static pthread_t		s_owner;
+static unsigned long	s_allocations = 0;
+static unsigned long	s_bytes = 0;
+
+static void *countedAlloc(std::size_t size)
+{
+	if (s_enabled && pthread_equal(pthread_self(), s_owner))
+	{
+		s_allocations++;
+		s_bytes += size;
+	}
+	void *p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new(std::size_t size) throw(std::bad_alloc)
+{
+	return countedAlloc(size);
+}
+
+void *operator new[](std::size_t size) throw(std::bad_alloc)
+{
+	return countedAlloc(size);
+}
+
+void operator delete(void *p) throw()
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+	std::free(p);
+}
+
+void AllocStats::enable()
+{
+	s_owner = pthread_self();
+	s_enabled = true;
+}
+
+bool AllocStats::enabled() { return s_enabled; }
+unsigned long AllocStats::allocations() { return s_allocations; }
+unsigned long AllocStats::bytes() { return s_bytes; }
@@ -0,0 +1,208 @@
+#include "Arena.hpp"
+#include <cstring>
+
+static const size_t HEADER = 2 * sizeof(void *); // sizeof(Block) rounded up to ALIGN
+
+static size_t alignUp(size_t n)
+{
+	return (n + Arena::ALIGN - 1) & ~(Arena::ALIGN - 1);
+}
+
+Arena::Arena(size_t blockSize) : _blocks(NULL), _used(0), _spilled(0), _highWater(0), _blockSize(blockSize) {}
+
+Arena::~Arena()
+{
+	freeBlocks();
+}
+
+char *Arena::payload(Block *block)
+{
+	return reinterpret_cast<char *>(block) + HEADER;
+}
+
+void Arena::addBlock(size_t minimum)
+{
+	size_t size = minimum > _blockSize ? minimum : _blockSize;
+	Block *block = static_cast<Block *>(::operator new(HEADER + size));
+	block->next = _blocks;
+	block->size = size;
+	if (_blocks)
+		_spilled += _used;
+	_blocks = block;
+	_used = 0;
+}
+
+void Arena::freeBlocks()
+{
+	while (_blocks)
+	{
+		Block *next = _blocks->next;
+		::operator delete(_blocks);
+		_blocks = next;
+	}
+	_used = 0;
+	_spilled = 0;
+}
+
+void *Arena::allocate(size_t size)
+{
+	size = alignUp(size ? size : 1);
+	if (!_blocks || _used + size > _blocks->size)
+		addBlock(size);
+	void *p = payload(_blocks) + _used;
+	_used += size;
+	if (_spilled + _used > _highWater)
+		_highWater = _spilled + _used;
+	return p;
+}
+
+char *Arena::copy(const char *data, size_t len)
+{
+	char *p = static_cast<char *>(allocate(len + 1));
+	std::memcpy(p, data, len);
+	p[len] = '\0';
+	return p;
+}
+
+// An iteration that needed several blocks gets them merged into one for the
+// next, so the arena settles on a single block of the usual peak size.
+void Arena::reset()
+{
+	if (_blocks && _blocks->next)
+	{
+		size_t peak = alignUp(_spilled + _used);
+		freeBlocks();
+		if (peak > _blockSize)
+			_blockSize = peak < MAX_RETAINED ? peak : MAX_RETAINED;
+		return;
+	}
+	if (_blocks && _blocks->size > MAX_RETAINED)
+		freeBlocks(); // one oversized request, do not keep it around
+	_used = 0;
+	_spilled = 0;
+}
+
+size_t Arena::used() const { return _spilled + _used; }
+size_t Arena::highWater() const { return _highWater; }
+
+size_t Arena::capacity() const
+{
+	size_t total = 0;
+	for (Block *b = _blocks; b; b = b->next)
+		total += b->size;
+	return total;
+}
+
+StringRef::StringRef() : _data(""), _size(0) {}
+StringRef::StringRef(const char *data, size_t size) : _data(data), _size(size) {}
+StringRef::StringRef(const std::string &value) : _data(value.data()), _size(value.size()) {}
+
+const char *StringRef::data() const { return _data; }
+size_t StringRef::size() const { return _size; }
+bool StringRef::empty() const { return _size == 0; }
+char StringRef::operator[](size_t i) const { return _data[i]; }
+
+bool StringRef::operator==(const StringRef &other) const
+{
+	return _size == other._size && std::memcmp(_data, other._data, _size) == 0;
+}
+
+bool StringRef::operator==(const char *literal) const
+{
+	return *this == StringRef(literal, std::strlen(literal));
+}
+
+std::string StringRef::str() const
+{
+	return std::string(_data, _size);
+}
+
+StringRef StringRef::word()
+{
+	size_t start = 0;
+	while (start < _size && (_data[start] == ' ' || _data[start] == '\t'))
+		start++;
+	size_t end = start;
+	while (end < _size && _data[end] != ' ' && _data[end] != '\t')
+		end++;
+	StringRef out(_data + start, end - start);
+	_data += end;
+	_size -= end;
+	return out;
+}
+
+StringRef StringRef::split(char sep)
+{
+	const char *found = static_cast<const char *>(std::memchr(_data, sep, _size));
+	size_t len = found ? static_cast<size_t>(found - _data) : _size;
+	StringRef out(_data, len);
+	size_t consumed = found ? len + 1 : len;
+	_data += consumed;
+	_size -= consumed;
+	return out;
+}
+
+StringRef StringRef::trimLeft(char c) const
+{
+	size_t start = 0;
+	while (start < _size && _data[start] == c)
+		start++;
+	return StringRef(_data + start, _size - start);
+}
+
+ArenaString::ArenaString(Arena &arena, size_t capacity) : _arena(arena), _size(0), _capacity(capacity)
+{
+	_data = static_cast<char *>(_arena.allocate(capacity));
+}
+
+// Growing leaves the old copy behind in the arena until the next reset
+void ArenaString::reserve(size_t needed)
+{
+	if (needed <= _capacity)
+		return;
+	size_t capacity = _capacity * 2 > needed ? _capacity * 2 : needed;
+	char *grown = static_cast<char *>(_arena.allocate(capacity));
+	std::memcpy(grown, _data, _size);
+	_data = grown;
+	_capacity = capacity;
+}
+
+ArenaString &ArenaString::append(const char *data, size_t len)
+{
+	reserve(_size + len);
+	std::memcpy(_data + _size, data, len);
+	_size += len;
+	return *this;
+}
+
+ArenaString &ArenaString::operator<<(const char *text) { return append(text, std::strlen(text)); }
+ArenaString &ArenaString::operator<<(const std::string &text) { return append(text.data(), text.size()); }
+ArenaString &ArenaString::operator<<(const StringRef &text) { return append(text.data(), text.size()); }
+ArenaString &ArenaString::operator<<(char c) { return append(&c, 1); }
+ArenaString &ArenaString::operator<<(int value) { return *this << static_cast<long>(value); }
+
+ArenaString &ArenaString::operator<<(long value)
+{
+	if (value < 0)
+	{
+		*this << '-';
+		return *this << (0UL - static_cast<unsigned long>(value));
+	}
+	return *this << static_cast<unsigned long>(value);
+}
+
+ArenaString &ArenaString::operator<<(unsigned long value)
+{
+	char digits[24];
+	size_t n = sizeof(digits);
+	do
+	{
+		digits[--n] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value);
+	return append(digits + n, sizeof(digits) - n);
+}
+
+const char *ArenaString::data() const { return _data; }
+size_t ArenaString::size() const { return _size; }
+void ArenaString::clear() { _size = 0; }
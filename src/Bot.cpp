@@ -0,0 +1,116 @@
+#include "Bot.hpp"
+#include "MaskIndex.hpp"
+#include <sstream>
+#include <cstdlib>
+#include <ctime>
+
+Bot::Bot(const std::string &nick, const std::string &channels) : _nick(nick), _rng(static_cast<unsigned long>(time(NULL)) | 1)
+{
+	std::istringstream list(channels);
+	std::string channel;
+	while (std::getline(list, channel, ','))
+		if (!channel.empty())
+			_channels.push_back(channel);
+}
+
+std::string Bot::nick() const
+{
+	return _nick;
+}
+
+std::string Bot::realname() const
+{
+	return "ft_irc bot, !help for commands";
+}
+
+void Bot::start()
+{
+	for (size_t i = 0; i < _channels.size(); ++i)
+		command("JOIN " + _channels[i]);
+}
+
+void Bot::saw(StringRef nick, const std::string &what)
+{
+	if (nick.empty())
+		return;
+	if (_seen.size() >= SEEN_MAX)
+		_seen.erase(_seen.begin()); // bounded, an arbitrary old entry goes
+	_seen[MaskIndex::casefold(nick.str())] = std::make_pair(static_cast<long>(time(NULL)), nick.str() + " " + what);
+}
+
+static std::string ago(long seconds)
+{
+	std::ostringstream out;
+	if (seconds < 120)
+		out << seconds << "s";
+	else if (seconds < 7200)
+		out << seconds / 60 << "m";
+	else if (seconds < 172800)
+		out << seconds / 3600 << "h";
+	else
+		out << seconds / 86400 << "d";
+	return out.str();
+}
+
+void Bot::answer(const std::string &replyTo, StringRef text)
+{
+	StringRef verb = text.word();
+	StringRef arg = text.word();
+	std::ostringstream reply;
+	if (verb == "!ping")
+		reply << "pong";
+	else if (verb == "!time")
+	{
+		time_t now = time(NULL);
+		struct tm utc;
+		gmtime_r(&now, &utc);
+		char stamp[32];
+		strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S UTC", &utc);
+		reply << stamp;
+	}
+	else if (verb == "!roll")
+	{
+		long sides = arg.empty() ? 6 : std::strtol(arg.str().c_str(), NULL, 10);
+		if (sides < 2 || sides > 1000000)
+			sides = 6;
+		_rng ^= _rng << 13;
+		_rng ^= _rng >> 7;
+		_rng ^= _rng << 17;
+		reply << "rolled " << (_rng % sides) + 1 << " (1-" << sides << ")";
+	}
+	else if (verb == "!seen" && !arg.empty())
+	{
+		std::map<std::string, std::pair<long, std::string> >::iterator it = _seen.find(MaskIndex::casefold(arg.str()));
+		if (it == _seen.end())
+			reply << "I have not seen " << arg.str();
+		else
+			reply << it->second.second << " " << ago(static_cast<long>(time(NULL)) - it->second.first) << " ago";
+	}
+	else if (verb == "!help")
+		reply << "!ping, !time, !roll [sides], !seen <nick>";
+	else
+		return;
+	command("PRIVMSG " + replyTo + " :" + reply.str());
+}
+
+void Bot::onEvent(const ServiceEvent &event)
+{
+	if (event.command == "PRIVMSG")
+	{
+		bool toChannel = !event.target.empty() && event.target[0] == '#';
+		if (toChannel)
+			saw(event.nick, "was talking in " + event.target.str());
+		if (!event.text.empty() && event.text[0] == '!')
+			answer(toChannel ? event.target.str() : event.nick.str(), event.text);
+	}
+	else if (event.command == "JOIN")
+		saw(event.nick, "joined " + event.target.str());
+	else if (event.command == "PART")
+		saw(event.nick, "left " + event.target.str());
+	else if (event.command == "QUIT")
+		saw(event.nick, "quit (" + event.text.str() + ")");
+	else if (event.command == "NICK")
+		saw(event.nick, "changed nick to " + (event.text.empty() ? event.target : event.text).str());
+	else if (event.command == "INVITE" && !event.text.empty())
+		command("JOIN " + event.text.str());
+}
@@ -1,14 +1,185 @@
 #include "Channel.hpp"
 #include <algorithm>
 #include <sys/socket.h>
+#include <sstream>
+#include <ctime>
 
-Channel::Channel() : _name(""), _userLimit(0), _topic("") {}
+Channel::Channel() : _name(""), _userLimit(0), _topic(""), _inviteOnly(false), _topicProtect(false),
+	_createdAt(0), _namesCache(NULL), _whoCache(NULL) {}
 
-Channel::Channel(const std::string &name) : _name(name),  _userLimit(0), _topic(""), _inviteOnly(false) {}
+Channel::Channel(const std::string &name) : _name(name),  _userLimit(0), _topic(""), _inviteOnly(false),
+	_topicProtect(false), _createdAt(static_cast<long>(time(NULL))), _namesCache(NULL), _whoCache(NULL) {}
+
+Channel::Channel(const Channel &other) : _name(other._name), _userLimit(other._userLimit), _topic(other._topic),
+	_inviteOnly(other._inviteOnly), _key(other._key), _topicProtect(other._topicProtect), _members(other._members),
+	_whiteList(other._whiteList), _createdAt(other._createdAt), _history(other._history), _bans(other._bans), _excepts(other._excepts),
+	_invexes(other._invexes), _namesCache(NULL), _whoCache(NULL) {}
+
+Channel &Channel::operator=(const Channel &other)
+{
+	if (this != &other)
+	{
+		_name = other._name;
+		_userLimit = other._userLimit;
+		_topic = other._topic;
+		_inviteOnly = other._inviteOnly;
+		_key = other._key;
+		_topicProtect = other._topicProtect;
+		_members = other._members;
+		_whiteList = other._whiteList;
+		_createdAt = other._createdAt;
+		_history = other._history;
+		_bans = other._bans;
+		_excepts = other._excepts;
+		_invexes = other._invexes;
+		invalidateReplies();
+	}
+	return *this;
+}
+
+Channel::~Channel()
+{
+	invalidateReplies();
+}
+
+void Channel::reset(const std::string &name)
+{
+	_name = name;
+	_userLimit = 0;
+	_topic.clear();
+	_inviteOnly = false;
+	_key.clear();
+	_topicProtect = false;
+	_members.clear();
+	_whiteList.clear();
+	_createdAt = static_cast<long>(time(NULL));
+	_history.clear();
+	_bans = MaskIndex();
+	_excepts = MaskIndex();
+	_invexes = MaskIndex();
+	invalidateReplies();
+}
+
+void Channel::invalidateReplies()
+{
+	if (_namesCache)
+		_namesCache->release();
+	if (_whoCache)
+		_whoCache->release();
+	_namesCache = NULL;
+	_whoCache = NULL;
+	_listCache.clear();
+}
+
+MaskIndex *Channel::getMaskList(char mode)
+{
+	if (mode == 'b')
+		return &_bans;
+	if (mode == 'e')
+		return &_excepts;
+	if (mode == 'I')
+		return &_invexes;
+	return NULL;
+}
+
+bool Channel::hasBans() const
+{
+	return _bans.size() > 0;
+}
+
+bool Channel::isBanned(int client_fd, unsigned long identity, const std::string &hostmask)
+{
+	return _bans.matches(client_fd, identity, hostmask) && !_excepts.matches(client_fd, identity, hostmask);
+}
+
+bool Channel::isInviteExempt(int client_fd, unsigned long identity, const std::string &hostmask)
+{
+	return _invexes.matches(client_fd, identity, hostmask);
+}
+
+static const size_t NAMES_CHUNK = 400; // keeps each 353 line well under 512 bytes
+
+ReplyBlock *Channel::getNamesReply()
+{
+	if (_namesCache)
+		return _namesCache;
+	_namesCache = ReplyBlock::create();
+	std::string head = "= " + _name + " :";
+	std::string line = head;
+	for (size_t i = 0; i < _members.size(); ++i)
+	{
+		if (line.size() > head.size() && line.size() + _members[i].nick.size() + 2 > NAMES_CHUNK)
+		{
+			_namesCache->lines.push_back(line);
+			line = head;
+		}
+		if (line.size() > head.size())
+			line += " ";
+		if (_members[i].isOperator)
+			line += "@";
+		line += _members[i].nick;
+	}
+	if (line.size() > head.size())
+		_namesCache->lines.push_back(line);
+	return _namesCache;
+}
+
+ReplyBlock *Channel::getWhoReply()
+{
+	return _whoCache;
+}
+
+void Channel::setWhoReply(ReplyBlock *block)
+{
+	if (_whoCache)
+		_whoCache->release();
+	_whoCache = block;
+}
+
+const std::string &Channel::getListReply()
+{
+	if (_listCache.empty())
+	{
+		std::ostringstream ss;
+		ss << _name << " " << _members.size() << " :" << _topic;
+		_listCache = ss.str();
+	}
+	return _listCache;
+}
+
+long Channel::getCreatedAt() const { return _createdAt; }
+void Channel::setCreatedAt(long ts) { _createdAt = ts; }
+
+void Channel::setOperator(int client_fd, bool op)
+{
+	for (size_t i = 0; i < _members.size(); ++i)
+	{
+		if (_members[i].fd == client_fd && _members[i].isOperator != op)
+		{
+			_members[i].isOperator = op;
+			invalidateReplies();
+		}
+	}
+}
+
+void Channel::clearOperators()
+{
+	for (size_t i = 0; i < _members.size(); ++i)
+		_members[i].isOperator = false;
+	invalidateReplies();
+}
+
+void Channel::setTopic(const std::string &topic)
+{
+	_topic = topic;
+	invalidateReplies();
+}
 
 const std::string &Channel::getName() const { return _name; }
 const std::string &Channel::getTopic() const { return _topic; }	
 const std::vector<struct Member> &Channel::getMembers() const { return _members; }
+ChannelHistory &Channel::getHistory() { return _history; }
+const ChannelHistory &Channel::getHistory() const { return _history; }
 
 bool Channel::hasMember(int client_fd) const
 {
@@ -41,6 +212,7 @@ void Channel::addMember(int client_fd, std::string nick, bool op)
             newMember.isOperator = true; // el primer miembro es operador
 		}
         _members.push_back(newMember);
+        invalidateReplies();
     }
 }
 
@@ -63,6 +235,7 @@ void Channel::removeMember(int target_fd, int requester_fd)
         if (_members[i].fd == target_fd)
         {
             _members.erase(_members.begin() + i);
+            invalidateReplies();
             break;
         }
     }
@@ -75,9 +248,13 @@ void Channel::removeMemberByFd(int target_fd)
         if (_members[i].fd == target_fd)
         {
             _members.erase(_members.begin() + i);
+            invalidateReplies();
             break;
         }
     }
+    _bans.forget(target_fd);
+    _excepts.forget(target_fd);
+    _invexes.forget(target_fd);
     // Also remove from whitelist if present
     for (size_t i = 0; i < _whiteList.size(); ++i)
     {
@@ -96,22 +273,12 @@ void Channel::updateMemberNick(int client_fd, const std::string &newNick)
         if (_members[i].fd == client_fd)
         {
             _members[i].nick = newNick;
+            invalidateReplies();
             break;
         }
     }
 }
 
-void Channel::broadcast(const std::string &message, int sender_fd)
-{
-    for (size_t i = 0; i < _members.size(); ++i)
-    {
-        int member_fd = _members[i].fd;
-        if (sender_fd != -1 && member_fd == sender_fd)
-            continue; // don't echo back to sender
-        send(member_fd, message.c_str(), message.size(), 0);
-    }
-}
-
 void Channel::addToWhiteList(int target_fd)
 {
 	_whiteList.push_back(target_fd);
@@ -147,7 +314,7 @@ int Channel::getFdByNick(std::string nick)
     }
 	return 0;
 }
-std::string Channel::getKey()
+const std::string &Channel::getKey() const
 {
 	return _key;
 }
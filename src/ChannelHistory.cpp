@@ -0,0 +1,198 @@
+#include "ChannelHistory.hpp"
+#include <cstring>
+#include <sys/time.h>
+
+size_t ChannelHistory::s_maxEntries = 200;
+size_t ChannelHistory::s_channelBytes = 64 * 1024;
+size_t ChannelHistory::s_globalCap = 64 * 1024 * 1024;
+size_t ChannelHistory::s_globalBytes = 0;
+
+ChannelHistory::ChannelHistory()
+	: _head(0), _count(0), _writePos(0), _liveBytes(0), _accounted(0) {}
+
+ChannelHistory::ChannelHistory(const ChannelHistory &other)
+	: _arena(other._arena), _index(other._index), _head(other._head), _count(other._count),
+	  _writePos(other._writePos), _liveBytes(other._liveBytes), _accounted(0)
+{
+	account();
+}
+
+ChannelHistory &ChannelHistory::operator=(const ChannelHistory &other)
+{
+	if (this != &other)
+	{
+		_arena = other._arena;
+		_index = other._index;
+		_head = other._head;
+		_count = other._count;
+		_writePos = other._writePos;
+		_liveBytes = other._liveBytes;
+		account();
+	}
+	return *this;
+}
+
+ChannelHistory::~ChannelHistory()
+{
+	s_globalBytes -= _accounted;
+}
+
+void ChannelHistory::configure(size_t maxEntries, size_t channelBytes, size_t globalCap)
+{
+	s_maxEntries = maxEntries;
+	s_channelBytes = channelBytes;
+	s_globalCap = globalCap;
+}
+
+size_t ChannelHistory::globalUsage() { return s_globalBytes; }
+size_t ChannelHistory::globalCap() { return s_globalCap; }
+
+long ChannelHistory::nowMillis()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<long>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+size_t ChannelHistory::size() const { return _count; }
+
+size_t ChannelHistory::memoryUsage() const
+{
+	return _arena.capacity() + _index.capacity() * sizeof(HistoryEntry);
+}
+
+void ChannelHistory::account()
+{
+	size_t now = memoryUsage();
+	s_globalBytes = s_globalBytes - _accounted + now;
+	_accounted = now;
+}
+
+const HistoryEntry &ChannelHistory::entryAt(size_t i) const
+{
+	return _index[(_head + i) % _index.size()];
+}
+
+void ChannelHistory::evictOldest()
+{
+	_liveBytes -= _index[_head].length;
+	_head = (_head + 1) % _index.size();
+	if (--_count == 0)
+	{
+		_head = 0;
+		_writePos = 0;
+	}
+}
+
+// Doubles the arena (up to the per-channel cap) if the global budget allows it,
+// laying the live lines out linearly in the new buffer
+bool ChannelHistory::grow(size_t needed)
+{
+	size_t target = _arena.size() ? _arena.size() : 4096;
+	while (target < needed)
+		target *= 2;
+	if (target > s_channelBytes)
+		target = s_channelBytes;
+	if (target <= _arena.size())
+		return false;
+	if (s_globalBytes - _arena.capacity() + target > s_globalCap)
+		return false;
+
+	std::vector<char> bigger(target);
+	size_t pos = 0;
+	for (size_t i = 0; i < _count; ++i)
+	{
+		HistoryEntry &e = _index[(_head + i) % _index.size()];
+		std::memcpy(&bigger[pos], &_arena[e.offset], e.length);
+		e.offset = pos;
+		pos += e.length;
+	}
+	_arena.swap(bigger);
+	_writePos = pos;
+	account();
+	return true;
+}
+
+void ChannelHistory::append(long when, const std::string &line)
+{
+	append(when, line.data(), line.size());
+}
+
+void ChannelHistory::append(long when, const char *line, size_t len)
+{
+	if (len == 0 || len > s_channelBytes || s_maxEntries == 0)
+		return;
+	if (_index.empty())
+	{
+		if (s_globalBytes + s_maxEntries * sizeof(HistoryEntry) > s_globalCap)
+			return;
+		_index.resize(s_maxEntries);
+		account();
+	}
+	if (_count == _index.size())
+		evictOldest();
+	if (_liveBytes + len > _arena.size())
+		grow(_liveBytes + len);
+	if (len > _arena.size())
+		return; // no budget left for this channel
+
+	size_t start = _writePos;
+	if (start + len > _arena.size())
+	{
+		// wrap: the lines left in the skipped tail are the oldest ones
+		while (_count > 0 && entryAt(0).offset >= start)
+			evictOldest();
+		start = 0;
+	}
+	while (_count > 0 && entryAt(0).offset < start + len && entryAt(0).offset + entryAt(0).length > start)
+		evictOldest();
+
+	std::memcpy(&_arena[start], line, len);
+	HistoryEntry &e = _index[(_head + _count) % _index.size()];
+	e.when = when;
+	e.offset = start;
+	e.length = len;
+	_count++;
+	_writePos = start + len;
+	_liveBytes += len;
+}
+
+void ChannelHistory::latest(size_t limit, std::vector<std::string> &out) const
+{
+	size_t first = _count > limit ? _count - limit : 0;
+	for (size_t i = first; i < _count; ++i)
+	{
+		const HistoryEntry &e = entryAt(i);
+		out.push_back(std::string(&_arena[e.offset], e.length));
+	}
+}
+
+void ChannelHistory::after(long when, size_t limit, std::vector<std::string> &out) const
+{
+	// entries are appended in time order, binary search the first newer one
+	size_t lo = 0, hi = _count;
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (entryAt(mid).when <= when)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (size_t i = lo; i < _count && i - lo < limit; ++i)
+	{
+		const HistoryEntry &e = entryAt(i);
+		out.push_back(std::string(&_arena[e.offset], e.length));
+	}
+}
+
+void ChannelHistory::clear()
+{
+	std::vector<char>().swap(_arena);
+	std::vector<HistoryEntry>().swap(_index);
+	_head = 0;
+	_count = 0;
+	_writePos = 0;
+	_liveBytes = 0;
+	account();
+}
@@ -0,0 +1,52 @@
+#include "ChannelPool.hpp"
+
+ChannelPool::ChannelPool() : _max(64), _live(0), _created(0), _reused(0), _reclaimed(0) {}
+
+ChannelPool::~ChannelPool()
+{
+	for (size_t i = 0; i < _free.size(); ++i)
+		delete _free[i];
+}
+
+void ChannelPool::setMax(size_t max)
+{
+	_max = max;
+	while (_free.size() > _max)
+	{
+		delete _free.back();
+		_free.pop_back();
+	}
+}
+
+Channel *ChannelPool::acquire(const std::string &name)
+{
+	_created++;
+	_live++;
+	if (_free.empty())
+		return new Channel(name);
+	Channel *channel = _free.back();
+	_free.pop_back();
+	channel->reset(name);
+	_reused++;
+	return channel;
+}
+
+// The channel is cleared now, so a spare holds no members, masks or history
+void ChannelPool::release(Channel *channel)
+{
+	_reclaimed++;
+	_live--;
+	if (_free.size() >= _max)
+	{
+		delete channel;
+		return;
+	}
+	channel->reset("");
+	_free.push_back(channel);
+}
+
+size_t ChannelPool::live() const { return _live; }
+size_t ChannelPool::spare() const { return _free.size(); }
+unsigned long ChannelPool::created() const { return _created; }
+unsigned long ChannelPool::reused() const { return _reused; }
+unsigned long ChannelPool::reclaimed() const { return _reclaimed; }
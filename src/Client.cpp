@@ -1,23 +1,163 @@
 #include "Client.hpp"
+#include "StringPool.hpp"
+#include <ctime>
+#include <sstream>
+#include <algorithm>
+
+static unsigned int g_nextIdentity = 1;
 
 Client::Client(int fd_)
-    : fd(fd_), _authenticated(false), _hasPass(false), _hasNick(false), _hasUser(false),
-      _username(""), _nickname(""), _hostname(""), _servername(""), _realname(""),
-      recv_buffer(""), send_buffer("") {}
+    : fd(fd_), _linkFd(-1), _identity(g_nextIdentity++), _uidSerial(0), _nickTs(0),
+      _authenticated(false), _hasPass(false), _hasNick(false), _hasUser(false),
+      _capNegotiating(false), _caps(0), _hostname(NULL), _servername(NULL), _uidServer(NULL), _origin(NULL), recv_buffer(NULL) {}
+
+Client::Client(const Client &other)
+    : fd(other.fd), _linkFd(other._linkFd), _identity(other._identity), _uidSerial(other._uidSerial),
+      _nickTs(other._nickTs), _authenticated(other._authenticated), _hasPass(other._hasPass),
+      _hasNick(other._hasNick), _hasUser(other._hasUser), _capNegotiating(other._capNegotiating),
+      _caps(other._caps), _username(other._username),
+      _nickname(other._nickname), _realname(other._realname),
+      _hostname(other._hostname ? StringPool::intern(*other._hostname) : NULL),
+      _servername(other._servername ? StringPool::intern(*other._servername) : NULL),
+      _uidServer(other._uidServer ? StringPool::intern(*other._uidServer) : NULL),
+      _origin(other._origin ? StringPool::intern(*other._origin) : NULL),
+      recv_buffer(other.recv_buffer ? new std::string(*other.recv_buffer) : NULL) {}
+
+Client &Client::operator=(const Client &other)
+{
+    if (this != &other)
+    {
+        Client copy(other); // takes its own pool references and buffer, ours leave with it
+        fd = other.fd;
+        _linkFd = other._linkFd;
+        _identity = other._identity;
+        _uidSerial = other._uidSerial;
+        _nickTs = other._nickTs;
+        _authenticated = other._authenticated;
+        _hasPass = other._hasPass;
+        _hasNick = other._hasNick;
+        _hasUser = other._hasUser;
+        _capNegotiating = other._capNegotiating;
+        _caps = other._caps;
+        _username = other._username;
+        _nickname = other._nickname;
+        _realname = other._realname;
+        std::swap(_hostname, copy._hostname);
+        std::swap(_servername, copy._servername);
+        std::swap(_uidServer, copy._uidServer);
+        std::swap(_origin, copy._origin);
+        std::swap(recv_buffer, copy.recv_buffer);
+    }
+    return *this;
+}
+
+Client::~Client()
+{
+    StringPool::release(_hostname);
+    StringPool::release(_servername);
+    StringPool::release(_uidServer);
+    StringPool::release(_origin);
+    delete recv_buffer;
+}
+
+static void reintern(const std::string *&slot, const std::string &value)
+{
+    const std::string *next = StringPool::intern(value);
+    StringPool::release(slot);
+    slot = next;
+}
 
 int Client::getFd() const
 {
     return fd;
 }
 
-const std::string& Client::getUser() const
+std::string Client::getUser() const
+{
+    return _username.str();
+}
+
+std::string Client::getNick() const
+{
+    return _nickname.str();
+}
+
+bool Client::isNick(const std::string& nick) const
+{
+    return _nickname.equals(nick);
+}
+
+std::string Client::getRealname() const
+{
+    return _realname.str();
+}
+
+const std::string& Client::getHost() const
+{
+    static const std::string unresolved = "localhost";
+    return _hostname ? *_hostname : unresolved;
+}
+
+std::string Client::getHostmask() const
+{
+    return getNick() + "!" + getUser() + "@" + getHost();
+}
+
+unsigned int Client::getIdentity() const
+{
+    return _identity;
+}
+
+std::string Client::getUid() const
+{
+    if (_uidSerial == 0)
+        return "";
+    std::ostringstream uid;
+    uid << _uidSerial << "@" << (_uidServer ? *_uidServer : StringPool::empty());
+    return uid.str();
+}
+
+const std::string& Client::getOrigin() const
+{
+    return _origin ? *_origin : StringPool::empty();
+}
+
+int Client::getLinkFd() const
+{
+    return _linkFd;
+}
+
+bool Client::isRemote() const
+{
+    return _linkFd != -1;
+}
+
+long Client::getNickTs() const
+{
+    return _nickTs;
+}
+
+// Only "<serial>@<server>" uids are stored, anything else clears it
+void Client::setUid(const std::string& uid)
 {
-    return _username;
+    size_t at = uid.find('@');
+    unsigned long serial = 0;
+    if (at != std::string::npos && at > 0 && at + 1 < uid.size()
+        && uid.find_first_not_of("0123456789") == at)
+        serial = std::strtoul(uid.substr(0, at).c_str(), NULL, 10);
+    _uidSerial = static_cast<unsigned int>(serial);
+    reintern(_uidServer, _uidSerial ? uid.substr(at + 1) : std::string());
 }
 
-const std::string& Client::getNick() const
+void Client::setRemote(const std::string& origin, int linkFd)
 {
-    return _nickname;
+    reintern(_origin, origin);
+    _linkFd = linkFd;
+}
+
+void Client::setNickTs(long ts)
+{
+    _nickTs = ts;
 }
 
 bool Client::isAuthenticated() const
@@ -33,12 +173,12 @@ void Client::setUser(const std::string& user)
 
 void Client::setHostname(const std::string& hostname)
 {
-    _hostname = hostname;
+    reintern(_hostname, hostname);
 }
 
 void Client::setServername(const std::string& servername)
 {
-    _servername = servername;
+    reintern(_servername, servername);
 }
 
 void Client::setRealname(const std::string& realname)
@@ -50,6 +190,8 @@ void Client::setNick(const std::string& nick)
 {
     _nickname = nick;
     _hasNick = true;
+    _identity = g_nextIdentity++;
+    _nickTs = static_cast<long>(time(NULL));
 }
 
 void Client::setAuthenticated(bool auth)
@@ -59,9 +201,25 @@ void Client::setAuthenticated(bool auth)
 
 std::string& Client::getBuffer()
 {
-    return recv_buffer;
+    if (!recv_buffer)
+        recv_buffer = new std::string();
+    return *recv_buffer;
+}
+
+bool Client::hasBufferedInput() const
+{
+    return recv_buffer && !recv_buffer->empty();
+}
+
+// Idle clients give the buffer back once every complete line has been handled
+void Client::releaseBuffer()
+{
+    if (recv_buffer && recv_buffer->empty())
+    {
+        delete recv_buffer;
+        recv_buffer = NULL;
+    }
 }
-Client::~Client() {}
 
 void Client::setPass(bool val)
 {
@@ -73,11 +231,43 @@ void Client::setHasNick(bool val)
     _hasNick = val;
 }
 
+// A refused nick must not stay behind: getFdByNick sees unregistered clients too
+void Client::clearNick()
+{
+    _nickname = std::string();
+    _hasNick = false;
+}
+
 void Client::setHasUser(bool val)
 {
     _hasUser = val;
 }
 
+unsigned int Client::getCaps() const
+{
+    return _caps;
+}
+
+bool Client::hasCap(Capability cap) const
+{
+    return (_caps & cap) != 0;
+}
+
+void Client::setCaps(unsigned int caps)
+{
+    _caps = caps & 0x3F;
+}
+
+bool Client::isNegotiatingCaps() const
+{
+    return _capNegotiating;
+}
+
+void Client::setNegotiatingCaps(bool val)
+{
+    _capNegotiating = val;
+}
+
 bool Client::hasPass() const
 {
     return _hasPass;
@@ -0,0 +1,130 @@
+#include "CommandStats.hpp"
+#include <sstream>
+#include <cstring>
+#include <time.h>
+
+LatencyHistogram::LatencyHistogram() : _total(0), _sum(0), _max(0)
+{
+	std::memset(_counts, 0, sizeof(_counts));
+}
+
+int LatencyHistogram::bucketFor(unsigned long value)
+{
+	// Values below 2 * SUB_COUNT get an exact bucket each
+	if (value < (unsigned long)(2 * SUB_COUNT))
+		return static_cast<int>(value);
+	int msb = 0;
+	for (unsigned long v = value; v > 1; v >>= 1)
+		++msb;
+	int shift = msb - SUB_BITS;
+	int top = static_cast<int>(value >> shift); // in [SUB_COUNT, 2 * SUB_COUNT)
+	return (shift + 1) * SUB_COUNT + (top - SUB_COUNT);
+}
+
+unsigned long LatencyHistogram::bucketHigh(int bucket)
+{
+	if (bucket < 2 * SUB_COUNT)
+		return static_cast<unsigned long>(bucket);
+	int shift = bucket / SUB_COUNT - 1;
+	unsigned long top = static_cast<unsigned long>(bucket % SUB_COUNT + SUB_COUNT);
+	return ((top + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(unsigned long value)
+{
+	_counts[bucketFor(value)]++;
+	_total++;
+	_sum += value;
+	if (value > _max)
+		_max = value;
+}
+
+unsigned long LatencyHistogram::percentile(double p) const
+{
+	if (_total == 0)
+		return 0;
+	unsigned long rank = static_cast<unsigned long>(p / 100.0 * _total);
+	if (rank >= _total)
+		rank = _total - 1;
+	unsigned long seen = 0;
+	for (int i = 0; i < BUCKETS; ++i)
+	{
+		seen += _counts[i];
+		if (seen > rank)
+		{
+			unsigned long high = bucketHigh(i);
+			return high < _max ? high : _max;
+		}
+	}
+	return _max;
+}
+
+unsigned long LatencyHistogram::count() const { return _total; }
+unsigned long LatencyHistogram::mean() const { return _total ? _sum / _total : 0; }
+unsigned long LatencyHistogram::max() const { return _max; }
+
+CommandStats::CommandStats() : _slowUs(10000) {}
+
+unsigned long CommandStats::nowMicros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<unsigned long>(ts.tv_sec) * 1000000UL + ts.tv_nsec / 1000;
+}
+
+void CommandStats::setSlowThreshold(unsigned long us) { _slowUs = us; }
+unsigned long CommandStats::getSlowThreshold() const { return _slowUs; }
+
+bool CommandStats::record(const std::string &verb, unsigned long us)
+{
+	std::map<std::string, LatencyHistogram>::iterator it = _byVerb.find(verb);
+	if (it == _byVerb.end())
+	{
+		const std::string key = _byVerb.size() < MAX_VERBS ? verb : "OTHER";
+		it = _byVerb.insert(std::make_pair(key, LatencyHistogram())).first;
+	}
+	it->second.record(us);
+	return us >= _slowUs;
+}
+
+std::vector<std::string> CommandStats::report() const
+{
+	std::vector<std::string> lines;
+	for (std::map<std::string, LatencyHistogram>::const_iterator it = _byVerb.begin(); it != _byVerb.end(); ++it)
+	{
+		const LatencyHistogram &h = it->second;
+		std::ostringstream ss;
+		ss << it->first << " " << h.count() << " " << h.mean() << " " << h.percentile(50)
+		   << " " << h.percentile(90) << " " << h.percentile(99) << " " << h.max();
+		lines.push_back(ss.str());
+	}
+	return lines;
+}
+
+void CommandStats::recordAllocations(const std::string &verb, unsigned long allocations, unsigned long bytes)
+{
+	std::map<std::string, AllocCount>::iterator it = _allocByVerb.find(verb);
+	if (it == _allocByVerb.end())
+	{
+		const std::string key = _allocByVerb.size() < MAX_VERBS ? verb : "OTHER";
+		AllocCount zero = { 0, 0, 0 };
+		it = _allocByVerb.insert(std::make_pair(key, zero)).first;
+	}
+	it->second.commands++;
+	it->second.allocations += allocations;
+	it->second.bytes += bytes;
+}
+
+std::vector<std::string> CommandStats::allocationReport() const
+{
+	std::vector<std::string> lines;
+	for (std::map<std::string, AllocCount>::const_iterator it = _allocByVerb.begin(); it != _allocByVerb.end(); ++it)
+	{
+		const AllocCount &c = it->second;
+		std::ostringstream ss;
+		ss << it->first << " " << c.commands << " " << c.allocations << " " << c.bytes << " "
+		   << static_cast<double>(c.allocations) / c.commands << " " << static_cast<double>(c.bytes) / c.commands;
+		lines.push_back(ss.str());
+	}
+	return lines;
+}
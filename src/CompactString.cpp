@@ -0,0 +1,108 @@
+#include "CompactString.hpp"
+#include <cstring>
+
+CompactString::CompactString()
+{
+	std::memset(_bytes, 0, sizeof(_bytes));
+}
+
+CompactString::CompactString(const std::string &value)
+{
+	std::memset(_bytes, 0, sizeof(_bytes));
+	assign(value.data(), value.size());
+}
+
+CompactString::CompactString(const CompactString &other)
+{
+	std::memset(_bytes, 0, sizeof(_bytes));
+	assign(other.data(), other.size());
+}
+
+CompactString &CompactString::operator=(const CompactString &other)
+{
+	if (this != &other)
+	{
+		std::string copy = other.str(); // other may point into our own heap buffer
+		clear();
+		assign(copy.data(), copy.size());
+	}
+	return *this;
+}
+
+CompactString &CompactString::operator=(const std::string &value)
+{
+	std::string copy = value;
+	clear();
+	assign(copy.data(), copy.size());
+	return *this;
+}
+
+CompactString::~CompactString()
+{
+	clear();
+}
+
+bool CompactString::isHeap() const
+{
+	return _bytes[15] != 0;
+}
+
+char *CompactString::heapPtr() const
+{
+	char *ptr;
+	std::memcpy(&ptr, _bytes, sizeof(ptr));
+	return ptr;
+}
+
+void CompactString::assign(const char *data, size_t len)
+{
+	if (len <= INLINE_CAPACITY)
+	{
+		std::memcpy(_bytes, data, len);
+		_bytes[14] = static_cast<char>(len);
+		_bytes[15] = 0;
+		return;
+	}
+	char *ptr = new char[len];
+	std::memcpy(ptr, data, len);
+	unsigned int size = static_cast<unsigned int>(len);
+	std::memcpy(_bytes, &ptr, sizeof(ptr));
+	std::memcpy(_bytes + sizeof(ptr), &size, sizeof(size));
+	_bytes[15] = 1;
+}
+
+void CompactString::clear()
+{
+	if (isHeap())
+		delete[] heapPtr();
+	std::memset(_bytes, 0, sizeof(_bytes));
+}
+
+const char *CompactString::data() const
+{
+	return isHeap() ? heapPtr() : _bytes;
+}
+
+size_t CompactString::size() const
+{
+	if (!isHeap())
+		return static_cast<unsigned char>(_bytes[14]);
+	unsigned int size;
+	std::memcpy(&size, _bytes + sizeof(char *), sizeof(size));
+	return size;
+}
+
+bool CompactString::empty() const
+{
+	return size() == 0;
+}
+
+std::string CompactString::str() const
+{
+	return std::string(data(), size());
+}
+
+bool CompactString::equals(const std::string &value) const
+{
+	return value.size() == size() && std::memcmp(value.data(), data(), value.size()) == 0;
+}
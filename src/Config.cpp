@@ -0,0 +1,24 @@
+#include "Config.hpp"
+#include <cstdlib>
+#include <cerrno>
+
+long configLong(const char *name, long def)
+{
+	const char *val = std::getenv(name);
+	if (!val || !*val)
+		return def;
+	char *end = NULL;
+	errno = 0;
+	long n = std::strtol(val, &end, 10);
+	if (errno != 0 || *end != '\0')
+		return def;
+	return n;
+}
+
+std::string configStr(const char *name, const std::string &def)
+{
+	const char *val = std::getenv(name);
+	if (!val || !*val)
+		return def;
+	return std::string(val);
+}
@@ -0,0 +1,232 @@
+#include "ContentFilter.hpp"
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <deque>
+
+static unsigned char fold(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+}
+
+ContentFilter::ContentFilter()
+{
+	compile();
+}
+
+bool ContentFilter::load(const std::string &path, std::string &error)
+{
+	std::ifstream in(path.c_str());
+	if (!in)
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+	clear();
+	std::string text;
+	for (int line = 1; std::getline(in, text); ++line)
+	{
+		if (!text.empty() && text[text.size() - 1] == '\r')
+			text.erase(text.size() - 1);
+		size_t start = text.find_first_not_of(" \t");
+		if (start == std::string::npos || text[start] == '#')
+			continue;
+		size_t end = text.find_first_of(" \t", start);
+		std::string word = text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+		size_t phrase = end == std::string::npos ? std::string::npos : text.find_first_not_of(" \t", end);
+		FilterAction action = word == "notify" ? FILTER_NOTIFY : word == "drop" ? FILTER_DROP
+							: word == "kill" ? FILTER_KILL : FILTER_PASS;
+		if (action == FILTER_PASS || phrase == std::string::npos)
+		{
+			std::ostringstream msg;
+			msg << path << ":" << line << ": expected <notify|drop|kill> <phrase>";
+			error = msg.str();
+			clear();
+			return false;
+		}
+		add(action, text.substr(phrase), line);
+	}
+	compile();
+	return true;
+}
+
+void ContentFilter::add(FilterAction action, const std::string &pattern, int line)
+{
+	FilterRule rule;
+	rule.action = action;
+	rule.pattern = pattern;
+	rule.line = line;
+	_rules.push_back(rule);
+}
+
+// Trie of the folded phrases, failure links breadth first, then the flat layout
+void ContentFilter::compile()
+{
+	std::vector<std::map<unsigned char, unsigned int> > children(1);
+	std::vector<unsigned char> action(1, FILTER_PASS);
+	std::vector<int> rule(1, -1);
+	for (size_t r = 0; r < _rules.size(); ++r)
+	{
+		const std::string &pattern = _rules[r].pattern;
+		if (pattern.empty())
+			continue;
+		unsigned int state = 0;
+		for (size_t i = 0; i < pattern.size(); ++i)
+		{
+			unsigned char c = fold(static_cast<unsigned char>(pattern[i]));
+			std::map<unsigned char, unsigned int>::iterator next = children[state].find(c);
+			if (next != children[state].end())
+			{
+				state = next->second;
+				continue;
+			}
+			unsigned int created = static_cast<unsigned int>(children.size());
+			children[state][c] = created;
+			children.push_back(std::map<unsigned char, unsigned int>());
+			action.push_back(FILTER_PASS);
+			rule.push_back(-1);
+			state = created;
+		}
+		if (_rules[r].action > action[state])
+		{
+			action[state] = static_cast<unsigned char>(_rules[r].action);
+			rule[state] = static_cast<int>(r);
+		}
+	}
+
+	size_t count = children.size();
+	_fail.assign(count, 0);
+	std::deque<unsigned int> queue;
+	for (std::map<unsigned char, unsigned int>::iterator it = children[0].begin(); it != children[0].end(); ++it)
+		queue.push_back(it->second);
+	while (!queue.empty())
+	{
+		unsigned int state = queue.front();
+		queue.pop_front();
+		// a phrase ending at the failure state also ends here
+		unsigned int fail = _fail[state];
+		if (action[fail] > action[state])
+		{
+			action[state] = action[fail];
+			rule[state] = rule[fail];
+		}
+		for (std::map<unsigned char, unsigned int>::iterator it = children[state].begin(); it != children[state].end(); ++it)
+		{
+			unsigned int f = fail;
+			std::map<unsigned char, unsigned int>::iterator next;
+			while ((next = children[f].find(it->first)) == children[f].end() && f != 0)
+				f = _fail[f];
+			_fail[it->second] = next != children[f].end() ? next->second : 0;
+			queue.push_back(it->second);
+		}
+	}
+
+	_edgeStart.assign(count + 1, 0);
+	_edgeByte.clear();
+	_edgeTarget.clear();
+	for (size_t s = 0; s < count; ++s)
+	{
+		_edgeStart[s] = static_cast<unsigned int>(_edgeByte.size());
+		if (s == 0)
+			continue; // the root uses _root
+		for (std::map<unsigned char, unsigned int>::iterator it = children[s].begin(); it != children[s].end(); ++it)
+		{
+			_edgeByte.push_back(it->first);
+			_edgeTarget.push_back(it->second);
+		}
+	}
+	_edgeStart[count] = static_cast<unsigned int>(_edgeByte.size());
+	_root.assign(256, 0);
+	for (std::map<unsigned char, unsigned int>::iterator it = children[0].begin(); it != children[0].end(); ++it)
+		_root[it->first] = it->second;
+	_action.swap(action);
+	_rule.swap(rule);
+}
+
+void ContentFilter::clear()
+{
+	_rules.clear();
+	compile();
+}
+
+void ContentFilter::swap(ContentFilter &other)
+{
+	_rules.swap(other._rules);
+	_edgeStart.swap(other._edgeStart);
+	_edgeByte.swap(other._edgeByte);
+	_edgeTarget.swap(other._edgeTarget);
+	_fail.swap(other._fail);
+	_action.swap(other._action);
+	_rule.swap(other._rule);
+	_root.swap(other._root);
+}
+
+bool ContentFilter::empty() const
+{
+	return _action.size() <= 1;
+}
+
+size_t ContentFilter::size() const
+{
+	return _rules.size();
+}
+
+size_t ContentFilter::states() const
+{
+	return _action.size();
+}
+
+// Memory held by the automaton, rules not counted
+size_t ContentFilter::bytes() const
+{
+	return _edgeStart.size() * sizeof(unsigned int) + _edgeByte.size() + _edgeTarget.size() * sizeof(unsigned int)
+		 + _fail.size() * sizeof(unsigned int) + _action.size() + _rule.size() * sizeof(int)
+		 + _root.size() * sizeof(unsigned int);
+}
+
+// Goto, following failure links until a state has an edge for c. States have
+// few edges, so a linear look beats a binary search.
+unsigned int ContentFilter::step(unsigned int state, unsigned char c) const
+{
+	while (state != 0)
+	{
+		for (unsigned int e = _edgeStart[state]; e < _edgeStart[state + 1]; ++e)
+		{
+			if (_edgeByte[e] == c)
+				return _edgeTarget[e];
+			if (_edgeByte[e] > c)
+				break;
+		}
+		state = _fail[state];
+	}
+	return _root[c];
+}
+
+FilterAction ContentFilter::scan(const char *text, size_t len, const FilterRule *&rule) const
+{
+	FilterAction best = FILTER_PASS;
+	unsigned int state = 0;
+	for (size_t i = 0; i < len; ++i)
+	{
+		state = step(state, fold(static_cast<unsigned char>(text[i])));
+		if (_action[state] > best)
+		{
+			best = static_cast<FilterAction>(_action[state]);
+			rule = &_rules[_rule[state]];
+			if (best == FILTER_KILL)
+				break;
+		}
+	}
+	return best;
+}
+
+const char *ContentFilter::actionName(FilterAction action)
+{
+	switch (action)
+	{
+		case FILTER_NOTIFY: return "notify";
+		case FILTER_DROP: return "drop";
+		case FILTER_KILL: return "kill";
+		default: return "pass";
+	}
+}
@@ -0,0 +1,112 @@
+#include "Endpoint.hpp"
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+
+Endpoint::Endpoint() : family(AF_UNSPEC), dualStack(false), port(0), len(0)
+{
+	std::memset(&addr, 0, sizeof(addr));
+}
+
+static bool parsePort(const std::string &text, int &port)
+{
+	if (text.empty() || text.size() > 5 || text.find_first_not_of("0123456789") != std::string::npos)
+		return false;
+	port = std::atoi(text.c_str());
+	return port > 0 && port <= 65535;
+}
+
+bool Endpoint::numeric(const std::string &host, int port, Endpoint &endpoint)
+{
+	endpoint = Endpoint();
+	endpoint.port = port;
+	std::string ip = host == "localhost" ? "127.0.0.1" : host;
+	struct sockaddr_in *v4 = reinterpret_cast<struct sockaddr_in *>(&endpoint.addr);
+	struct sockaddr_in6 *v6 = reinterpret_cast<struct sockaddr_in6 *>(&endpoint.addr);
+	if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1)
+	{
+		v4->sin_family = AF_INET;
+		v4->sin_port = htons(static_cast<unsigned short>(port));
+		endpoint.len = sizeof(*v4);
+	}
+	else if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1)
+	{
+		v6->sin6_family = AF_INET6;
+		v6->sin6_port = htons(static_cast<unsigned short>(port));
+		endpoint.len = sizeof(*v6);
+	}
+	else
+		return false;
+	endpoint.family = endpoint.addr.ss_family;
+	return true;
+}
+
+bool Endpoint::parse(const std::string &spec, Endpoint &endpoint)
+{
+	endpoint = Endpoint();
+	if (spec.compare(0, 5, "unix:") == 0)
+	{
+		struct sockaddr_un *un = reinterpret_cast<struct sockaddr_un *>(&endpoint.addr);
+		std::string path = spec.substr(5);
+		if (path.empty() || path.size() >= sizeof(un->sun_path))
+			return false;
+		un->sun_family = AF_UNIX;
+		std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+		endpoint.family = AF_UNIX;
+		endpoint.len = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.size() + 1);
+		endpoint.text = spec;
+		return true;
+	}
+	int port;
+	if (parsePort(spec, port)) // bare port: the dual-stack wildcard
+	{
+		if (!numeric("::", port, endpoint))
+			return false;
+		endpoint.dualStack = true;
+		endpoint.text = spec;
+		return true;
+	}
+	size_t colon = spec.rfind(':');
+	if (colon == std::string::npos || !parsePort(spec.substr(colon + 1), port))
+		return false;
+	std::string host = spec.substr(0, colon);
+	if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']')
+		host = host.substr(1, host.size() - 2);
+	else if (host.find(':') != std::string::npos) // IPv6 needs its brackets
+		return false;
+	if (!numeric(host, port, endpoint))
+		return false;
+	endpoint.text = spec;
+	return true;
+}
+
+std::string Endpoint::host(const struct sockaddr_storage &peer, int &port)
+{
+	char text[INET6_ADDRSTRLEN];
+	port = 0;
+	if (peer.ss_family == AF_INET)
+	{
+		const struct sockaddr_in *v4 = reinterpret_cast<const struct sockaddr_in *>(&peer);
+		port = ntohs(v4->sin_port);
+		return inet_ntop(AF_INET, &v4->sin_addr, text, sizeof(text)) ? text : "";
+	}
+	if (peer.ss_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *v6 = reinterpret_cast<const struct sockaddr_in6 *>(&peer);
+		port = ntohs(v6->sin6_port);
+		if (IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr)) // ::ffff:1.2.3.4
+			return inet_ntop(AF_INET, &v6->sin6_addr.s6_addr[12], text, sizeof(text)) ? text : "";
+		return inet_ntop(AF_INET6, &v6->sin6_addr, text, sizeof(text)) ? text : "";
+	}
+	return "";
+}
+
+std::string Endpoint::path() const
+{
+	if (family != AF_UNIX)
+		return "";
+	return reinterpret_cast<const struct sockaddr_un *>(&addr)->sun_path;
+}
@@ -0,0 +1,60 @@
+#include "FanOut.hpp"
+#include <algorithm>
+
+FanOut::FanOut(Arena *arena)
+	: _fds(ArenaAllocator<int>(arena)), _excluded(ArenaAllocator<int>(arena)), _sources(0), _resolved(false) {}
+
+void FanOut::addChannel(const Channel &channel)
+{
+	const std::vector<struct Member> &members = channel.getMembers();
+	_fds.reserve(_fds.size() + members.size());
+	for (size_t i = 0; i < members.size(); ++i)
+		_fds.push_back(members[i].fd);
+	_sources++;
+	_resolved = false;
+}
+
+void FanOut::addFd(int fd)
+{
+	_fds.push_back(fd);
+	_sources++;
+	_resolved = false;
+}
+
+void FanOut::exclude(int fd)
+{
+	_excluded.push_back(fd);
+	_resolved = false;
+}
+
+void FanOut::exclude(const FdList &fds)
+{
+	_excluded.insert(_excluded.end(), fds.begin(), fds.end());
+	_resolved = false;
+}
+
+const FanOut::FdList &FanOut::recipients()
+{
+	if (_resolved)
+		return _fds;
+	// a single channel has no duplicates, only sort when merging sources
+	if (_sources > 1)
+	{
+		std::sort(_fds.begin(), _fds.end());
+		_fds.erase(std::unique(_fds.begin(), _fds.end()), _fds.end());
+	}
+	if (!_excluded.empty())
+	{
+		std::sort(_excluded.begin(), _excluded.end());
+		size_t out = 0;
+		for (size_t i = 0; i < _fds.size(); ++i)
+		{
+			if (!std::binary_search(_excluded.begin(), _excluded.end(), _fds[i]))
+				_fds[out++] = _fds[i];
+		}
+		_fds.resize(out);
+		_excluded.clear();
+	}
+	_resolved = true;
+	return _fds;
+}
@@ -0,0 +1,92 @@
+#include "FaultInjection.hpp"
+#include "Config.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+
+static unsigned long	s_perMillion[FaultInjection::KINDS];
+static unsigned long	s_injected[FaultInjection::KINDS];
+static unsigned long	s_state = 1; // xorshift, fixed by IRC_FAULT_SEED for a reproducible run
+
+static unsigned long nextRandom()
+{
+	unsigned long x = s_state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	s_state = x;
+	return x;
+}
+
+static bool roll(FaultInjection::Kind kind)
+{
+	if (!s_perMillion[kind] || nextRandom() % 1000000 >= s_perMillion[kind])
+		return false;
+	s_injected[kind]++;
+	return true;
+}
+
+static ssize_t fail(int error)
+{
+	errno = error;
+	return -1;
+}
+
+// A percentage of calls, fractions allowed ("0.01")
+static unsigned long rate(const char *name)
+{
+	double percent = std::strtod(configStr(name, "0").c_str(), NULL);
+	if (percent <= 0)
+		return 0;
+	return percent >= 100 ? 1000000 : static_cast<unsigned long>(percent * 10000);
+}
+
+void FaultInjection::configure()
+{
+	s_perMillion[RECV_SPLIT] = rate("IRC_FAULT_RECV_SPLIT");
+	s_perMillion[RECV_EAGAIN] = rate("IRC_FAULT_RECV_EAGAIN");
+	s_perMillion[SEND_SHORT] = rate("IRC_FAULT_SEND_SHORT");
+	s_perMillion[SEND_EAGAIN] = rate("IRC_FAULT_SEND_EAGAIN");
+	s_perMillion[CONN_RESET] = rate("IRC_FAULT_RESET");
+	long seed = configLong("IRC_FAULT_SEED", 0);
+	s_state = seed ? static_cast<unsigned long>(seed)
+				   : static_cast<unsigned long>(std::time(NULL)) ^ (static_cast<unsigned long>(getpid()) << 16);
+	if (!s_state)
+		s_state = 1;
+}
+
+// A split read asks the kernel for fewer bytes; the rest stays queued and
+// poll reports the socket readable again
+ssize_t FaultInjection::recv(int fd, void *buf, size_t len, int flags)
+{
+	if (roll(CONN_RESET))
+		return fail(ECONNRESET);
+	if (roll(RECV_EAGAIN))
+		return fail(EAGAIN);
+	if (len > 1 && roll(RECV_SPLIT))
+		len = 1 + nextRandom() % (len - 1);
+	return ::recv(fd, buf, len, flags);
+}
+
+ssize_t FaultInjection::send(int fd, const void *buf, size_t len, int flags)
+{
+	if (roll(CONN_RESET))
+		return fail(ECONNRESET);
+	if (roll(SEND_EAGAIN))
+		return fail(EAGAIN);
+	if (len > 1 && roll(SEND_SHORT))
+		len = 1 + nextRandom() % (len - 1);
+	return ::send(fd, buf, len, flags);
+}
+
+unsigned long FaultInjection::injected(Kind kind)
+{
+	return s_injected[kind];
+}
+
+const char *FaultInjection::name(Kind kind)
+{
+	static const char *names[KINDS] = { "recv_split", "recv_eagain", "send_short", "send_eagain", "reset" };
+	return names[kind];
+}
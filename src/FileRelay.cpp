@@ -0,0 +1,181 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE // splice(2)
+#endif
+#include "FileRelay.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+FileRelay::FileRelay() : _from(-1), _to(-1), _size(0), _received(0), _sent(0), _rate(0), _allowance(0),
+	_refilledAt(0), _state(FAILED), _error(NULL)
+{
+	_pipe[0] = -1;
+	_pipe[1] = -1;
+}
+
+bool FileRelay::start(int from, int to, unsigned long size, unsigned long rate, unsigned long nowUs)
+{
+	_from = from;
+	_to = to;
+	_size = size;
+	_received = 0;
+	_sent = 0;
+	_rate = rate;
+	_allowance = rate / 8; // a full bucket to start with
+	_refilledAt = nowUs;
+	_error = NULL;
+	_state = READING;
+#ifdef __linux__
+	if (pipe(_pipe) < 0)
+	{
+		fail("No pipe for the transfer");
+		return false;
+	}
+	fcntl(_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(_pipe[1], F_SETFL, O_NONBLOCK);
+	return true;
+#else
+	fail("File transfers need splice(2), which is Linux only");
+	return false;
+#endif
+}
+
+void FileRelay::stop()
+{
+	for (int i = 0; i < 2; ++i)
+		if (_pipe[i] != -1)
+			close(_pipe[i]);
+	_pipe[0] = _pipe[1] = -1;
+}
+
+// The bucket holds at most an eighth of a second of allowance, so a
+// throttled transfer wakes the loop about eight times a second
+void FileRelay::refill(unsigned long nowUs)
+{
+	if (_rate == 0 || nowUs <= _refilledAt)
+		return;
+	unsigned long burst = _rate / 8 > 0 ? _rate / 8 : 1;
+	unsigned long elapsed = nowUs - _refilledAt;
+	if (elapsed > 1000000UL)
+		elapsed = 1000000UL;
+	unsigned long gain = elapsed * _rate / 1000000UL;
+	if (gain == 0)
+		return; // keep _refilledAt so the fraction is not lost
+	_allowance = _allowance + gain > burst ? burst : _allowance + gain;
+	_refilledAt = nowUs;
+}
+
+FileRelay::State FileRelay::fail(const char *error)
+{
+	_error = error;
+	return _state = FAILED;
+}
+
+FileRelay::State FileRelay::pump(unsigned long nowUs, size_t maxBytes)
+{
+	if (_state == DONE || _state == FAILED)
+		return _state;
+	refill(nowUs);
+#ifdef __linux__
+	size_t moved = 0;
+	for (;;)
+	{
+		if (_sent < _received) // the pipe is drained before more is read, so it never fills up
+		{
+			ssize_t n = splice(_pipe[0], NULL, _to, NULL, _received - _sent, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0 && errno == EAGAIN)
+				return _state = WRITING;
+			if (n <= 0)
+				return fail("Receiver connection lost");
+			_sent += n;
+			continue;
+		}
+		if (_received == _size)
+			return _state = DONE;
+		if (moved >= maxBytes)
+			return _state = READING; // poll reports the sender again on the next iteration
+		size_t want = _size - _received;
+		if (want > CHUNK)
+			want = CHUNK;
+		if (want > maxBytes - moved)
+			want = maxBytes - moved;
+		if (_rate > 0)
+		{
+			if (_allowance == 0)
+				return _state = THROTTLED;
+			if (want > _allowance)
+				want = _allowance;
+		}
+		ssize_t n = splice(_from, NULL, _pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return _state = READING;
+		if (n == 0)
+			return fail("Sender closed before the end of the file");
+		if (n < 0)
+			return fail("Sender connection lost");
+		_received += n;
+		moved += n;
+		if (_rate > 0)
+			_allowance -= n;
+	}
+#else
+	(void)maxBytes;
+	return fail("File transfers need splice(2), which is Linux only");
+#endif
+}
+
+FileRelay::State FileRelay::state() const
+{
+	return _state;
+}
+
+// What the loop has to poll each socket for in the current state
+short FileRelay::events(int fd) const
+{
+	if (_state == READING && fd == _from)
+		return POLLIN;
+	if (_state == WRITING && fd == _to)
+		return POLLOUT;
+	return 0;
+}
+
+// When a THROTTLED transfer has allowance for another chunk (or its tail)
+unsigned long FileRelay::resumeAt() const
+{
+	if (_rate == 0)
+		return _refilledAt;
+	unsigned long burst = _rate / 8 > 0 ? _rate / 8 : 1;
+	unsigned long need = _size - _received < burst ? _size - _received : burst;
+	need = need > _allowance ? need - _allowance : 0;
+	return _refilledAt + (need * 1000000UL + _rate - 1) / _rate;
+}
+
+bool FileRelay::allReceived() const
+{
+	return _received == _size;
+}
+
+unsigned long FileRelay::sent() const
+{
+	return _sent;
+}
+
+int FileRelay::from() const
+{
+	return _from;
+}
+
+int FileRelay::to() const
+{
+	return _to;
+}
+
+const char *FileRelay::error() const
+{
+	return _error;
+}
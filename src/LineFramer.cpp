@@ -0,0 +1,98 @@
+#include "LineFramer.hpp"
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+const unsigned char IrcChars::table[256] = {
+	0x00, 0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x10, 0x08, 0x00, 0x00, 0x08, 0x00, 0x10,	// 0x00
+	0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x10, 0x10,	// 0x10
+	0x00, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x07, 0x04, 0x04,	// 0x20
+	0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x00, 0x04, 0x04, 0x04, 0x04, 0x04,	// 0x30
+	0x04, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07,	// 0x40
+	0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07,	// 0x50
+	0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07,	// 0x60
+	0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x04, 0x04,	// 0x70
+	0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,	// 0x80
+	0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,	// 0x90
+	0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,	// 0xa0
+	0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,	// 0xb0
+	0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,	// 0xc0
+	0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,	// 0xd0
+	0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,	// 0xe0
+	0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,	// 0xf0
+};
+
+bool IrcChars::isNick(StringRef nick)
+{
+	if (nick.empty() || !is(nick[0], NICK_FIRST))
+		return false;
+	for (size_t i = 1; i < nick.size(); ++i)
+		if (!is(nick[i], NICK))
+			return false;
+	return true;
+}
+
+bool IrcChars::isChannel(StringRef name)
+{
+	if (name.size() < 2 || name[0] != '#')
+		return false;
+	for (size_t i = 1; i < name.size(); ++i)
+		if (!is(name[i], CHANNEL))
+			return false;
+	return true;
+}
+
+// One byte below 0x20 at pos: it ends the current line or, unless it is a
+// formatting code, taints it
+static inline void control(const char *data, size_t pos, size_t &start, bool &clean, LineFramer::Lines &lines)
+{
+	if (!IrcChars::is(data[pos], IrcChars::TERMINATOR))
+	{
+		clean = clean && IrcChars::is(data[pos], IrcChars::FORMAT);
+		return;
+	}
+	if (pos > start)
+	{
+		LineFramer::Line line = { start, pos - start, clean };
+		lines.push_back(line);
+	}
+	start = pos + 1;
+	clean = true;
+}
+
+size_t LineFramer::scan(const char *data, size_t len, Lines &lines)
+{
+#ifdef __SSE2__
+	size_t start = 0;
+	bool clean = true;
+	size_t i = 0;
+	const __m128i limit = _mm_set1_epi8(0x1F);
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+		// unsigned b <= 0x1F exactly when max(b, 0x1F) == 0x1F
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(block, limit), limit));
+		while (mask)
+		{
+			control(data, i + __builtin_ctz(mask), start, clean, lines);
+			mask &= mask - 1;
+		}
+	}
+	for (; i < len; ++i)
+		if (static_cast<unsigned char>(data[i]) < 0x20)
+			control(data, i, start, clean, lines);
+	return start;
+#else
+	return scanScalar(data, len, lines);
+#endif
+}
+
+size_t LineFramer::scanScalar(const char *data, size_t len, Lines &lines)
+{
+	size_t start = 0;
+	bool clean = true;
+	for (size_t i = 0; i < len; ++i)
+		if (static_cast<unsigned char>(data[i]) < 0x20)
+			control(data, i, start, clean, lines);
+	return start;
+}
@@ -0,0 +1,138 @@
+#include "LoadShedder.hpp"
+
+LoadShedder::LoadShedder() : _lagUs(0), _queued(0), _windowUs(100000), _holdUs(2000000), _windowEnd(0), _windowMax(0),
+	_windowQueued(0), _lag(0), _depth(0), _calmSince(0), _stage(NORMAL)
+{
+	for (int i = 0; i < STAGES; ++i)
+	{
+		_entered[i] = 0;
+		_actions[i] = 0;
+	}
+}
+
+void LoadShedder::configure(unsigned long lagUs, size_t queued, unsigned long windowUs, unsigned long holdUs)
+{
+	_lagUs = lagUs;
+	_queued = queued;
+	_windowUs = windowUs ? windowUs : 1;
+	_holdUs = holdUs;
+}
+
+bool LoadShedder::enabled() const
+{
+	return _lagUs != 0;
+}
+
+// Highest stage the signals reach, with the readings multiplied by scale
+// (2 asks whether they are still above half the thresholds)
+LoadShedder::Stage LoadShedder::target(unsigned long scale) const
+{
+	int stage = NORMAL;
+	for (int k = DEFER_ACCEPTS; k < STAGES; ++k)
+	{
+		bool lagged = _lag * scale >= _lagUs << (k - 1);
+		bool queued = _queued && _depth * scale >= _queued << (k - 1);
+		if (lagged || queued)
+			stage = k;
+	}
+	return static_cast<Stage>(stage);
+}
+
+bool LoadShedder::closeWindow(unsigned long nowUs)
+{
+	_lag = (_lag * 3 + _windowMax) / 4;
+	_depth = _windowQueued;
+	_windowMax = 0;
+	_windowQueued = 0;
+	_windowEnd += _windowUs;
+	// windows without an iteration (the loop slept through them) count as idle
+	for (int idle = 0; _windowEnd <= nowUs; ++idle)
+	{
+		if (idle == 64)
+		{
+			_lag = 0;
+			_windowEnd = nowUs + _windowUs;
+			break;
+		}
+		_lag = _lag * 3 / 4;
+		_depth = 0;
+		_windowEnd += _windowUs;
+	}
+	Stage up = target(1);
+	if (up > _stage)
+	{
+		_stage = up;
+		_entered[up]++;
+		_calmSince = 0;
+		return true;
+	}
+	if (target(2) >= _stage)
+	{
+		_calmSince = 0;
+		return false;
+	}
+	if (_calmSince == 0)
+		_calmSince = nowUs;
+	if (nowUs - _calmSince < _holdUs)
+		return false;
+	_stage = static_cast<Stage>(_stage - 1);
+	_calmSince = nowUs; // the next step down waits a full hold again
+	return true;
+}
+
+bool LoadShedder::sample(unsigned long busyUs, size_t queued, unsigned long nowUs)
+{
+	if (!enabled())
+		return false;
+	if (_windowEnd == 0)
+		_windowEnd = nowUs + _windowUs;
+	if (busyUs > _windowMax)
+		_windowMax = busyUs;
+	if (queued > _windowQueued)
+		_windowQueued = queued;
+	if (nowUs < _windowEnd)
+		return false;
+	return closeWindow(nowUs);
+}
+
+LoadShedder::Stage LoadShedder::stage() const
+{
+	return _stage;
+}
+
+unsigned long LoadShedder::lag() const
+{
+	return _lag;
+}
+
+size_t LoadShedder::depth() const
+{
+	return _depth;
+}
+
+unsigned long LoadShedder::window() const
+{
+	return _windowUs;
+}
+
+void LoadShedder::note(Stage stage)
+{
+	_actions[stage]++;
+}
+
+unsigned long LoadShedder::entered(Stage stage) const
+{
+	return _entered[stage];
+}
+
+unsigned long LoadShedder::actions(Stage stage) const
+{
+	return _actions[stage];
+}
+
+const char *LoadShedder::name(Stage stage)
+{
+	static const char *names[STAGES] = { "normal", "defer-accepts", "reject-connections", "deprioritize-unregistered",
+										 "refuse-expensive" };
+	return names[stage];
+}
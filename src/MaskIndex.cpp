@@ -0,0 +1,312 @@
+#include "MaskIndex.hpp"
+#include <algorithm>
+
+MaskIndex::MaskIndex() : _maxPrefix(0), _maxSuffix(0), _generation(0) {}
+
+MaskIndex::MaskIndex(const MaskIndex &other) : _maxPrefix(0), _maxSuffix(0), _generation(0)
+{
+	*this = other;
+}
+
+MaskIndex &MaskIndex::operator=(const MaskIndex &other)
+{
+	if (this == &other)
+		return *this;
+	_entries = other._entries;
+	_byPrefix.clear();
+	_bySuffix.clear();
+	_generic.clear();
+	_cache.clear();
+	_maxPrefix = 0;
+	_maxSuffix = 0;
+	_byTrigram.clear();
+	for (std::map<std::string, MaskEntry>::iterator it = _entries.begin(); it != _entries.end(); ++it)
+		index(&it->second);
+	_generation++;
+	return *this;
+}
+
+std::string MaskIndex::normalize(const std::string &mask)
+{
+	std::string nick, user, host;
+	size_t bang = mask.find('!');
+	size_t at = mask.find('@', bang == std::string::npos ? 0 : bang);
+	if (bang != std::string::npos)
+	{
+		nick = mask.substr(0, bang);
+		user = mask.substr(bang + 1, at == std::string::npos ? std::string::npos : at - bang - 1);
+	}
+	else if (at != std::string::npos)
+		user = mask.substr(0, at);
+	else
+		nick = mask;
+	if (at != std::string::npos)
+		host = mask.substr(at + 1);
+	return (nick.empty() ? "*" : nick) + "!" + (user.empty() ? "*" : user) + "@" + (host.empty() ? "*" : host);
+}
+
+std::string MaskIndex::casefold(const std::string &s)
+{
+	std::string out(s);
+	for (size_t i = 0; i < out.size(); ++i)
+	{
+		char c = out[i];
+		if (c >= 'A' && c <= 'Z')
+			out[i] = c - 'A' + 'a';
+		else if (c == '[')
+			out[i] = '{';
+		else if (c == ']')
+			out[i] = '}';
+		else if (c == '\\')
+			out[i] = '|';
+		else if (c == '~')
+			out[i] = '^';
+	}
+	return out;
+}
+
+bool MaskIndex::globMatch(const std::string &pattern, const std::string &subject)
+{
+	return globRange(pattern, 0, pattern.size(), subject, 0, subject.size());
+}
+
+// Greedy '*' matching with single backtrack point, over [p, pEnd) and [s, sEnd)
+bool MaskIndex::globRange(const std::string &pattern, size_t p, size_t pEnd,
+							const std::string &subject, size_t s, size_t sEnd)
+{
+	size_t starP = std::string::npos, starS = 0;
+	while (s < sEnd)
+	{
+		if (p < pEnd && (pattern[p] == '?' || pattern[p] == subject[s]))
+		{
+			++p;
+			++s;
+		}
+		else if (p < pEnd && pattern[p] == '*')
+		{
+			starP = p++;
+			starS = s;
+		}
+		else if (starP != std::string::npos)
+		{
+			p = starP + 1;
+			s = ++starS;
+		}
+		else
+			return false;
+	}
+	while (p < pEnd && pattern[p] == '*')
+		++p;
+	return p == pEnd;
+}
+
+unsigned MaskIndex::trigramAt(const std::string &s, size_t pos)
+{
+	return (static_cast<unsigned char>(s[pos]) << 16) | (static_cast<unsigned char>(s[pos + 1]) << 8)
+		| static_cast<unsigned char>(s[pos + 2]);
+}
+
+bool MaskIndex::matchEntry(const MaskEntry &entry, const std::string &subject)
+{
+	if (entry.literal)
+		return entry.pattern == subject;
+	size_t fixed = entry.prefix.size() + entry.suffix.size();
+	if (subject.size() < fixed)
+		return false;
+	if (subject.compare(0, entry.prefix.size(), entry.prefix) != 0)
+		return false;
+	if (subject.compare(subject.size() - entry.suffix.size(), entry.suffix.size(), entry.suffix) != 0)
+		return false;
+	// only the wildcard part in the middle is left to glob
+	return globRange(entry.pattern, entry.prefix.size(), entry.pattern.size() - entry.suffix.size(),
+		subject, entry.prefix.size(), subject.size() - entry.suffix.size());
+}
+
+bool MaskIndex::add(const std::string &mask, const std::string &setBy, long setAt)
+{
+	MaskEntry entry;
+	entry.mask = normalize(mask);
+	entry.pattern = casefold(entry.mask);
+	if (_entries.find(entry.pattern) != _entries.end())
+		return false;
+	size_t first = entry.pattern.find_first_of("*?");
+	size_t last = entry.pattern.find_last_of("*?");
+	entry.literal = first == std::string::npos;
+	entry.prefix = entry.literal ? entry.pattern : entry.pattern.substr(0, first);
+	entry.suffix = entry.literal ? "" : entry.pattern.substr(last + 1);
+	entry.setBy = setBy;
+	entry.setAt = setAt;
+
+	entry.bucket = 0;
+	entry.trigram = 0;
+	index(&_entries.insert(std::make_pair(entry.pattern, entry)).first->second);
+	_generation++;
+	return true;
+}
+
+void MaskIndex::index(MaskEntry *entry)
+{
+	entry->bucket = 0;
+	if (entry->literal)
+		return; // found through _entries directly
+	if (!entry->prefix.empty())
+	{
+		entry->bucket = 'p';
+		_byPrefix[entry->prefix].push_back(entry);
+		_maxPrefix = std::max(_maxPrefix, entry->prefix.size());
+		return;
+	}
+	// pick the smallest bucket among the suffix and every literal trigram
+	size_t best = std::string::npos;
+	if (!entry->suffix.empty())
+	{
+		Buckets::iterator b = _bySuffix.find(std::string(entry->suffix.rbegin(), entry->suffix.rend()));
+		best = b == _bySuffix.end() ? 0 : b->second.size();
+		entry->bucket = 's';
+	}
+	const std::string &pat = entry->pattern;
+	for (size_t i = 0; i + 3 <= pat.size(); ++i)
+	{
+		if (pat.find_first_of("*?", i) < i + 3)
+			continue;
+		unsigned tri = trigramAt(pat, i);
+		TrigramBuckets::iterator b = _byTrigram.find(tri);
+		size_t size = b == _byTrigram.end() ? 0 : b->second.size();
+		if (best == std::string::npos || size < best)
+		{
+			best = size;
+			entry->bucket = 't';
+			entry->trigram = tri;
+		}
+	}
+	if (entry->bucket == 's')
+	{
+		_bySuffix[std::string(entry->suffix.rbegin(), entry->suffix.rend())].push_back(entry);
+		_maxSuffix = std::max(_maxSuffix, entry->suffix.size());
+	}
+	else if (entry->bucket == 't')
+		_byTrigram[entry->trigram].push_back(entry);
+	else
+	{
+		entry->bucket = 'g';
+		_generic.push_back(entry);
+	}
+}
+
+void MaskIndex::unlink(std::vector<const MaskEntry *> &list, const MaskEntry *entry)
+{
+	std::vector<const MaskEntry *>::iterator it = std::find(list.begin(), list.end(), entry);
+	if (it != list.end())
+		list.erase(it);
+}
+
+bool MaskIndex::remove(const std::string &mask)
+{
+	std::map<std::string, MaskEntry>::iterator it = _entries.find(casefold(normalize(mask)));
+	if (it == _entries.end())
+		return false;
+	const MaskEntry *entry = &it->second;
+	if (entry->bucket == 'p')
+	{
+		Buckets::iterator b = _byPrefix.find(entry->prefix);
+		unlink(b->second, entry);
+		if (b->second.empty())
+			_byPrefix.erase(b);
+	}
+	else if (entry->bucket == 's')
+	{
+		Buckets::iterator b = _bySuffix.find(std::string(entry->suffix.rbegin(), entry->suffix.rend()));
+		unlink(b->second, entry);
+		if (b->second.empty())
+			_bySuffix.erase(b);
+	}
+	else if (entry->bucket == 't')
+	{
+		TrigramBuckets::iterator b = _byTrigram.find(entry->trigram);
+		unlink(b->second, entry);
+		if (b->second.empty())
+			_byTrigram.erase(b);
+	}
+	else if (entry->bucket == 'g')
+		unlink(_generic, entry);
+	_entries.erase(it);
+	_generation++;
+	return true;
+}
+
+bool MaskIndex::contains(const std::string &mask) const
+{
+	return _entries.find(casefold(normalize(mask))) != _entries.end();
+}
+
+size_t MaskIndex::size() const { return _entries.size(); }
+
+const std::map<std::string, MaskEntry> &MaskIndex::entries() const { return _entries; }
+
+bool MaskIndex::matches(const std::string &hostmask) const
+{
+	if (_entries.empty())
+		return false;
+	std::string subject = casefold(hostmask);
+	if (_entries.find(subject) != _entries.end())
+		return true;
+	// every prefix of the subject that could be a bucket key
+	std::string key;
+	size_t maxLen = _byPrefix.empty() ? 0 : std::min(_maxPrefix, subject.size());
+	for (size_t len = 1; len <= maxLen; ++len)
+	{
+		key += subject[len - 1];
+		Buckets::const_iterator b = _byPrefix.find(key);
+		if (b == _byPrefix.end())
+			continue;
+		for (size_t i = 0; i < b->second.size(); ++i)
+			if (matchEntry(*b->second[i], subject))
+				return true;
+	}
+	key.clear();
+	maxLen = _bySuffix.empty() ? 0 : std::min(_maxSuffix, subject.size());
+	for (size_t len = 1; len <= maxLen; ++len)
+	{
+		key += subject[subject.size() - len];
+		Buckets::const_iterator b = _bySuffix.find(key);
+		if (b == _bySuffix.end())
+			continue;
+		for (size_t i = 0; i < b->second.size(); ++i)
+			if (matchEntry(*b->second[i], subject))
+				return true;
+	}
+	std::vector<unsigned> seen;
+	for (size_t pos = 0; !_byTrigram.empty() && pos + 3 <= subject.size(); ++pos)
+	{
+		unsigned tri = trigramAt(subject, pos);
+		TrigramBuckets::const_iterator b = _byTrigram.find(tri);
+		if (b == _byTrigram.end() || std::find(seen.begin(), seen.end(), tri) != seen.end())
+			continue;
+		seen.push_back(tri);
+		for (size_t i = 0; i < b->second.size(); ++i)
+			if (matchEntry(*b->second[i], subject))
+				return true;
+	}
+	for (size_t i = 0; i < _generic.size(); ++i)
+		if (matchEntry(*_generic[i], subject))
+			return true;
+	return false;
+}
+
+bool MaskIndex::matches(int fd, unsigned long identity, const std::string &hostmask)
+{
+	std::map<int, CacheEntry>::iterator it = _cache.find(fd);
+	if (it != _cache.end() && it->second.identity == identity && it->second.generation == _generation)
+		return it->second.result;
+	CacheEntry entry;
+	entry.identity = identity;
+	entry.generation = _generation;
+	entry.result = matches(hostmask);
+	_cache[fd] = entry;
+	return entry.result;
+}
+
+void MaskIndex::forget(int fd)
+{
+	_cache.erase(fd);
+}
@@ -0,0 +1,319 @@
+#include "PasswordHasher.hpp"
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace
+{
+	const unsigned int K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	unsigned int rotr(unsigned int x, int n)
+	{
+		return (x >> n) | (x << (32 - n));
+	}
+
+	// Streaming SHA-256, so HMAC can keep its keyed inner and outer states and
+	// copy them instead of rehashing the key on every PBKDF2 round
+	struct Sha256
+	{
+		unsigned int h[8];
+		unsigned char block[64];
+		size_t used;
+		unsigned long long total;
+
+		Sha256() : used(0), total(0)
+		{
+			static const unsigned int init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+												  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+			std::memcpy(h, init, sizeof(h));
+		}
+
+		void compress(const unsigned char *p)
+		{
+			unsigned int w[64];
+			for (int i = 0; i < 16; ++i)
+				w[i] = (p[i * 4] << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+			for (int i = 16; i < 64; ++i)
+			{
+				unsigned int s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				unsigned int s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+			unsigned int a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+			for (int i = 0; i < 64; ++i)
+			{
+				unsigned int t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+				unsigned int t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+				k = g;
+				g = f;
+				f = e;
+				e = d + t1;
+				d = c;
+				c = b;
+				b = a;
+				a = t1 + t2;
+			}
+			h[0] += a;
+			h[1] += b;
+			h[2] += c;
+			h[3] += d;
+			h[4] += e;
+			h[5] += f;
+			h[6] += g;
+			h[7] += k;
+		}
+
+		void update(const unsigned char *data, size_t len)
+		{
+			total += len;
+			while (len)
+			{
+				size_t take = std::min(len, sizeof(block) - used);
+				std::memcpy(block + used, data, take);
+				used += take;
+				data += take;
+				len -= take;
+				if (used == sizeof(block))
+				{
+					compress(block);
+					used = 0;
+				}
+			}
+		}
+
+		void final(unsigned char digest[PasswordHasher::DIGEST])
+		{
+			unsigned long long bits = total * 8;
+			unsigned char pad = 0x80;
+			update(&pad, 1);
+			pad = 0;
+			while (used != 56)
+				update(&pad, 1);
+			unsigned char length[8];
+			for (int i = 0; i < 8; ++i)
+				length[i] = static_cast<unsigned char>(bits >> (56 - i * 8));
+			update(length, 8);
+			for (int i = 0; i < 8; ++i)
+			{
+				digest[i * 4] = static_cast<unsigned char>(h[i] >> 24);
+				digest[i * 4 + 1] = static_cast<unsigned char>(h[i] >> 16);
+				digest[i * 4 + 2] = static_cast<unsigned char>(h[i] >> 8);
+				digest[i * 4 + 3] = static_cast<unsigned char>(h[i]);
+			}
+		}
+	};
+
+	// HMAC-SHA256 keyed once; mac() copies the two prepared states
+	struct Hmac
+	{
+		Sha256 inner;
+		Sha256 outer;
+
+		Hmac(const std::string &key)
+		{
+			unsigned char block[64];
+			std::memset(block, 0, sizeof(block));
+			if (key.size() > sizeof(block))
+				PasswordHasher::sha256(reinterpret_cast<const unsigned char *>(key.data()), key.size(), block);
+			else
+				std::memcpy(block, key.data(), key.size());
+			unsigned char pad[64];
+			for (size_t i = 0; i < sizeof(pad); ++i)
+				pad[i] = block[i] ^ 0x36;
+			inner.update(pad, sizeof(pad));
+			for (size_t i = 0; i < sizeof(pad); ++i)
+				pad[i] = block[i] ^ 0x5c;
+			outer.update(pad, sizeof(pad));
+			std::memset(block, 0, sizeof(block));
+		}
+
+		void mac(const unsigned char *data, size_t len, const unsigned char *more, size_t moreLen,
+				 unsigned char digest[PasswordHasher::DIGEST]) const
+		{
+			Sha256 in = inner;
+			in.update(data, len);
+			in.update(more, moreLen);
+			unsigned char inside[PasswordHasher::DIGEST];
+			in.final(inside);
+			Sha256 out = outer;
+			out.update(inside, sizeof(inside));
+			out.final(digest);
+		}
+	};
+}
+
+PasswordHasher::PasswordHasher() : _stopping(false), _nextId(1), _maxQueued(64)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_wake, NULL);
+	_pipe[0] = -1;
+	_pipe[1] = -1;
+}
+
+PasswordHasher::~PasswordHasher()
+{
+	stop();
+	pthread_cond_destroy(&_wake);
+	pthread_mutex_destroy(&_lock);
+}
+
+void PasswordHasher::start(size_t threads, size_t maxQueued)
+{
+	_maxQueued = maxQueued;
+	if (pipe(_pipe) < 0)
+		return;
+	fcntl(_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(_pipe[1], F_SETFL, O_NONBLOCK);
+	for (size_t i = 0; i < threads; ++i)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, &PasswordHasher::worker, this) == 0)
+			_threads.push_back(thread);
+	}
+}
+
+// Waits for hashes already running; queued ones are dropped
+void PasswordHasher::stop()
+{
+	pthread_mutex_lock(&_lock);
+	_stopping = true;
+	_queue.clear();
+	pthread_cond_broadcast(&_wake);
+	pthread_mutex_unlock(&_lock);
+	for (size_t i = 0; i < _threads.size(); ++i)
+		pthread_join(_threads[i], NULL);
+	_threads.clear();
+	for (int i = 0; i < 2; ++i)
+	{
+		if (_pipe[i] != -1)
+			close(_pipe[i]);
+		_pipe[i] = -1;
+	}
+}
+
+int PasswordHasher::notifyFd() const
+{
+	return _pipe[0];
+}
+
+unsigned long PasswordHasher::submit(int fd, const std::string &password, const unsigned char *salt,
+									 unsigned long iterations)
+{
+	Request request;
+	request.fd = fd;
+	request.password = password;
+	std::memcpy(request.salt, salt, SALT);
+	request.iterations = iterations;
+	pthread_mutex_lock(&_lock);
+	if (_threads.empty() || _queue.size() >= _maxQueued)
+	{
+		pthread_mutex_unlock(&_lock);
+		return 0;
+	}
+	request.id = _nextId++;
+	_queue.push_back(request);
+	pthread_cond_signal(&_wake);
+	pthread_mutex_unlock(&_lock);
+	return request.id;
+}
+
+std::vector<HashResult> PasswordHasher::collect()
+{
+	char drain[256];
+	while (read(_pipe[0], drain, sizeof(drain)) > 0)
+		;
+	std::vector<HashResult> done;
+	pthread_mutex_lock(&_lock);
+	done.swap(_done);
+	pthread_mutex_unlock(&_lock);
+	return done;
+}
+
+void *PasswordHasher::worker(void *self)
+{
+	static_cast<PasswordHasher *>(self)->work();
+	return NULL;
+}
+
+void PasswordHasher::work()
+{
+	while (true)
+	{
+		pthread_mutex_lock(&_lock);
+		while (_queue.empty() && !_stopping)
+			pthread_cond_wait(&_wake, &_lock);
+		if (_stopping)
+		{
+			pthread_mutex_unlock(&_lock);
+			return;
+		}
+		Request request = _queue.front();
+		_queue.pop_front();
+		pthread_mutex_unlock(&_lock);
+
+		HashResult result;
+		result.id = request.id;
+		result.fd = request.fd;
+		pbkdf2(request.password, request.salt, SALT, request.iterations, result.digest);
+		std::fill(request.password.begin(), request.password.end(), '\0');
+
+		pthread_mutex_lock(&_lock);
+		_done.push_back(result);
+		pthread_mutex_unlock(&_lock);
+		char byte = 1;
+		ssize_t woke = write(_pipe[1], &byte, 1); // EAGAIN: the loop already has wakeups pending
+		(void)woke;
+	}
+}
+
+void PasswordHasher::sha256(const unsigned char *data, size_t len, unsigned char digest[DIGEST])
+{
+	Sha256 ctx;
+	ctx.update(data, len);
+	ctx.final(digest);
+}
+
+// RFC 8018 PBKDF2 with HMAC-SHA256, one block: the digest is exactly one hash long
+void PasswordHasher::pbkdf2(const std::string &password, const unsigned char *salt, size_t saltLen,
+							unsigned long iterations, unsigned char digest[DIGEST])
+{
+	Hmac hmac(password);
+	static const unsigned char blockIndex[4] = { 0, 0, 0, 1 };
+	unsigned char u[DIGEST];
+	hmac.mac(salt, saltLen, blockIndex, sizeof(blockIndex), u);
+	std::memcpy(digest, u, DIGEST);
+	for (unsigned long i = 1; i < iterations; ++i)
+	{
+		hmac.mac(u, DIGEST, NULL, 0, u);
+		for (size_t k = 0; k < DIGEST; ++k)
+			digest[k] ^= u[k];
+	}
+}
+
+bool PasswordHasher::equal(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	unsigned char diff = 0;
+	for (size_t i = 0; i < len; ++i)
+		diff |= a[i] ^ b[i];
+	return diff == 0;
+}
+
+bool PasswordHasher::randomSalt(unsigned char salt[SALT])
+{
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+		return false;
+	ssize_t got = read(fd, salt, SALT);
+	close(fd);
+	return got == static_cast<ssize_t>(SALT);
+}
@@ -0,0 +1,20 @@
+#include "ReplyBlock.hpp"
+
+ReplyBlock::ReplyBlock() : _refs(1) {}
+
+ReplyBlock *ReplyBlock::create()
+{
+	return new ReplyBlock();
+}
+
+ReplyBlock *ReplyBlock::retain()
+{
+	_refs++;
+	return this;
+}
+
+void ReplyBlock::release()
+{
+	if (--_refs == 0)
+		delete this;
+}
@@ -0,0 +1,263 @@
+#include "Resolver.hpp"
+#include "Endpoint.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+Resolver::Resolver() : _stopping(false), _nextId(1), _ttl(300), _ident(false), _identTimeoutMs(3000)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_wake, NULL);
+	_pipe[0] = -1;
+	_pipe[1] = -1;
+}
+
+Resolver::~Resolver()
+{
+	stop();
+	pthread_cond_destroy(&_wake);
+	pthread_mutex_destroy(&_lock);
+}
+
+void Resolver::start(size_t threads, long ttl, bool ident, int identTimeoutMs, const std::string &hostsFile)
+{
+	_ttl = ttl;
+	_ident = ident;
+	_identTimeoutMs = identTimeoutMs;
+	if (!hostsFile.empty())
+		loadHosts(hostsFile);
+	if (pipe(_pipe) < 0)
+		return;
+	fcntl(_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(_pipe[1], F_SETFL, O_NONBLOCK);
+	for (size_t i = 0; i < threads; ++i)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, &Resolver::worker, this) == 0)
+			_threads.push_back(thread);
+	}
+}
+
+// Waits for lookups already running; queued ones are dropped
+void Resolver::stop()
+{
+	pthread_mutex_lock(&_lock);
+	_stopping = true;
+	_queue.clear();
+	pthread_cond_broadcast(&_wake);
+	pthread_mutex_unlock(&_lock);
+	for (size_t i = 0; i < _threads.size(); ++i)
+		pthread_join(_threads[i], NULL);
+	_threads.clear();
+	for (int i = 0; i < 2; ++i)
+	{
+		if (_pipe[i] != -1)
+			close(_pipe[i]);
+		_pipe[i] = -1;
+	}
+}
+
+int Resolver::notifyFd() const
+{
+	return _pipe[0];
+}
+
+void Resolver::loadHosts(const std::string &path)
+{
+	std::ifstream file(path.c_str());
+	std::string line;
+	while (std::getline(file, line))
+	{
+		line = line.substr(0, line.find('#'));
+		std::istringstream iss(line);
+		std::string ip, name;
+		if (iss >> ip >> name)
+			_hosts[ip] = name;
+	}
+}
+
+bool Resolver::cached(const std::string &ip, std::string &host)
+{
+	std::map<std::string, std::string>::iterator fixed = _hosts.find(ip);
+	if (fixed != _hosts.end())
+	{
+		host = fixed->second;
+		return true;
+	}
+	pthread_mutex_lock(&_lock);
+	std::map<std::string, CacheEntry>::iterator it = _cache.find(ip);
+	bool hit = it != _cache.end() && it->second.expires > time(NULL);
+	if (hit)
+		host = it->second.host;
+	pthread_mutex_unlock(&_lock);
+	return hit;
+}
+
+unsigned long Resolver::submit(int fd, const std::string &ip, int remotePort, int localPort)
+{
+	Request request;
+	request.fd = fd;
+	request.ip = ip;
+	request.remotePort = remotePort;
+	request.localPort = localPort;
+	pthread_mutex_lock(&_lock);
+	request.id = _nextId++;
+	_queue.push_back(request);
+	pthread_cond_signal(&_wake);
+	pthread_mutex_unlock(&_lock);
+	return request.id;
+}
+
+std::vector<ResolverResult> Resolver::collect()
+{
+	char drain[256];
+	while (read(_pipe[0], drain, sizeof(drain)) > 0)
+		;
+	std::vector<ResolverResult> done;
+	pthread_mutex_lock(&_lock);
+	done.swap(_done);
+	pthread_mutex_unlock(&_lock);
+	return done;
+}
+
+void *Resolver::worker(void *self)
+{
+	static_cast<Resolver *>(self)->work();
+	return NULL;
+}
+
+void Resolver::work()
+{
+	while (true)
+	{
+		pthread_mutex_lock(&_lock);
+		while (_queue.empty() && !_stopping)
+			pthread_cond_wait(&_wake, &_lock);
+		if (_stopping)
+		{
+			pthread_mutex_unlock(&_lock);
+			return;
+		}
+		Request request = _queue.front();
+		_queue.pop_front();
+		pthread_mutex_unlock(&_lock);
+
+		ResolverResult result;
+		result.id = request.id;
+		result.fd = request.fd;
+		if (!cached(request.ip, result.host))
+		{
+			result.host = lookupHost(request.ip);
+			pthread_mutex_lock(&_lock);
+			if (_cache.size() >= MAX_CACHE)
+			{
+				time_t now = time(NULL);
+				for (std::map<std::string, CacheEntry>::iterator it = _cache.begin(); it != _cache.end();)
+				{
+					if (it->second.expires <= now)
+						_cache.erase(it++);
+					else
+						++it;
+				}
+				if (_cache.size() >= MAX_CACHE)
+					_cache.erase(_cache.begin());
+			}
+			CacheEntry entry;
+			entry.host = result.host; // failures are cached too, as an empty name
+			entry.expires = time(NULL) + _ttl;
+			_cache[request.ip] = entry;
+			pthread_mutex_unlock(&_lock);
+		}
+		if (_ident)
+			result.ident = lookupIdent(request.ip, request.remotePort, request.localPort);
+
+		pthread_mutex_lock(&_lock);
+		_done.push_back(result);
+		pthread_mutex_unlock(&_lock);
+		char byte = 1;
+		ssize_t woke = write(_pipe[1], &byte, 1); // EAGAIN: the loop already has wakeups pending
+		(void)woke;
+	}
+}
+
+// PTR lookup, accepted only if the name resolves back to the same address
+std::string Resolver::lookupHost(const std::string &ip)
+{
+	Endpoint addr;
+	if (!Endpoint::numeric(ip, 0, addr))
+		return "";
+	char name[NI_MAXHOST];
+	if (getnameinfo((struct sockaddr *)&addr.addr, addr.len, name, sizeof(name), NULL, 0, NI_NAMEREQD) != 0)
+		return "";
+
+	struct addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = addr.family;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *res = NULL;
+	if (getaddrinfo(name, NULL, &hints, &res) != 0)
+		return "";
+	bool confirmed = false;
+	for (struct addrinfo *ai = res; ai && !confirmed; ai = ai->ai_next)
+	{
+		int port;
+		struct sockaddr_storage back;
+		std::memset(&back, 0, sizeof(back));
+		std::memcpy(&back, ai->ai_addr, ai->ai_addrlen);
+		confirmed = Endpoint::host(back, port) == ip;
+	}
+	freeaddrinfo(res);
+	return confirmed ? std::string(name) : std::string();
+}
+
+// RFC 1413: ask the client's identd which user owns the connection
+std::string Resolver::lookupIdent(const std::string &ip, int remotePort, int localPort)
+{
+	Endpoint addr;
+	if (!Endpoint::numeric(ip, 113, addr))
+		return "";
+	int fd = socket(addr.family, SOCK_STREAM, 0);
+	if (fd < 0)
+		return "";
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	std::string reply;
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	if ((connect(fd, (struct sockaddr *)&addr.addr, addr.len) == 0 || errno == EINPROGRESS)
+		&& poll(&pfd, 1, _identTimeoutMs) == 1 && !(pfd.revents & (POLLERR | POLLHUP)))
+	{
+		char query[32];
+		std::snprintf(query, sizeof(query), "%d , %d\r\n", remotePort, localPort);
+		send(fd, query, std::strlen(query), MSG_NOSIGNAL);
+		pfd.events = POLLIN;
+		char buf[512];
+		while (reply.find('\n') == std::string::npos && poll(&pfd, 1, _identTimeoutMs) == 1)
+		{
+			ssize_t n = recv(fd, buf, sizeof(buf), 0);
+			if (n <= 0)
+				break;
+			reply.append(buf, n);
+		}
+	}
+	close(fd);
+	// "<ports> : USERID : <os> : <user>"
+	if (reply.find(": USERID :") == std::string::npos)
+		return "";
+	std::string user = reply.substr(reply.rfind(':') + 1);
+	size_t start = user.find_first_not_of(' ');
+	size_t end = user.find_first_of(" \r\n", start);
+	if (start == std::string::npos)
+		return "";
+	user = user.substr(start, end == std::string::npos ? std::string::npos : end - start);
+	return user.size() > 10 ? user.substr(0, 10) : user;
+}
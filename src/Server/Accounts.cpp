@@ -0,0 +1,374 @@
+#include "Server.hpp"
+#include "Config.hpp"
+#include "MaskIndex.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+static const size_t SASL_CHUNK = 400;			// AUTHENTICATE payloads come in 400-byte pieces
+static const size_t MAX_SASL_PAYLOAD = 1200;	// base64 of authzid, authcid and password
+
+// IRC_ACCOUNTS_FILE turns accounts and SASL on; the file is created on first
+// use. IRC_HASH_ITERATIONS sets the PBKDF2 rounds of new accounts,
+// IRC_HASH_THREADS and IRC_HASH_QUEUE the workers and how many hashes may wait
+// for them before logins are refused.
+void Server::configureAccounts()
+{
+	long iterations = configLong("IRC_HASH_ITERATIONS", 100000);
+	_hashIterations = static_cast<unsigned int>(iterations > 0 ? iterations : 1);
+	_minPasswordLen = static_cast<size_t>(configLong("IRC_ACCOUNT_MIN_PASSWORD", 8));
+	std::string path = configStr("IRC_ACCOUNTS_FILE", "");
+	if (path.empty())
+		return;
+	std::string error;
+	if (!_accounts.open(path, error))
+	{
+		std::cerr << "Accounts disabled, " << path << ": " << error << "\n";
+		return;
+	}
+	_hasher.start(static_cast<size_t>(configLong("IRC_HASH_THREADS", 1)),
+				  static_cast<size_t>(configLong("IRC_HASH_QUEUE", 64)));
+	std::cout << "Accounts in " << path << ": " << _accounts.size() << " registered, SASL PLAIN on\n";
+}
+
+static bool decodeBase64(const std::string &in, std::string &out)
+{
+	unsigned int bits = 0;
+	int count = 0;
+	size_t padding = 0;
+	for (size_t i = 0; i < in.size(); ++i)
+	{
+		char c = in[i];
+		int value;
+		if (c >= 'A' && c <= 'Z')
+			value = c - 'A';
+		else if (c >= 'a' && c <= 'z')
+			value = c - 'a' + 26;
+		else if (c >= '0' && c <= '9')
+			value = c - '0' + 52;
+		else if (c == '+')
+			value = 62;
+		else if (c == '/')
+			value = 63;
+		else if (c == '=' && i + 2 >= in.size())
+		{
+			padding++;
+			continue;
+		}
+		else
+			return false;
+		if (padding)
+			return false;
+		bits = (bits << 6) | value;
+		if (++count == 4)
+		{
+			out += static_cast<char>((bits >> 16) & 0xFF);
+			out += static_cast<char>((bits >> 8) & 0xFF);
+			out += static_cast<char>(bits & 0xFF);
+			bits = 0;
+			count = 0;
+		}
+	}
+	if (count == 1 || (padding && count + padding != 4))
+		return false;
+	if (count == 2)
+		out += static_cast<char>((bits >> 4) & 0xFF);
+	else if (count == 3)
+	{
+		out += static_cast<char>((bits >> 10) & 0xFF);
+		out += static_cast<char>((bits >> 2) & 0xFF);
+	}
+	return true;
+}
+
+// RFC 4616: authzid NUL authcid NUL password
+static bool splitPlain(const std::string &message, std::string &authzid, std::string &authcid, std::string &password)
+{
+	size_t first = message.find('\0');
+	size_t second = first == std::string::npos ? first : message.find('\0', first + 1);
+	if (second == std::string::npos || message.find('\0', second + 1) != std::string::npos)
+		return false;
+	authzid = message.substr(0, first);
+	authcid = message.substr(first + 1, second - first - 1);
+	password = message.substr(second + 1);
+	return !authcid.empty() && !password.empty();
+}
+
+static void scrub(std::string &secret)
+{
+	std::fill(secret.begin(), secret.end(), '\0');
+}
+
+// AUTHENTICATE PLAIN, then AUTHENTICATE <base64> in 400-byte chunks ("+" for
+// an empty last one), or AUTHENTICATE * to give up. The account is found in
+// the mapped store at once; only the password hash goes to the hasher and
+// finishLogin answers when it is back. Registration waits for the answer.
+void Server::handleAuthenticate(Client &client, std::istringstream &iss)
+{
+	int fd = client.getFd();
+	std::string nick = client.getNick().empty() ? "*" : client.getNick();
+	std::string arg;
+	iss >> arg;
+	if (arg.empty())
+	{
+		sendTo(fd, ":server 461 " + nick + " AUTHENTICATE :Not enough parameters\r\n");
+		return;
+	}
+	if (!_accounts.isOpen())
+	{
+		sendTo(fd, ":server 904 " + nick + " :SASL authentication failed\r\n");
+		return;
+	}
+	if (client.isAuthenticated() || _loggedIn.find(fd) != _loggedIn.end())
+	{
+		sendTo(fd, ":server 907 " + nick + " :You have already authenticated using SASL\r\n");
+		return;
+	}
+	std::map<int, SaslSession>::iterator it = _sasl.find(fd);
+	if (arg == "*")
+	{
+		if (it != _sasl.end())
+		{
+			_hashJobs.erase(it->second.job);
+			_sasl.erase(it);
+		}
+		sendTo(fd, ":server 906 " + nick + " :SASL authentication aborted\r\n");
+		completeRegistration(client);
+		return;
+	}
+	if (it == _sasl.end())
+	{
+		for (size_t i = 0; i < arg.size(); ++i)
+			arg[i] = static_cast<char>(std::toupper(static_cast<unsigned char>(arg[i])));
+		if (arg != "PLAIN")
+		{
+			sendTo(fd, ":server 908 " + nick + " PLAIN :are available SASL mechanisms\r\n"
+					   ":server 904 " + nick + " :SASL authentication failed\r\n");
+			return;
+		}
+		SaslSession session;
+		session.job = 0;
+		_sasl[fd] = session;
+		sendTo(fd, "AUTHENTICATE +\r\n");
+		return;
+	}
+	SaslSession &session = it->second;
+	if (session.job != 0)
+		return; // the password is being checked, finishLogin answers
+	if (arg != "+")
+		session.payload += arg;
+	if (session.payload.size() > MAX_SASL_PAYLOAD)
+	{
+		_sasl.erase(it);
+		sendTo(fd, ":server 905 " + nick + " :SASL message too long\r\n");
+		completeRegistration(client);
+		return;
+	}
+	if (arg.size() == SASL_CHUNK)
+		return; // a full chunk means more follow
+
+	std::string message, authzid, authcid, password;
+	const AccountRecord *record = NULL;
+	if (decodeBase64(session.payload, message) && splitPlain(message, authzid, authcid, password)
+		&& (authzid.empty() || MaskIndex::casefold(authzid) == MaskIndex::casefold(authcid)))
+		record = _accounts.find(authcid);
+	unsigned long id = record ? _hasher.submit(fd, password, record->salt, record->iterations) : 0;
+	scrub(message);
+	scrub(password);
+	if (id == 0)
+	{
+		if (record)
+			std::cout << "[accounts] hasher queue full, login of " << authcid << " refused\n";
+		_sasl.erase(it);
+		sendTo(fd, ":server 904 " + nick + " :SASL authentication failed\r\n");
+		completeRegistration(client);
+		return;
+	}
+	PendingHash job;
+	job.fd = fd;
+	job.registering = false;
+	job.account.assign(record->name, record->nameLen);
+	std::memcpy(job.salt, record->salt, sizeof(job.salt));
+	job.iterations = record->iterations;
+	std::memcpy(job.expected, record->digest, sizeof(job.expected));
+	_hashJobs[id] = job;
+	session.job = id;
+	session.payload.clear();
+}
+
+// REGISTER <account|*> <email|*> <password> (IRCv3 draft/account-registration).
+// The account is the caller's nick. No mail is sent, the e-mail is ignored.
+void Server::handleRegister(Client &client, std::istringstream &iss)
+{
+	int fd = client.getFd();
+	std::string account, email, password;
+	iss >> account >> email;
+	std::getline(iss, password);
+	size_t start = password.find_first_not_of(' ');
+	password = start == std::string::npos ? "" : password.substr(start);
+	if (!password.empty() && password[0] == ':')
+		password.erase(0, 1);
+	if (account.empty() || email.empty() || password.empty())
+	{
+		sendTo(fd, ":server 461 " + client.getNick() + " REGISTER :Not enough parameters\r\n");
+		return;
+	}
+	if (account == "*")
+		account = client.getNick();
+
+	std::string fail = ":server FAIL REGISTER ";
+	if (!_accounts.isOpen())
+	{
+		sendTo(fd, fail + "TEMPORARILY_UNAVAILABLE " + account + " :Accounts are not enabled on this server\r\n");
+		return;
+	}
+	if (_loggedIn.find(fd) != _loggedIn.end())
+	{
+		sendTo(fd, fail + "ALREADY_AUTHENTICATED " + account + " :You are already logged in\r\n");
+		return;
+	}
+	if (MaskIndex::casefold(account) != MaskIndex::casefold(client.getNick()))
+	{
+		sendTo(fd, fail + "ACCOUNT_NAME_MUST_BE_NICK " + account + " :The account name must be your nickname\r\n");
+		return;
+	}
+	if (account.size() > AccountStore::MAX_NAME)
+	{
+		std::ostringstream reason;
+		reason << " :Account names are at most " << AccountStore::MAX_NAME << " characters\r\n";
+		sendTo(fd, fail + "BAD_ACCOUNT_NAME " + account + reason.str());
+		return;
+	}
+	if (_accounts.find(account))
+	{
+		sendTo(fd, fail + "ACCOUNT_EXISTS " + account + " :Account already exists\r\n");
+		return;
+	}
+	if (password.size() < _minPasswordLen)
+	{
+		std::ostringstream reason;
+		reason << " :Passwords need at least " << _minPasswordLen << " characters\r\n";
+		sendTo(fd, fail + "WEAK_PASSWORD " + account + reason.str());
+		return;
+	}
+	for (std::map<unsigned long, PendingHash>::iterator it = _hashJobs.begin(); it != _hashJobs.end(); ++it)
+	{
+		if (it->second.fd == fd)
+		{
+			sendTo(fd, fail + "TEMPORARILY_UNAVAILABLE " + account + " :Your registration is still in progress\r\n");
+			return;
+		}
+	}
+	PendingHash job;
+	job.fd = fd;
+	job.registering = true;
+	job.account = account;
+	job.iterations = _hashIterations;
+	unsigned long id = 0;
+	if (PasswordHasher::randomSalt(job.salt))
+		id = _hasher.submit(fd, password, job.salt, job.iterations);
+	scrub(password);
+	if (id == 0)
+	{
+		sendTo(fd, fail + "TEMPORARILY_UNAVAILABLE " + account + " :Server is busy, try again later\r\n");
+		return;
+	}
+	_hashJobs[id] = job;
+}
+
+void Server::handleHashed()
+{
+	std::vector<HashResult> results = _hasher.collect();
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		// jobs of clients that left or aborted are gone from _hashJobs
+		std::map<unsigned long, PendingHash>::iterator it = _hashJobs.find(results[i].id);
+		if (it == _hashJobs.end())
+			continue;
+		PendingHash job = it->second;
+		_hashJobs.erase(it);
+		std::map<int, Client>::iterator client = _clients.find(job.fd);
+		if (client == _clients.end())
+			continue;
+		if (job.registering)
+			finishRegister(client->second, job, results[i].digest);
+		else
+			finishLogin(client->second, job, results[i].digest);
+	}
+}
+
+void Server::finishLogin(Client &client, const PendingHash &job, const unsigned char *digest)
+{
+	int fd = client.getFd();
+	std::string nick = client.getNick().empty() ? "*" : client.getNick();
+	_sasl.erase(fd);
+	if (!PasswordHasher::equal(digest, job.expected, PasswordHasher::DIGEST))
+	{
+		std::cout << "[accounts] failed login to " << job.account << " from fd=" << fd << "\n";
+		sendTo(fd, ":server 904 " + nick + " :SASL authentication failed\r\n");
+		completeRegistration(client);
+		return;
+	}
+	client.setPass(true);
+	logIn(client, job.account);
+	sendTo(fd, ":server 903 " + nick + " :SASL authentication successful\r\n");
+	completeRegistration(client); // held by CAP negotiation until CAP END, as usual
+}
+
+void Server::finishRegister(Client &client, const PendingHash &job, const unsigned char *digest)
+{
+	int fd = client.getFd();
+	// NICK is not held while the hash runs: a client that renamed in the
+	// meantime would be logged in to a name it no longer uses
+	if (MaskIndex::casefold(job.account) != MaskIndex::casefold(client.getNick()))
+	{
+		sendTo(fd, ":server FAIL REGISTER ACCOUNT_NAME_MUST_BE_NICK " + job.account +
+				   " :The account name must be your nickname\r\n");
+		return;
+	}
+	if (!_accounts.add(job.account, job.salt, digest, job.iterations, time(NULL)))
+	{
+		bool taken = _accounts.find(job.account) != NULL; // someone else's registration finished first
+		sendTo(fd, ":server FAIL REGISTER " + std::string(taken ? "ACCOUNT_EXISTS " : "TEMPORARILY_UNAVAILABLE ") +
+				   job.account + (taken ? " :Account already exists\r\n" : " :The account could not be stored\r\n"));
+		return;
+	}
+	std::cout << "[accounts] registered " << job.account << " (" << _accounts.size() << " accounts)\n";
+	sendTo(fd, ":server REGISTER SUCCESS " + job.account + " :Account created\r\n");
+	logIn(client, job.account);
+}
+
+// 900 RPL_LOGGEDIN
+void Server::logIn(Client &client, const std::string &account)
+{
+	int fd = client.getFd();
+	_loggedIn[fd] = account;
+	std::string nick = client.getNick().empty() ? "*" : client.getNick();
+	sendTo(fd, ":server 900 " + nick + " " + client.getHostmask() + " " + account +
+			   " :You are now logged in as " + account + "\r\n");
+	std::cout << "Client " << fd << " logged in as " << account << "\n";
+}
+
+// A registered account's name can only be used as a nick by someone logged in to it
+bool Server::nickReserved(const Client &client, const std::string &nick) const
+{
+	if (!_accounts.find(nick))
+		return false;
+	std::map<int, std::string>::const_iterator it = _loggedIn.find(client.getFd());
+	return it == _loggedIn.end() || MaskIndex::casefold(it->second) != MaskIndex::casefold(nick);
+}
+
+void Server::dropAccountState(int fd)
+{
+	_loggedIn.erase(fd);
+	_sasl.erase(fd);
+	for (std::map<unsigned long, PendingHash>::iterator it = _hashJobs.begin(); it != _hashJobs.end();)
+	{
+		if (it->second.fd == fd)
+			_hashJobs.erase(it++);
+		else
+			++it;
+	}
+}
@@ -0,0 +1,133 @@
+#include "Server.hpp"
+#include "Config.hpp"
+#include "FaultInjection.hpp"
+#include <iostream>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+static const size_t REJECTS_PER_EVENT = 64; // one listener event cannot hold the loop either
+
+// IRC_SHED_LAG_US is the loop lag that starts shedding, 0 turns it off.
+// IRC_SHED_QUEUE is the number of queued fan-out recipients, reply jobs and
+// service events that does the same. Every later stage needs twice the
+// previous threshold (LoadShedder.hpp).
+void Server::configureAdmission()
+{
+	_shedder.configure(static_cast<unsigned long>(configLong("IRC_SHED_LAG_US", 50000)),
+					   static_cast<size_t>(configLong("IRC_SHED_QUEUE", 50000)),
+					   static_cast<unsigned long>(configLong("IRC_SHED_WINDOW_MS", 100)) * 1000UL,
+					   static_cast<unsigned long>(configLong("IRC_SHED_HOLD_MS", 2000)) * 1000UL);
+	_shedUnregisteredPerTick = static_cast<size_t>(configLong("IRC_SHED_UNREGISTERED_PER_TICK", 8));
+}
+
+// Work the loop has accepted but not done yet
+size_t Server::queuedWork() const
+{
+	size_t queued = _serviceQueue.size();
+	for (std::deque<FanOutJob>::const_iterator it = _fanoutJobs.begin(); it != _fanoutJobs.end(); ++it)
+		queued += it->recipients.size() - it->cursor;
+	for (std::map<int, std::deque<ReplyJob> >::const_iterator it = _replyJobs.begin(); it != _replyJobs.end(); ++it)
+		queued += it->second.size();
+	return queued;
+}
+
+// Called once per iteration with the time since poll() returned
+void Server::updateAdmission(unsigned long busyUs, unsigned long nowUs)
+{
+	if (!_shedder.sample(busyUs, queuedWork(), nowUs))
+		return;
+	LoadShedder::Stage stage = _shedder.stage();
+	std::cout << BRIGHT_RED << "[overload] " << LoadShedder::name(stage) << " (lag " << _shedder.lag() << "us, queued "
+			  << _shedder.depth() << ")" << RESET << "\n";
+	// deferring leaves new connections in the kernel backlog until the loop catches up
+	short events = stage == LoadShedder::DEFER_ACCEPTS ? 0 : POLLIN;
+	for (std::map<int, Listener>::iterator it = _listeners.begin(); it != _listeners.end(); ++it)
+	{
+		int index = pollIndex(it->first);
+		if (index >= 0)
+			_pfds[index].events = events;
+	}
+}
+
+// Above REJECT_CONNECTIONS new connections are turned away at once: no client,
+// no lookup, no welcome, one write and a close
+bool Server::rejectConnections(int listenFd)
+{
+	if (_shedder.stage() < LoadShedder::REJECT_CONNECTIONS)
+		return false;
+	static const char ircError[] = "ERROR :Server overloaded, try again later\r\n";
+	static const char httpError[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 5\r\nContent-Length: 0\r\n"
+									"Connection: close\r\n\r\n";
+	bool webSocket = _listeners[listenFd].webSocket;
+	const char *reply = webSocket ? httpError : ircError;
+	size_t len = webSocket ? sizeof(httpError) - 1 : sizeof(ircError) - 1;
+	for (size_t i = 0; i < REJECTS_PER_EVENT; ++i)
+	{
+		int fd = accept(listenFd, NULL, NULL);
+		if (fd < 0)
+		{
+			if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
+				std::cerr << "accept() failed: " << strerror(errno) << std::endl;
+			break;
+		}
+		sockSend(fd, reply, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		close(fd);
+		_shedder.note(LoadShedder::REJECT_CONNECTIONS);
+	}
+	return true;
+}
+
+// Above DEPRIORITIZE_UNREGISTERED a connection that has not registered yet
+// waits behind registered clients and links
+bool Server::postponeRead(int fd) const
+{
+	if (_shedder.stage() < LoadShedder::DEPRIORITIZE_UNREGISTERED || fd < 0)
+		return false;
+	std::map<int, Client>::const_iterator it = _clients.find(fd);
+	return it != _clients.end() && !it->second.isAuthenticated() && _links.find(fd) == _links.end();
+}
+
+// Above REFUSE_EXPENSIVE the commands whose cost grows with the network are
+// answered with RPL_TRYAGAIN instead of being run
+bool Server::refuseUnderLoad(Client &client, const std::string &command, StringRef params)
+{
+	if (_shedder.stage() < LoadShedder::REFUSE_EXPENSIVE)
+		return false;
+	bool expensive = command == "LIST" || command == "WHO" || command == "NAMES" || command == "CHATHISTORY"
+					 || command == "REGISTER" || (command == "FILE" && params.word() == "SEND");
+	if (!expensive)
+		return false;
+	_shedder.note(LoadShedder::REFUSE_EXPENSIVE);
+	ArenaString reply(_arena);
+	reply << ":server 263 " << client.getNick() << ' ' << command
+		  << " :Server load is temporarily too heavy. Please wait a while and try again.\r\n";
+	sendTo(client.getFd(), reply.data(), reply.size());
+	return true;
+}
+
+// STATS l: the current stage, what feeds it and what each stage has shed
+void Server::sendLoadStats(Client &client)
+{
+	std::ostringstream head;
+	head << ":server 249 " << client.getNick() << " stage " << LoadShedder::name(_shedder.stage());
+	if (!_shedder.enabled())
+		head << " (shedding off, IRC_SHED_LAG_US=0)";
+	else
+		head << " lag " << _shedder.lag() << "us queued " << _shedder.depth() << " window " << _shedder.window() / 1000 << "ms";
+	head << "\r\n";
+	sendTo(client.getFd(), head.str());
+	for (int k = LoadShedder::DEFER_ACCEPTS; k < LoadShedder::STAGES; ++k)
+	{
+		LoadShedder::Stage stage = static_cast<LoadShedder::Stage>(k);
+		std::ostringstream line;
+		line << ":server 249 " << client.getNick() << " " << LoadShedder::name(stage) << " entered " << _shedder.entered(stage);
+		if (stage != LoadShedder::DEFER_ACCEPTS) // deferred connections are the kernel's to count
+			line << " shed " << _shedder.actions(stage);
+		line << "\r\n";
+		sendTo(client.getFd(), line.str());
+	}
+}
@@ -5,26 +5,32 @@
 #include <sstream>
 #include <sys/socket.h>
 
-bool isValidNick(const std::string &nick) {
-    if (std::isdigit(nick[0]))
-        return false;
-    for (size_t i = 0; i < nick.size(); ++i) {
-        char c = nick[i];
-        if (!std::isalnum(c) && std::string("[]\\`_^{|}-").find(c) == std::string::npos)
-            return false;
-    }
-    return true;
-}
-
 bool Server::authMiddleware(Client &client, const std::string &command, std::istringstream &iss)
 {
 	int	client_fd = client.getFd();
 	std::string msg;
 
-	if (!client.hasPass() && command != "PASS")
+	if (command == "CAP")
+	{
+		handleCap(client, iss); // clients open with CAP LS, before PASS
+		return false;
+	}
+	if (command == "AUTHENTICATE")
+	{
+		handleAuthenticate(client, iss); // a SASL login stands in for PASS
+		return false;
+	}
+	if (command == "RESUME")
+	{
+		handleResume(client, iss); // the token stands in for the whole registration
+		return false;
+	}
+	// a client negotiating caps may send NICK and USER first and log in with SASL instead of PASS
+	bool early = client.isNegotiatingCaps() && (command == "NICK" || command == "USER");
+	if (!client.hasPass() && command != "PASS" && !early)
 	{
 		msg = "461 PASS :You need to be authenticated\r\n";
-		send(client_fd, msg.c_str(), msg.size(), 0);
+		sendTo(client_fd, msg);
 		return false;
 	}
 	if (command == "PASS")
@@ -35,25 +41,25 @@ bool Server::authMiddleware(Client &client, const std::string &command, std::ist
 		if (pass.empty())
 		{
 			msg = "461 PASS :Not enough parameters\r\n";
-			send(client_fd, msg.c_str(), msg.size(), 0);
+			sendTo(client_fd, msg);
 			return false;
 		}
 		if (client.hasPass())
 		{
 			msg = "462 PASS :You may not reregister\r\n";
-			send(client_fd, msg.c_str(), msg.size(), 0);
+			sendTo(client_fd, msg);
 			return false;
 		}
 		if (pass == _password)
 		{
 			client.setPass(true);
 			msg = ":server NOTICE * :Password accepted\r\n";
-			send(client_fd, msg.c_str(), msg.size(), 0);
+			sendTo(client_fd, msg);
 		}
 		else
 		{
 			msg = "464 PASS :Password incorrect\r\n";
-			send(client_fd, msg.c_str(), msg.size(), 0);
+			sendTo(client_fd, msg);
 		}
 		return false;
 	}
@@ -64,19 +70,36 @@ bool Server::authMiddleware(Client &client, const std::string &command, std::ist
 		if (nick.empty())
 		{
 			msg = "431 NICK :No nickname given\r\n";
-			send(client_fd, msg.c_str(), msg.size(), 0);
+			sendTo(client_fd, msg);
 			return false;
 		}
-		if (this->getFdByNick(nick) != -1)
+		int holder = this->getFdByNick(nick);
+		// an unregistered connection can never keep a nick reserved against it,
+		// so the account owner takes it over
+		if (holder != -1 && holder != client_fd && !_clients[holder].isAuthenticated()
+			&& _accounts.find(nick) && !nickReserved(client, nick) && nickReserved(_clients[holder], nick))
+		{
+			sendTo(holder, ":server 433 * " + nick + " :Nickname belongs to a registered account, log in to use it\r\n");
+			_clients[holder].clearNick();
+			holder = -1;
+		}
+		if (holder != -1)
 		{
 			std::string msg = ":server 433 * " + nick + " :Nickname is already in use\r\n";
-			send(client.getFd(), msg.c_str(), msg.size(), 0);
+			sendTo(client.getFd(), msg);
 			return false;
 		}
-		if (!isValidNick(nick))
+		if (!IrcChars::isNick(nick))
 		{
 			msg = ":server 432 * " + nick + " :Erroneous nickname\r\n";
-			send(client_fd, msg.c_str(), msg.size(), 0);
+			sendTo(client_fd, msg);
+			return false;
+		}
+		// before registration the SASL login may still come, completeRegistration checks again
+		if (client.isAuthenticated() && nickReserved(client, nick))
+		{
+			msg = ":server 433 * " + nick + " :Nickname belongs to a registered account, log in to use it\r\n";
+			sendTo(client_fd, msg);
 			return false;
 		}
 		
@@ -86,17 +109,10 @@ bool Server::authMiddleware(Client &client, const std::string &command, std::ist
 		
 		client.setNick(nick);
 		msg = ":server NOTICE * :Nickname set to " + nick + "\r\n";
-		send(client_fd, msg.c_str(), msg.size(), 0);
+		sendTo(client_fd, msg);
 		
 		if (!client.isAuthenticated() && client.hasPass() && client.hasNick() && client.hasUser())
-		{
-			client.setAuthenticated(true);
-			std::string welcome = ":server NOTICE " + client.getNick() +
-				" :Welcome to ft_irc, " + client.getNick() + "!" + client.getUser() + "@localhost\r\n";
-			send(client_fd, welcome.c_str(), welcome.size(), 0);
-			std::cout << "Client " << client_fd << " is now authenticated as "
-					  << client.getNick() << "\n";
-		}
+			completeRegistration(client); // may wait for the hostname lookup
 		else if (wasAuthenticated && !oldNick.empty())
 		{
 			// User was already authenticated and changed nick - notify all channels
@@ -120,46 +136,38 @@ bool Server::authMiddleware(Client &client, const std::string &command, std::ist
 		if (client.hasUser())
 		{
 			msg = ":server 462 USER :You may not reregister\r\n";
-			send(client_fd, msg.c_str(), msg.size(), 0);
+			sendTo(client_fd, msg);
 			return false;
 		}
 
 		if (client.isAuthenticated())
 		{
 			msg = ":server 462 USER :You may not reregister\r\n";
-			send(client_fd, msg.c_str(), msg.size(), 0);
+			sendTo(client_fd, msg);
 			return false;
 		}
 
 		if (username.empty() || hostname.empty() || servername.empty() || realname.empty())
 		{
 			msg = ":server 461 USER :Not enough parameters\r\n";
-			send(client_fd, msg.c_str(), msg.size(), 0);
+			sendTo(client_fd, msg);
 			return false;
 		}
 		client.setUser(username); //!
-		client.setHostname(hostname);
+		// the hostname parameter is ignored (RFC 2812), the host comes from the resolver
 		client.setServername(servername);
 		client.setRealname(realname);
 		//client.setUserSet(true); //Flag para saber que todo se ha seteado correctamente
 
 		msg = ":server NOTICE * :Username set to " + username + "\r\n";
-		send(client_fd, msg.c_str(), msg.size(), 0);
-		if (!client.isAuthenticated() && client.hasPass() && client.hasNick() && client.hasUser())
-		{
-			client.setAuthenticated(true);
-			std::string welcome = ":server NOTICE " + client.getNick() +
-				" :Welcome to ft_irc, " + client.getNick() + "!" + client.getUser() + "@localhost\r\n";
-			send(client_fd, welcome.c_str(), welcome.size(), 0);
-			std::cout << "Client " << client_fd << " is now authenticated as "
-					  << client.getNick() << "\n";
-		}
+		sendTo(client_fd, msg);
+		completeRegistration(client); // may wait for the hostname lookup
 		return false;
 	}
 	if (!client.isAuthenticated())
 	{
 		msg = "461 " + command + " :You are not fully authenticated, did you set your USER and NICK?\r\n";
-		send(client_fd, msg.c_str(), msg.size(), 0);
+		sendTo(client_fd, msg);
 		return false;
 	}
 	return true;
@@ -0,0 +1,126 @@
+#include "Server.hpp"
+#include <sstream>
+#include <cctype>
+#include <cstdlib>
+
+struct CapName
+{
+	const char *name;
+	unsigned int cap;
+};
+
+static const CapName CAPS[] = {
+	{ "message-tags", CAP_MESSAGE_TAGS },
+	{ "server-time", CAP_SERVER_TIME },
+	{ "echo-message", CAP_ECHO_MESSAGE },
+	{ "multi-prefix", CAP_MULTI_PREFIX }, // one prefix (@) exists, so NAMES and WHO already show them all
+	{ "sasl", CAP_SASL }, // only offered with an account store (Accounts.cpp)
+	{ "draft/resume-0.5", CAP_RESUME }, // only offered with IRC_RESUME_GRACE (Resume.cpp)
+};
+static const size_t CAP_COUNT = sizeof(CAPS) / sizeof(CAPS[0]);
+
+static unsigned int capByName(const std::string &name)
+{
+	for (size_t i = 0; i < CAP_COUNT; ++i)
+		if (name == CAPS[i].name)
+			return CAPS[i].cap;
+	return 0;
+}
+
+// values: CAP LS 302 lists sasl with its mechanisms
+static std::string capNames(unsigned int caps, bool values = false)
+{
+	std::string names;
+	for (size_t i = 0; i < CAP_COUNT; ++i)
+	{
+		if (!(caps & CAPS[i].cap))
+			continue;
+		if (!names.empty())
+			names += " ";
+		names += CAPS[i].name;
+		if (values && CAPS[i].cap == CAP_SASL)
+			names += "=PLAIN";
+	}
+	return names;
+}
+
+// CAP LS [302] | LIST | REQ :[-]<cap> ... | END
+// LS or REQ before registration holds it until END. A REQ is taken whole or
+// refused whole (NAK), as IRCv3 asks.
+void Server::handleCap(Client &client, std::istringstream &iss)
+{
+	int fd = client.getFd();
+	std::string sub;
+	iss >> sub;
+	for (size_t i = 0; i < sub.size(); ++i)
+		sub[i] = static_cast<char>(std::toupper(static_cast<unsigned char>(sub[i])));
+	std::string prefix = ":server CAP " + (client.isAuthenticated() ? client.getNick() : std::string("*")) + " ";
+	unsigned int offered = _accounts.isOpen() ? ~0u : ~static_cast<unsigned int>(CAP_SASL);
+	if (!_resumeGraceUs)
+		offered &= ~static_cast<unsigned int>(CAP_RESUME);
+
+	if (sub == "LS")
+	{
+		std::string version;
+		iss >> version;
+		if (!client.isAuthenticated())
+			client.setNegotiatingCaps(true);
+		sendTo(fd, prefix + "LS :" + capNames(offered, std::atoi(version.c_str()) >= 302) + "\r\n");
+	}
+	else if (sub == "LIST")
+		sendTo(fd, prefix + "LIST :" + capNames(client.getCaps()) + "\r\n");
+	else if (sub == "REQ")
+	{
+		std::string list;
+		std::getline(iss, list);
+		size_t start = list.find_first_not_of(" :");
+		list = start == std::string::npos ? "" : list.substr(start);
+		if (!client.isAuthenticated())
+			client.setNegotiatingCaps(true);
+		unsigned int caps = client.getCaps();
+		bool known = !list.empty();
+		std::istringstream names(list);
+		std::string name;
+		while (known && names >> name)
+		{
+			bool remove = name[0] == '-';
+			unsigned int cap = capByName(remove ? name.substr(1) : name) & offered;
+			known = cap != 0;
+			caps = remove ? caps & ~cap : caps | cap;
+		}
+		if (!known)
+		{
+			sendTo(fd, prefix + "NAK :" + list + "\r\n");
+			return;
+		}
+		unsigned int had = client.getCaps();
+		setCaps(client, caps);
+		sendTo(fd, prefix + "ACK :" + list + "\r\n");
+		if (client.isAuthenticated() && (caps & ~had & CAP_RESUME))
+			issueResumeToken(client); // before registration it comes with the welcome
+		else if (had & ~caps & CAP_RESUME)
+			dropSession(fd);
+	}
+	else if (sub == "END")
+	{
+		if (!client.isNegotiatingCaps())
+			return;
+		client.setNegotiatingCaps(false);
+		completeRegistration(client); // may still wait for PASS/NICK/USER or the hostname lookup
+	}
+	else
+		sendTo(fd, ":server 410 " + (client.isAuthenticated() ? client.getNick() : std::string("*")) + " " + sub +
+				   " :Invalid CAP command\r\n");
+}
+
+// Fan-out reads the wire bits from _wireCaps by fd instead of looking the client up
+void Server::setCaps(Client &client, unsigned int caps)
+{
+	client.setCaps(caps);
+	int fd = client.getFd();
+	if (fd < 0)
+		return;
+	if (static_cast<size_t>(fd) >= _wireCaps.size())
+		_wireCaps.resize(fd + 1, 0);
+	_wireCaps[fd] = static_cast<unsigned char>(caps & CAP_WIRE_MASK);
+}
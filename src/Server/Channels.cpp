@@ -0,0 +1,48 @@
+#include "Server.hpp"
+#include "Config.hpp"
+#include <sstream>
+
+// IRC_PERSISTENT_CHANNELS: comma list of channels kept, modes and topic
+// included, when their last member leaves. IRC_CHANNEL_POOL: spare Channel
+// objects kept for new channels.
+void Server::configureChannels()
+{
+	std::istringstream names(configStr("IRC_PERSISTENT_CHANNELS", ""));
+	std::string name;
+	while (std::getline(names, name, ','))
+		if (!name.empty())
+			_persistentChannels.insert(name);
+	_channelPool.setMax(static_cast<size_t>(configLong("IRC_CHANNEL_POOL", 64)));
+}
+
+std::map<std::string, Channel *>::iterator Server::createChannel(const std::string &name)
+{
+	return _channels.insert(std::make_pair(name, _channelPool.acquire(name))).first;
+}
+
+// Every path that takes a member out (QUIT, KICK, a refused JOIN, a netsplit)
+// ends here, so an empty channel never outlives the command that emptied it
+void Server::reclaimChannel(std::map<std::string, Channel *>::iterator it)
+{
+	if (it == _channels.end() || !it->second->getMembers().empty() || _persistentChannels.count(it->first))
+		return;
+	_channelPool.release(it->second);
+	_channels.erase(it);
+}
+
+// STATS C: channels in the table and what the pool has done
+void Server::sendChannelStats(Client &client)
+{
+	size_t empty = 0;
+	for (std::set<std::string>::iterator it = _persistentChannels.begin(); it != _persistentChannels.end(); ++it)
+	{
+		std::map<std::string, Channel *>::iterator found = _channels.find(*it);
+		if (found != _channels.end() && found->second->getMembers().empty())
+			empty++;
+	}
+	std::ostringstream line;
+	line << ":server 249 " << client.getNick() << " C live " << _channels.size() << " empty_persistent " << empty
+		 << " created " << _channelPool.created() << " reclaimed " << _channelPool.reclaimed()
+		 << " reused " << _channelPool.reused() << " spare " << _channelPool.spare() << "\r\n";
+	sendTo(client.getFd(), line.str());
+}
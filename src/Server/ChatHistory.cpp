@@ -0,0 +1,81 @@
+#include "Server.hpp"
+#include <sstream>
+#include <cstdlib>
+
+static const size_t CHATHISTORY_MAX = 100;
+
+static std::string failLine(const std::string &code, const std::string &text)
+{
+	return ":server FAIL CHATHISTORY " + code + " :" + text + "\r\n";
+}
+
+// "*" means no reference point; otherwise "timestamp=<ms since epoch>" or a bare number
+static bool parseReference(const std::string &ref, long &when)
+{
+	if (ref == "*")
+	{
+		when = -1;
+		return true;
+	}
+	std::string num = ref;
+	if (num.compare(0, 10, "timestamp=") == 0)
+		num = num.substr(10);
+	if (num.empty())
+		return false;
+	char *end = NULL;
+	when = std::strtol(num.c_str(), &end, 10);
+	return *end == '\0' && when >= 0;
+}
+
+// CHATHISTORY LATEST <channel> <* | timestamp=ms> <limit>
+// CHATHISTORY AFTER <channel> <timestamp=ms> <limit>
+void Server::handleChatHistory(Client &client, std::istringstream &iss)
+{
+	std::string sub, target, ref, limitStr;
+	iss >> sub >> target >> ref >> limitStr;
+	if (sub.empty() || target.empty() || ref.empty() || limitStr.empty())
+	{
+		sendTo(client.getFd(), failLine("NEED_MORE_PARAMS", "Usage: CHATHISTORY LATEST|AFTER <channel> <*|timestamp=ms> <limit>"));
+		return;
+	}
+	long limit = std::atol(limitStr.c_str());
+	long when;
+	if (limit <= 0 || !parseReference(ref, when) || (sub == "AFTER" && when < 0))
+	{
+		sendTo(client.getFd(), failLine("INVALID_PARAMS", "Invalid reference or limit"));
+		return;
+	}
+	if (static_cast<size_t>(limit) > CHATHISTORY_MAX)
+		limit = CHATHISTORY_MAX;
+
+	std::map<std::string, Channel *>::iterator it = _channels.find(target);
+	if (it == _channels.end() || !it->second->hasMember(client.getFd()))
+	{
+		sendTo(client.getFd(), failLine("INVALID_TARGET", target + " is not a channel you are on"));
+		return;
+	}
+	const ChannelHistory &history = it->second->getHistory();
+	std::vector<std::string> lines;
+	if (sub == "LATEST" && when < 0)
+		history.latest(limit, lines);
+	else if (sub == "LATEST")
+	{
+		history.after(when, history.size(), lines);
+		if (lines.size() > static_cast<size_t>(limit))
+			lines.erase(lines.begin(), lines.end() - limit);
+	}
+	else if (sub == "AFTER")
+		history.after(when, limit, lines);
+	else
+	{
+		sendTo(client.getFd(), failLine("INVALID_PARAMS", "Unknown subcommand " + sub));
+		return;
+	}
+	for (size_t i = 0; i < lines.size(); ++i)
+		sendTo(client.getFd(), lines[i]);
+	std::ostringstream end;
+	end << ":server NOTICE " << client.getNick() << " :End of CHATHISTORY " << target
+		<< " (" << lines.size() << " lines)\r\n";
+	std::string endMsg = end.str();
+	sendTo(client.getFd(), endMsg);
+}
@@ -0,0 +1,295 @@
+#include "Server.hpp"
+#include "FaultInjection.hpp"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <ctime>
+#include <cstdio>
+
+// Sends one copy of msg to every recipient of the fan-out. Large fan-outs become
+// a job the loop works through a slice at a time, so one message to a huge
+// channel does not hold up everyone else.
+void Server::deliver(FanOut &fan, const std::string &msg)
+{
+	deliver(fan, msg.data(), msg.size());
+}
+
+// msg may live in the arena: a job keeps its own copy. Recipients get the
+// form of their capability class (wireForm), each rendered once per message,
+// so a channel costs one render per class present rather than per member.
+void Server::deliver(FanOut &fan, const char *msg, size_t len, StringRef clientTags)
+{
+	const FanOut::FdList &recipients = fan.recipients();
+	_cmdFanout += recipients.size();
+	bool tagged = !clientTags.empty();
+	if (recipients.size() <= _fanoutInlineMax)
+	{
+		WireMessage forms[WIRE_FORMS];
+		for (unsigned int f = 0; f < WIRE_FORMS; ++f)
+		{
+			WireMessage unrendered = { NULL, 0, NULL, 0 };
+			forms[f] = unrendered;
+		}
+		forms[0].data = msg;
+		forms[0].len = len;
+		long timeMs = -1;
+		for (size_t i = 0; i < recipients.size(); ++i)
+		{
+			unsigned int form = wireForm(recipients[i], tagged);
+			if (!forms[form].data)
+			{
+				if (timeMs < 0)
+					timeMs = ChannelHistory::nowMillis();
+				StringRef rendered = renderForm(form, msg, len, clientTags, timeMs);
+				forms[form].data = rendered.data();
+				forms[form].len = rendered.size();
+			}
+			sendTo(recipients[i], forms[form]);
+		}
+		return;
+	}
+	FanOutJob job;
+	job.seq = ++_fanoutSeq;
+	job.forms[0].assign(msg, len);
+	job.tags.assign(clientTags.data(), clientTags.size());
+	job.timeMs = ChannelHistory::nowMillis();
+	job.cursor = 0;
+	job.recipients.assign(recipients.begin(), recipients.end());
+	for (size_t i = 0; i < recipients.size(); ++i)
+	{
+		int fd = recipients[i];
+		if (fd < 0)
+			continue;
+		if (static_cast<size_t>(fd) >= _fanoutTail.size())
+		{
+			_fanoutTail.resize(fd + 1, _fanoutSeq - 1);
+			_fanoutDelivered.resize(fd + 1, _fanoutSeq - 1);
+		}
+		_fanoutTail[fd] = job.seq; // from now on sendTo holds its messages back
+	}
+	_fanoutJobs.push_back(job);
+}
+
+// Jobs run oldest first, up to _fanoutPerTick recipients per loop iteration. A
+// recipient gets the job's message, then whatever was held back behind it.
+void Server::processFanOutJobs()
+{
+	size_t budget = _fanoutPerTick;
+	while (budget > 0 && !_fanoutJobs.empty())
+	{
+		FanOutJob &job = _fanoutJobs.front();
+		while (budget > 0 && job.cursor < job.recipients.size())
+		{
+			int fd = job.recipients[job.cursor++];
+			budget--;
+			if (fd < 0)
+			{
+				if (!_services.empty())
+					queueServiceInput(fd, job.forms[0].data(), job.forms[0].size());
+				continue;
+			}
+			// fds closed (and maybe reused) since the job started were reset past it
+			if (_fanoutDelivered[fd] >= job.seq)
+				continue;
+			unsigned int form = wireForm(fd, !job.tags.empty());
+			std::string &text = job.forms[form];
+			if (text.empty())
+			{
+				StringRef rendered = renderForm(form, job.forms[0].data(), job.forms[0].size(), StringRef(job.tags), job.timeMs);
+				text.assign(rendered.data(), rendered.size());
+			}
+			std::string &framed = job.framed[form];
+			WireMessage wire = { text.data(), text.size(), NULL, 0 };
+			if (!framed.empty())
+			{
+				wire.framed = framed.data();
+				wire.framedLen = framed.size();
+			}
+			transmit(fd, wire);
+			if (wire.framed && framed.empty())
+				framed.assign(wire.framed, wire.framedLen); // outlives this iteration's arena
+			_fanoutDelivered[fd] = job.seq;
+			std::map<int, std::deque<std::pair<unsigned long, std::string> > >::iterator held = _deferred.find(fd);
+			if (held == _deferred.end())
+				continue;
+			std::deque<std::pair<unsigned long, std::string> > &queue = held->second;
+			while (!queue.empty() && queue.front().first <= job.seq)
+			{
+				WireMessage held = { queue.front().second.data(), queue.front().second.size(), NULL, 0 };
+				transmit(fd, held);
+				queue.pop_front();
+			}
+			if (queue.empty())
+				_deferred.erase(held);
+		}
+		if (job.cursor == job.recipients.size())
+			_fanoutJobs.pop_front();
+	}
+}
+
+// Index of the form fd gets: its server-time and message-tags bits, the
+// latter only when there are client tags to show
+unsigned int Server::wireForm(int fd, bool tagged) const
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= _wireCaps.size())
+		return 0;
+	unsigned int form = _wireCaps[fd];
+	return tagged ? form : form & ~static_cast<unsigned int>(CAP_MESSAGE_TAGS);
+}
+
+// "@time=2026-01-02T03:04:05.678Z;+tag=value " in front of msg, on the arena
+StringRef Server::renderForm(unsigned int form, const char *msg, size_t len, StringRef clientTags, long timeMs)
+{
+	if (!form)
+		return StringRef(msg, len);
+	ArenaString out(_arena, len + clientTags.size() + 48);
+	char sep = '@';
+	if (form & CAP_SERVER_TIME)
+	{
+		time_t seconds = static_cast<time_t>(timeMs / 1000);
+		struct tm utc;
+		gmtime_r(&seconds, &utc);
+		char stamp[40];
+		size_t n = std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+		std::snprintf(stamp + n, sizeof(stamp) - n, ".%03ldZ", timeMs % 1000);
+		out << sep << "time=" << stamp;
+		sep = ';';
+	}
+	if (form & CAP_MESSAGE_TAGS)
+		out << sep << clientTags;
+	out << ' ' << StringRef(msg, len);
+	return StringRef(out.data(), out.size());
+}
+
+// The only place bytes for a client hit its socket
+void Server::transmit(int fd, WireMessage &wire)
+{
+	std::map<int, WebSocket>::iterator ws = _webSockets.empty() ? _webSockets.end() : _webSockets.find(fd);
+	if (ws == _webSockets.end())
+	{
+		writeOut(fd, wire.data, wire.len);
+		return;
+	}
+	if (!ws->second.isOpen())
+		return; // nothing is sent before the upgrade response
+	if (!wire.framed)
+	{
+		char *out = static_cast<char *>(_arena.allocate(WebSocket::framedSize(wire.data, wire.len)));
+		wire.framedLen = WebSocket::frameLines(out, wire.data, wire.len);
+		wire.framed = out;
+	}
+	writeOut(fd, wire.framed, wire.framedLen);
+}
+
+// Bytes go behind whatever is already queued for fd, so a short write never
+// lets a later message overtake or cut into an earlier one
+void Server::writeOut(int fd, const char *data, size_t len)
+{
+	if (!_closing.empty() && _closing.find(fd) != _closing.end())
+		return;
+	std::map<int, std::string>::iterator queued = _sendQueues.empty() ? _sendQueues.end() : _sendQueues.find(fd);
+	if (queued != _sendQueues.end())
+	{
+		if (queued->second.size() + len > _sendQueueMax)
+			closeLater(fd, "SendQ exceeded");
+		else
+			queued->second.append(data, len);
+		return;
+	}
+	size_t sent = 0;
+	if (!writeSome(fd, data, len, sent) || sent == len)
+		return;
+	_sendQueues[fd].assign(data + sent, len - sent);
+	watchWritable(fd, true);
+}
+
+// Writes until the socket is full. False on a real error, after which fd is
+// already on its way out.
+bool Server::writeSome(int fd, const char *data, size_t len, size_t &sent)
+{
+	while (sent < len)
+	{
+		ssize_t n = sockSend(fd, data + sent, len - sent, MSG_NOSIGNAL);
+		if (n > 0)
+			sent += static_cast<size_t>(n);
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		else
+		{
+			closeLater(fd, std::string("Write error: ") + std::strerror(errno));
+			return false;
+		}
+	}
+	return true;
+}
+
+// POLLOUT: hand the socket what it did not take before
+void Server::flushSendQueue(int fd)
+{
+	std::map<int, std::string>::iterator queued = _sendQueues.find(fd);
+	if (queued == _sendQueues.end())
+	{
+		watchWritable(fd, false);
+		return;
+	}
+	size_t sent = 0;
+	if (!writeSome(fd, queued->second.data(), queued->second.size(), sent))
+		return;
+	queued->second.erase(0, sent);
+	if (!queued->second.empty())
+		return;
+	_sendQueues.erase(queued);
+	watchWritable(fd, false);
+}
+
+void Server::watchWritable(int fd, bool on)
+{
+	int index = pollIndex(fd);
+	if (index < 0)
+		return;
+	if (on)
+		_pfds[index].events |= POLLOUT;
+	else
+		_pfds[index].events &= ~POLLOUT;
+}
+
+// A send can fail deep inside a broadcast or a command; the fd is only
+// closed once the loop is back between events
+void Server::closeLater(int fd, const std::string &reason)
+{
+	_closing.insert(std::make_pair(fd, reason));
+}
+
+void Server::closePending()
+{
+	while (!_closing.empty())
+	{
+		std::map<int, std::string>::iterator it = _closing.begin();
+		int fd = it->first;
+		std::string reason = it->second;
+		_closing.erase(it);
+		if (reason.compare(0, 12, "Write error:") == 0 && detachSession(fd))
+			continue; // a dead socket, the session waits for a RESUME
+		disconnectClientFd(fd, reason); // telling the others can fail more writes, the loop picks them up
+	}
+}
+
+// A closed fd drops its held messages and skips every job already queued.
+// Queued output gets one last non-blocking try.
+void Server::forgetDelivery(int fd)
+{
+	_deferred.erase(fd);
+	if (fd >= 0 && static_cast<size_t>(fd) < _wireCaps.size())
+		_wireCaps[fd] = 0;
+	if (!_sendQueues.empty() && _sendQueues.find(fd) != _sendQueues.end())
+		flushSendQueue(fd);
+	_sendQueues.erase(fd);
+	_closing.erase(fd);
+	if (fd >= 0 && static_cast<size_t>(fd) < _fanoutTail.size())
+	{
+		_fanoutTail[fd] = _fanoutSeq;
+		_fanoutDelivered[fd] = _fanoutSeq;
+	}
+}
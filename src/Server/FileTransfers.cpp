@@ -0,0 +1,393 @@
+#include "Server.hpp"
+#include "Config.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cctype>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+static const size_t TOKEN_LINE_MAX = 128; // a data connection's first line, the token
+
+// 16 random bytes in hex. A token is all that ties a data connection to a
+// transfer, so it comes from the kernel's generator.
+static std::string makeToken()
+{
+	unsigned char raw[16];
+	int fd = open("/dev/urandom", O_RDONLY);
+	ssize_t n = fd < 0 ? -1 : read(fd, raw, sizeof(raw));
+	if (fd >= 0)
+		close(fd);
+	if (n != static_cast<ssize_t>(sizeof(raw)))
+		for (size_t i = 0; i < sizeof(raw); ++i)
+			raw[i] = static_cast<unsigned char>(std::rand());
+	static const char hex[] = "0123456789abcdef";
+	std::string token;
+	for (size_t i = 0; i < sizeof(raw); ++i)
+	{
+		token += hex[raw[i] >> 4];
+		token += hex[raw[i] & 15];
+	}
+	return token;
+}
+
+// IRC_FILE_PORT turns transfers on. The data connections get their own
+// listener so file bytes never go through the IRC line path.
+void Server::configureFileTransfers()
+{
+	_filePort = configLong("IRC_FILE_PORT", 0);
+	_fileMax = static_cast<size_t>(configLong("IRC_FILE_MAX", 4));
+	_fileMaxSize = static_cast<unsigned long>(configLong("IRC_FILE_MAX_SIZE", 1024L * 1024 * 1024));
+	_fileRate = static_cast<unsigned long>(configLong("IRC_FILE_RATE", 1024L * 1024));
+	_fileBytesPerTick = static_cast<size_t>(configLong("IRC_FILE_BYTES_PER_TICK", 4 * FileRelay::CHUNK));
+	_fileTimeoutUs = static_cast<unsigned long>(configLong("IRC_FILE_TIMEOUT", 120)) * 1000000UL;
+	if (_filePort <= 0)
+		return;
+	std::signal(SIGPIPE, SIG_IGN); // splice(2) into a closed socket raises it and has no MSG_NOSIGNAL
+	std::ostringstream port;
+	port << _filePort;
+	Endpoint endpoint;
+	Endpoint::parse(port.str(), endpoint); // every address, like the client port
+	_fileListenFd = setupListener(endpoint);
+	std::cout << "File transfers on port " << _filePort << ": at most " << _fileMax << " at once, "
+			  << _fileRate << " bytes/s each\n";
+}
+
+// FILE SEND <nick> <filename> <size>	offer a file
+// FILE ACCEPT <id>						take an offer, both ends get READY with their token
+// FILE CANCEL <id>						withdraw or refuse an offer, or stop a running transfer
+void Server::handleFile(Client &client, std::istringstream &iss)
+{
+	int fd = client.getFd();
+	const std::string &nick = client.getNick();
+	std::string sub;
+	iss >> sub;
+	for (size_t i = 0; i < sub.size(); ++i)
+		sub[i] = static_cast<char>(std::toupper(static_cast<unsigned char>(sub[i])));
+	if (_fileListenFd == -1)
+	{
+		sendTo(fd, ":server FAIL FILE DISABLED :File transfers are not enabled on this server\r\n");
+		return;
+	}
+	if (sub == "SEND")
+	{
+		std::string target, name;
+		unsigned long size = 0;
+		if (!(iss >> target >> name >> size) || size == 0)
+		{
+			sendTo(fd, ":server 461 " + nick + " FILE :Not enough parameters\r\n");
+			return;
+		}
+		name = name.substr(name.find_last_of('/') + 1); // the receiver gets a name, never a path
+		int toFd = getFdByNick(target);
+		if (toFd == -1 || name.empty())
+		{
+			sendTo(fd, ":server 401 " + nick + " " + target + " :No such nick\r\n");
+			return;
+		}
+		if (toFd < 0 || toFd == fd)
+		{
+			sendTo(fd, ":server FAIL FILE BAD_TARGET " + target + " :Files only go to other users on this server\r\n");
+			return;
+		}
+		if (size > _fileMaxSize)
+		{
+			sendTo(fd, ":server FAIL FILE TOO_LARGE " + target + " :File is larger than this server relays\r\n");
+			return;
+		}
+		if (_transfers.size() >= _fileMax)
+		{
+			sendTo(fd, ":server FAIL FILE TOO_MANY " + target + " :Too many transfers in progress, try again later\r\n");
+			return;
+		}
+		unsigned long id = ++_nextTransfer;
+		Transfer &t = _transfers[id];
+		t.fromFd = fd;
+		t.toFd = toFd;
+		t.name = name;
+		t.size = size;
+		t.accepted = false;
+		t.sendData = -1;
+		t.recvData = -1;
+		t.relaying = false;
+		t.deadline = CommandStats::nowMicros() + _fileTimeoutUs;
+		t.resumeAt = 0;
+		std::ostringstream offer;
+		offer << id << " " << name << " " << size;
+		sendTo(fd, ":server FILE " + nick + " OFFERED " + target + " " + offer.str() + "\r\n");
+		sendTo(toFd, ":server FILE " + _clients[toFd].getNick() + " OFFER " + nick + " " + offer.str() + "\r\n");
+		return;
+	}
+	if (sub != "ACCEPT" && sub != "CANCEL")
+	{
+		sendTo(fd, ":server 421 " + nick + " FILE :Unknown FILE subcommand\r\n");
+		return;
+	}
+	unsigned long id = 0;
+	iss >> id;
+	std::map<unsigned long, Transfer>::iterator it = _transfers.find(id);
+	if (it == _transfers.end() || (it->second.toFd != fd && (sub == "ACCEPT" || it->second.fromFd != fd)))
+	{
+		std::ostringstream msg;
+		msg << ":server FAIL FILE NO_SUCH_TRANSFER " << id << " :No such transfer\r\n";
+		sendTo(fd, msg.str());
+		return;
+	}
+	Transfer &t = it->second;
+	if (sub == "CANCEL")
+	{
+		finishTransfer(id, t.toFd == fd && !t.accepted ? "Refused" : "Cancelled");
+		return;
+	}
+	if (t.accepted)
+		return;
+	t.accepted = true;
+	t.sendToken = makeToken();
+	t.recvToken = makeToken();
+	t.deadline = CommandStats::nowMicros() + _fileTimeoutUs;
+	std::ostringstream ready;
+	ready << " READY " << id << " " << _filePort << " ";
+	if (t.fromFd != -1)
+		sendTo(t.fromFd, ":server FILE " + _clients[t.fromFd].getNick() + ready.str() + t.sendToken + "\r\n");
+	sendTo(fd, ":server FILE " + nick + ready.str() + t.recvToken + "\r\n");
+}
+
+void Server::acceptFileConnection()
+{
+	int fd = accept(_fileListenFd, NULL, NULL);
+	if (fd < 0)
+	{
+		if (errno != EWOULDBLOCK && errno != EAGAIN)
+			std::cerr << "accept() failed: " << strerror(errno) << std::endl;
+		return;
+	}
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+	{
+		close(fd);
+		return;
+	}
+	addPollFd(fd);
+	_fileHandshakes[fd].deadline = CommandStats::nowMicros() + _fileTimeoutUs;
+}
+
+bool Server::isFileSocket(int fd) const
+{
+	if (_fileHandshakes.empty() && _fileSockets.empty())
+		return false;
+	return _fileHandshakes.count(fd) || _fileSockets.count(fd);
+}
+
+// The token line is peeked first and only consumed up to its newline, so
+// file bytes the sender wrote right behind it stay in the socket for splice
+void Server::readFileToken(int fd)
+{
+	DataHandshake &shake = _fileHandshakes[fd];
+	char buf[TOKEN_LINE_MAX];
+	ssize_t n = recv(fd, buf, sizeof(buf) - shake.line.size(), MSG_PEEK);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	const char *eol = n > 0 ? static_cast<const char *>(memchr(buf, '\n', n)) : NULL;
+	if (!eol && n > 0 && shake.line.size() + n < sizeof(buf))
+	{
+		n = recv(fd, buf, n, 0); // all token so far, safe to take off the socket
+		if (n > 0)
+			shake.line.append(buf, n);
+		return;
+	}
+	unsigned long id = 0;
+	if (eol)
+	{
+		std::string token = shake.line + std::string(buf, eol - buf);
+		if (!token.empty() && token[token.size() - 1] == '\r')
+			token.erase(token.size() - 1);
+		for (std::map<unsigned long, Transfer>::iterator it = _transfers.begin(); it != _transfers.end(); ++it)
+		{
+			Transfer &t = it->second;
+			if (!t.accepted || token.empty())
+				continue;
+			if (token == t.sendToken && t.sendData == -1)
+				t.sendData = fd;
+			else if (token == t.recvToken && t.recvData == -1)
+				t.recvData = fd;
+			else
+				continue;
+			id = it->first;
+			break;
+		}
+	}
+	_fileHandshakes.erase(fd);
+	if (id == 0)
+	{
+		removePollFd(fd);
+		close(fd);
+		return;
+	}
+	recv(fd, buf, eol - buf + 1, 0);
+	_fileSockets[fd] = id;
+	_pfds[pollIndex(fd)].events = 0; // nothing is read until the other end is there too
+	Transfer &t = _transfers[id];
+	if (t.sendData != -1 && t.recvData != -1)
+		startRelay(id);
+}
+
+void Server::startRelay(unsigned long id)
+{
+	Transfer &t = _transfers[id];
+	if (!t.relay.start(t.sendData, t.recvData, t.size, _fileRate, CommandStats::nowMicros()))
+	{
+		finishTransfer(id, t.relay.error());
+		return;
+	}
+	t.relaying = true;
+	pumpTransfer(id);
+}
+
+// One bounded step of a running transfer, then poll for whatever it waits on
+void Server::pumpTransfer(unsigned long id)
+{
+	Transfer &t = _transfers[id];
+	FileRelay::State state = t.relay.pump(CommandStats::nowMicros(), _fileBytesPerTick);
+	if (state == FileRelay::DONE || state == FileRelay::FAILED)
+	{
+		finishTransfer(id, state == FileRelay::FAILED ? t.relay.error() : NULL);
+		return;
+	}
+	t.resumeAt = state == FileRelay::THROTTLED ? t.relay.resumeAt() : 0;
+	int ends[2] = { t.sendData, t.recvData };
+	for (int i = 0; i < 2; ++i)
+	{
+		int index = pollIndex(ends[i]);
+		if (index >= 0)
+			_pfds[index].events = t.relay.events(ends[i]);
+	}
+}
+
+void Server::handleFileSocket(int fd, short revents)
+{
+	if (_fileHandshakes.count(fd))
+	{
+		readFileToken(fd);
+		return;
+	}
+	unsigned long id = _fileSockets[fd];
+	Transfer &t = _transfers[id];
+	bool hangup = (revents & (POLLERR | POLLHUP)) != 0;
+	if (!t.relaying || (hangup && fd == t.recvData))
+	{
+		// a waiting end is polled for nothing, only an error or hangup gets here
+		finishTransfer(id, fd == t.recvData ? "Receiver connection lost" : "Sender connection lost");
+		return;
+	}
+	if (hangup && t.relay.allReceived())
+		removePollFd(fd); // the sender is done and gone, the pipe still drains to the receiver
+	pumpTransfer(id);
+}
+
+// Tells whoever is still around how it ended and closes the data connections.
+// reason is NULL for a transfer that delivered every byte.
+void Server::finishTransfer(unsigned long id, const char *reason)
+{
+	std::map<unsigned long, Transfer>::iterator it = _transfers.find(id);
+	if (it == _transfers.end())
+		return;
+	Transfer &t = it->second;
+	std::ostringstream end;
+	if (reason)
+		end << " ABORTED " << id << " :" << reason << "\r\n";
+	else
+		end << " DONE " << id << " " << t.relay.sent() << "\r\n";
+	int parties[2] = { t.fromFd, t.toFd };
+	for (int i = 0; i < 2; ++i)
+		if (parties[i] != -1)
+			sendTo(parties[i], ":server FILE " + _clients[parties[i]].getNick() + end.str());
+	int ends[2] = { t.sendData, t.recvData };
+	for (int i = 0; i < 2; ++i)
+	{
+		if (ends[i] == -1)
+			continue;
+		removePollFd(ends[i]);
+		_fileSockets.erase(ends[i]);
+		close(ends[i]);
+	}
+	if (t.relaying)
+		t.relay.stop();
+	if (reason)
+		std::cout << "File transfer " << id << " aborted: " << reason << "\n";
+	else
+		std::cout << "File transfer " << id << " done: " << t.relay.sent() << " bytes\n";
+	_transfers.erase(it);
+}
+
+// Offers and transfers still missing a data connection expire; throttled
+// relays whose allowance came back run again
+void Server::expireTransfers()
+{
+	if (_transfers.empty() && _fileHandshakes.empty())
+		return;
+	unsigned long now = CommandStats::nowMicros();
+	std::vector<unsigned long> expired;
+	std::vector<unsigned long> resumed;
+	for (std::map<unsigned long, Transfer>::iterator it = _transfers.begin(); it != _transfers.end(); ++it)
+	{
+		if (!it->second.relaying && now >= it->second.deadline)
+			expired.push_back(it->first);
+		else if (it->second.resumeAt && now >= it->second.resumeAt)
+			resumed.push_back(it->first);
+	}
+	for (size_t i = 0; i < expired.size(); ++i)
+		finishTransfer(expired[i], "Timed out");
+	for (size_t i = 0; i < resumed.size(); ++i)
+		pumpTransfer(resumed[i]);
+	std::vector<int> stale;
+	for (std::map<int, DataHandshake>::iterator it = _fileHandshakes.begin(); it != _fileHandshakes.end(); ++it)
+		if (now >= it->second.deadline)
+			stale.push_back(it->first);
+	for (size_t i = 0; i < stale.size(); ++i)
+	{
+		removePollFd(stale[i]);
+		close(stale[i]);
+		_fileHandshakes.erase(stale[i]);
+	}
+}
+
+// Earliest us at which expireTransfers has something to do, 0 for never
+unsigned long Server::nextTransferEvent() const
+{
+	unsigned long next = 0;
+	for (std::map<unsigned long, Transfer>::const_iterator it = _transfers.begin(); it != _transfers.end(); ++it)
+	{
+		unsigned long at = it->second.relaying ? it->second.resumeAt : it->second.deadline;
+		if (at && (next == 0 || at < next))
+			next = at;
+	}
+	for (std::map<int, DataHandshake>::const_iterator it = _fileHandshakes.begin(); it != _fileHandshakes.end(); ++it)
+		if (next == 0 || it->second.deadline < next)
+			next = it->second.deadline;
+	return next;
+}
+
+// A client that leaves takes its offers with it. A relay already running
+// does not need it and finishes on its own.
+void Server::dropTransfers(int fd)
+{
+	std::vector<unsigned long> gone;
+	for (std::map<unsigned long, Transfer>::iterator it = _transfers.begin(); it != _transfers.end(); ++it)
+	{
+		Transfer &t = it->second;
+		if (t.fromFd == fd)
+			t.fromFd = -1;
+		else if (t.toFd == fd)
+			t.toFd = -1;
+		else
+			continue;
+		if (!t.relaying)
+			gone.push_back(it->first);
+	}
+	for (size_t i = 0; i < gone.size(); ++i)
+		finishTransfer(gone[i], "The other user left");
+}
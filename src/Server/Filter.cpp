@@ -0,0 +1,140 @@
+#include "Server.hpp"
+#include "Config.hpp"
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
+
+// SIGHUP sets it, the run loop starts a reload; kept here rather than in
+// main.cpp so everything linking Server.o has it
+static volatile sig_atomic_t g_reload = 0;
+
+extern "C" void reloadHandler(int signum)
+{
+	(void)signum;
+	g_reload = 1;
+}
+
+volatile sig_atomic_t *getReloadFlag()
+{
+	return &g_reload;
+}
+
+static void *compileFilter(void *arg)
+{
+	FilterReload *reload = static_cast<FilterReload *>(arg);
+	reload->error.clear();
+	reload->filter.load(reload->path, reload->error);
+	char byte = 1;
+	ssize_t woke = write(reload->pipe[1], &byte, 1);
+	(void)woke;
+	return NULL;
+}
+
+// IRC_FILTER_FILE: rule file of the PRIVMSG content filter, reread on SIGHUP.
+// IRC_FILTER_NOTIFY: channel whose operators are told about notify matches.
+void Server::configureFilter()
+{
+	_filterReload.path = configStr("IRC_FILTER_FILE", "");
+	_filterReload.running = false;
+	_filterReload.again = false;
+	_filterReload.pipe[0] = -1;
+	_filterReload.pipe[1] = -1;
+	_filterChannel = configStr("IRC_FILTER_NOTIFY", "#opers");
+	if (_filterReload.path.empty())
+		return;
+	std::string error;
+	if (!_filter.load(_filterReload.path, error))
+		std::cerr << "Content filter: " << error << ", no rules loaded\n"; // a later SIGHUP can fix it
+	else
+		std::cout << "Content filter: " << _filter.size() << " rules, " << _filter.states() << " states\n";
+	if (pipe(_filterReload.pipe) < 0)
+		return;
+	fcntl(_filterReload.pipe[0], F_SETFL, O_NONBLOCK);
+	addPollFd(_filterReload.pipe[0]);
+}
+
+// SIGHUP: the rules are compiled again off the loop, the old ones keep
+// filtering until the new set is ready
+void Server::reloadFilter()
+{
+	if (_filterReload.pipe[0] == -1)
+		return;
+	if (_filterReload.running)
+	{
+		_filterReload.again = true;
+		return;
+	}
+	_filterReload.running = true;
+	if (pthread_create(&_filterReload.thread, NULL, compileFilter, &_filterReload) != 0)
+	{
+		_filterReload.running = false;
+		std::cerr << "Content filter: cannot start the reload thread\n";
+	}
+}
+
+void Server::finishFilterReload()
+{
+	char drain[16];
+	while (read(_filterReload.pipe[0], drain, sizeof(drain)) > 0)
+		;
+	if (!_filterReload.running)
+		return;
+	pthread_join(_filterReload.thread, NULL);
+	_filterReload.running = false;
+	if (_filterReload.error.empty())
+	{
+		_filter.swap(_filterReload.filter);
+		std::cout << "Content filter reloaded: " << _filter.size() << " rules, " << _filter.states() << " states\n";
+	}
+	else
+		std::cerr << "Content filter: " << _filterReload.error << ", keeping the old rules\n";
+	_filterReload.filter.clear();
+	if (_filterReload.again)
+	{
+		_filterReload.again = false;
+		reloadFilter();
+	}
+}
+
+void Server::stopFilterReload()
+{
+	if (_filterReload.running)
+		pthread_join(_filterReload.thread, NULL);
+	_filterReload.running = false;
+	for (int i = 0; i < 2; ++i)
+	{
+		if (_filterReload.pipe[i] != -1)
+			close(_filterReload.pipe[i]);
+		_filterReload.pipe[i] = -1;
+	}
+}
+
+// One scan of the message for all the rules. False when it must not be
+// delivered; after a kill the client is gone.
+bool Server::filterMessage(Client &client, StringRef target, StringRef message)
+{
+	const FilterRule *rule = NULL;
+	FilterAction action = _filter.scan(message.data(), message.size(), rule);
+	if (action == FILTER_PASS)
+		return true;
+	std::ostringstream what;
+	what << client.getHostmask() << " to " << target.str() << " matched line " << rule->line << " ("
+		 << ContentFilter::actionName(action) << "): " << rule->pattern;
+	std::cout << "Content filter: " << what.str() << "\n";
+	if (action == FILTER_NOTIFY)
+	{
+		std::map<std::string, Channel *>::iterator staff = _channels.find(_filterChannel);
+		if (staff == _channels.end())
+			return true;
+		const std::vector<Member> &members = staff->second->getMembers();
+		for (size_t i = 0; i < members.size(); ++i)
+			if (members[i].isOperator && members[i].fd >= 0 && members[i].fd != client.getFd()) // local operators only
+				sendTo(members[i].fd, ":server NOTICE " + members[i].nick + " :*** Filter: " + what.str() + "\r\n");
+		return true;
+	}
+	if (action == FILTER_KILL)
+		killUser(client.getFd(), "Content filter");
+	return false;
+}
@@ -0,0 +1,639 @@
+#include "Server.hpp"
+#include "FanOut.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+// Server-to-server protocol, one line per event, users addressed by uid ("<n>@<server>"):
+//   SERVER <name> <password>            handshake, answered with our own SERVER line
+//   SERVERS <name>...                   servers reachable behind the sender
+//   SQUIT <name>...                     those servers split off
+//   UID <uid> <nick> <ts> <user> <host> :<real>
+//   :<uid> NICK <nick> <ts>   :<uid> QUIT :<reason>   KILL <uid> :<reason>
+//   SJOIN <ts> <#chan> :[@]<uid>...     members (and ops) joining, ts is the channel TS
+//   :<uid> KICK <#chan> <uid>   :<uid> PRIVMSG <#chan|uid> :<text>   ERROR :<reason>
+// Nick collisions keep the older nick TS (both die on a tie); on netjoin the older
+// channel TS keeps its operators. Modes, topics and INVITE stay local to each server.
+
+static const time_t LINK_RETRY_SECONDS = 5;
+
+static bool splitLine(const std::string &line, std::string &source, std::string &command,
+						std::vector<std::string> &params)
+{
+	std::istringstream iss(line);
+	std::string word;
+	if (!(iss >> word))
+		return false;
+	if (word[0] == ':')
+	{
+		source = word.substr(1);
+		if (!(iss >> word))
+			return false;
+	}
+	command = word;
+	while (iss >> word)
+	{
+		if (word[0] == ':')
+		{
+			std::string rest;
+			std::getline(iss, rest);
+			params.push_back(word.substr(1) + rest);
+			break;
+		}
+		params.push_back(word);
+	}
+	return true;
+}
+
+static std::vector<std::string> splitWords(const std::string &text)
+{
+	std::vector<std::string> words;
+	std::istringstream iss(text);
+	std::string word;
+	while (iss >> word)
+		words.push_back(word);
+	return words;
+}
+
+// IRC_LINKS="host:port,[v6]:port,unix:/path": servers we dial and keep redialing,
+// at their IRC_LINK_LISTEN endpoint. Nothing is dialed without IRC_LINK_PASSWORD.
+void Server::loadLinkTargets(const std::string &spec)
+{
+	if (_linkPassword.empty())
+	{
+		if (!spec.empty())
+			std::cerr << "IRC_LINKS ignored: linking is off until IRC_LINK_PASSWORD is set" << std::endl;
+		return;
+	}
+	std::stringstream ss(spec);
+	std::string item;
+	while (std::getline(ss, item, ','))
+	{
+		LinkTarget target;
+		if (!Endpoint::parse(item, target.endpoint) || target.endpoint.dualStack) // a bare port is no peer
+			continue;
+		target.fd = -1;
+		target.nextAttempt = 0;
+		_linkTargets.push_back(target);
+	}
+}
+
+// Starts connect() to every target that is down and finishes the ones in progress
+void Server::connectLinks()
+{
+	time_t now = time(NULL);
+	for (size_t i = 0; i < _linkTargets.size(); ++i)
+	{
+		LinkTarget &target = _linkTargets[i];
+		if (target.fd == -1)
+		{
+			if (now < target.nextAttempt)
+				continue;
+			target.nextAttempt = now + LINK_RETRY_SECONDS;
+			const Endpoint &peer = target.endpoint;
+			int fd = socket(peer.family, SOCK_STREAM, 0);
+			if (fd < 0)
+				continue;
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			// a UNIX-domain connect that would block reports EAGAIN (the peer's backlog is full)
+			if (connect(fd, (const struct sockaddr *)&peer.addr, peer.len) < 0 && errno != EINPROGRESS)
+			{
+				close(fd);
+				continue;
+			}
+			Link link;
+			link.outbound = true;
+			link.connecting = true;
+			_links[fd] = link;
+			target.fd = fd;
+			continue;
+		}
+		std::map<int, Link>::iterator it = _links.find(target.fd);
+		if (it == _links.end() || !it->second.connecting)
+			continue;
+		struct pollfd pfd;
+		pfd.fd = target.fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 0) <= 0)
+			continue;
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(target.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+		{
+			close(target.fd);
+			_links.erase(it);
+			target.fd = -1;
+			continue;
+		}
+		it->second.connecting = false;
+		addPollFd(target.fd);
+		tuneSocket(target.fd);
+		sendLink(target.fd, "SERVER " + _serverName + " " + _linkPassword);
+		std::cout << "Link fd=" << target.fd << " connected to " << target.endpoint.text << "\n";
+	}
+}
+
+// A connection that opened with SERVER is a peer server, not a user
+void Server::promoteToLink(int fd, const std::string &firstLine)
+{
+	std::string rest = _clients[fd].getBuffer();
+	dropReplyJobs(fd);
+	_clients.erase(fd);
+	Link link;
+	link.outbound = false;
+	link.connecting = false;
+	_links[fd] = link;
+	handleLinkLine(fd, firstLine);
+	if (_links.find(fd) != _links.end())
+		handleLinkData(fd, rest.c_str(), rest.size());
+}
+
+void Server::handleLinkData(int fd, const char *data, size_t len)
+{
+	std::map<int, Link>::iterator it = _links.find(fd);
+	it->second.buffer.append(data, len);
+	// framed once up front, from a copy: handling a line may drop the link and its buffer
+	const char *bytes = _arena.copy(it->second.buffer.data(), it->second.buffer.size());
+	LineFramer::Lines lines((ArenaAllocator<LineFramer::Line>(&_arena)));
+	size_t used = LineFramer::scan(bytes, it->second.buffer.size(), lines);
+	it->second.buffer.erase(0, used);
+	// the link can be dropped by any line (ERROR, bad handshake), so look it up each time
+	for (size_t k = 0; k < lines.size() && _links.find(fd) != _links.end(); ++k)
+	{
+		if (lines[k].clean)
+			handleLinkLine(fd, std::string(bytes + lines[k].start, lines[k].len));
+		else
+			std::cerr << "link fd=" << fd << ": dropped a line with a control character\n";
+	}
+}
+
+void Server::handleLinkLine(int fd, const std::string &line)
+{
+	std::string source, command;
+	std::vector<std::string> params;
+	if (!splitLine(line, source, command, params))
+		return;
+	Link &link = _links[fd];
+
+	if (command == "ERROR")
+	{
+		dropLink(fd, "Link closed: " + (params.empty() ? std::string("ERROR") : params[0]));
+		return;
+	}
+	if (link.name.empty())
+	{
+		if (command != "SERVER" && link.outbound)
+			return; // the peer greets every new connection as a user first
+		if (command != "SERVER" || params.size() < 2 || params[1] != _linkPassword)
+		{
+			sendLink(fd, "ERROR :Bad link password");
+			dropLink(fd, "Bad link handshake");
+			return;
+		}
+		if (params[0] == _serverName || serverKnown(params[0]))
+		{
+			sendLink(fd, "ERROR :Server " + params[0] + " already linked");
+			dropLink(fd, "Server already linked");
+			return;
+		}
+		link.name = params[0];
+		link.servers.push_back(params[0]);
+		if (!link.outbound)
+			sendLink(fd, "SERVER " + _serverName + " " + _linkPassword);
+		std::cout << "Linked with " << link.name << " (fd " << fd << ")\n";
+		propagate("SERVERS " + link.name, fd);
+		sendBurst(fd);
+		return;
+	}
+
+	if (command == "SERVERS")
+	{
+		for (size_t i = 0; i < params.size(); ++i)
+		{
+			if (params[i] == _serverName || serverKnown(params[i]))
+			{
+				sendLink(fd, "ERROR :Server " + params[i] + " already linked (loop)");
+				dropLink(fd, "Link loop");
+				return;
+			}
+		}
+		std::string names;
+		for (size_t i = 0; i < params.size(); ++i)
+		{
+			link.servers.push_back(params[i]);
+			names += " " + params[i];
+		}
+		if (!names.empty())
+			propagate("SERVERS" + names, fd);
+		return;
+	}
+	if (command == "SQUIT")
+	{
+		netsplit(fd, params);
+		return;
+	}
+	if (command == "UID")
+	{
+		linkUid(fd, params);
+		return;
+	}
+	if (command == "SJOIN")
+	{
+		linkSjoin(fd, params);
+		return;
+	}
+	if (command == "KILL")
+	{
+		std::map<std::string, int>::iterator victim = _uids.find(params.empty() ? "" : params[0]);
+		if (victim != _uids.end())
+			killUser(victim->second, params.size() > 1 ? params[1] : "Killed", fd);
+		return;
+	}
+
+	// The rest are sent by a user; drop them if it is already gone on our side
+	std::map<std::string, int>::iterator from = _uids.find(source);
+	if (from == _uids.end())
+		return;
+	Client &user = _clients[from->second];
+	if (command == "NICK")
+		linkNick(fd, user, params);
+	else if (command == "QUIT")
+	{
+		int id = user.getFd();
+		quitUser(user, params.empty() ? "Quit" : params[0], fd);
+		_clients.erase(id);
+	}
+	else if (command == "KICK")
+		linkKick(fd, user, params);
+	else if (command == "PRIVMSG")
+		linkPrivmsg(fd, user, params);
+}
+
+// Removes the users behind names and tells the other links
+void Server::netsplit(int fd, const std::vector<std::string> &names)
+{
+	std::map<int, Link>::iterator link = _links.find(fd);
+	std::vector<int> gone;
+	for (std::map<int, Client>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (it->second.getLinkFd() == fd
+			&& std::find(names.begin(), names.end(), it->second.getOrigin()) != names.end())
+			gone.push_back(it->first);
+	}
+	for (size_t i = 0; i < gone.size(); ++i)
+	{
+		Client &user = _clients[gone[i]];
+		// SQUIT already tells the other servers, no QUIT per user
+		_uids.erase(user.getUid());
+		user.setUid("");
+		quitUser(user, "*.net *.split", fd);
+		_clients.erase(gone[i]);
+	}
+	std::string list;
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		list += " " + names[i];
+		if (link != _links.end())
+		{
+			std::vector<std::string> &servers = link->second.servers;
+			servers.erase(std::remove(servers.begin(), servers.end(), names[i]), servers.end());
+		}
+	}
+	if (!list.empty())
+		propagate("SQUIT" + list, fd);
+}
+
+void Server::dropLink(int fd, const std::string &reason)
+{
+	std::map<int, Link>::iterator it = _links.find(fd);
+	if (it == _links.end())
+		return;
+	std::vector<std::string> servers = it->second.servers;
+	std::string name = it->second.name;
+	netsplit(fd, servers);
+	forgetDelivery(fd);
+	close(fd);
+	removePollFd(fd);
+	_links.erase(fd);
+	for (size_t i = 0; i < _linkTargets.size(); ++i)
+	{
+		if (_linkTargets[i].fd == fd)
+		{
+			_linkTargets[i].fd = -1;
+			_linkTargets[i].nextAttempt = time(NULL) + LINK_RETRY_SECONDS;
+		}
+	}
+	std::cout << "Link fd=" << fd << " (" << (name.empty() ? "unregistered" : name) << ") dropped: " << reason << "\n";
+}
+
+void Server::sendLink(int fd, const std::string &line)
+{
+	std::string msg = line + "\r\n";
+	sendTo(fd, msg);
+}
+
+// Sends line to every registered link except exceptLink
+void Server::propagate(const std::string &line, int exceptLink)
+{
+	for (std::map<int, Link>::iterator it = _links.begin(); it != _links.end(); ++it)
+	{
+		if (it->first != exceptLink && !it->second.name.empty())
+			sendLink(it->first, line);
+	}
+}
+
+// One copy per link that leads to a member of the channel
+void Server::propagateToChannel(Channel &channel, const std::string &line, int exceptLink)
+{
+	std::vector<int> links;
+	const std::vector<Member> &members = channel.getMembers();
+	for (size_t i = 0; i < members.size(); ++i)
+	{
+		if (members[i].fd >= 0)
+			continue;
+		std::map<int, Client>::iterator it = _clients.find(members[i].fd);
+		if (it == _clients.end())
+			continue;
+		int linkFd = it->second.getLinkFd();
+		if (linkFd != exceptLink && std::find(links.begin(), links.end(), linkFd) == links.end())
+			links.push_back(linkFd);
+	}
+	for (size_t i = 0; i < links.size(); ++i)
+		sendLink(links[i], line);
+}
+
+bool Server::serverKnown(const std::string &name) const
+{
+	for (std::map<int, Link>::const_iterator it = _links.begin(); it != _links.end(); ++it)
+	{
+		const std::vector<std::string> &servers = it->second.servers;
+		if (std::find(servers.begin(), servers.end(), name) != servers.end())
+			return true;
+	}
+	return false;
+}
+
+// Everything the new peer has to learn: servers, users, then channel memberships
+void Server::sendBurst(int fd)
+{
+	std::string names;
+	for (std::map<int, Link>::iterator it = _links.begin(); it != _links.end(); ++it)
+	{
+		if (it->first == fd)
+			continue;
+		for (size_t i = 0; i < it->second.servers.size(); ++i)
+			names += " " + it->second.servers[i];
+	}
+	if (!names.empty())
+		sendLink(fd, "SERVERS" + names);
+	for (std::map<int, Client>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		Client &user = it->second;
+		if (user.getUid().empty() || user.getLinkFd() == fd)
+			continue;
+		std::ostringstream line;
+		line << "UID " << user.getUid() << " " << user.getNick() << " " << user.getNickTs()
+			 << " " << user.getUser() << " " << user.getHost() << " :" << user.getRealname();
+		sendLink(fd, line.str());
+	}
+	for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		Channel &channel = *it->second;
+		std::string members;
+		const std::vector<Member> &list = channel.getMembers();
+		for (size_t i = 0; i < list.size(); ++i)
+		{
+			std::map<int, Client>::iterator c = _clients.find(list[i].fd);
+			if (c == _clients.end() || c->second.getUid().empty() || c->second.getLinkFd() == fd)
+				continue;
+			members += (members.empty() ? "" : " ") + std::string(list[i].isOperator ? "@" : "") + c->second.getUid();
+		}
+		if (members.empty())
+			continue;
+		std::ostringstream line;
+		line << "SJOIN " << channel.getCreatedAt() << " " << channel.getName() << " :" << members;
+		sendLink(fd, line.str());
+	}
+}
+
+// Gives a freshly registered local user its uid and announces it to the network
+void Server::introduceUser(Client &client)
+{
+	if (!client.getUid().empty())
+		return;
+	std::ostringstream uid;
+	uid << _nextUid++ << "@" << _serverName;
+	client.setUid(uid.str());
+	_uids[uid.str()] = client.getFd();
+	std::ostringstream line;
+	line << "UID " << client.getUid() << " " << client.getNick() << " " << client.getNickTs()
+		 << " " << client.getUser() << " " << client.getHost() << " :" << client.getRealname();
+	propagate(line.str());
+}
+
+// Local users are disconnected, remote ones removed and the KILL routed on
+void Server::killUser(int id, const std::string &reason, int exceptLink)
+{
+	std::map<int, Client>::iterator it = _clients.find(id);
+	if (it == _clients.end())
+		return;
+	Client &user = it->second;
+	if (!user.isRemote())
+	{
+		std::string msg = "ERROR :Killed (" + reason + ")\r\n";
+		sendTo(id, msg);
+		disconnectClientFd(id, "Killed (" + reason + ")");
+		return;
+	}
+	std::string uid = user.getUid();
+	_uids.erase(uid);
+	user.setUid("");
+	quitUser(user, "Killed (" + reason + ")", exceptLink);
+	_clients.erase(id);
+	propagate("KILL " + uid + " :" + reason, exceptLink);
+}
+
+void Server::linkUid(int fd, const std::vector<std::string> &params)
+{
+	if (params.size() < 6 || _uids.find(params[0]) != _uids.end())
+		return;
+	Client probe;
+	probe.setUid(params[0]);
+	if (probe.getUid() != params[0])
+		return; // not a "<serial>@<server>" uid
+	const std::string &uid = params[0];
+	const std::string &nick = params[1];
+	long ts = std::atol(params[2].c_str());
+	int existing = getFdByNick(nick);
+	if (existing != -1)
+	{
+		long existingTs = _clients[existing].getNickTs();
+		// same rule on both sides of the link: the older nick stays, a tie removes both
+		if (existingTs <= ts)
+			sendLink(fd, "KILL " + uid + " :Nick collision");
+		if (existingTs >= ts)
+			killUser(existing, "Nick collision");
+		if (existingTs <= ts)
+			return;
+	}
+	int id = _nextVirtualId--;
+	Client user(id);
+	user.setNick(nick);
+	user.setNickTs(ts);
+	user.setUser(params[3]);
+	user.setHostname(params[4]);
+	user.setRealname(params[5]);
+	user.setUid(uid);
+	user.setRemote(uid.substr(uid.find('@') + 1), fd);
+	user.setPass(true);
+	user.setHasNick(true);
+	user.setHasUser(true);
+	user.setAuthenticated(true);
+	_clients[id] = user;
+	_uids[uid] = id;
+	userOnline(_clients[id]);
+	std::ostringstream line;
+	line << "UID " << uid << " " << nick << " " << ts << " " << params[3] << " " << params[4] << " :" << params[5];
+	propagate(line.str(), fd);
+}
+
+void Server::linkNick(int fd, Client &user, const std::vector<std::string> &params)
+{
+	if (params.size() < 2)
+		return;
+	const std::string &nick = params[0];
+	long ts = std::atol(params[1].c_str());
+	int id = user.getFd();
+	int existing = getFdByNick(nick);
+	if (existing != -1 && existing != id)
+	{
+		long existingTs = _clients[existing].getNickTs();
+		if (existingTs <= ts)
+			killUser(id, "Nick collision");
+		if (existingTs >= ts)
+			killUser(existing, "Nick collision");
+		if (existingTs <= ts)
+			return;
+	}
+	std::string oldNick = user.getNick();
+	user.setNick(nick);
+	user.setNickTs(ts);
+	notifyNickChange(id, oldNick, nick, user.getUser(), fd);
+}
+
+// Netjoin: the side with the older channel TS keeps its operators
+void Server::linkSjoin(int fd, const std::vector<std::string> &params)
+{
+	if (params.size() < 3 || params[1].empty() || params[1][0] != '#')
+		return;
+	long ts = std::atol(params[0].c_str());
+	const std::string &name = params[1];
+	std::map<std::string, Channel *>::iterator found = _channels.find(name);
+	bool created = found == _channels.end();
+	if (created)
+		found = createChannel(name);
+	Channel &channel = *found->second;
+	bool keepOps = true;
+	if (created || ts < channel.getCreatedAt())
+	{
+		if (!created)
+			channel.clearOperators();
+		channel.setCreatedAt(ts);
+	}
+	else if (ts > channel.getCreatedAt())
+		keepOps = false;
+
+	std::string joined;
+	std::vector<std::string> members = splitWords(params[2]);
+	for (size_t i = 0; i < members.size(); ++i)
+	{
+		bool op = members[i][0] == '@';
+		std::string uid = op ? members[i].substr(1) : members[i];
+		std::map<std::string, int>::iterator it = _uids.find(uid);
+		if (it == _uids.end() || channel.hasMember(it->second))
+			continue;
+		Client &user = _clients[it->second];
+		op = op && keepOps;
+		channel.addMember(user.getFd(), user.getNick(), op);
+		channel.setOperator(user.getFd(), op);
+		joined += (joined.empty() ? "" : " ") + std::string(op ? "@" : "") + uid;
+
+		std::string joinMsg = ":" + user.getNick() + " JOIN " + name + "\r\n";
+		FanOut fan;
+		fan.addChannel(channel);
+		deliver(fan, joinMsg);
+		channel.getHistory().append(ChannelHistory::nowMillis(), joinMsg);
+	}
+	if (joined.empty())
+	{
+		reclaimChannel(found); // none of its users are known here
+		return;
+	}
+	std::ostringstream line;
+	line << "SJOIN " << channel.getCreatedAt() << " " << name << " :" << joined;
+	propagate(line.str(), fd);
+}
+
+void Server::linkKick(int fd, Client &by, const std::vector<std::string> &params)
+{
+	if (params.size() < 2)
+		return;
+	std::map<std::string, Channel *>::iterator chan = _channels.find(params[0]);
+	std::map<std::string, int>::iterator target = _uids.find(params[1]);
+	if (chan == _channels.end() || target == _uids.end() || !chan->second->hasMember(target->second))
+		return;
+	Channel &channel = *chan->second;
+	std::string fullMsg = ":" + by.getHostmask() + " KICK " + channel.getName() + " "
+						+ _clients[target->second].getNick() + "\r\n";
+	FanOut fan;
+	fan.addChannel(channel);
+	deliver(fan, fullMsg);
+	channel.getHistory().append(ChannelHistory::nowMillis(), fullMsg);
+	channel.removeMemberByFd(target->second);
+	propagate(":" + by.getUid() + " KICK " + params[0] + " " + params[1], fd);
+	reclaimChannel(chan);
+}
+
+void Server::linkPrivmsg(int fd, Client &from, const std::vector<std::string> &params)
+{
+	if (params.size() < 2)
+		return;
+	const std::string &to = params[0];
+	std::string line = ":" + from.getUid() + " PRIVMSG " + to + " :" + params[1];
+	if (to[0] == '#')
+	{
+		std::map<std::string, Channel *>::iterator it = _channels.find(to);
+		if (it == _channels.end())
+			return;
+		std::string fullMsg = ":" + from.getNick() + " PRIVMSG " + to + ":" + params[1] + "\r\n";
+		FanOut fan;
+		fan.addChannel(*it->second);
+		deliver(fan, fullMsg);
+		it->second->getHistory().append(ChannelHistory::nowMillis(), fullMsg);
+		propagateToChannel(*it->second, line, fd);
+		return;
+	}
+	std::map<std::string, int>::iterator target = _uids.find(to);
+	if (target == _uids.end())
+		return;
+	Client &user = _clients[target->second];
+	if (user.isRemote())
+	{
+		if (user.getLinkFd() != fd)
+			sendLink(user.getLinkFd(), line);
+		return;
+	}
+	std::string fullMsg = ":" + from.getNick() + " PRIVMSG " + user.getNick() + ":" + params[1] + "\r\n";
+	sendTo(user.getFd(), fullMsg);
+	_cmdFanout++;
+}
@@ -0,0 +1,208 @@
+#include "Server.hpp"
+#include "Config.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+static void listenerFailed(const char *call, int fd)
+{
+	std::cerr << call << "() failed: " << strerror(errno) << std::endl;
+	if (fd >= 0)
+		close(fd);
+	exit(1);
+}
+
+// Built directly rather than parsed: port 0, an ephemeral port the benchmarks
+// rely on, is no valid IRC_LISTEN entry
+static Endpoint everyAddress(long port)
+{
+	std::ostringstream spec;
+	spec << port;
+	Endpoint endpoint;
+	Endpoint::numeric("::", static_cast<int>(port), endpoint);
+	endpoint.dualStack = true;
+	endpoint.text = spec.str();
+	return endpoint;
+}
+
+// A socket file left behind by a server that died is removed. A live one, or
+// anything that is not a socket, stays and bind() reports it.
+static void clearStaleSocket(const Endpoint &endpoint)
+{
+	struct stat st;
+	if (lstat(endpoint.path().c_str(), &st) < 0 || !S_ISSOCK(st.st_mode))
+		return;
+	int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe < 0)
+		return;
+	bool live = connect(probe, reinterpret_cast<const struct sockaddr *>(&endpoint.addr), endpoint.len) == 0;
+	close(probe);
+	if (!live)
+		unlink(endpoint.path().c_str());
+}
+
+// The port argument is a dual-stack listener on every address. IRC_LISTEN adds
+// more, as comma-separated endpoints (Endpoint.hpp), each optionally followed
+// by "@<n>", the connections it accepts per poll wakeup; IRC_ACCEPT_BUDGET is
+// the default. IRC_WS_PORT is one more, for WebSocket clients, and
+// IRC_LINK_LISTEN takes endpoints in the IRC_LISTEN form for peer servers.
+void Server::configureListeners(int port)
+{
+	long budget = configLong("IRC_ACCEPT_BUDGET", 16);
+	size_t defaultBudget = budget > 0 ? static_cast<size_t>(budget) : 1;
+	openListener(everyAddress(port), false, defaultBudget);
+	openListeners("IRC_LISTEN", defaultBudget, false);
+
+	long wsPort = configLong("IRC_WS_PORT", 0);
+	if (wsPort > 0)
+	{
+		openListener(everyAddress(wsPort), true, defaultBudget);
+		std::cout << "WebSocket clients on port " << wsPort << "\n";
+	}
+
+	if (_linkPassword.empty())
+	{
+		if (!configStr("IRC_LINK_LISTEN", "").empty())
+			std::cerr << "IRC_LINK_LISTEN ignored: linking is off until IRC_LINK_PASSWORD is set" << std::endl;
+		return;
+	}
+	openListeners("IRC_LINK_LISTEN", defaultBudget, true);
+}
+
+void Server::openListeners(const char *variable, size_t defaultBudget, bool serverLinks)
+{
+	std::stringstream ss(configStr(variable, ""));
+	std::string item;
+	while (std::getline(ss, item, ','))
+	{
+		if (item.empty())
+			continue;
+		size_t itemBudget = defaultBudget;
+		size_t at = item.rfind('@');
+		if (at != std::string::npos && at + 1 < item.size()
+			&& item.find_first_not_of("0123456789", at + 1) == std::string::npos)
+		{
+			long n = std::atol(item.c_str() + at + 1);
+			itemBudget = n > 0 ? static_cast<size_t>(n) : 1;
+			item.erase(at);
+		}
+		Endpoint endpoint;
+		if (!Endpoint::parse(item, endpoint))
+		{
+			std::cerr << variable << ": cannot parse endpoint \"" << item << "\"" << std::endl;
+			exit(1);
+		}
+		openListener(endpoint, false, itemBudget, serverLinks);
+	}
+}
+
+// Binds and polls one endpoint. A listener that cannot be set up stops the
+// server: running without a configured endpoint would go unnoticed.
+int Server::setupListener(const Endpoint &requested)
+{
+	Endpoint endpoint = requested;
+	int fd = socket(endpoint.family, SOCK_STREAM, 0);
+	if (fd < 0 && endpoint.dualStack && errno == EAFNOSUPPORT)
+	{
+		// no IPv6 on this host: the wildcard takes IPv4 alone. Built directly,
+		// as in everyAddress(), so port 0 still gets an ephemeral port
+		std::string text = endpoint.text;
+		if (!Endpoint::numeric("0.0.0.0", endpoint.port, endpoint))
+			listenerFailed("socket", -1);
+		endpoint.text = text;
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+	}
+	if (fd < 0)
+		listenerFailed("socket", -1);
+
+	int opt = 1;
+	if (endpoint.family != AF_UNIX && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+		listenerFailed("setsockopt", fd);
+	if (endpoint.family == AF_INET6)
+	{
+		// the wildcard takes IPv4 clients as ::ffff:a.b.c.d; an explicit [addr] does not,
+		// so [::]:port and 0.0.0.0:port can both be listed
+		int v6only = endpoint.dualStack ? 0 : 1;
+		if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0)
+			listenerFailed("setsockopt", fd);
+	}
+	if (endpoint.family == AF_UNIX)
+		clearStaleSocket(endpoint);
+
+	if (bind(fd, reinterpret_cast<const struct sockaddr *>(&endpoint.addr), endpoint.len) < 0)
+	{
+		std::cerr << endpoint.text << ": ";
+		listenerFailed("bind", fd);
+	}
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+		listenerFailed("fcntl", fd);
+	if (listen(fd, SOMAXCONN) < 0)
+		listenerFailed("listen", fd);
+
+	addPollFd(fd);
+	if (endpoint.family == AF_UNIX)
+		std::cout << "Listening on " << endpoint.text << " (fd " << fd << ")\n";
+	else
+		std::cout << "Listening on port " << endpoint.port << (endpoint.dualStack ? "" : " of " + endpoint.text)
+				  << " (fd " << fd << ")\n";
+	return fd;
+}
+
+void Server::openListener(const Endpoint &endpoint, bool webSocket, size_t acceptBudget, bool serverLinks)
+{
+	int fd = setupListener(endpoint);
+	Listener &listener = _listeners[fd];
+	listener.endpoint = endpoint;
+	listener.webSocket = webSocket;
+	listener.serverLinks = serverLinks;
+	listener.acceptBudget = acceptBudget;
+	listener.accepted = 0;
+}
+
+bool Server::isListener(int fd) const
+{
+	return _listeners.find(fd) != _listeners.end();
+}
+
+// Up to the listener's budget per wakeup: a busy endpoint takes its share
+// without holding back the clients that are already connected
+void Server::acceptConnections(int listenFd)
+{
+	size_t budget = _listeners[listenFd].acceptBudget;
+	for (size_t i = 0; i < budget; ++i)
+	{
+		if (!acceptNewConnection(listenFd))
+			break;
+	}
+}
+
+void Server::closeListeners()
+{
+	for (std::map<int, Listener>::iterator it = _listeners.begin(); it != _listeners.end(); ++it)
+	{
+		close(it->first);
+		if (it->second.endpoint.family == AF_UNIX)
+			unlink(it->second.endpoint.path().c_str());
+	}
+	_listeners.clear();
+}
+
+// STATS P: every listener, its accept budget and what it has accepted
+void Server::sendListenerStats(Client &client)
+{
+	for (std::map<int, Listener>::iterator it = _listeners.begin(); it != _listeners.end(); ++it)
+	{
+		std::ostringstream line;
+		line << ":server 249 " << client.getNick() << " " << it->second.endpoint.text
+			 << (it->second.webSocket ? " websocket" : "") << " budget " << it->second.acceptBudget
+			 << " accepted " << it->second.accepted << "\r\n";
+		sendTo(client.getFd(), line.str());
+	}
+}
@@ -0,0 +1,209 @@
+#include "Server.hpp"
+#include <sstream>
+#include <sys/socket.h>
+
+// Lines a single reply job may emit in one step; replies that fit are sent right away
+static const size_t REPLY_LINES_PER_STEP = 128;
+
+void Server::queueReply(int fd, const ReplyJob &job)
+{
+	std::deque<ReplyJob> &queue = _replyJobs[fd];
+	queue.push_back(job);
+	if (job.block)
+		job.block->retain();
+	// nothing ahead of it for this client: start streaming now
+	if (queue.size() == 1)
+		stepReplyJob(fd, REPLY_LINES_PER_STEP);
+}
+
+// Emits up to maxLines of the oldest job for fd in one send; returns lines emitted
+size_t Server::stepReplyJob(int fd, size_t maxLines)
+{
+	std::map<int, std::deque<ReplyJob> >::iterator qit = _replyJobs.find(fd);
+	if (qit == _replyJobs.end())
+		return 0;
+	ReplyJob &job = qit->second.front();
+	std::string out;
+	size_t emitted = 0;
+	bool done;
+	if (!job.list)
+	{
+		const std::vector<std::string> &lines = job.block->lines;
+		while (emitted < maxLines && job.next < lines.size())
+		{
+			out += job.prefix + lines[job.next++] + "\r\n";
+			emitted++;
+		}
+		done = job.next >= lines.size();
+	}
+	else
+	{
+		std::map<std::string, Channel *>::iterator it = job.cursor.empty() ? _channels.begin() : _channels.upper_bound(job.cursor);
+		for (; emitted < maxLines && it != _channels.end(); ++it)
+		{
+			out += job.prefix + it->second->getListReply() + "\r\n";
+			job.cursor = it->first;
+			emitted++;
+		}
+		done = it == _channels.end();
+	}
+	if (done)
+		out += job.trailer;
+	sendTo(fd, out);
+	if (done)
+	{
+		if (job.block)
+			job.block->release();
+		qit->second.pop_front();
+		if (qit->second.empty())
+			_replyJobs.erase(qit);
+		else if (emitted < maxLines)
+			emitted += stepReplyJob(fd, maxLines - emitted);
+	}
+	return emitted;
+}
+
+// Called once per loop iteration: round robin over clients with pending replies
+void Server::processReplyJobs()
+{
+	size_t budget = _replyLinesPerTick;
+	size_t clients = _replyJobs.size();
+	while (budget > 0 && clients-- > 0 && !_replyJobs.empty())
+	{
+		std::map<int, std::deque<ReplyJob> >::iterator it = _replyJobs.upper_bound(_replyRR);
+		if (it == _replyJobs.end())
+			it = _replyJobs.begin();
+		_replyRR = it->first;
+		size_t quota = budget < REPLY_LINES_PER_STEP ? budget : REPLY_LINES_PER_STEP;
+		size_t emitted = stepReplyJob(it->first, quota);
+		size_t cost = emitted ? emitted : 1;
+		budget = cost < budget ? budget - cost : 0;
+	}
+}
+
+void Server::dropReplyJobs(int fd)
+{
+	std::map<int, std::deque<ReplyJob> >::iterator it = _replyJobs.find(fd);
+	if (it == _replyJobs.end())
+		return;
+	for (size_t i = 0; i < it->second.size(); ++i)
+	{
+		if (it->second[i].block)
+			it->second[i].block->release();
+	}
+	_replyJobs.erase(it);
+}
+
+void Server::sendNames(Client &client, Channel &channel)
+{
+	ReplyJob job;
+	job.prefix = ":server 353 " + client.getNick() + " ";
+	job.block = channel.getNamesReply();
+	job.next = 0;
+	job.list = false;
+	job.trailer = ":server 366 " + client.getNick() + " " + channel.getName() + " :End of /NAMES list.\r\n";
+	queueReply(client.getFd(), job);
+}
+
+// NAMES <channel>[,<channel>...]
+void Server::handleNames(Client &client, std::istringstream &iss)
+{
+	std::string targets;
+	iss >> targets;
+	if (targets.empty())
+	{
+		std::string end = ":server 366 " + client.getNick() + " * :End of /NAMES list.\r\n";
+		sendTo(client.getFd(), end);
+		return;
+	}
+	std::stringstream ss(targets);
+	std::string name;
+	while (std::getline(ss, name, ','))
+	{
+		std::map<std::string, Channel *>::iterator it = _channels.find(name);
+		if (it == _channels.end())
+		{
+			std::string end = ":server 366 " + client.getNick() + " " + name + " :End of /NAMES list.\r\n";
+			sendTo(client.getFd(), end);
+			continue;
+		}
+		sendNames(client, *it->second);
+	}
+}
+
+// WHO <channel> | WHO <nick>
+void Server::handleWho(Client &client, std::istringstream &iss)
+{
+	std::string mask;
+	iss >> mask;
+	std::string trailer = ":server 315 " + client.getNick() + " " + (mask.empty() ? "*" : mask) + " :End of /WHO list.\r\n";
+	std::map<std::string, Channel *>::iterator it = _channels.find(mask);
+	if (it != _channels.end())
+	{
+		Channel &channel = *it->second;
+		if (!channel.getWhoReply())
+		{
+			ReplyBlock *block = ReplyBlock::create();
+			const std::vector<struct Member> &members = channel.getMembers();
+			block->lines.reserve(members.size());
+			for (size_t i = 0; i < members.size(); ++i)
+			{
+				std::map<int, Client>::iterator c = _clients.find(members[i].fd);
+				if (c == _clients.end())
+					continue;
+				block->lines.push_back(channel.getName() + " " + c->second.getUser() + " " + c->second.getHost() + " server " +
+					members[i].nick + (members[i].isOperator ? " H@" : " H") + " :0 " + c->second.getRealname());
+			}
+			channel.setWhoReply(block);
+		}
+		ReplyJob job;
+		job.prefix = ":server 352 " + client.getNick() + " ";
+		job.block = channel.getWhoReply();
+		job.next = 0;
+		job.list = false;
+		job.trailer = trailer;
+		queueReply(client.getFd(), job);
+		return;
+	}
+	int fd = mask.empty() ? -1 : getFdByNick(mask);
+	std::string reply;
+	if (fd != -1)
+	{
+		Client &target = _clients[fd];
+		reply = ":server 352 " + client.getNick() + " * " + target.getUser() + " " + target.getHost() + " server " +
+			target.getNick() + " H :0 " + target.getRealname() + "\r\n";
+	}
+	reply += trailer;
+	sendTo(client.getFd(), reply);
+}
+
+// LIST [<channel>[,<channel>...]]
+void Server::handleList(Client &client, std::istringstream &iss)
+{
+	std::string targets;
+	iss >> targets;
+	std::string prefix = ":server 322 " + client.getNick() + " ";
+	std::string trailer = ":server 323 " + client.getNick() + " :End of /LIST\r\n";
+	if (targets.empty())
+	{
+		ReplyJob job;
+		job.prefix = prefix;
+		job.block = NULL;
+		job.next = 0;
+		job.list = true;
+		job.trailer = trailer;
+		queueReply(client.getFd(), job);
+		return;
+	}
+	std::string reply;
+	std::stringstream ss(targets);
+	std::string name;
+	while (std::getline(ss, name, ','))
+	{
+		std::map<std::string, Channel *>::iterator it = _channels.find(name);
+		if (it != _channels.end())
+			reply += prefix + it->second->getListReply() + "\r\n";
+	}
+	reply += trailer;
+	sendTo(client.getFd(), reply);
+}
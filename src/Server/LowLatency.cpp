@@ -0,0 +1,135 @@
+#include "Server.hpp"
+#include "Config.hpp"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// IRC_LOW_LATENCY=1 trades CPU for p99: the loop is pinned to IRC_CPU, sockets
+// busy-poll the NIC queue for IRC_BUSY_POLL_US, and the loop spins on a
+// non-blocking poll for IRC_SPIN_US before it goes to sleep.
+void Server::configureLowLatency()
+{
+	_spinUs = 0;
+	_busyPollUs = 0;
+	_lowLatency = configLong("IRC_LOW_LATENCY", 0) != 0;
+	if (!_lowLatency)
+		return;
+	_spinUs = static_cast<unsigned long>(configLong("IRC_SPIN_US", 50));
+	_busyPollUs = static_cast<int>(configLong("IRC_BUSY_POLL_US", 50));
+	long cpu = configLong("IRC_CPU", -1);
+#ifdef __linux__
+	if (cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(static_cast<int>(cpu), &set);
+		if (sched_setaffinity(0, sizeof(set), &set) < 0)
+			std::cerr << "sched_setaffinity(" << cpu << ") failed: " << strerror(errno) << std::endl;
+	}
+#else
+	if (cpu >= 0)
+		std::cerr << "IRC_CPU ignored: CPU pinning is only supported on Linux\n";
+#endif
+	std::cout << "Low-latency mode: cpu=" << cpu << " spin=" << _spinUs << "us busy_poll=" << _busyPollUs << "us\n";
+}
+
+// Applied to every client and link socket. TCP ones always skip Nagle, IRC
+// lines being small and interactive; busy polling is the per-socket half of
+// the low-latency mode. UNIX-domain clients (IRC_LISTEN) have neither.
+void Server::tuneSocket(int fd)
+{
+	struct sockaddr_storage local;
+	socklen_t len = sizeof(local);
+	if (getsockname(fd, reinterpret_cast<struct sockaddr *>(&local), &len) < 0
+		|| (local.ss_family != AF_INET && local.ss_family != AF_INET6))
+		return;
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (!_lowLatency)
+		return;
+#ifdef SO_BUSY_POLL
+	if (_busyPollUs > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &_busyPollUs, sizeof(_busyPollUs)) < 0)
+	{
+		// raising it above net.core.busy_poll needs CAP_NET_ADMIN; say so once and go on without
+		std::cerr << "SO_BUSY_POLL unavailable: " << strerror(errno) << std::endl;
+		_busyPollUs = 0;
+	}
+#endif
+}
+
+// Sleep until the next thing the loop has to do on its own: immediately while
+// jobs or service events are queued, at the nearest lookup deadline, link redial or file
+// transfer timer, every shedding window while the server sheds load (so it
+// can step back down with nothing else going on), otherwise only when a socket
+// (or a signal) wakes us.
+int Server::nextTimeout() const
+{
+	if (!_fanoutJobs.empty() || !_replyJobs.empty() || !_serviceQueue.empty())
+		return 0;
+	long timeout = -1;
+	unsigned long now = CommandStats::nowMicros();
+	for (std::map<int, PendingLookup>::const_iterator it = _lookups.begin(); it != _lookups.end(); ++it)
+	{
+		if (it->second.done)
+			continue;
+		long ms = it->second.deadline > now ? static_cast<long>((it->second.deadline - now + 999) / 1000) : 0;
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	time_t wall = time(NULL);
+	for (size_t i = 0; i < _linkTargets.size(); ++i)
+	{
+		long ms;
+		if (_linkTargets[i].fd == -1)
+			ms = _linkTargets[i].nextAttempt > wall ? static_cast<long>(_linkTargets[i].nextAttempt - wall) * 1000 : 0;
+		else if (_links.count(_linkTargets[i].fd) && _links.find(_linkTargets[i].fd)->second.connecting)
+			ms = 50; // connect() completion is checked by connectLinks, not by poll
+		else
+			continue;
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	if (_shedder.stage() != LoadShedder::NORMAL)
+	{
+		long ms = static_cast<long>(_shedder.window() / 1000) + 1;
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	unsigned long transfer = nextTransferEvent();
+	if (transfer)
+	{
+		long ms = transfer > now ? static_cast<long>((transfer - now + 999) / 1000) : 0;
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	unsigned long session = nextSessionExpiry();
+	if (session)
+	{
+		long ms = session > now ? static_cast<long>((session - now + 999) / 1000) : 0;
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	return static_cast<int>(timeout);
+}
+
+// poll() that spins for up to _spinUs on a zero timeout first, so a message
+// arriving just after the previous batch is picked up without a wakeup
+int Server::waitForEvents(int timeout)
+{
+	if (_spinUs > 0 && timeout != 0)
+	{
+		unsigned long deadline = CommandStats::nowMicros() + _spinUs;
+		do
+		{
+			int ready = poll(&_pfds[0], _pfds.size(), 0);
+			if (ready != 0)
+				return ready;
+		} while (CommandStats::nowMicros() < deadline);
+	}
+	return poll(&_pfds[0], _pfds.size(), timeout);
+}
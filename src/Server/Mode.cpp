@@ -0,0 +1,129 @@
+#include "Server.hpp"
+#include <sstream>
+#include <ctime>
+#include <sys/socket.h>
+
+// Streams the +b, +e or +I list of a channel (367/368, 348/349, 346/347)
+void Server::sendMaskList(Client &client, Channel &channel, char mode)
+{
+	const char *item = mode == 'b' ? "367" : mode == 'e' ? "348" : "346";
+	const char *end = mode == 'b' ? "368" : mode == 'e' ? "349" : "347";
+	const char *what = mode == 'b' ? "ban" : mode == 'e' ? "exception" : "invite";
+
+	ReplyBlock *block = ReplyBlock::create();
+	const std::map<std::string, MaskEntry> &entries = channel.getMaskList(mode)->entries();
+	block->lines.reserve(entries.size());
+	for (std::map<std::string, MaskEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		std::ostringstream ss;
+		ss << channel.getName() << " " << it->second.mask << " " << it->second.setBy << " " << it->second.setAt;
+		block->lines.push_back(ss.str());
+	}
+	ReplyJob job;
+	job.prefix = std::string(":server ") + item + " " + client.getNick() + " ";
+	job.block = block;
+	job.next = 0;
+	job.list = false;
+	job.trailer = std::string(":server ") + end + " " + client.getNick() + " " + channel.getName() +
+		" :End of channel " + what + " list\r\n";
+	queueReply(client.getFd(), job);
+	block->release();
+}
+
+// MODE <channel> [(+|-)<b|e|I>... [<mask>...]]
+void Server::handleMode(Client &client, std::istringstream &iss)
+{
+	std::string target, modes;
+	iss >> target >> modes;
+	if (target.empty())
+	{
+		std::string err = ":server 461 " + client.getNick() + " MODE :Not enough parameters\r\n";
+		sendTo(client.getFd(), err);
+		return;
+	}
+	if (target[0] != '#')
+	{
+		// no user modes yet
+		std::string reply = target == client.getNick()
+			? ":server 221 " + client.getNick() + " +\r\n"
+			: ":server 502 " + client.getNick() + " :Cannot change mode for other users\r\n";
+		sendTo(client.getFd(), reply);
+		return;
+	}
+	if (!channelExist(target, client))
+		return;
+	Channel &channel = *_channels[target];
+	if (modes.empty())
+	{
+		std::string flags = "+";
+		if (channel.getInviteOnly())
+			flags += "i";
+		if (!channel.getKey().empty())
+			flags += "k";
+		if (channel.getUserLimit() != 0)
+			flags += "l";
+		std::string reply = ":server 324 " + client.getNick() + " " + target + " " + flags + "\r\n";
+		sendTo(client.getFd(), reply);
+		return;
+	}
+
+	std::vector<std::string> args;
+	std::string arg;
+	while (iss >> arg)
+		args.push_back(arg);
+
+	char sign = '+';
+	char appliedSign = 0;
+	size_t next = 0;
+	std::string applied, appliedArgs;
+	for (size_t i = 0; i < modes.size(); ++i)
+	{
+		char c = modes[i];
+		if (c == '+' || c == '-')
+		{
+			sign = c;
+			continue;
+		}
+		MaskIndex *list = channel.getMaskList(c);
+		if (!list)
+		{
+			std::string err = ":server 472 " + client.getNick() + " " + std::string(1, c) + " :is unknown mode char to me\r\n";
+			sendTo(client.getFd(), err);
+			continue;
+		}
+		if (next >= args.size())
+		{
+			sendMaskList(client, channel, c);
+			continue;
+		}
+		if (!hasPermissions(client.getFd(), client, channel))
+			return;
+		std::string mask = MaskIndex::normalize(args[next++]);
+		bool changed;
+		if (sign == '-')
+			changed = list->remove(mask);
+		else if (list->size() >= _maxMaskEntries)
+		{
+			std::string err = ":server 478 " + client.getNick() + " " + target + " " + mask + " :Channel list is full\r\n";
+			sendTo(client.getFd(), err);
+			changed = false;
+		}
+		else
+			changed = list->add(mask, client.getHostmask(), static_cast<long>(std::time(NULL)));
+		if (!changed)
+			continue;
+		if (appliedSign != sign)
+		{
+			applied += sign;
+			appliedSign = sign;
+		}
+		applied += c;
+		appliedArgs += " " + mask;
+	}
+	if (!applied.empty())
+	{
+		FanOut fan;
+		fan.addChannel(channel);
+		deliver(fan, ":" + client.getHostmask() + " MODE " + target + " " + applied + appliedArgs + "\r\n");
+	}
+}
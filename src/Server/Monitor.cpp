@@ -0,0 +1,187 @@
+#include "Server.hpp"
+#include "MaskIndex.hpp"
+#include <sstream>
+
+static const size_t MONITOR_LINE_TARGETS = 400; // bytes of comma-separated targets per numeric
+
+// prefix + comma-joined items, split over as many lines as it takes to stay
+// well under the 512-byte line limit
+static std::string joinedLines(const std::string &prefix, const std::vector<std::string> &items)
+{
+	std::string out;
+	std::string current;
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		if (!current.empty() && current.size() + items[i].size() + 1 > MONITOR_LINE_TARGETS)
+		{
+			out += prefix + current + "\r\n";
+			current.clear();
+		}
+		if (!current.empty())
+			current += ",";
+		current += items[i];
+	}
+	if (!current.empty())
+		out += prefix + current + "\r\n";
+	return out;
+}
+
+// 730 RPL_MONONLINE with full hostmasks for the targets that are on, 731
+// RPL_MONOFFLINE for the rest
+void Server::sendMonitorStatus(Client &client, const std::vector<std::string> &targets)
+{
+	std::vector<std::string> on;
+	std::vector<std::string> off;
+	for (size_t i = 0; i < targets.size(); ++i)
+	{
+		std::map<std::string, int>::iterator it = _online.find(MaskIndex::casefold(targets[i]));
+		if (it != _online.end())
+			on.push_back(_clients[it->second].getHostmask());
+		else
+			off.push_back(targets[i]);
+	}
+	const std::string &nick = client.getNick();
+	std::string reply = joinedLines(":server 730 " + nick + " :", on) + joinedLines(":server 731 " + nick + " :", off);
+	if (!reply.empty())
+		sendTo(client.getFd(), reply);
+}
+
+// MONITOR + <nick>[,<nick>...]	add to the watch list, answered with the current status
+// MONITOR - <nick>[,<nick>...]	remove
+// MONITOR C						clear the list
+// MONITOR L						list the watched nicks
+// MONITOR S						status of every watched nick
+void Server::handleMonitor(Client &client, std::istringstream &iss)
+{
+	int fd = client.getFd();
+	std::string sub, targetList;
+	iss >> sub >> targetList;
+	if (sub.empty() || ((sub == "+" || sub == "-") && targetList.empty()))
+	{
+		sendTo(fd, ":server 461 " + client.getNick() + " MONITOR :Not enough parameters\r\n");
+		return;
+	}
+	std::vector<std::string> targets;
+	std::istringstream split(targetList);
+	std::string target;
+	while (std::getline(split, target, ','))
+		if (!target.empty())
+			targets.push_back(target);
+
+	if (sub == "+")
+	{
+		std::map<std::string, std::string> &list = _monitored[fd];
+		std::vector<std::string> added;
+		for (size_t i = 0; i < targets.size(); ++i)
+		{
+			std::string key = MaskIndex::casefold(targets[i]);
+			if (list.find(key) != list.end())
+				continue;
+			if (list.size() >= _monitorMax)
+			{
+				// ERR_MONLISTFULL names the targets that were not added
+				std::string rest = targets[i];
+				for (size_t j = i + 1; j < targets.size() && rest.size() < MONITOR_LINE_TARGETS; ++j)
+					rest += "," + targets[j];
+				std::ostringstream full;
+				full << ":server 734 " << client.getNick() << " " << _monitorMax << " " << rest
+					 << " :Monitor list is full.\r\n";
+				sendTo(fd, full.str());
+				break;
+			}
+			list[key] = targets[i];
+			_watchers[key].insert(fd);
+			added.push_back(targets[i]);
+		}
+		if (list.empty())
+			_monitored.erase(fd);
+		sendMonitorStatus(client, added);
+	}
+	else if (sub == "-")
+	{
+		std::map<int, std::map<std::string, std::string> >::iterator it = _monitored.find(fd);
+		if (it == _monitored.end())
+			return;
+		for (size_t i = 0; i < targets.size(); ++i)
+		{
+			std::string key = MaskIndex::casefold(targets[i]);
+			if (!it->second.erase(key))
+				continue;
+			std::map<std::string, std::set<int> >::iterator w = _watchers.find(key);
+			if (w != _watchers.end())
+			{
+				w->second.erase(fd);
+				if (w->second.empty())
+					_watchers.erase(w);
+			}
+		}
+		if (it->second.empty())
+			_monitored.erase(it);
+	}
+	else if (sub == "C" || sub == "c")
+		dropMonitor(fd);
+	else if (sub == "L" || sub == "l" || sub == "S" || sub == "s")
+	{
+		std::vector<std::string> watched;
+		std::map<int, std::map<std::string, std::string> >::iterator it = _monitored.find(fd);
+		if (it != _monitored.end())
+			for (std::map<std::string, std::string>::iterator n = it->second.begin(); n != it->second.end(); ++n)
+				watched.push_back(n->second);
+		if (sub == "S" || sub == "s")
+			sendMonitorStatus(client, watched);
+		else
+			sendTo(fd, joinedLines(":server 732 " + client.getNick() + " :", watched) +
+				   ":server 733 " + client.getNick() + " :End of MONITOR list\r\n");
+	}
+	else
+		sendTo(fd, ":server 421 " + client.getNick() + " MONITOR :Unknown MONITOR subcommand\r\n");
+}
+
+// A nick became visible: a local registration, a remote user introduced by a
+// link or the new side of a NICK change. Costs one lookup plus one line per
+// watcher of that nick.
+void Server::userOnline(Client &client)
+{
+	std::string key = MaskIndex::casefold(client.getNick());
+	_online[key] = client.getFd();
+	std::map<std::string, std::set<int> >::iterator w = _watchers.find(key);
+	if (w == _watchers.end())
+		return;
+	std::string tail = " :" + client.getHostmask() + "\r\n";
+	for (std::set<int>::iterator it = w->second.begin(); it != w->second.end(); ++it)
+		sendTo(*it, ":server 730 " + _clients[*it].getNick() + tail);
+}
+
+// The user that held nick left or renamed itself
+void Server::userOffline(int id, const std::string &nick)
+{
+	std::string key = MaskIndex::casefold(nick);
+	std::map<std::string, int>::iterator on = _online.find(key);
+	if (on == _online.end() || on->second != id)
+		return;
+	_online.erase(on);
+	std::map<std::string, std::set<int> >::iterator w = _watchers.find(key);
+	if (w == _watchers.end())
+		return;
+	std::string tail = " :" + nick + "\r\n";
+	for (std::set<int>::iterator it = w->second.begin(); it != w->second.end(); ++it)
+		sendTo(*it, ":server 731 " + _clients[*it].getNick() + tail);
+}
+
+// Forgets fd's watch list and takes it out of the reverse index
+void Server::dropMonitor(int fd)
+{
+	std::map<int, std::map<std::string, std::string> >::iterator it = _monitored.find(fd);
+	if (it == _monitored.end())
+		return;
+	for (std::map<std::string, std::string>::iterator n = it->second.begin(); n != it->second.end(); ++n)
+	{
+		std::map<std::string, std::set<int> >::iterator w = _watchers.find(n->first);
+		if (w == _watchers.end())
+			continue;
+		w->second.erase(fd);
+		if (w->second.empty())
+			_watchers.erase(w);
+	}
+	_monitored.erase(it);
+}
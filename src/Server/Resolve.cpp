@@ -0,0 +1,122 @@
+#include "Server.hpp"
+#include <iostream>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// Starts the hostname (and ident) lookup of a new connection. Until it finishes
+// the client is known by its IP and registration is held back.
+void Server::startLookup(int fd, const struct sockaddr_storage &peer)
+{
+	Client &client = _clients[fd];
+	if (peer.ss_family == AF_UNIX)
+	{
+		client.setHostname("localhost"); // a process on this machine, nothing to look up
+		return;
+	}
+	int remotePort;
+	std::string ipstr = Endpoint::host(peer, remotePort);
+	// "::1" would start with the ':' of a trailing parameter in every prefix it appears in
+	client.setHostname(!ipstr.empty() && ipstr[0] == ':' ? "0" + ipstr : ipstr);
+	sendTo(fd, ":server NOTICE * :*** Looking up your hostname...\r\n");
+
+	std::string host;
+	if (_resolver.notifyFd() == -1 || (!_identEnabled && _resolver.cached(ipstr, host)))
+	{
+		finishLookup(fd, host, "");
+		return;
+	}
+	struct sockaddr_storage local;
+	socklen_t len = sizeof(local);
+	int localPort = 0;
+	if (getsockname(fd, (struct sockaddr *)&local, &len) == 0)
+		Endpoint::host(local, localPort);
+	PendingLookup lookup;
+	lookup.id = _resolver.submit(fd, ipstr, remotePort, localPort);
+	lookup.ip = ipstr;
+	lookup.deadline = CommandStats::nowMicros() + _lookupTimeoutUs;
+	lookup.done = false;
+	_lookups[fd] = lookup;
+}
+
+void Server::handleResolved()
+{
+	std::vector<ResolverResult> results = _resolver.collect();
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		std::map<int, PendingLookup>::iterator it = _lookups.find(results[i].fd);
+		// answers that arrive after the timeout (or for a reused fd) only warm the cache
+		if (it == _lookups.end() || it->second.done || it->second.id != results[i].id)
+			continue;
+		finishLookup(results[i].fd, results[i].host, results[i].ident);
+	}
+}
+
+// Lookups past their deadline fall back to the IP
+void Server::expireLookups()
+{
+	unsigned long now = CommandStats::nowMicros();
+	std::vector<int> expired;
+	for (std::map<int, PendingLookup>::iterator it = _lookups.begin(); it != _lookups.end(); ++it)
+	{
+		if (!it->second.done && now >= it->second.deadline)
+			expired.push_back(it->first);
+	}
+	for (size_t i = 0; i < expired.size(); ++i)
+		finishLookup(expired[i], "", "");
+}
+
+void Server::finishLookup(int fd, const std::string &host, const std::string &ident)
+{
+	std::map<int, Client>::iterator it = _clients.find(fd);
+	if (it == _clients.end())
+	{
+		_lookups.erase(fd);
+		return;
+	}
+	Client &client = it->second;
+	if (host.empty())
+		sendTo(fd, ":server NOTICE * :*** Couldn't look up your hostname, using your IP address instead\r\n");
+	else
+	{
+		client.setHostname(host);
+		sendTo(fd, ":server NOTICE * :*** Found your hostname: " + host + "\r\n");
+	}
+	PendingLookup &lookup = _lookups[fd];
+	lookup.done = true;
+	lookup.ident = ident;
+	completeRegistration(client);
+}
+
+// Registration finishes once PASS (or a SASL login), NICK and USER are in and the lookup is done
+void Server::completeRegistration(Client &client)
+{
+	int fd = client.getFd();
+	if (client.isAuthenticated() || !client.hasPass() || !client.hasNick() || !client.hasUser()
+		|| client.isNegotiatingCaps() || _sasl.find(fd) != _sasl.end()) // finishLogin comes back here
+		return;
+	if (nickReserved(client, client.getNick()))
+	{
+		sendTo(fd, ":server 433 * " + client.getNick() +
+				   " :Nickname belongs to a registered account, log in to use it\r\n");
+		client.clearNick(); // registration goes on with the next NICK
+		return;
+	}
+	std::map<int, PendingLookup>::iterator lookup = _lookups.find(fd);
+	if (lookup != _lookups.end())
+	{
+		if (!lookup->second.done)
+			return;
+		if (!lookup->second.ident.empty())
+			client.setUser(lookup->second.ident);
+		_lookups.erase(lookup);
+	}
+	client.setAuthenticated(true);
+	introduceUser(client);
+	userOnline(client);
+	std::string welcome = ":server NOTICE " + client.getNick() +
+		" :Welcome to ft_irc, " + client.getHostmask() + "\r\n";
+	sendTo(fd, welcome);
+	if (client.getCaps() & CAP_RESUME)
+		issueResumeToken(client);
+	std::cout << "Client " << fd << " is now authenticated as " << client.getHostmask() << "\n";
+}
@@ -0,0 +1,165 @@
+#include "Server.hpp"
+#include "Config.hpp"
+#include "PasswordHasher.hpp"
+#include "CommandStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+
+// IRC_RESUME_GRACE: seconds a dropped client with a resume token keeps its
+// nick and channels, 0 turns resumption off
+void Server::configureResume()
+{
+	long grace = configLong("IRC_RESUME_GRACE", 60);
+	_resumeGraceUs = grace > 0 ? static_cast<unsigned long>(grace) * 1000000UL : 0;
+}
+
+// RESUME TOKEN <token>, single use: a resume hands out the next one
+void Server::issueResumeToken(Client &client)
+{
+	int fd = client.getFd();
+	unsigned char raw[PasswordHasher::SALT];
+	if (!_resumeGraceUs || !PasswordHasher::randomSalt(raw))
+		return;
+	static const char hex[] = "0123456789abcdef";
+	std::string token;
+	for (size_t i = 0; i < sizeof(raw); ++i)
+	{
+		token += hex[raw[i] >> 4];
+		token += hex[raw[i] & 15];
+	}
+	Session &session = _sessions[fd];
+	if (!session.token.empty())
+		_resumeTokens.erase(session.token);
+	session.token = token;
+	session.detached = false;
+	session.deadline = 0;
+	_resumeTokens[token] = fd;
+	sendTo(fd, ":server RESUME TOKEN " + token + "\r\n");
+}
+
+// The connection under fd is gone, the user is not. A /dev/null placeholder
+// takes the fd number so memberships, nick and every other fd-keyed table stay
+// as they are; what the channels send meanwhile waits in the send queue,
+// still bounded by SendQ. False when fd has no session to keep.
+bool Server::detachSession(int fd)
+{
+	std::map<int, Session>::iterator it = _sessions.find(fd);
+	if (it == _sessions.end() || it->second.detached)
+		return false;
+	int placeholder = open("/dev/null", O_RDWR);
+	if (placeholder < 0)
+		return false;
+	dup2(placeholder, fd); // closes the socket
+	close(placeholder);
+	removePollFd(fd);
+	dropReplyJobs(fd);
+	dropTransfers(fd);
+	_closing.erase(fd);
+	_webSockets.erase(fd);
+	_sendQueues[fd].clear(); // what the old socket did not take is lost with it
+	_clients[fd].releaseBuffer();
+	it->second.detached = true;
+	it->second.deadline = CommandStats::nowMicros() + _resumeGraceUs;
+	std::cout << "Client fd=" << fd << " detached, resumable for " << _resumeGraceUs / 1000000 << "s\n";
+	return true;
+}
+
+// RESUME <token>, instead of PASS/NICK/USER. The new socket is moved onto the
+// old fd number and the registration-time state of the new connection is
+// thrown away: nobody sees a QUIT or a JOIN and no channel state is rebuilt.
+// The client gets RESUME SUCCESS, what it missed, then a new token.
+void Server::handleResume(Client &client, std::istringstream &iss)
+{
+	int newFd = client.getFd();
+	std::string token;
+	iss >> token;
+	if (client.isAuthenticated())
+	{
+		sendTo(newFd, ":server FAIL RESUME REGISTRATION_IS_COMPLETED :Already registered\r\n");
+		return;
+	}
+	if (!(client.getCaps() & CAP_RESUME))
+	{
+		sendTo(newFd, ":server FAIL RESUME CANNOT_RESUME :Request the draft/resume-0.5 capability first\r\n");
+		return;
+	}
+	std::map<std::string, int>::iterator found = _resumeTokens.find(token);
+	if (token.empty() || found == _resumeTokens.end())
+	{
+		sendTo(newFd, ":server FAIL RESUME INVALID_TOKEN :Invalid resume token\r\n");
+		return;
+	}
+	int oldFd = found->second;
+	if (!_sessions[oldFd].detached)
+	{
+		// the old connection is half-open and has not noticed yet
+		sendTo(oldFd, "ERROR :Connection resumed elsewhere\r\n");
+		detachSession(oldFd);
+	}
+	unsigned int caps = client.getCaps();
+	bool webSocket = _webSockets.find(newFd) != _webSockets.end();
+	if (webSocket)
+	{
+		_webSockets[oldFd] = _webSockets[newFd];
+		_webSockets.erase(newFd);
+	}
+	dup2(newFd, oldFd); // replaces the placeholder
+	removePollFd(newFd);
+	_lookups.erase(newFd);
+	dropAccountState(newFd);
+	forgetDelivery(newFd);
+	_clients.erase(newFd); // client is gone from here on
+	close(newFd);
+
+	Client &resumed = _clients[oldFd];
+	setCaps(resumed, caps);
+	std::string missed;
+	missed.swap(_sendQueues[oldFd]);
+	_sendQueues.erase(oldFd);
+	addPollFd(oldFd);
+	_sessions[oldFd].detached = false;
+	std::cout << "Client fd=" << oldFd << " resumed as " << resumed.getHostmask() << " from fd=" << newFd << "\n";
+	// straight to the socket: what it missed is older than anything fan-out still holds for the fd
+	missed.insert(0, ":server RESUME SUCCESS " + resumed.getNick() + "\r\n");
+	WireMessage wire = { missed.data(), missed.size(), NULL, 0 };
+	transmit(oldFd, wire);
+	issueResumeToken(resumed);
+}
+
+// Grace periods that ran out end like any other disconnect, QUIT included
+void Server::expireSessions()
+{
+	if (_sessions.empty())
+		return;
+	unsigned long now = CommandStats::nowMicros();
+	std::vector<int> expired;
+	for (std::map<int, Session>::iterator it = _sessions.begin(); it != _sessions.end(); ++it)
+		if (it->second.detached && now >= it->second.deadline)
+			expired.push_back(it->first);
+	for (size_t i = 0; i < expired.size(); ++i)
+		disconnectClientFd(expired[i], "Connection closed");
+}
+
+// Earliest us at which expireSessions has something to do, 0 for never
+unsigned long Server::nextSessionExpiry() const
+{
+	unsigned long next = 0;
+	for (std::map<int, Session>::const_iterator it = _sessions.begin(); it != _sessions.end(); ++it)
+		if (it->second.detached && (next == 0 || it->second.deadline < next))
+			next = it->second.deadline;
+	return next;
+}
+
+// The client is leaving for good, or gave up the capability
+void Server::dropSession(int fd)
+{
+	std::map<int, Session>::iterator it = _sessions.find(fd);
+	if (it == _sessions.end())
+		return;
+	if (it->second.detached)
+		_sendQueues.erase(fd); // the placeholder cannot take it
+	_resumeTokens.erase(it->second.token);
+	_sessions.erase(it);
+}
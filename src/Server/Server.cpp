@@ -1,4 +1,8 @@
 #include "Server.hpp"
+#include "Config.hpp"
+#include "FanOut.hpp"
+#include "AllocStats.hpp"
+#include "FaultInjection.hpp"
 
 #include <iostream>
 #include <sstream>
@@ -6,6 +10,7 @@
 #include <cerrno>
 #include <vector>
 #include <map>
+#include <algorithm>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -17,6 +22,7 @@
 #include <csignal>
 
 extern volatile sig_atomic_t* getShutdownFlag();
+extern volatile sig_atomic_t* getReloadFlag();
 
 // Helper: set non-blocking
 /*static bool setNonBlocking(int fd)
@@ -35,96 +41,150 @@ static bool setNonBlocking(int fd)
     return true;
 }
 
-Server::Server(int port, const std::string &password) : _listen_fd(-1), _password(password), _running(false)
+static const size_t MAX_PRIVMSG_TARGETS = 10;
+
+Server::Server(int port, const std::string &password) : _password(password), _running(false), _cmdFanout(0), _replyRR(-1),
+    _fanoutSeq(0), _nextVirtualId(-2), _nextUid(1), _fileListenFd(-1), _nextTransfer(0), _activeService(0)
 {
-    setupListener(port);
+    _fanoutInlineMax = static_cast<size_t>(configLong("IRC_FANOUT_INLINE_MAX", 512));
+    _fanoutPerTick = static_cast<size_t>(configLong("IRC_FANOUT_PER_TICK", 4096));
+    _sendQueueMax = static_cast<size_t>(configLong("IRC_SENDQ_MAX", 1024 * 1024));
+    _replyLinesPerTick = static_cast<size_t>(configLong("IRC_REPLY_LINES_PER_TICK", 1024));
+    _maxMaskEntries = static_cast<size_t>(configLong("IRC_MAX_MASK_ENTRIES", 20000));
+    _monitorMax = static_cast<size_t>(configLong("IRC_MONITOR_MAX", 100));
+    _stats.setSlowThreshold(static_cast<unsigned long>(configLong("IRC_SLOW_CMD_US", 10000)));
+    ChannelHistory::configure(configLong("IRC_HISTORY_LINES", 200), configLong("IRC_HISTORY_BYTES", 64 * 1024),
+                              configLong("IRC_HISTORY_GLOBAL_BYTES", 64 * 1024 * 1024));
+    _serverName = configStr("IRC_SERVER_NAME", "ft_irc.local");
+    _linkPassword = configStr("IRC_LINK_PASSWORD", "");
+    long lookupTimeoutMs = configLong("IRC_LOOKUP_TIMEOUT_MS", 3000);
+    _lookupTimeoutUs = static_cast<unsigned long>(lookupTimeoutMs) * 1000UL;
+    _identEnabled = configLong("IRC_IDENT", 0) != 0;
+    _allocStats = configLong("IRC_ALLOC_STATS", 0) != 0;
+    if (_allocStats)
+        AllocStats::enable();
+    configureLowLatency();
+    configureAdmission();
+#ifdef IRC_FAULT_INJECTION
+    FaultInjection::configure();
+    std::cout << "Fault injection build: IRC_FAULT_* rates apply to client and link sockets\n";
+#endif
+    configureListeners(port);
+    configureFileTransfers();
+    loadLinkTargets(configStr("IRC_LINKS", ""));
+    loadServices();
+    configureAccounts();
+    configureResume();
+    configureFilter();
+    configureChannels();
+    _resolver.start(static_cast<size_t>(configLong("IRC_RESOLVER_THREADS", 2)), configLong("IRC_DNS_TTL", 300),
+                    _identEnabled, static_cast<int>(lookupTimeoutMs / 2), configStr("IRC_HOSTS_FILE", ""));
+    if (_resolver.notifyFd() != -1)
+        addPollFd(_resolver.notifyFd());
+    if (_hasher.notifyFd() != -1)
+        addPollFd(_hasher.notifyFd());
 }
 
 Server::~Server()
 {
+    _resolver.stop();
+    _hasher.stop();
+    stopFilterReload();
     // Close all client connections
     for (std::map<int, Client>::iterator it = _clients.begin(); it != _clients.end(); ++it)
     {
-        close(it->first);
+        if (it->first >= 0) // remote users have no socket
+            close(it->first);
     }
     _clients.clear();
+    for (std::map<int, Service *>::iterator it = _services.begin(); it != _services.end(); ++it)
+        delete it->second;
+    for (size_t i = 0; i < _retiredServices.size(); ++i)
+        delete _retiredServices[i];
+    for (std::map<int, Link>::iterator it = _links.begin(); it != _links.end(); ++it)
+        close(it->first);
+    _links.clear();
+    for (std::map<unsigned long, Transfer>::iterator it = _transfers.begin(); it != _transfers.end(); ++it)
+        it->second.relay.stop();
+    for (std::map<int, unsigned long>::iterator it = _fileSockets.begin(); it != _fileSockets.end(); ++it)
+        close(it->first);
+    for (std::map<int, DataHandshake>::iterator it = _fileHandshakes.begin(); it != _fileHandshakes.end(); ++it)
+        close(it->first);
     
-    // Close listening socket
-    if (_listen_fd != -1)
+    // Close listening sockets
+    closeListeners();
+    if (_fileListenFd != -1)
     {
-        close(_listen_fd);
-        _listen_fd = -1;
+        close(_fileListenFd);
+        _fileListenFd = -1;
     }
     
     // Clear channels
+    for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+        _channelPool.release(it->second);
     _channels.clear();
 }
 
-void Server::setupListener(int port)
+void Server::addPollFd(int fd)
 {
-    _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (_listen_fd < 0)
-    {
-        std::cerr << "socket() failed: " << strerror(errno) << std::endl;
-        exit(1);
-    }
-
-    // permitir reuseaddr para evitar "address already in use" en reinicios
-    int opt = 1;
-    if (setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-    {
-        std::cerr << "setsockopt() failed: " << strerror(errno) << std::endl;
-        close(_listen_fd);
-        exit(1);
-    }
-
-    struct sockaddr_in addr;
-    std::memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(static_cast<uint16_t>(port));
-
-    if (bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-    {
-        std::cerr << "bind() failed: " << strerror(errno) << std::endl;
-        close(_listen_fd);
-        exit(1);
-    }
-
-    if (!setNonBlocking(_listen_fd))
-    {
-        std::cerr << "failed to set listen socket non-blocking\n";
-        close(_listen_fd);
-        exit(1);
-    }
-
-    if (listen(_listen_fd, SOMAXCONN) < 0)
-    {
-        std::cerr << "listen() failed: " << strerror(errno) << std::endl;
-        close(_listen_fd);
-        exit(1);
-    }
-
-    // inicializamos pollfd para el socket de escucha
     struct pollfd pfd;
-    pfd.fd = _listen_fd;
-    pfd.events = POLLIN; // nos interesa aceptar nuevas conexiones
+    pfd.fd = fd;
+    pfd.events = POLLIN;
     pfd.revents = 0;
+    if (static_cast<size_t>(fd) >= _pfdIndex.size())
+        _pfdIndex.resize(fd + 1, -1);
+    _pfdIndex[fd] = static_cast<int>(_pfds.size());
     _pfds.push_back(pfd);
+}
 
-    std::cout << "Listening on port " << port << " (fd " << _listen_fd << ")\n";
+// Swap with the last entry so removal is O(1); callers look fds up through _pfdIndex
+void Server::removePollFd(int fd)
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= _pfdIndex.size() || _pfdIndex[fd] < 0)
+        return;
+    size_t index = _pfdIndex[fd];
+    _pfds[index] = _pfds.back();
+    _pfdIndex[_pfds[index].fd] = static_cast<int>(index);
+    _pfds.pop_back();
+    _pfdIndex[fd] = -1;
+}
+
+int Server::pollIndex(int fd) const
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= _pfdIndex.size())
+        return -1;
+    return _pfdIndex[fd];
 }
 
 void Server::run()
 {
     _running = true;
     volatile sig_atomic_t* shutdown = getShutdownFlag();
+    volatile sig_atomic_t* reload = getReloadFlag();
+    unsigned long wokeAt = CommandStats::nowMicros();
     
     while (_running && !(*shutdown))
     {
-        int timeout = 1000; // ms, puedes ajustar
+        if (*reload)
+        {
+            *reload = 0;
+            reloadFilter(); // SIGHUP: las reglas se compilan en otro hilo
+        }
+        runServices(); // sus lineas viven en el arena, se atienden antes de vaciarlo
+        _arena.reset(); // nada de la vuelta anterior sigue vivo
+        connectLinks();
+        processFanOutJobs();
+        processReplyJobs();
+        closePending();
+        expireLookups();
+        expireTransfers();
+        expireSessions();
+        unsigned long now = CommandStats::nowMicros();
+        updateAdmission(now - wokeAt, now); // lo que tardamos en volver a poll es lo que espera un evento nuevo
+        int timeout = nextTimeout(); // ms, 0 si quedan trabajos pendientes, -1 si solo esperamos a los sockets
 		// poll espera actividad en uno o varios fds
-        int poll_ret = poll(&_pfds[0], _pfds.size(), timeout);
+        int poll_ret = waitForEvents(timeout);
+        wokeAt = CommandStats::nowMicros();
 		// esto va a añadir información a la estructura de cada fd del vector _pfds, ejemplo: en _pfds[0].enevts nosotros le decimos que evento queremos vigilar
 		// _pfds[0].revents indica que eventos REALMENTE ocurrieron
         if (poll_ret < 0)
@@ -144,32 +204,103 @@ void Server::run()
             // timeout, loop otra vez
             continue;
         }
-        // guardo el size de _pfds paor si hay una nueva conexion durante la ejecución del bucle y este tamaño cambia no de error, comprobamos los eventos
-        size_t pfds_size = _pfds.size();
-        for (size_t i = 0; i < pfds_size; ++i)
+        // copiamos los eventos antes de atenderlos: atender uno puede cerrar otros sockets
+        // (KILL, netsplit) y reordenar _pfds, asi que luego buscamos cada fd por su indice actual
+        std::vector<struct pollfd, ArenaAllocator<struct pollfd> > ready((ArenaAllocator<struct pollfd>(&_arena)));
+        for (size_t i = 0; i < _pfds.size(); ++i)
+        {
+            if (_pfds[i].revents != 0) // consultar REVENTS.txt
+                ready.push_back(_pfds[i]);
+        }
+        size_t batch = ready.size();
+        size_t unregisteredQuota = _shedUnregisteredPerTick;
+        for (size_t r = 0; r < ready.size(); ++r)
         {
-			// hacemos una referencia a _pfds[i], si cambiamos esta, cambia el original
-            struct pollfd &p = _pfds[i];
-            if (p.revents == 0) continue;// consultar REVENTS.txt
-            if (p.fd == _listen_fd && (p.revents & POLLIN)) // el socket del servidor escucha nuevas conexines
+            struct pollfd &p = ready[r];
+            int i = pollIndex(p.fd);
+            if (i < 0) continue; // cerrado mientras atendiamos otro evento
+            if (r < batch && postponeRead(p.fd))
+            {
+                // sobrecargados: los que aun no se han registrado van al final, y solo unos pocos
+                struct pollfd later = p;
+                if (unregisteredQuota > 0)
+                {
+                    unregisteredQuota--;
+                    ready.push_back(later);
+                }
+                else
+                    _shedder.note(LoadShedder::DEPRIORITIZE_UNREGISTERED); // poll lo vuelve a avisar
+                continue;
+            }
+            if (isListener(p.fd) && (p.revents & POLLIN)) // un socket de escucha: nuevas conexiones
             {
 				//cuando comparamos con & estamos comparando los bits
 				// por eemplo si revents es 0x011, es true, porque POLLIN es 0x001 y ese bit coincide
                 // nueva conexión entrante creamos nuevo socket
-                acceptNewConnection();
+                if (!rejectConnections(p.fd))
+                    acceptConnections(p.fd); // hasta el presupuesto de ese listener
             }  
+            else if (p.fd == _resolver.notifyFd())
+                handleResolved(); // el resolver ha terminado alguna busqueda
+            else if (p.fd == _hasher.notifyFd())
+                handleHashed(); // hay hashes de contraseñas terminados (SASL, REGISTER)
+            else if (p.fd == _filterReload.pipe[0])
+                finishFilterReload(); // las reglas nuevas del filtro estan listas
+            else if (p.fd == _fileListenFd)
+                acceptFileConnection(); // conexion de datos de una transferencia
+            else if (isFileSocket(p.fd))
+                handleFileSocket(p.fd, p.revents); // los bytes del fichero van de socket a socket, no son lineas IRC
             else // se miran los demas sockets
             {
+                if (p.revents & POLLOUT)
+                    flushSendQueue(p.fd); // el socket vuelve a aceptar lo que se quedo en la cola
                 if (p.revents & (POLLIN | POLLERR | POLLHUP))
                 {
                     handleClientRead(i);
                 }
-                // para ahora no manejamos POLLOUT (salida) — se añadirá más tarde
             }
+            runServices(); // los bots ven lo que ha pasado en este evento, ya entregado a todos
+            closePending(); // los errores de escritura cierran aqui, nunca en medio de un broadcast
         }
     }
     
     std::cout << "\nBye...\n";
+#ifdef IRC_FAULT_INJECTION
+    std::cout << "Faults injected:";
+    for (int k = 0; k < FaultInjection::KINDS; ++k)
+        std::cout << " " << FaultInjection::name(static_cast<FaultInjection::Kind>(k)) << "="
+                  << FaultInjection::injected(static_cast<FaultInjection::Kind>(k));
+    std::cout << "\n";
+#endif
+}
+
+// Every write to a client goes through here so nothing overtakes a fan-out job
+// that still has to reach it
+void Server::sendTo(int fd, const std::string &msg)
+{
+	sendTo(fd, msg.data(), msg.size());
+}
+
+void Server::sendTo(int fd, const char *msg, size_t len)
+{
+	WireMessage wire = { msg, len, NULL, 0 };
+	sendTo(fd, wire);
+}
+
+void Server::sendTo(int fd, WireMessage &wire)
+{
+	if (fd < 0)
+	{
+		if (!_services.empty())
+			queueServiceInput(fd, wire.data, wire.len); // services get lines, not bytes
+		return; // remote users are reached through their link, not per message
+	}
+	if (static_cast<size_t>(fd) < _fanoutTail.size() && _fanoutTail[fd] > _fanoutDelivered[fd])
+	{
+		_deferred[fd].push_back(std::make_pair(_fanoutTail[fd], std::string(wire.data, wire.len)));
+		return;
+	}
+	transmit(fd, wire);
 }
 
 void Server::sendWelcomeMessage(int client_fd)
@@ -182,14 +313,15 @@ void Server::sendWelcomeMessage(int client_fd)
         ":server NOTICE * :USER <username> <hostname> <servername> <realname>\r\n"
         ":server NOTICE * :After that, you can use HELP to see all the commands\r\n";
 
-    send(client_fd, welcome.c_str(), welcome.size(), 0);
+    sendTo(client_fd, welcome);
 }
 
-void Server::acceptNewConnection()
+// false once the backlog is empty
+bool Server::acceptNewConnection(int listenFd)
 {
-    struct sockaddr_in clientaddr;
+    struct sockaddr_storage clientaddr;
     socklen_t addrlen = sizeof(clientaddr);
-    int client_fd = accept(_listen_fd, (struct sockaddr *)&clientaddr, &addrlen);
+    int client_fd = accept(listenFd, (struct sockaddr *)&clientaddr, &addrlen);
 	//accept() toma la conexión pendiente en _listen_fd (el socket del servidor).
 	// Devuelve un nuevo descriptor de socket (client_fd) para comunicarte con ese cliente.
 
@@ -197,64 +329,125 @@ void Server::acceptNewConnection()
     {
         if (errno != EWOULDBLOCK && errno != EAGAIN)
             std::cerr << "accept() failed: " << strerror(errno) << std::endl;
-        return;
+        return false;
     }
     if (!setNonBlocking(client_fd))
     {
         std::cerr << "failed to set client non-blocking\n";
         close(client_fd);
-        return;
+        return true;
     }
-    struct pollfd pfd;
-    pfd.fd = client_fd;
-    pfd.events = POLLIN;
-    pfd.revents = 0;
-    _pfds.push_back(pfd); // poll vigila este cliente en el siugiente ciclo
+    addPollFd(client_fd); // poll vigila este cliente en el siugiente ciclo
+    tuneSocket(client_fd);
 
     _clients.insert(std::make_pair(client_fd, Client(client_fd)));
 	// con insert evitas sobreescrivir un cliente que ya existiera con esa clave (su fd) si ya existe no hace nada, si quisieramos sobreescribir hariamos lo tipico de _clients[client_fd] = Client(client_fd)
-    char ipstr[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &clientaddr.sin_addr, ipstr, sizeof(ipstr));
-	// inet_ntop() → convierte la IP del cliente de binario a texto (ej. "192.168.1.5").
-	// ntohs() → convierte el puerto de byte order de red a byte order del host.
-    std::cout << "Accepted connection from " << ipstr << ":" << ntohs(clientaddr.sin_port)
-              << " (fd=" << client_fd << ")\n";
-	sendWelcomeMessage(client_fd);
-
+    Listener &listener = _listeners[listenFd];
+    listener.accepted++;
+    int port;
+    std::string ip = Endpoint::host(clientaddr, port);
+    // Endpoint::host() → la IP del cliente en texto (ej. "192.168.1.5" o "2001:db8::1"), y su puerto.
+    // Un cliente IPv4 en el socket dual-stack llega como ::ffff:192.168.1.5 y sale como IPv4.
+    if (clientaddr.ss_family == AF_UNIX)
+        std::cout << "Accepted connection on " << listener.endpoint.text << " (fd=" << client_fd << ")\n";
+    else if (ip.find(':') != std::string::npos)
+        std::cout << "Accepted connection from [" << ip << "]:" << port << " (fd=" << client_fd << ")\n";
+    else
+        std::cout << "Accepted connection from " << ip << ":" << port << " (fd=" << client_fd << ")\n";
+    if (listener.webSocket)
+        _webSockets[client_fd] = WebSocket(); // el welcome espera al upgrade HTTP
+    else if (listener.serverLinks)
+        _linkAccepts.insert(client_fd); // un servidor: nada de welcome, su primera linea tiene que ser SERVER
+    else
+        sendWelcomeMessage(client_fd);
+    startLookup(client_fd, clientaddr);
+    return true;
 }
 
 void Server::handleClientRead(int index)
 {
     int fd = _pfds[index].fd;
     char buf[4096]; 
-    ssize_t n = recv(fd, buf, sizeof(buf), 0); // va a leer 4096 bytes del fd
+    ssize_t n = sockRecv(fd, buf, sizeof(buf), 0); // va a leer 4096 bytes del fd
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return; // nada que leer todavia, poll avisara otra vez
     if (n <= 0) // si devuelve 0 bytes es que cliente cerró conexion, si es menor que 0 es error
     {
-        closeClient(index);
+        if (!detachSession(fd)) // con token de resume el usuario se queda en sus canales un rato
+            closeClient(index);
+        return;
+    }
+    if (_links.find(fd) != _links.end())
+    {
+        handleLinkData(fd, buf, n);
+        return;
+    }
+    const char *data = buf;
+    size_t len = static_cast<size_t>(n);
+    bool webSocket = !_webSockets.empty() && _webSockets.find(fd) != _webSockets.end();
+    // los clientes WebSocket mandan tramas: las pasamos a lineas IRC y siguen el mismo camino
+    if (webSocket && !readWebSocket(fd, data, len))
+    {
+        closeClient(index, "WebSocket closed");
         return;
     }
     Client &client = _clients[fd]; //hacemos referincia al cliente que toca
-    client.getBuffer().append(buf, n); 
-	// funciona como gnl, pegamos n bytes en el buffer
-    std::string &buffer = client.getBuffer();
-    size_t pos;
-    while ((pos = buffer.find("\r\n")) != std::string::npos)
+    if (client.hasBufferedInput())
+    {
+        // funciona como gnl: pegamos lo nuevo a la linea a medias y lo pasamos todo al arena
+        std::string &buffer = client.getBuffer();
+        buffer.append(data, len);
+        len = buffer.size();
+        data = _arena.copy(buffer.data(), len);
+        buffer.clear();
+    }
+    // las lineas completas se atienden en su sitio, sin copiarlas a un std::string.
+    // Se buscan todas de una pasada (LineFramer): vale \r\n, \n o \r sueltos
+    LineFramer::Lines lines((ArenaAllocator<LineFramer::Line>(&_arena)));
+    size_t used = LineFramer::scan(data, len, lines);
+    // el cliente puede desaparecer dentro de handleCommand (QUIT, KILL), lo buscamos en cada vuelta
+    for (size_t k = 0; k < lines.size() && _clients.find(fd) != _clients.end(); ++k)
     {
-		// buscamos si dentro de lo que hemos pegado hay un salto de linea
-        std::string line = buffer.substr(0, pos); // extraemos hasta el salto de linea
-        buffer.erase(0, pos + 2); // borramos lo que hemos extraido del buffer para que el resto quede para la siugiente iteracion
+        StringRef line(data + lines[k].start, lines[k].len);
+        if (!lines[k].clean)
+        {
+            // un NUL o un caracter de control en medio de la linea: no llega a ningun comando
+            sendTo(fd, ":server FAIL * INVALID_CHARACTERS :Line dropped, it contains a NUL or control character\r\n");
+            continue;
+        }
+        if (!_linkAccepts.empty() && _linkAccepts.erase(fd))
+        {
+            // solo en un listener de links (IRC_LINK_LISTEN) y solo como primera linea:
+            // otro servidor se presenta y la conexion pasa a ser un link, con lo que quede sin leer
+            if (line.size() < 7 || std::memcmp(line.data(), "SERVER ", 7) != 0)
+            {
+                sendTo(fd, "ERROR :This port only takes server links\r\n");
+                disconnectClientFd(fd, "Not a server link");
+                return;
+            }
+            size_t rest = lines[k].start + lines[k].len + 1;
+            client.getBuffer().assign(data + rest, len - rest);
+            promoteToLink(fd, line.str());
+            return;
+        }
         handleCommand(client, line);
 		// \r\n es basicamente lo mismo que \n pero en protocolos de red se hace asi no se por que y hay que manejarlo asi por la cara la r es que pones el cursor al principio de la linea
     }
+    if (_clients.find(fd) == _clients.end())
+        return;
+    if (used < len)
+        client.getBuffer().assign(data + used, len - used); // linea a medias
+    else
+        client.releaseBuffer(); // sin lineas a medias el cliente no guarda buffer
 }
 
 bool Server::channelExist(std::string channelName, Client &client)
 {
-	std::map<std::string, Channel>::iterator it = _channels.find(channelName);
+	std::map<std::string, Channel *>::iterator it = _channels.find(channelName);
 	if (it == _channels.end())
 	{
 		std::string err = "403 " + client.getNick() + " " + channelName + " :No such channel\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		sendTo(client.getFd(), err);
 		return false;
 	}
 	return true;
@@ -264,7 +457,7 @@ bool Server::channelExist(std::string channelName, Client &client)
 {
     for (std::map<int, Client>::iterator it = _clients.begin(); it != _clients.end(); ++it)
     {
-        if (it->second.getNick() == nick)
+        if (it->second.isNick(nick))
             return it->first;
     }
     return -1;
@@ -272,17 +465,12 @@ bool Server::channelExist(std::string channelName, Client &client)
 
 bool Server::clientExist(int target_fd, Client &client)
 {
-    if (target_fd < 0)
-    {
-        std::string err = "401 " + client.getNick() + " :No such user\r\n";
-        send(client.getFd(), err.c_str(), err.size(), 0);
-        return false;
-    }
+    // remote users have negative ids, -1 is "not found"
     std::map<int, Client>::iterator it = _clients.find(target_fd);
     if (it == _clients.end())
     {
         std::string err = "401 " + client.getNick() + " :No such user\r\n";
-        send(client.getFd(), err.c_str(), err.size(), 0);
+        sendTo(client.getFd(), err);
         return false;
     }
     return true;
@@ -293,7 +481,7 @@ bool Server::hasPermissions(int client_fd, Client &client, Channel &channel)
     if (!channel.hasMember(client_fd) || !channel.isOperator(client_fd)) 
     {
         std::string err = "482 " + client.getNick() + " " + channel.getName() + " :You have no permissions\r\n";
-        send(client.getFd(), err.c_str(), err.size(), 0);
+        sendTo(client.getFd(), err);
         return false;
     }
     return true;
@@ -301,141 +489,142 @@ bool Server::hasPermissions(int client_fd, Client &client, Channel &channel)
 
 bool Server::channelHasNick(std::string target, std::string channelName, Client &client)
 {
-	Channel &channel = _channels[channelName];
+	Channel &channel = *_channels[channelName];
 	if (!channel.hasMemberNick(target)) 
 	{
 		std::string err = "441 " + client.getNick() + " " + target + " " + channelName + " :They aren't on that channel\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		sendTo(client.getFd(), err);
 		return false;
 	}
 	return true;
 }
 
-void helpCommand(Client &client)
+static std::string helpText()
 {
-	std::string help =
+	return
+	":server NOTICE * :CAP LS | LIST | REQ :<capability> ... | END - Negotiate message-tags, server-time, echo-message, multi-prefix, sasl\r\n"
+	":server NOTICE * :AUTHENTICATE PLAIN - Log in to an account during registration (SASL), instead of PASS\r\n"
+	":server NOTICE * :RESUME <token> - Take back a dropped connection's nick and channels, instead of registering\r\n"
 	":server NOTICE * :PASS - set the password\r\n"
 	":server NOTICE * :USER <username> <hostname> <servername> <realname>- set the user\r\n"
 	":server NOTICE * :NICK - set the nickname\r\n"
 	":server NOTICE * :QUIT - stop execution\r\n"
-	":server NOTICE * :PRIVMSG <target nickname> <message> — Send a private message to a user\r\n"
+	":server NOTICE * :PRIVMSG <target>[,<target>...] <message> — Send a message to users and/or channels\r\n"
 	":server NOTICE * :JOIN <channel name> — Join a channel, If the channel does not exist, it will be created automatically\r\n"
 	":server NOTICE * :KICK <channel> <nickname> - Remove user from channel\r\n"
 	":server NOTICE * :INVITE <nickname> <channel> - Invite user from channel'\' add to whitelist\r\n"
-	":server NOTICE * :PRIVMSG <nickname> <message> - Send a private message to another user\r\n";
-	send(client.getFd(), help.c_str(), help.size(), 0);
+	":server NOTICE * :PRIVMSG <nickname> <message> - Send a private message to another user\r\n"
+	":server NOTICE * :CHATHISTORY LATEST|AFTER <channel> <*|timestamp=ms> <limit> - Replay recent channel messages\r\n"
+	":server NOTICE * :MODE <channel> [+|-][b|e|I] [<mask>...] - List or change ban, exception and invite masks\r\n"
+	":server NOTICE * :NAMES <channel>[,<channel>...] - List the members of channels\r\n"
+	":server NOTICE * :WHO <channel|nickname> - Show user details\r\n"
+	":server NOTICE * :LIST [<channel>[,<channel>...]] - List channels, their size and topic\r\n"
+	":server NOTICE * :MONITOR +|- <nickname>[,<nickname>...] | C | L | S - Get told when nicknames come online or leave\r\n"
+	":server NOTICE * :REGISTER <nickname|*> <email|*> <password> - Register your nickname as an account\r\n"
+	":server NOTICE * :FILE SEND <nickname> <filename> <size> | ACCEPT <id> | CANCEL <id> - Send a file through the server\r\n"
+	":server NOTICE * :STATS m - Show per-command latency (count mean p50 p90 p99 max, in us)\r\n"
+	":server NOTICE * :STATS h - Show channel history memory usage\r\n"
+	":server NOTICE * :STATS l - Show the overload stage, loop lag and what has been shed\r\n"
+	":server NOTICE * :STATS P - Show the listeners, their accept budgets and connections accepted\r\n"
+	":server NOTICE * :STATS C - Show live channels and how many were reclaimed and reused\r\n"
+	":server NOTICE * :STATS a - Show heap allocations per command (count allocs bytes allocs/cmd bytes/cmd)\r\n";
 }
 
-bool Server::handleJoin(Client &client, std::istringstream &iss)
+bool Server::handleJoin(Client &client, StringRef params)
 {
-    std::string channelListStr, passwordListStr;
+    StringRef channelList = params.word();
+	StringRef passwordList = params.word();
 
-    iss >> channelListStr;
-	iss >> passwordListStr;
-
-   if (channelListStr.empty())
+   if (channelList.empty())
 	{
 		std::string err = ":server 461 " + client.getNick() + " JOIN :Not enough parameters\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		sendTo(client.getFd(), err);
 		return false;
 	}
-	std::vector<std::string> channels;
-	std::stringstream ssChannels(channelListStr);
-	std::string temp;
-	while (std::getline(ssChannels, temp, ','))
-	{
-		channels.push_back(temp);
-	}
-	std::vector<std::string> passwords;
-	if (!passwordListStr.empty())
-	{
-		std::stringstream ssPasswords(passwordListStr);
-		while (std::getline(ssPasswords, temp, ','))
-		{
-			passwords.push_back(temp);
-		}
-	}
+	ArenaAllocator<StringRef> alloc(&_arena);
+	std::vector<StringRef, ArenaAllocator<StringRef> > channels(alloc);
+	while (!channelList.empty())
+		channels.push_back(channelList.split(','));
+	std::vector<StringRef, ArenaAllocator<StringRef> > passwords(alloc);
+	while (!passwordList.empty())
+		passwords.push_back(passwordList.split(','));
 	for (size_t i = 0; i < channels.size(); ++i)
 	{
-		const std::string channelName = channels[i];
-		const std::string key = (i < passwords.size()) ? passwords[i] : "";
+		const std::string &channelName = _nameKey.assign(channels[i].data(), channels[i].size());
+		const StringRef key = (i < passwords.size()) ? passwords[i] : StringRef();
 
-		if (channelName.empty() || channelName[0] != '#' )
+		if (!IrcChars::isChannel(channels[i]))
 		{
 			std::string err = ":server 403 " + client.getNick() + " " + channelName + " :Invalid channel name\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
+			sendTo(client.getFd(), err);
 			continue;
 		}
+		std::map<std::string, Channel *>::iterator found = _channels.find(channelName);
 		bool newlyCreated = false;
-		if (_channels.find(channelName) == _channels.end())
+		if (found == _channels.end())
 		{
-			_channels.insert(std::make_pair(channelName, Channel(channelName)));
+			found = createChannel(channelName);
 			newlyCreated = true;
 			std::cout << "Created new channel: " << channelName << "\n";
 		}
-		Channel &channel = _channels[channelName];
+		Channel &channel = *found->second;
 		if (newlyCreated && !key.empty())
 		{
-			channel.setKey(key);
+			channel.setKey(key.str());
 		}
+		std::string err;
 		if (channel.hasMember(client.getFd()))
+			err = ":server 443 " + client.getNick() + " " + channelName + " :is already on channel\r\n";
+		else if (!channel.getKey().empty() && !(StringRef(channel.getKey()) == key))
+			err = ":server 475 " + client.getNick() + " " + channelName + " :Cannot join channel (+k) - wrong key\r\n";
+		else if (channel.getUserLimit() != 0 && channel.getCurrentUsers() >= channel.getUserLimit())
+			err = ":server 471 " + client.getNick() + " " + channelName + " :Cannot join channel (+l) - channel is full\r\n";
+		else if (channel.hasBans() && channel.isBanned(client.getFd(), client.getIdentity(), client.getHostmask()))
+			err = ":server 474 " + client.getNick() + " " + channel.getName() + " :Cannot join channel (+b) - you are banned\r\n";
+		else if (channel.getInviteOnly() && !channel.isInWhiteList(client.getFd())
+			&& !channel.isInviteExempt(client.getFd(), client.getIdentity(), client.getHostmask()))
+			err = ":server 473 " + client.getNick() + " " + channel.getName() + " :Cannot join channel (+i) - you must be invited\r\n";
+		if (!err.empty())
 		{
-			std::string msg = ":server 443 " + client.getNick() + " " + channelName + " :is already on channel\r\n";
-			send(client.getFd(), msg.c_str(), msg.size(), 0);
+			sendTo(client.getFd(), err);
+			reclaimChannel(found); // a channel created for a refused JOIN does not stay behind
 			continue;
 		}
-		if (!channel.getKey().empty() && channel.getKey() != key)
-		{
-			std::string err = ":server 475 " + client.getNick() + " " + channelName + " :Cannot join channel (+k) - wrong key\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
-			continue;
-		}
-		if (channel.getUserLimit() != 0 && channel.getCurrentUsers() >= channel.getUserLimit())
-		{
-			std::string err = ":server 471 " + client.getNick() + " " + channelName + " :Cannot join channel (+l) - channel is full\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
-			continue;
-		}
-
-		if (channel.getInviteOnly() && !channel.isInWhiteList(client.getFd()))
+		channel.addMember(client.getFd(), client.getNick(), false);
+		ArenaString joinMsg(_arena);
+		joinMsg << ':' << client.getNick() << " JOIN " << channelName << "\r\n";
+		sendTo(client.getFd(), joinMsg.data(), joinMsg.size());
+		FanOut joinFan(&_arena);
+		joinFan.addChannel(channel);
+		joinFan.exclude(client.getFd());
+		deliver(joinFan, joinMsg.data(), joinMsg.size());
+		channel.getHistory().append(ChannelHistory::nowMillis(), joinMsg.data(), joinMsg.size());
+		if (!_links.empty() && !client.getUid().empty())
 		{
-			std::string err = ":server 473 " + client.getNick() + " " + channel.getName() + " :Cannot join channel (+i) - you must be invited\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
-			continue;
+			std::ostringstream sjoin;
+			sjoin << "SJOIN " << channel.getCreatedAt() << " " << channelName << " :"
+				  << (channel.isOperator(client.getFd()) ? "@" : "") << client.getUid();
+			propagate(sjoin.str());
 		}
-		channel.addMember(client.getFd(), client.getNick(), false);
-		std::string joinMsg = ":" + client.getNick() + " JOIN " + channelName + "\r\n";
-		send(client.getFd(), joinMsg.c_str(), joinMsg.size(), 0);
-		channel.broadcast(joinMsg, client.getFd());
-		std::string welcome = ":server NOTICE " + client.getNick() + " :Welcome to " + channel.getName() + "\r\n";
-		send(client.getFd(), welcome.c_str(), welcome.size(), 0);
-
-		std::string topicMsg;
+		ArenaString reply(_arena);
+		reply << ":server NOTICE " << client.getNick() << " :Welcome to " << channel.getName() << "\r\n";
 		if (channel.getTopic().empty())
-			topicMsg = ":server 331 " + client.getNick() + " " + channel.getName() + " :No topic is set\r\n";
+			reply << ":server 331 " << client.getNick() << ' ' << channel.getName() << " :No topic is set\r\n";
 		else
-			topicMsg = ":server 332 " + client.getNick() + " " + channel.getName() + " :" + channel.getTopic() + "\r\n";
-		send(client.getFd(), topicMsg.c_str(), topicMsg.size(), 0);
+			reply << ":server 332 " << client.getNick() << ' ' << channel.getName() << " :" << channel.getTopic() << "\r\n";
+		sendTo(client.getFd(), reply.data(), reply.size());
+		sendNames(client, channel);
 
-		size_t currentUsers = channel.getCurrentUsers();
-		std::string limitStr;
+		reply.clear();
+		reply << ":server NOTICE " << client.getNick() << " :Users: " << channel.getCurrentUsers() << '/';
 		if (channel.getUserLimit() == 0)
-			limitStr = "unlimited";
-		else {
-			std::stringstream ss;
-			ss << channel.getUserLimit();
-			limitStr = ss.str();
-		}
-		std::stringstream ss2;
-		ss2 << ":server NOTICE " << client.getNick() << " :Users: " << currentUsers << "/" << limitStr << "\r\n";
-		std::string userInfo = ss2.str();
-		send(client.getFd(), userInfo.c_str(), userInfo.size(), 0);
-
+			reply << "unlimited";
+		else
+			reply << channel.getUserLimit();
+		reply << "\r\n";
 		if (channel.isOperator(client.getFd()))
-		{
-			std::string opMsg = ":server NOTICE " + client.getNick() + " :You have channel operator privileges\r\n";
-			send(client.getFd(), opMsg.c_str(), opMsg.size(), 0);
-		}
+			reply << ":server NOTICE " << client.getNick() << " :You have channel operator privileges\r\n";
+		sendTo(client.getFd(), reply.data(), reply.size());
 		std::cout << client.getNick() << " joined " << channelName << "\n";
 	}
 	return true;
@@ -450,21 +639,26 @@ bool Server::handleKick(Client &client, std::istringstream &iss)
     if (channelName.empty() || target.empty())
     {
         std::string err = "461 KICK :Not enough parameters\r\n";
-        send(client.getFd(), err.c_str(), err.size(), 0);
+        sendTo(client.getFd(), err);
         return false;
     }
     if (!channelExist(channelName, client)) return false;
-    Channel &channel = _channels[channelName];
+    Channel &channel = *_channels[channelName];
     if (!channelHasNick(target, channelName, client)) return false;
     int target_fd = channel.getFdByNick(target);
     if (!clientExist(target_fd, client)) return false;
     if (!hasPermissions(client.getFd(), client, channel)) return false;
     channel.removeMember(target_fd, client.getFd());
-    std::string fullMsg = ":" + client.getNick() + "!" + client.getUser() + "@localhost "
+    std::string fullMsg = ":" + client.getHostmask() + " "
                         "KICK " + channelName + " " + target + "\r\n";
-    channel.broadcast(fullMsg, 0);
-    send(target_fd, fullMsg.c_str(), fullMsg.size(), 0);
-
+    FanOut fan;
+    fan.addChannel(channel);
+    fan.addFd(target_fd);
+    deliver(fan, fullMsg);
+    channel.getHistory().append(ChannelHistory::nowMillis(), fullMsg);
+    if (!client.getUid().empty() && !_clients[target_fd].getUid().empty())
+        propagate(":" + client.getUid() + " KICK " + channelName + " " + _clients[target_fd].getUid());
+    reclaimChannel(_channels.find(channelName));
     return true;
 }
 
@@ -475,134 +669,288 @@ bool Server::handleInvite(Client &client, std::istringstream &iss)
 		if (target.empty() || channelName.empty())
 		{
 			std::string err = "461 INVITE :Not enough parameters\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
+			sendTo(client.getFd(), err);
 			return false;
 		}
 		if (!channelExist(channelName, client)) return false;
-		Channel &channel = _channels[channelName];
+		Channel &channel = *_channels[channelName];
 		if (!hasPermissions(client.getFd(), client, channel)) return false;
 		int target_fd = getFdByNick(target);
 		if (!clientExist(target_fd, client)) return false;
 		if (channel.hasMember(target_fd))
 		{
 			std::string errMsg = ":server 443 " + client.getNick() + " " + target + " " + channelName + " :is already on channel\r\n";
-			send(client.getFd(), errMsg.c_str(), errMsg.size(), 0);
+			sendTo(client.getFd(), errMsg);
 			return false;
 		}
 		if (!channel.isInWhiteList(target_fd))
 		{
 			channel.addToWhiteList(target_fd);
-			std::string inviteMsg = ":" + client.getNick() + "!" + client.getUser() + "@localhost "
+			std::string inviteMsg = ":" + client.getHostmask() + " "
 							"INVITE " + target + " :" + channelName + "\r\n";
-			send(target_fd, inviteMsg.c_str(), inviteMsg.size(), 0);
+			sendTo(target_fd, inviteMsg);
+			_cmdFanout++;
 		}
 		else
 		{
 			std::string errMsg = ":server 443 " + client.getNick() + " " + target + " " + channelName + " :is already invited\r\n";
-			send(client.getFd(), errMsg.c_str(), errMsg.size(), 0);
+			sendTo(client.getFd(), errMsg);
 		}
 		return true;
 }
 
-void Server::handlePriv(Client &client, std::istringstream &iss)
+// Runs entirely on the arena: the parsed targets, the recipient lists and the
+// outgoing line are all command-scoped.
+void Server::handlePriv(Client &client, StringRef params)
 {
-	std::string target;
-	iss >> target;
+	StringRef target = params.word();
 	if (target.empty())
 	{
-		send(client.getFd(), "411 :No recipient given (PRIVMSG)\r\n", strlen("411 :No recipient given (PRIVMSG)\r\n"), 0);
+		sendTo(client.getFd(), "411 :No recipient given (PRIVMSG)\r\n");
 		return;
 	}
 
-	std::string message;
-	std::getline(iss, message);
-	size_t start = message.find_first_not_of(' ');
-	if (start != std::string::npos)
-		message = message.substr(start);
-	else
-		message.clear();
-
+	StringRef message = params.trimLeft(' ');
 	if (message.empty())
 	{
-		send(client.getFd(), "412 :No text to send\r\n", strlen("412 :No text to send\r\n"), 0);
+		sendTo(client.getFd(), "412 :No text to send\r\n");
 		return;
 	}
 	if (message[0] != ':')
 	{
 		std::string err = ":server 461 " + client.getNick() +
 						" PRIVMSG :Invalid syntax, use ':' before message\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		sendTo(client.getFd(), err);
+		return;
+	}
+	message = StringRef(message.data() + 1, message.size() - 1);
+	if (!_filter.empty() && client.getFd() >= 0 && !filterMessage(client, target, message))
+		return; // una sola pasada por el texto, tenga las reglas que tenga
+
+	std::vector<StringRef, ArenaAllocator<StringRef> > targets((ArenaAllocator<StringRef>(&_arena)));
+	StringRef list = target;
+	while (!list.empty())
+	{
+		StringRef name = list.split(',');
+		if (!name.empty() && std::find(targets.begin(), targets.end(), name) == targets.end())
+			targets.push_back(name);
+	}
+	if (targets.size() > MAX_PRIVMSG_TARGETS)
+	{
+		std::string err = ":server 407 " + client.getNick() + " " + target.str() + " :Too many targets\r\n";
+		sendTo(client.getFd(), err);
 		return;
 	}
-	message = message.substr(1);
-	std::string fullMsg = ":" + client.getNick() + " PRIVMSG " + target + ":" + message + "\r\n";
-	if (target[0] == '#')
+
+	// Each recipient gets one copy, addressed to the first target that reaches them
+	FanOut::FdList served((ArenaAllocator<int>(&_arena)));
+	served.push_back(client.getFd());
+	for (size_t i = 0; i < targets.size(); ++i)
 	{
-		std::map<std::string, Channel>::iterator it = _channels.find(target);
-		if (it == _channels.end())
+		const StringRef &to = targets[i];
+		ArenaString fullMsg(_arena);
+		fullMsg << ':' << client.getNick() << " PRIVMSG " << to << ':' << message << "\r\n";
+		FanOut fan(&_arena);
+		_nameKey.assign(to.data(), to.size());
+		if (to[0] == '#')
+		{
+			std::map<std::string, Channel *>::iterator it = _channels.find(_nameKey);
+			if (it == _channels.end())
+			{
+				std::string err = "403 " + to.str() + " :No such channel\r\n";
+				sendTo(client.getFd(), err);
+				continue;
+			}
+			Channel &chan = *it->second;
+			if (!chan.hasMember(client.getFd()))
+			{
+				std::string err = "442 " + to.str() + " :You're not on that channel\r\n";
+				sendTo(client.getFd(), err);
+				continue;
+			}
+			if (chan.hasBans() && chan.isBanned(client.getFd(), client.getIdentity(), client.getHostmask()))
+			{
+				std::string err = ":server 404 " + client.getNick() + " " + to.str() + " :Cannot send to channel (+b)\r\n";
+				sendTo(client.getFd(), err);
+				continue;
+			}
+			fan.addChannel(chan);
+			chan.getHistory().append(ChannelHistory::nowMillis(), fullMsg.data(), fullMsg.size());
+			if (!_links.empty())
+				propagateToChannel(chan, ":" + client.getUid() + " PRIVMSG " + to.str() + " :" + message.str());
+		}
+		else
 		{
-			std::string err = "403 " + target + " :No such channel\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
-			return;
+			int target_fd = getFdByNick(_nameKey);
+			if (target_fd == -1)
+			{
+				std::string err = "401 " + to.str() + " :No such nick\r\n";
+				sendTo(client.getFd(), err);
+				continue;
+			}
+			fan.addFd(target_fd);
+			Client &remote = _clients[target_fd];
+			if (remote.isRemote() && std::find(served.begin(), served.end(), target_fd) == served.end())
+				sendLink(remote.getLinkFd(), ":" + client.getUid() + " PRIVMSG " + remote.getUid() + " :" + message.str());
+		}
+		fan.exclude(served);
+		const FanOut::FdList &recipients = fan.recipients();
+		served.insert(served.end(), recipients.begin(), recipients.end());
+		deliver(fan, fullMsg.data(), fullMsg.size(), _clientTags);
+		if (client.hasCap(CAP_ECHO_MESSAGE))
+		{
+			FanOut echo(&_arena);
+			echo.addFd(client.getFd());
+			deliver(echo, fullMsg.data(), fullMsg.size(), _clientTags);
 		}
-		Channel &chan = it->second;
-		if (!chan.hasMember(client.getFd()))
+	}
+}
+
+
+
+// STATS m: per-command dispatch latency histograms, readable while the server runs
+// STATS a: heap allocations per command verb, when IRC_ALLOC_STATS is set
+// STATS l: overload stage and loop lag (Admission.cpp)
+// STATS P: listeners and what each has accepted (Listeners.cpp)
+void Server::handleStats(Client &client, std::istringstream &iss)
+{
+	std::string query;
+	iss >> query;
+	if (query.empty())
+		query = "m";
+	if (query == "m")
+	{
+		std::vector<std::string> lines = _stats.report();
+		for (size_t i = 0; i < lines.size(); ++i)
 		{
-			std::string err = "442 " + target + " :You're not on that channel\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
-			return;
+			std::string reply = ":server 212 " + client.getNick() + " " + lines[i] + "\r\n";
+			sendTo(client.getFd(), reply);
 		}
-		chan.broadcast(fullMsg, client.getFd());
 	}
-	else
+	else if (query == "a")
 	{
-		bool found = false;
-		for (std::map<int, Client>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+		if (!_allocStats)
 		{
-			if (it->second.getNick() == target)
-			{
-				send(it->second.getFd(), fullMsg.c_str(), fullMsg.size(), 0);
-				found = true;
-				break;
-			}
+			std::string off = ":server NOTICE " + client.getNick() + " :Allocation counting is off (IRC_ALLOC_STATS=1)\r\n";
+			sendTo(client.getFd(), off);
 		}
-		if (!found)
+		std::vector<std::string> lines = _stats.allocationReport();
+		for (size_t i = 0; i < lines.size(); ++i)
 		{
-			std::string err = "401 " + target + " :No such nick\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
+			std::string reply = ":server 212 " + client.getNick() + " " + lines[i] + "\r\n";
+			sendTo(client.getFd(), reply);
 		}
 	}
+	else if (query == "l")
+		sendLoadStats(client);
+	else if (query == "P")
+		sendListenerStats(client);
+	else if (query == "C")
+		sendChannelStats(client);
+	else if (query == "h")
+	{
+		for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+		{
+			std::ostringstream ss;
+			ss << ":server 249 " << client.getNick() << " " << it->first << " " << it->second->getHistory().size()
+			   << " lines " << it->second->getHistory().memoryUsage() << " bytes\r\n";
+			std::string reply = ss.str();
+			sendTo(client.getFd(), reply);
+		}
+		std::ostringstream total;
+		total << ":server 249 " << client.getNick() << " * " << ChannelHistory::globalUsage() << "/"
+			  << ChannelHistory::globalCap() << " bytes\r\n";
+		std::string reply = total.str();
+		sendTo(client.getFd(), reply);
+	}
+	std::string end = ":server 219 " + client.getNick() + " " + query + " :End of STATS report\r\n";
+	sendTo(client.getFd(), end);
+}
+
+// Message tags the client set itself ("+typing=active"), the only ones it may
+// pass on; server tags it tries to send are dropped, as is an oversized set
+static StringRef clientOnlyTags(Arena &arena, StringRef tags)
+{
+	static const size_t MAX_CLIENT_TAGS = 4094;
+	StringRef rest(tags.data() + 1, tags.size() - 1);
+	ArenaString kept(arena, rest.size() + 1);
+	while (!rest.empty())
+	{
+		StringRef tag = rest.split(';');
+		if (tag.size() < 2 || tag[0] != '+')
+			continue;
+		if (kept.size())
+			kept << ';';
+		kept << tag;
+	}
+	if (kept.size() > MAX_CLIENT_TAGS)
+		return StringRef();
+	return StringRef(kept.data(), kept.size());
 }
 
+void Server::handleCommand(Client &client, StringRef line)
+{
+	unsigned long allocsBefore = AllocStats::allocations();
+	unsigned long bytesBefore = AllocStats::bytes();
+    StringRef params = line;
+    _clientTags = StringRef();
+    if (!params.empty() && params[0] == '@')
+        _clientTags = clientOnlyTags(_arena, params.word());
+    std::string command = params.word().str(); // verbs fit std::string's inline buffer
+    int client_fd = client.getFd();
 
+	// client may be gone after QUIT, only use the copies taken here afterwards
+	_cmdFanout = 0;
+	unsigned long start = CommandStats::nowMicros();
+	dispatchCommand(client, command, params);
+	unsigned long elapsed = CommandStats::nowMicros() - start;
+	if (_allocStats && !command.empty())
+		_stats.recordAllocations(command, AllocStats::allocations() - allocsBefore, AllocStats::bytes() - bytesBefore);
+	if (!command.empty() && _stats.record(command, elapsed))
+	{
+		std::cout << BRIGHT_YELLOW << "[slow] " << command << " took " << elapsed << "us"
+				  << " fanout=" << _cmdFanout << " fd=" << client_fd << RESET << "\n";
+	}
+}
 
-void Server::handleCommand(Client &client, const std::string &line)
+void Server::dispatchCommand(Client &client, const std::string &command, StringRef params)
 {
-    std::istringstream iss(line);
-    std::string command;
     int client_fd = client.getFd();
-    iss >> command;
+
+    // the hot verbs of registered clients read their parameters in place, the rest go through istringstream
+    if (client.isAuthenticated() && command == "PRIVMSG")
+    {
+        handlePriv(client, params);
+        return;
+    }
+    if (client.isAuthenticated() && command == "JOIN")
+    {
+        handleJoin(client, params);
+        return;
+    }
+    std::istringstream iss(params.str());
 
     if (command == "QUIT")
     {
-		send(client_fd, "221 :Goodbye\r\n", 14, 0);
+		std::string reason;
+		std::getline(iss, reason);
+		size_t start = reason.find_first_not_of(" :");
+		reason = (start == std::string::npos) ? "Client Quit" : reason.substr(start);
+		sendTo(client_fd, "221 :Goodbye\r\n");
 		// Ensure we properly remove from poll list and clients map
-		disconnectClientFd(client_fd);
+		disconnectClientFd(client_fd, "Quit: " + reason);
 		return;
     }
     if (command == "HELP")
     {
-        helpCommand(client);
+        sendTo(client_fd, helpText());
         return;
     }
     if (!authMiddleware(client, command, iss))
         return;
-    if (command == "JOIN")
-    {
-        handleJoin(client, iss);
+    if (refuseUnderLoad(client, command, params))
         return;
-    }
-    else if (command == "KICK")
+    if (command == "KICK")
     {
         handleKick(client, iss);
         return;
@@ -612,50 +960,118 @@ void Server::handleCommand(Client &client, const std::string &line)
 		handleInvite(client, iss);
 		return;
 	}
-    else if (command == "PRIVMSG")
-    {
-		handlePriv(client, iss);
+	else if (command == "CHATHISTORY")
+	{
+		handleChatHistory(client, iss);
+		return;
+	}
+	else if (command == "MODE")
+	{
+		handleMode(client, iss);
+		return;
+	}
+	else if (command == "NAMES")
+	{
+		handleNames(client, iss);
+		return;
+	}
+	else if (command == "WHO")
+	{
+		handleWho(client, iss);
+		return;
+	}
+	else if (command == "LIST")
+	{
+		handleList(client, iss);
+		return;
+	}
+	else if (command == "STATS")
+	{
+		handleStats(client, iss);
+		return;
+	}
+	else if (command == "MONITOR")
+	{
+		handleMonitor(client, iss);
+		return;
+	}
+	else if (command == "FILE")
+	{
+		handleFile(client, iss);
+		return;
+	}
+	else if (command == "REGISTER")
+	{
+		handleRegister(client, iss);
 		return;
 	}
     else
-        send(client.getFd(), "421 :Unknown command\r\n", 23, 0);
+        sendTo(client.getFd(), "421 :Unknown command\r\n");
 }
 
 
-void Server::closeClient(int index)
+// Tells everyone sharing a channel with the user, once, and drops its memberships.
+// Registered users are also announced to the linked servers, except exceptLink.
+void Server::quitUser(Client &client, const std::string &reason, int exceptLink)
 {
-    int fd = _pfds[index].fd;
-	// If we still have the client object, use its nick to broadcast part messages
-	std::string nick;
-	std::string user;
-	std::map<int, Client>::iterator itc = _clients.find(fd);
-	if (itc != _clients.end())
-	{
-		nick = itc->second.getNick();
-		user = itc->second.getUser();
-	}
-
-	// Remove from all channels and notify
-	for (std::map<std::string, Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+	int fd = client.getFd();
+	FanOut fan;
+	std::vector<std::string> emptied;
+	for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
 	{
-		Channel &ch = it->second;
+		Channel &ch = *it->second;
 		if (ch.hasMember(fd))
 		{
-			std::string partMsg;
-			if (!nick.empty())
-				partMsg = ":" + nick + "!" + user + "@localhost PART " + ch.getName() + "\r\n";
-			else
-				partMsg = ":server NOTICE * :Client left channel " + ch.getName() + "\r\n";
-			ch.broadcast(partMsg, fd);
+			fan.addChannel(ch);
 			ch.removeMemberByFd(fd);
+			if (ch.getMembers().empty())
+				emptied.push_back(it->first);
 		}
 	}
+	for (size_t i = 0; i < emptied.size(); ++i)
+		reclaimChannel(_channels.find(emptied[i]));
+	if (client.isAuthenticated())
+		userOffline(fd, client.getNick());
+	if (!client.getNick().empty())
+	{
+		fan.exclude(fd);
+		std::string quitMsg = ":" + client.getHostmask() + " QUIT :" + reason + "\r\n";
+		deliver(fan, quitMsg);
+	}
+	if (!client.getUid().empty())
+	{
+		propagate(":" + client.getUid() + " QUIT :" + reason, exceptLink);
+		_uids.erase(client.getUid());
+	}
+}
+
+void Server::closeClient(int index, const std::string &reason)
+{
+    int fd = _pfds[index].fd;
+    if (_links.find(fd) != _links.end())
+    {
+        dropLink(fd, reason);
+        return;
+    }
+	// If we still have the client object, tell everyone sharing a channel with it
+	std::map<int, Client>::iterator itc = _clients.find(fd);
+	if (itc != _clients.end())
+		quitUser(itc->second, reason, -1);
 
+    dropSession(fd);
+    dropReplyJobs(fd);
+    forgetDelivery(fd);
+    dropMonitor(fd);
+    dropTransfers(fd);
+    dropAccountState(fd);
+    _lookups.erase(fd);
+    _webSockets.erase(fd);
+    _linkAccepts.erase(fd);
     close(fd);
     _clients.erase(fd);
 
     // remover pfd del vector
-    _pfds.erase(_pfds.begin() + index);
+    removePollFd(fd);
     
     std::cout << "Client fd=" << fd << " disconnected\n";
 }
@@ -666,18 +1082,31 @@ void Server::stop()
 }
 
 // Remove a client given its fd: close socket, erase from pollfds and clients map
-void Server::disconnectClientFd(int fd)
+void Server::disconnectClientFd(int fd, const std::string &reason)
 {
-	// Find the pollfd index for this fd
-	for (size_t i = 0; i < _pfds.size(); ++i)
+	int index = pollIndex(fd);
+	if (index >= 0)
 	{
-		if (_pfds[i].fd == fd)
-		{
-			closeClient(static_cast<int>(i));
-			return;
-		}
+		closeClient(index, reason);
+		return;
 	}
-	// If not in poll list (edge case), just close and erase
+	if (isService(fd))
+	{
+		retireService(fd, reason);
+		return;
+	}
+	// Not in poll list: a detached session (Resume.cpp) or an edge case, just close and erase
+	std::map<int, Client>::iterator itc = _clients.find(fd);
+	if (itc != _clients.end())
+		quitUser(itc->second, reason, -1);
+	dropSession(fd);
+	dropReplyJobs(fd);
+	forgetDelivery(fd);
+	dropMonitor(fd);
+	dropTransfers(fd);
+	dropAccountState(fd);
+	_webSockets.erase(fd);
+	_linkAccepts.erase(fd);
 	close(fd);
 	_clients.erase(fd);
 }
@@ -692,21 +1121,36 @@ Lo que pasaba es que tenias entradas duplicadas y estado obsoleto al volver a in
 */
 
 // Notify all channels where client is present about nick change
-void Server::notifyNickChange(int client_fd, const std::string &oldNick, const std::string &newNick, const std::string &username)
+void Server::notifyNickChange(int client_fd, const std::string &oldNick, const std::string &newNick, const std::string &username, int exceptLink)
 {
+	std::map<int, Client>::iterator it = _clients.find(client_fd);
+	std::string host = it != _clients.end() ? it->second.getHost() : "localhost";
 	// Standard IRC NICK change format: :oldnick!user@host NICK :newnick
-	std::string nickMsg = ":" + oldNick + "!" + username + "@localhost NICK :" + newNick + "\r\n";
+	std::string nickMsg = ":" + oldNick + "!" + username + "@" + host + " NICK :" + newNick + "\r\n";
 	
-	// Broadcast to all channels where this user is a member
-	for (std::map<std::string, Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+	// One copy per peer, however many channels they share (the user gets it through its own membership)
+	FanOut fan;
+	for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
 	{
-		Channel &ch = it->second;
+		Channel &ch = *it->second;
 		if (ch.hasMember(client_fd))
 		{
-			// Broadcast to everyone in the channel (including the user who changed nick)
-			ch.broadcast(nickMsg, -1);
+			fan.addChannel(ch);
 			// Update the nickname in the channel's member list
 			ch.updateMemberNick(client_fd, newNick);
 		}
 	}
+	deliver(fan, nickMsg);
+
+	if (it != _clients.end())
+	{
+		userOffline(client_fd, oldNick);
+		userOnline(it->second);
+	}
+	if (it != _clients.end() && !it->second.getUid().empty())
+	{
+		std::ostringstream line;
+		line << ":" << it->second.getUid() << " NICK " << newNick << " " << it->second.getNickTs();
+		propagate(line.str(), exceptLink);
+	}
 }
\ No newline at end of file
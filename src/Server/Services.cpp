@@ -0,0 +1,117 @@
+#include "Server.hpp"
+#include "Config.hpp"
+#include "Bot.hpp"
+#include <iostream>
+#include <cstring>
+
+void Server::loadServices()
+{
+	if (configLong("IRC_BOT", 0) != 0)
+		registerService(new Bot(configStr("IRC_BOT_NICK", "ircbot"), configStr("IRC_BOT_CHANNELS", "")));
+}
+
+// The service becomes a registered user with the next virtual id: it is
+// introduced to the network, shows in NAMES and WHO, and can be messaged,
+// invited and kicked. The server owns it from here on.
+void Server::registerService(Service *service)
+{
+	std::string nick = service->nick();
+	if (getFdByNick(nick) != -1)
+	{
+		std::cerr << "Service " << nick << " not started: nickname in use\n";
+		delete service;
+		return;
+	}
+	int id = _nextVirtualId--;
+	Client &client = _clients.insert(std::make_pair(id, Client(id))).first->second;
+	client.setPass(true);
+	client.setNick(nick);
+	client.setUser("service");
+	client.setHasUser(true);
+	client.setRealname(service->realname());
+	client.setHostname(_serverName);
+	_services[id] = service;
+	service->attach(this, id);
+	completeRegistration(client);
+	_activeService = id;
+	service->start();
+	_activeService = 0;
+	std::cout << "Service " << client.getHostmask() << " started (id " << id << ")\n";
+}
+
+// Whatever a sendTo or a fan-out hands a service id. The lines wait in the
+// arena until runServices, so a service never runs in the middle of a
+// delivery and its replies cannot overtake the message that caused them.
+// Lines caused by a service are not given to services, so two of them can
+// never keep each other busy.
+void Server::queueServiceInput(int id, const char *data, size_t len)
+{
+	if (_activeService != 0 || _services.find(id) == _services.end())
+		return;
+	StringRef rest(_arena.copy(data, len), len);
+	while (!rest.empty())
+	{
+		const char *eol = static_cast<const char *>(memmem(rest.data(), rest.size(), "\r\n", 2));
+		size_t lineLen = eol ? static_cast<size_t>(eol - rest.data()) : rest.size();
+		if (lineLen > 0)
+			_serviceQueue.push_back(std::make_pair(id, StringRef(rest.data(), lineLen)));
+		size_t consumed = eol ? lineLen + 2 : lineLen;
+		rest = StringRef(rest.data() + consumed, rest.size() - consumed);
+	}
+}
+
+// Runs before the arena is reset and after every socket event
+void Server::runServices()
+{
+	for (size_t i = 0; i < _serviceQueue.size(); ++i)
+	{
+		std::map<int, Service *>::iterator it = _services.find(_serviceQueue[i].first);
+		if (it == _services.end())
+			continue; // retired by an earlier event
+		_activeService = it->first;
+		it->second->onEvent(ServiceEvent::parse(_serviceQueue[i].second));
+		_activeService = 0;
+	}
+	_serviceQueue.clear();
+	for (size_t i = 0; i < _retiredServices.size(); ++i)
+		delete _retiredServices[i];
+	_retiredServices.clear();
+}
+
+// A line run as the service through the normal command path
+void Server::serviceCommand(int id, const std::string &line)
+{
+	std::map<int, Client>::iterator it = _clients.find(id);
+	if (it == _clients.end() || _services.find(id) == _services.end())
+		return;
+	size_t len = line.size();
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+		len--;
+	int previous = _activeService;
+	_activeService = id;
+	handleCommand(it->second, StringRef(line.data(), len));
+	_activeService = previous;
+}
+
+bool Server::isService(int id) const
+{
+	return id < 0 && !_services.empty() && _services.find(id) != _services.end();
+}
+
+// QUIT or KILL of a service: it leaves like a user. The object may be the
+// caller, so it is deleted once runServices is past it.
+void Server::retireService(int id, const std::string &reason)
+{
+	std::map<int, Service *>::iterator it = _services.find(id);
+	if (it == _services.end())
+		return;
+	std::map<int, Client>::iterator client = _clients.find(id);
+	if (client != _clients.end())
+	{
+		quitUser(client->second, reason, -1);
+		_clients.erase(client);
+	}
+	_retiredServices.push_back(it->second);
+	_services.erase(it);
+	std::cout << "Service id " << id << " stopped: " << reason << "\n";
+}
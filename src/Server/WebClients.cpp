@@ -0,0 +1,23 @@
+#include "Server.hpp"
+
+// Turns what a WebSocket client sent into CRLF-terminated IRC lines on the
+// arena, ready for the normal line path. The first request completes the
+// HTTP upgrade. False when the connection has to close (bad request, close
+// frame, protocol error); the answer to that has already been sent.
+bool Server::readWebSocket(int fd, const char *&data, size_t &len)
+{
+	WebSocket &ws = _webSockets[fd];
+	bool wasOpen = ws.isOpen();
+	std::string reply;
+	bool keep = ws.feed(data, len, reply);
+	if (!reply.empty())
+		writeOut(fd, reply.data(), reply.size()); // the HTTP response and control frames are sent as they are
+	if (!keep)
+		return false;
+	if (!wasOpen && ws.isOpen())
+		sendWelcomeMessage(fd);
+	len = ws.lines().size();
+	data = len ? _arena.copy(ws.lines().data(), len) : "";
+	ws.clearLines();
+	return true;
+}
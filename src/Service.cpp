@@ -0,0 +1,66 @@
+#include "Service.hpp"
+#include "Server.hpp"
+#include <cstring>
+
+// ":nick!user@host COMMAND <target> [...] :<text>". The server writes
+// "PRIVMSG <target>:<text>" with no space, so the target also ends at a ':'.
+ServiceEvent ServiceEvent::parse(StringRef line)
+{
+	ServiceEvent event;
+	event.line = line;
+	StringRef rest = line;
+	if (!rest.empty() && rest[0] == ':')
+	{
+		StringRef prefix = rest.word();
+		event.source = StringRef(prefix.data() + 1, prefix.size() - 1);
+		StringRef source = event.source;
+		event.nick = source.split('!');
+	}
+	event.command = rest.word();
+	event.params = rest.trimLeft(' ');
+	const char *start = event.params.data();
+	const char *end = start + event.params.size();
+	const char *cut = start;
+	while (cut < end && *cut != ' ' && *cut != ':')
+		cut++;
+	event.target = StringRef(start, cut - start);
+	const char *colon = NULL;
+	if (cut < end && *cut == ':')
+		colon = cut;
+	else if (cut < end)
+	{
+		const char *found = static_cast<const char *>(memmem(cut, end - cut, " :", 2));
+		colon = found ? found + 1 : NULL;
+	}
+	if (colon)
+		event.text = StringRef(colon + 1, end - colon - 1);
+	return event;
+}
+
+Service::Service() : _server(NULL), _id(0) {}
+
+Service::~Service() {}
+
+void Service::attach(Server *server, int id)
+{
+	_server = server;
+	_id = id;
+}
+
+int Service::id() const
+{
+	return _id;
+}
+
+void Service::command(const std::string &line)
+{
+	if (_server)
+		_server->serviceCommand(_id, line);
+}
+
+std::string Service::realname() const
+{
+	return "Service";
+}
+
+void Service::start() {}
@@ -0,0 +1,37 @@
+#include "StringPool.hpp"
+
+std::map<std::string, unsigned long> &StringPool::pool()
+{
+	static std::map<std::string, unsigned long> entries;
+	return entries;
+}
+
+// Empty strings are not pooled, callers get NULL and read them back as empty()
+const std::string *StringPool::intern(const std::string &value)
+{
+	if (value.empty())
+		return NULL;
+	std::map<std::string, unsigned long>::iterator it = pool().insert(std::make_pair(value, 0UL)).first;
+	it->second++;
+	return &it->first;
+}
+
+void StringPool::release(const std::string *value)
+{
+	if (!value)
+		return;
+	std::map<std::string, unsigned long>::iterator it = pool().find(*value);
+	if (it != pool().end() && --it->second == 0)
+		pool().erase(it);
+}
+
+const std::string &StringPool::empty()
+{
+	static const std::string none;
+	return none;
+}
+
+size_t StringPool::size()
+{
+	return pool().size();
+}
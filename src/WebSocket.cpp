@@ -0,0 +1,394 @@
+#include "WebSocket.hpp"
+#include <cstring>
+#include <cctype>
+
+static const char *WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const char *WS_PROTOCOL = "text.ircv3.net";
+
+enum
+{
+	OP_CONTINUATION = 0x0,
+	OP_TEXT = 0x1,
+	OP_BINARY = 0x2,
+	OP_CLOSE = 0x8,
+	OP_PING = 0x9,
+	OP_PONG = 0xA
+};
+
+static unsigned int rotl(unsigned int x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+// SHA-1 is only used for Sec-WebSocket-Accept, never for anything secret
+static void sha1(const std::string &input, unsigned char digest[20])
+{
+	unsigned int h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	std::string msg = input;
+	unsigned long long bits = static_cast<unsigned long long>(input.size()) * 8;
+	msg += static_cast<char>(0x80);
+	while (msg.size() % 64 != 56)
+		msg += '\0';
+	for (int i = 7; i >= 0; --i)
+		msg += static_cast<char>((bits >> (i * 8)) & 0xFF);
+
+	for (size_t chunk = 0; chunk < msg.size(); chunk += 64)
+	{
+		unsigned int w[80];
+		for (int i = 0; i < 16; ++i)
+		{
+			const unsigned char *p = reinterpret_cast<const unsigned char *>(msg.data() + chunk + i * 4);
+			w[i] = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		}
+		for (int i = 16; i < 80; ++i)
+			w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		unsigned int a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int i = 0; i < 80; ++i)
+		{
+			unsigned int f, k;
+			if (i < 20)
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			}
+			else if (i < 40)
+			{
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			}
+			else if (i < 60)
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+			unsigned int t = rotl(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = rotl(b, 30);
+			b = a;
+			a = t;
+		}
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+	for (int i = 0; i < 5; ++i)
+	{
+		digest[i * 4] = static_cast<unsigned char>(h[i] >> 24);
+		digest[i * 4 + 1] = static_cast<unsigned char>(h[i] >> 16);
+		digest[i * 4 + 2] = static_cast<unsigned char>(h[i] >> 8);
+		digest[i * 4 + 3] = static_cast<unsigned char>(h[i]);
+	}
+}
+
+static std::string base64(const unsigned char *data, size_t len)
+{
+	static const char *table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	for (size_t i = 0; i < len; i += 3)
+	{
+		unsigned int n = data[i] << 16;
+		if (i + 1 < len)
+			n |= data[i + 1] << 8;
+		if (i + 2 < len)
+			n |= data[i + 2];
+		out += table[(n >> 18) & 63];
+		out += table[(n >> 12) & 63];
+		out += i + 1 < len ? table[(n >> 6) & 63] : '=';
+		out += i + 2 < len ? table[n & 63] : '=';
+	}
+	return out;
+}
+
+static std::string lower(const std::string &s)
+{
+	std::string out = s;
+	for (size_t i = 0; i < out.size(); ++i)
+		out[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(out[i])));
+	return out;
+}
+
+static std::string trim(const std::string &s)
+{
+	size_t start = s.find_first_not_of(" \t");
+	if (start == std::string::npos)
+		return "";
+	return s.substr(start, s.find_last_not_of(" \t") - start + 1);
+}
+
+// "a, b,c" contains token b, compared case-insensitively
+static bool hasToken(const std::string &list, const std::string &token)
+{
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t comma = list.find(',', start);
+		if (comma == std::string::npos)
+			comma = list.size();
+		if (lower(trim(list.substr(start, comma - start))) == token)
+			return true;
+		start = comma + 1;
+	}
+	return false;
+}
+
+// Steps through the non-empty lines of buf, line endings dropped
+static bool nextLine(const char *buf, size_t len, size_t &pos, const char *&line, size_t &lineLen)
+{
+	while (pos < len)
+	{
+		const char *nl = static_cast<const char *>(std::memchr(buf + pos, '\n', len - pos));
+		size_t end = nl ? static_cast<size_t>(nl - buf) : len;
+		line = buf + pos;
+		lineLen = end - pos;
+		if (lineLen > 0 && buf[end - 1] == '\r')
+			lineLen--;
+		pos = end + 1;
+		if (lineLen > 0)
+			return true;
+	}
+	return false;
+}
+
+// Header bytes of a server frame (never masked); writes them when out is set
+static size_t frameHeader(char *out, unsigned char opcode, size_t len)
+{
+	unsigned char header[10];
+	size_t n;
+	header[0] = static_cast<unsigned char>(0x80 | opcode);
+	if (len <= 125)
+	{
+		header[1] = static_cast<unsigned char>(len);
+		n = 2;
+	}
+	else if (len <= 0xFFFF)
+	{
+		header[1] = 126;
+		header[2] = static_cast<unsigned char>(len >> 8);
+		header[3] = static_cast<unsigned char>(len);
+		n = 4;
+	}
+	else
+	{
+		header[1] = 127;
+		for (int i = 0; i < 8; ++i)
+			header[2 + i] = static_cast<unsigned char>(static_cast<unsigned long long>(len) >> ((7 - i) * 8));
+		n = 10;
+	}
+	if (out)
+		std::memcpy(out, header, n);
+	return n;
+}
+
+WebSocket::WebSocket() : _open(false), _fragmented(false) {}
+
+bool WebSocket::isOpen() const { return _open; }
+const std::string &WebSocket::lines() const { return _lines; }
+void WebSocket::clearLines() { _lines.clear(); }
+
+std::string WebSocket::acceptKey(const std::string &key)
+{
+	unsigned char digest[20];
+	sha1(key + WS_GUID, digest);
+	return base64(digest, sizeof(digest));
+}
+
+void WebSocket::appendFrame(std::string &out, unsigned char opcode, const char *payload, size_t len)
+{
+	char header[10];
+	out.append(header, frameHeader(header, opcode, len));
+	out.append(payload, len);
+}
+
+size_t WebSocket::framedSize(const char *msg, size_t len)
+{
+	size_t total = 0, pos = 0, lineLen;
+	const char *line;
+	while (nextLine(msg, len, pos, line, lineLen))
+		total += frameHeader(NULL, OP_TEXT, lineLen) + lineLen;
+	return total;
+}
+
+size_t WebSocket::frameLines(char *out, const char *msg, size_t len)
+{
+	size_t written = 0, pos = 0, lineLen;
+	const char *line;
+	while (nextLine(msg, len, pos, line, lineLen))
+	{
+		written += frameHeader(out + written, OP_TEXT, lineLen);
+		std::memcpy(out + written, line, lineLen);
+		written += lineLen;
+	}
+	return written;
+}
+
+bool WebSocket::fail(unsigned short code, std::string &reply)
+{
+	char status[2] = { static_cast<char>(code >> 8), static_cast<char>(code & 0xFF) };
+	appendFrame(reply, OP_CLOSE, status, sizeof(status));
+	_input.clear();
+	return false;
+}
+
+// A message may hold several lines; each comes back CRLF-terminated
+void WebSocket::takeMessage(const char *payload, size_t len)
+{
+	size_t pos = 0, lineLen;
+	const char *line;
+	while (nextLine(payload, len, pos, line, lineLen))
+	{
+		_lines.append(line, lineLen);
+		_lines.append("\r\n");
+	}
+}
+
+bool WebSocket::handshake(std::string &reply)
+{
+	if (_input.size() >= 4 && _input.compare(0, 4, "GET ") != 0)
+	{
+		reply += "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+		return false; // not HTTP at all, likely a plain IRC client on the wrong port
+	}
+	size_t end = _input.find("\r\n\r\n");
+	if (end == std::string::npos)
+	{
+		if (_input.size() <= MAX_HANDSHAKE)
+			return true;
+		reply += "HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\n\r\n";
+		return false;
+	}
+	std::string upgrade, connection, key, version, protocols;
+	size_t pos = _input.find("\r\n") + 2;
+	while (pos < end)
+	{
+		size_t eol = _input.find("\r\n", pos);
+		std::string line = _input.substr(pos, eol - pos);
+		pos = eol + 2;
+		size_t colon = line.find(':');
+		if (colon == std::string::npos)
+			continue;
+		std::string name = lower(trim(line.substr(0, colon)));
+		std::string value = trim(line.substr(colon + 1));
+		if (name == "upgrade")
+			upgrade = value;
+		else if (name == "connection")
+			connection = value;
+		else if (name == "sec-websocket-key")
+			key = value;
+		else if (name == "sec-websocket-version")
+			version = value;
+		else if (name == "sec-websocket-protocol")
+			protocols += (protocols.empty() ? "" : ",") + value;
+	}
+	_input.erase(0, end + 4);
+	if (!hasToken(upgrade, "websocket") || !hasToken(connection, "upgrade") || key.empty())
+	{
+		reply += "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+		return false;
+	}
+	if (version != "13")
+	{
+		reply += "HTTP/1.1 426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+		return false;
+	}
+	reply += "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n";
+	reply += "Sec-WebSocket-Accept: " + acceptKey(key) + "\r\n";
+	if (hasToken(protocols, WS_PROTOCOL))
+		reply += std::string("Sec-WebSocket-Protocol: ") + WS_PROTOCOL + "\r\n";
+	reply += "\r\n";
+	_open = true;
+	return true;
+}
+
+bool WebSocket::feed(const char *data, size_t len, std::string &reply)
+{
+	_input.append(data, len);
+	if (!_open)
+	{
+		if (!handshake(reply))
+			return false;
+		if (!_open)
+			return true; // request not complete yet
+	}
+	size_t pos = 0;
+	while (_input.size() - pos >= 2)
+	{
+		size_t avail = _input.size() - pos;
+		unsigned char *p = reinterpret_cast<unsigned char *>(&_input[0] + pos);
+		bool fin = (p[0] & 0x80) != 0;
+		unsigned char opcode = p[0] & 0x0F;
+		if ((p[0] & 0x70) || !(p[1] & 0x80))
+			return fail(1002, reply); // no extensions negotiated, and clients must mask
+		unsigned long long payloadLen = p[1] & 0x7F;
+		size_t header = 2;
+		if (payloadLen == 126)
+		{
+			if (avail < 4)
+				break;
+			payloadLen = (p[2] << 8) | p[3];
+			header = 4;
+		}
+		else if (payloadLen == 127)
+		{
+			if (avail < 10)
+				break;
+			payloadLen = 0;
+			for (int i = 2; i < 10; ++i)
+				payloadLen = (payloadLen << 8) | p[i];
+			header = 10;
+		}
+		if (payloadLen > MAX_MESSAGE)
+			return fail(1009, reply);
+		size_t frameLen = header + 4 + static_cast<size_t>(payloadLen);
+		if (avail < frameLen)
+			break;
+		const unsigned char *mask = p + header;
+		char *payload = reinterpret_cast<char *>(p + header + 4);
+		size_t plen = static_cast<size_t>(payloadLen);
+		for (size_t i = 0; i < plen; ++i)
+			payload[i] = static_cast<char>(payload[i] ^ mask[i & 3]);
+		pos += frameLen;
+
+		if (opcode & 0x8)
+		{
+			if (!fin || plen > 125)
+				return fail(1002, reply);
+			if (opcode == OP_CLOSE)
+			{
+				appendFrame(reply, OP_CLOSE, payload, plen >= 2 ? 2 : 0); // echo the status code
+				_input.clear();
+				return false;
+			}
+			if (opcode == OP_PING)
+				appendFrame(reply, OP_PONG, payload, plen);
+			else if (opcode != OP_PONG)
+				return fail(1002, reply);
+			continue;
+		}
+		if ((opcode == OP_CONTINUATION) != _fragmented || (opcode != OP_CONTINUATION && opcode != OP_TEXT && opcode != OP_BINARY))
+			return fail(1002, reply);
+		if (fin && !_fragmented)
+		{
+			takeMessage(payload, plen); // the usual case: one line, one frame
+			continue;
+		}
+		if (_message.size() + plen > MAX_MESSAGE)
+			return fail(1009, reply);
+		_message.append(payload, plen);
+		_fragmented = !fin;
+		if (fin)
+		{
+			takeMessage(_message.data(), _message.size());
+			_message.clear();
+		}
+	}
+	_input.erase(0, pos);
+	return true;
+}
@@ -20,9 +20,12 @@ extern volatile sig_atomic_t* getShutdownFlag()
 	return &g_shutdown;
 }
 
+extern "C" void reloadHandler(int signum); // Filter.cpp
+
 int main(int argc, char* argv[]) 
 {
 	std::signal(SIGINT, signalHandler);   // Ctrl+C
+	std::signal(SIGHUP, reloadHandler);   // reread IRC_FILTER_FILE
 
     if (argc != 3)
     {